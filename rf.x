@@ -65,6 +65,442 @@ struct RF_CloseFileReply_T
 	long	closeStatus;
 };
 
+/*
+ * Version 2 structures.
+ *
+ * Read and write payloads are variable length opaque data instead of the fixed
+ * 64 byte buf of version 1. The largest block a client may ask for is returned
+ * by rf_openfile as maxBlock and depends on the transport the request came in on.
+ */
+
+const RF_MAXPATHLEN   = 1024;     /* longest file pathname accepted by version 2 */
+const RF_MAXBLOCK_UDP = 61440;    /* largest block that can ever be sent over UDP (60 KB) */
+const RF_MAXBLOCK_TCP = 4194304;  /* largest block that can ever be sent over TCP (4 MB) */
+
+typedef opaque RF_Data_T<RF_MAXBLOCK_TCP>;  /* file data moved by read and write */
+
+struct RF_OpenFile2Request_T
+{
+	string	filename<RF_MAXPATHLEN>;  /* file pathname */
+	string	mode<3>;                  /* fopen mode, "r" for read or "w" for write */
+};
+
+struct RF_OpenFile2Reply_T
+{
+	long	openStatus;	/* 0 success, else failed */
+	long	fd;		    /* file descriptor */
+	long	maxBlock;	/* largest bytesToRead / write size the server accepts */
+};
+
+struct RF_ReadFile2Request_T
+{
+	long	fd;		        /* file descriptor */
+	long	bytesToRead;	/* number of bytes to read, clamped to maxBlock */
+};
+
+struct RF_ReadFile2Reply_T
+{
+	long		readStatus;	/* 0 success, else failed */
+	RF_Data_T	data;		/* bytes read, data_len is 0 at end of file */
+};
+
+struct RF_WriteFile2Request_T
+{
+	long		fd;		/* file descriptor */
+	RF_Data_T	data;	/* bytes to write, at most maxBlock */
+};
+
+struct RF_WriteFile2Reply_T
+{
+	long	writeStatus;	/* 0 success, else failed */
+	long	bytesWritten;	/* actual number of bytes written */
+};
+
+/*
+ * Offset addressed read and write (pread/pwrite semantics). They do not use or
+ * move the file position, so a client may keep many of them in flight and
+ * they may complete in any order. Repeating one has no further effect.
+ */
+
+struct RF_PReadRequest_T
+{
+	long	fd;		        /* file descriptor */
+	hyper	offset;	        /* file offset to read from */
+	long	bytesToRead;	/* number of bytes to read, clamped to maxBlock */
+};
+
+struct RF_PReadReply_T
+{
+	long		readStatus;	/* 0 success, else failed */
+	hyper		offset;		/* offset of the request, echoed */
+	RF_Data_T	data;		/* bytes read, shorter than asked only at end of file */
+};
+
+struct RF_PWriteRequest_T
+{
+	long		fd;		/* file descriptor */
+	hyper		offset;	/* file offset to write at */
+	RF_Data_T	data;	/* bytes to write, at most maxBlock */
+};
+
+struct RF_PWriteReply_T
+{
+	long	writeStatus;	/* 0 success, else failed */
+	hyper	offset;			/* offset of the request, echoed */
+	long	bytesWritten;	/* actual number of bytes written */
+};
+
+/*
+ * Compound procedures. Each one opens the file, moves its data and closes it
+ * on the server within a single call, so a small file costs one round trip
+ * instead of three or more. A call carries at most maxBlock bytes of data for
+ * its transport; rf_fetchmany shares that limit among its files, in order.
+ */
+
+const RF_MAXFETCH = 64;   /* most files in one rf_fetchmany call */
+
+struct RF_FetchRequest_T
+{
+	string	filename<RF_MAXPATHLEN>;  /* file pathname */
+	long	maxBytes;                 /* read at most this many bytes from the start */
+};
+
+struct RF_FetchReply_T
+{
+	long		fetchStatus;	/* 0 success, else the file could not be opened or read */
+	hyper		fileSize;		/* size of the whole file; more than data_len if it was cut short */
+	RF_Data_T	data;			/* the file's first bytes */
+};
+
+struct RF_StoreRequest_T
+{
+	string		filename<RF_MAXPATHLEN>;  /* file pathname */
+	string		mode<3>;                  /* "w" to replace the file, "a" to append to it */
+	RF_Data_T	data;                     /* bytes to write, at most maxBlock */
+};
+
+struct RF_StoreReply_T
+{
+	long	storeStatus;	/* 0 success, else failed */
+	long	bytesWritten;	/* actual number of bytes written */
+};
+
+struct RF_FetchManyRequest_T
+{
+	RF_FetchRequest_T	files<RF_MAXFETCH>;
+};
+
+struct RF_FetchManyReply_T
+{
+	RF_FetchReply_T		files<RF_MAXFETCH>;	/* one reply per requested file, same order */
+};
+
+/*
+ * Stateless read and write. The file is named by its path on every call, so
+ * the server keeps no state for the client and there is nothing to open or
+ * close. Like rf_preadfile/rf_pwritefile they do not use a file position, so
+ * repeating one has no further effect. rf_writepath creates a missing file
+ * but never truncates one; use rf_storefile for that.
+ */
+
+struct RF_PathReadRequest_T
+{
+	string	filename<RF_MAXPATHLEN>;  /* file pathname */
+	hyper	offset;                   /* file offset to read from */
+	long	bytesToRead;              /* number of bytes to read, clamped to maxBlock */
+};
+
+struct RF_PathWriteRequest_T
+{
+	string		filename<RF_MAXPATHLEN>;  /* file pathname */
+	hyper		offset;                   /* file offset to write at */
+	RF_Data_T	data;                     /* bytes to write, at most maxBlock */
+};
+
+/*
+ * Checksummed stateless read and write, and whole file digests. The checksums
+ * are CRC32C (see rfcrc.h) and let the client catch data that was damaged on
+ * the way, which the UDP checksum (if any) does not always do. rf_readsum
+ * replies with the checksum of the bytes it read; rf_writesum writes nothing
+ * if its block does not match the checksum sent with it. Otherwise they behave
+ * like rf_readpath and rf_writepath.
+ * rf_digest returns the checksum of a whole file, or of a range of it; length
+ * -1 runs to the end of the file.
+ */
+
+struct RF_SumReadReply_T
+{
+	RF_PReadReply_T	read;	/* as from rf_readpath */
+	unsigned int	crc;	/* CRC32C of read.data */
+};
+
+struct RF_SumWriteRequest_T
+{
+	RF_PathWriteRequest_T	write;	/* as for rf_writepath */
+	unsigned int			crc;	/* CRC32C of write.data */
+};
+
+struct RF_DigestRequest_T
+{
+	string	filename<RF_MAXPATHLEN>;  /* file pathname */
+	hyper	offset;                   /* start of the range */
+	hyper	length;                   /* bytes in the range, -1 for the rest of the file */
+};
+
+struct RF_DigestReply_T
+{
+	long			digestStatus;	/* 0 success, else failed */
+	hyper			fileSize;		/* size of the whole file */
+	hyper			bytes;			/* bytes checksummed, short of length only at end of file */
+	unsigned int	crc;			/* CRC32C of those bytes */
+};
+
+/*
+ * Delta transfer, after rsync. The client cuts its copy of a file into blocks
+ * of blockSize bytes and signs each with a weak rolling checksum and a CRC32C
+ * (see rfdelta.h). rf_delta scans the server's file from offset and replies
+ * with the parts the client already has as runs of its blocks, and with the
+ * rest as literal data. A call covers at most length bytes of the file and
+ * maxBytes of reply; the client calls again from nextOffset until it reaches
+ * fileSize. Each call carries the signatures of a window of blocks, those
+ * around where the client expects the matching data, starting at firstBlock.
+ */
+
+const RF_MAXDELTASIGS = 4096;   /* most block signatures in one rf_delta call */
+const RF_MAXDELTAOPS  = 4096;   /* most runs in one rf_delta reply */
+
+struct RF_BlockSig_T
+{
+	unsigned int	weak;	/* rolling checksum of the block */
+	unsigned int	strong;	/* CRC32C of the block */
+};
+
+struct RF_DeltaRequest_T
+{
+	string			filename<RF_MAXPATHLEN>;	/* file pathname */
+	hyper			offset;						/* where in the file to go on from */
+	hyper			length;						/* most file bytes to cover */
+	long			maxBytes;					/* most reply bytes, literal data plus 12 per run; clamped to maxBlock */
+	long			blockSize;					/* bytes per client block */
+	hyper			localSize;					/* size of the client's copy, whose last block may be short */
+	hyper			firstBlock;					/* block number of sigs[0] */
+	RF_BlockSig_T	sigs<RF_MAXDELTASIGS>;
+};
+
+struct RF_DeltaOp_T
+{
+	hyper			block;	/* first client block of a run to copy, -1 for literal data */
+	unsigned int	length;	/* bytes in the run */
+};
+
+struct RF_DeltaReply_T
+{
+	long			deltaStatus;			/* 0 success, else failed */
+	hyper			fileSize;				/* size of the whole file */
+	hyper			nextOffset;				/* where the next call goes on from */
+	unsigned int	crc;					/* CRC32C of the file from offset to nextOffset */
+	RF_DeltaOp_T	ops<RF_MAXDELTAOPS>;	/* the runs, in file order */
+	RF_Data_T		data;					/* the literal runs, one after another */
+};
+
+/*
+ * Compressed stateless read and write. The data of a block may travel
+ * compressed, in the format named by codec; length and crc are those of the
+ * block before compression. The client lists the codecs it can take with
+ * every rf_readz, and the server compresses a block only when that makes it
+ * clearly smaller, at the level it was started with. rf_writez takes any
+ * codec the server knows. Otherwise they behave like rf_readsum and rf_writesum.
+ */
+
+const RF_CODEC_NONE = 0;   /* data as it is */
+const RF_CODEC_LZ4  = 1;   /* LZ4 block format (see rfcomp.h) */
+
+struct RF_ZReadRequest_T
+{
+	RF_PathReadRequest_T	read;	/* as for rf_readpath */
+	unsigned int			codecs;	/* 1 << codec for each codec the client can take */
+};
+
+struct RF_ZReadReply_T
+{
+	RF_SumReadReply_T	sum;	/* as from rf_readsum, sum.read.data compressed */
+	unsigned int		codec;	/* how sum.read.data is compressed */
+	unsigned int		length;	/* bytes read, before compression */
+};
+
+struct RF_ZWriteRequest_T
+{
+	RF_SumWriteRequest_T	sum;	/* as for rf_writesum, sum.write.data compressed */
+	unsigned int			codec;	/* how sum.write.data is compressed */
+	unsigned int			length;	/* bytes to write, before compression */
+};
+
+/*
+ * Directory listing and bulk stat, so a client can find out what is on the
+ * server without opening every file. rf_readdirplus lists a directory a page
+ * at a time, each entry with its attributes, sorted by name. The first call
+ * passes cookie 0; the next one passes the cookie and verifier of the reply,
+ * until eof. If the directory changed in between, readdirStatus is
+ * RF_READDIR_STALE and the listing starts again from cookie 0. A page holds
+ * at most count entries and what fits in maxBlock of the transport.
+ * rf_statmany stats a list of paths in one call.
+ */
+
+const RF_MAXNAMELEN    = 255;    /* longest name in a directory */
+const RF_MAXDIRPAGE    = 4096;   /* most entries in one rf_readdirplus reply */
+const RF_MAXSTAT       = 256;    /* most paths in one rf_statmany call */
+const RF_READDIR_STALE = 1;      /* readdirStatus when the directory changed since the cookie */
+
+const RF_TYPE_FILE  = 1;   /* regular file */
+const RF_TYPE_DIR   = 2;   /* directory */
+const RF_TYPE_LINK  = 3;   /* symbolic link, not followed by rf_readdirplus */
+const RF_TYPE_OTHER = 4;   /* device, pipe or socket */
+
+typedef string RF_Path_T<RF_MAXPATHLEN>;
+
+struct RF_Attr_T
+{
+	unsigned int	type;	/* RF_TYPE_ */
+	hyper			size;	/* bytes */
+	hyper			mtime;	/* modification time, nanoseconds since the epoch */
+	unsigned hyper	inode;
+};
+
+struct RF_DirEntry_T
+{
+	string		name<RF_MAXNAMELEN>;
+	RF_Attr_T	attr;
+};
+
+struct RF_ReadDirRequest_T
+{
+	string			dirname<RF_MAXPATHLEN>;  /* directory pathname */
+	unsigned hyper	cookie;                  /* 0 for the first page, else from the last reply */
+	unsigned hyper	verifier;                /* from the last reply, ignored with cookie 0 */
+	unsigned int	count;                   /* most entries wanted, at most RF_MAXDIRPAGE */
+};
+
+struct RF_ReadDirReply_T
+{
+	long			readdirStatus;	/* 0 success, RF_READDIR_STALE, else failed */
+	unsigned hyper	cookie;			/* where the next page starts */
+	unsigned hyper	verifier;		/* identifies this listing of the directory */
+	bool			eof;			/* no entries after these */
+	RF_DirEntry_T	entries<RF_MAXDIRPAGE>;
+};
+
+struct RF_StatManyRequest_T
+{
+	RF_Path_T	paths<RF_MAXSTAT>;
+};
+
+struct RF_StatResult_T
+{
+	long		statStatus;	/* 0 success, else the path does not exist or can not be reached */
+	RF_Attr_T	attr;		/* of the file the path names, symbolic links followed */
+};
+
+struct RF_StatManyReply_T
+{
+	RF_StatResult_T	results<RF_MAXSTAT>;	/* one per requested path, same order */
+};
+
+/*
+ * Revalidation, for clients that keep copies of files (see rfccache.h).
+ * rf_getattr tells, for a list of regular files, enough to know whether a
+ * copy is still that of the file: its size, modification time, inode and
+ * change counter, which moves on whenever the file's data or attributes do.
+ * A change made in the same clock tick as the last one would not move the
+ * times, so stable says the file last changed long enough ago for a copy
+ * taken now to be told apart from the next change. Bytes still in a
+ * write-behind buffer (see rfwb.h) are not seen, as by rf_readpath.
+ */
+
+struct RF_GetAttrRequest_T
+{
+	RF_Path_T	paths<RF_MAXSTAT>;
+};
+
+struct RF_GetAttrResult_T
+{
+	long			getattrStatus;	/* 0 success, else not a regular file that can be reached */
+	hyper			size;			/* bytes */
+	hyper			mtime;			/* modification time, nanoseconds since the epoch */
+	hyper			change;			/* change counter: the inode change time, in nanoseconds */
+	unsigned hyper	inode;
+	bool			stable;			/* unchanged for longer than the file system's clock tick */
+};
+
+struct RF_GetAttrReply_T
+{
+	RF_GetAttrResult_T	results<RF_MAXSTAT>;	/* one per requested path, same order */
+};
+
+/*
+ * Durable close. The server gathers small writes at the file position into
+ * larger ones (see rfwb.h) and syncs files to stable storage as its
+ * durability policy says. rf_closesync closes a file like rf_closefile and
+ * also tells whether everything written through the handle was on stable
+ * storage when the reply was sent. sync asks for the file to be synced
+ * first, whatever the policy.
+ */
+
+const RF_SYNC_NONE     = 0;   /* the server leaves writing back to the kernel */
+const RF_SYNC_CLOSE    = 1;   /* files written to are synced when closed */
+const RF_SYNC_PERIODIC = 2;   /* files written to are synced every interval */
+
+struct RF_CloseSyncRequest_T
+{
+	long	fd;		/* File descriptor */
+	long	sync;	/* non zero to sync the file before closing it */
+};
+
+struct RF_CloseSyncReply_T
+{
+	long	closeStatus;	/* 0 success, else failed */
+	long	durability;		/* the server's RF_SYNC_ policy */
+	bool	durable;		/* written data was on stable storage */
+};
+
+/*
+ * Admission control (see rfadmit.h). A server under load, or a client over
+ * its rate, may turn a version 2 call away without running it. The reply
+ * then carries a status of RF_BUSY or less in place of the procedure's
+ * status: in every result of rf_fetchmany, rf_statmany and rf_getattr, and
+ * in the first field of the other replies. The client should call again
+ * after RF_BUSY - status milliseconds, at most RF_BUSY_MAXWAIT. rf_stats is
+ * never turned away. Handles created with rf_connect, and pipes (see
+ * rfpipe.h), wait and call again by themselves.
+ */
+
+const RF_BUSY         = -1000;   /* status of a call turned away, less the milliseconds to wait */
+const RF_BUSY_MAXWAIT = 60000;   /* longest wait a server asks for, in milliseconds */
+
+/*
+ * Server metrics, summed over all worker threads. Latencies are in
+ * microseconds; percentiles are the upper edge of their histogram bucket.
+ */
+
+struct RF_ProcStats_T
+{
+	string	name<32>;	/* procedure name and version, e.g. rf_preadfile_2 */
+	hyper	calls;
+	hyper	errors;		/* calls that returned a failed status */
+	hyper	bytes;		/* payload bytes read or written */
+	hyper	sumUsec;	/* total latency, for the mean */
+	hyper	maxUsec;
+	hyper	p50Usec;
+	hyper	p99Usec;
+	hyper	p999Usec;
+};
+
+struct RF_StatsReply_T
+{
+	hyper			uptimeUsec;		/* time since the server started */
+	long			openHandles;	/* files open right now */
+	RF_ProcStats_T	procs<>;		/* procedures that have been called */
+};
+
 /*
  * RPC program number, version number and list of procedures (functions)
  */
@@ -78,4 +514,30 @@ program RFILE
 	RF_CloseFileReply_T  rf_closefile (RF_CloseFileRequest_T) = 3;	/* procedure 3 */
 	RF_WriteFileReply_T  rf_writefile (RF_WriteFileRequest_T) = 4;  /* procedure 4 */
    } = 1;  /* RCP server version number is 1 */
+
+   version RFILE_VERS2
+   {
+	RF_OpenFile2Reply_T  rf_openfile  (RF_OpenFile2Request_T)  = 1;	/* procedure 1 */
+	RF_ReadFile2Reply_T  rf_readfile  (RF_ReadFile2Request_T)  = 2;	/* procedure 2 */
+	RF_CloseFileReply_T  rf_closefile (RF_CloseFileRequest_T)  = 3;	/* procedure 3 */
+	RF_WriteFile2Reply_T rf_writefile (RF_WriteFile2Request_T) = 4;  /* procedure 4 */
+	RF_PReadReply_T      rf_preadfile (RF_PReadRequest_T)      = 5;  /* procedure 5 */
+	RF_PWriteReply_T     rf_pwritefile (RF_PWriteRequest_T)    = 6;  /* procedure 6 */
+	RF_StatsReply_T      rf_stats (void)                       = 7;  /* procedure 7 */
+	RF_FetchReply_T      rf_fetchfile (RF_FetchRequest_T)      = 8;  /* procedure 8 */
+	RF_StoreReply_T      rf_storefile (RF_StoreRequest_T)      = 9;  /* procedure 9 */
+	RF_FetchManyReply_T  rf_fetchmany (RF_FetchManyRequest_T)  = 10; /* procedure 10 */
+	RF_PReadReply_T      rf_readpath (RF_PathReadRequest_T)    = 11; /* procedure 11 */
+	RF_PWriteReply_T     rf_writepath (RF_PathWriteRequest_T)  = 12; /* procedure 12 */
+	RF_SumReadReply_T    rf_readsum (RF_PathReadRequest_T)     = 13; /* procedure 13 */
+	RF_PWriteReply_T     rf_writesum (RF_SumWriteRequest_T)    = 14; /* procedure 14 */
+	RF_DigestReply_T     rf_digest (RF_DigestRequest_T)        = 15; /* procedure 15 */
+	RF_DeltaReply_T      rf_delta (RF_DeltaRequest_T)          = 16; /* procedure 16 */
+	RF_ZReadReply_T      rf_readz (RF_ZReadRequest_T)          = 17; /* procedure 17 */
+	RF_PWriteReply_T     rf_writez (RF_ZWriteRequest_T)        = 18; /* procedure 18 */
+	RF_CloseSyncReply_T  rf_closesync (RF_CloseSyncRequest_T)  = 19; /* procedure 19 */
+	RF_ReadDirReply_T    rf_readdirplus (RF_ReadDirRequest_T)  = 20; /* procedure 20 */
+	RF_StatManyReply_T   rf_statmany (RF_StatManyRequest_T)    = 21; /* procedure 21 */
+	RF_GetAttrReply_T    rf_getattr (RF_GetAttrRequest_T)      = 22; /* procedure 22 */
+   } = 2;  /* version 2 carries variable length blocks */
 } = 877;     /* RPC server program number is 877 */
@@ -0,0 +1,483 @@
+/* rfadmit.c */
+
+/* This file implements the server's admission control (see rfadmit.h).
+// Clients are held in a hash table keyed by IP address. One mutex guards the
+// table, the buckets and the queue. A call that has to wait sleeps on a
+// condition variable of its own, on the worker's stack, in a list of waiting
+// calls. That list holds at most one call per worker, and only TCP calls, so
+// a plain scan finds the one to let in next. When the table is full, clients that have been idle
+// for a while are dropped. If there are none to drop, newcomers share one
+// overflow entry.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "rf.h"
+#include "rfadmit.h"
+
+#define OKAY 0
+#define FAILED -1
+
+#define RF_ADMIT_BUCKETS  1024         /* hash chains of the client table */
+#define RF_ADMIT_CLIENTS  4096         /* most clients remembered */
+#define RF_ADMIT_IDLE     60000000LL   /* us a client stays remembered with nothing in */
+#define RF_ADMIT_MAXSLEEP 1000         /* ms a version 1 call waits for its rate, at most */
+#define RF_ADMIT_RETRY    5            /* ms a UDP call that finds every slot taken is told to wait */
+#define RF_ADMIT_WEIGHTS  64           /* most clients given a weight */
+
+typedef struct RF_AdmitClient_T
+{
+	unsigned char	addr[16];	/* IPv4 or IPv6 address */
+	int				addrLen;
+	double			weight;
+	double			ops;		/* call tokens, below 1 when over the rate */
+	double			bytes;		/* byte tokens, below 0 when in debt */
+	long long		refilled;	/* us, when the tokens were last topped up */
+	long long		lastUsed;	/* us */
+	double			finish;		/* virtual time the client's next call starts at, at the earliest */
+	int				running;	/* calls let in and not yet done */
+	int				waiting;	/* calls in the queue */
+	struct RF_AdmitClient_T *hashNext;
+} RF_AdmitClient_T;
+
+/* A call in the queue. */
+typedef struct RF_AdmitWaiter_T
+{
+	double			tag;		/* start tag: the call is let in in order of it */
+	long long		since;		/* us, when the call started waiting */
+	int				admitted;
+	pthread_cond_t	cond;
+	struct RF_AdmitWaiter_T *next;
+} RF_AdmitWaiter_T;
+
+/* A weight given with -w. */
+typedef struct RF_AdmitWeight_T
+{
+	unsigned char	addr[16];
+	int				addrLen;
+	double			weight;
+} RF_AdmitWeight_T;
+
+static RF_AdmitClient_T *table[RF_ADMIT_BUCKETS];
+static RF_AdmitClient_T overflow;     /* shared by clients that find the table full */
+static int numClients = 0;
+static RF_AdmitWeight_T weightList[RF_ADMIT_WEIGHTS];
+static int numWeights = 0;
+static RF_AdmitWaiter_T *queue = NULL;
+static int enabled = 0;               /* set by rf_admit_init if there is any limit */
+static int maxActive = 1 << 30;       /* most calls running at once */
+static int active = 0;
+static double vclock = 0;             /* start tag of the call let in last */
+static double opsRate = 0;            /* calls per second per client, 0 for no limit */
+static double bytesRate = 0;          /* bytes per second per client, 0 for no limit */
+static long long target = 0;          /* us a call may wait before others are turned away, 0 for never */
+static long long numWaited = 0, numLimited = 0, numShed = 0;
+static pthread_mutex_t admitLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* The client of the call this thread is serving, NULL if it was not let in here. */
+static __thread RF_AdmitClient_T *current;
+static __thread long long currentBytes;
+
+
+// *****************************************************
+//
+// rf_admit_now
+//     Reads the monotonic clock.
+// return value: Current time in microseconds.
+//
+// *****************************************************
+static long long rf_admit_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return((long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+}
+
+// *****************************************************
+//
+// rf_admit_addr
+//     Takes the IP address out of a socket address.
+// input parameters: sa   - The socket address.
+//                   addr - Set to the address, 16 bytes of room.
+// return value: Bytes in the address, 0 if it is not IPv4 or IPv6.
+//
+// *****************************************************
+static int rf_admit_addr(struct sockaddr *sa, unsigned char *addr)
+{
+	if (sa->sa_family == AF_INET) {
+		memcpy(addr, &((struct sockaddr_in *)sa)->sin_addr, 4);
+		return(4);
+	}
+	if (sa->sa_family == AF_INET6) {
+		memcpy(addr, &((struct sockaddr_in6 *)sa)->sin6_addr, 16);
+		return(16);
+	}
+
+	return(0);
+}
+
+// *****************************************************
+//
+// rf_admit_parse_weights
+//     Reads the weights given with -w: a comma separated list of
+//     address=weight, for instance "10.0.0.5=4,10.0.0.6=0.5".
+// input parameters: list - The list, modified.
+// return value: OKAY, or FAILED if an entry is not understood.
+//
+// *****************************************************
+static int rf_admit_parse_weights(char *list)
+{
+	RF_AdmitWeight_T *w;
+	char *entry, *eq, *end, *save;
+
+	for (entry = strtok_r(list, ",", &save); entry != NULL; entry = strtok_r(NULL, ",", &save)) {
+		if (numWeights == RF_ADMIT_WEIGHTS || (eq = strchr(entry, '=')) == NULL)
+			return(FAILED);
+		*eq = '\0';
+		w = &weightList[numWeights];
+		if (inet_pton(AF_INET, entry, w->addr) == 1)
+			w->addrLen = 4;
+		else if (inet_pton(AF_INET6, entry, w->addr) == 1)
+			w->addrLen = 16;
+		else
+			return(FAILED);
+		w->weight = strtod(eq + 1, &end);
+		if (*end != '\0' || !(w->weight > 0))
+			return(FAILED);
+		numWeights++;
+	}
+
+	return(OKAY);
+}
+
+// *****************************************************
+//
+// rf_admit_init
+//     Sets the limits. Without a call, or with no limit, all calls are let in
+//     at once.
+// input parameters: maxRunning  - Most calls running at once, 0 for no limit.
+//                   opsPerSec   - Calls per second per client, 0 for no limit.
+//                   bytesPerSec - Bytes per second per client, 0 for no limit.
+//                   targetMs    - Milliseconds calls may wait before version 2
+//                                 calls are turned away, 0 for never. Calls
+//                                 only wait with maxRunning set.
+//                   weights     - Weights of clients (see rf_admit_parse_weights),
+//                                 or NULL for all 1. Modified.
+// return value: OKAY, or FAILED if the weights are not understood.
+//
+// *****************************************************
+int rf_admit_init(int maxRunning, long opsPerSec, long long bytesPerSec, int targetMs, char *weights)
+{
+	if (weights != NULL && rf_admit_parse_weights(weights) != OKAY)
+		return(FAILED);
+
+	maxActive = (maxRunning > 0) ? maxRunning : 1 << 30;
+	opsRate = (opsPerSec > 0) ? opsPerSec : 0;
+	bytesRate = (bytesPerSec > 0) ? bytesPerSec : 0;
+	target = (targetMs > 0) ? targetMs * 1000LL : 0;
+	overflow.weight = 1;
+	overflow.ops = opsRate;
+	overflow.bytes = bytesRate;
+	enabled = (maxRunning > 0 || opsRate > 0 || bytesRate > 0);
+
+	return(OKAY);
+}
+
+// *****************************************************
+//
+// rf_admit_sweep
+//     Drops the clients that have had nothing in for RF_ADMIT_IDLE. Called
+//     with admitLock held.
+// input parameters: now - Current time in us.
+//
+// *****************************************************
+static void rf_admit_sweep(long long now)
+{
+	RF_AdmitClient_T *c, **pp;
+
+	for (int i = 0; i < RF_ADMIT_BUCKETS; i++) {
+		for (pp = &table[i]; (c = *pp) != NULL; ) {
+			if (c->running == 0 && c->waiting == 0 && now - c->lastUsed > RF_ADMIT_IDLE) {
+				*pp = c->hashNext;
+				free(c);
+				numClients--;
+			} else {
+				pp = &c->hashNext;
+			}
+		}
+	}
+}
+
+// *****************************************************
+//
+// rf_admit_client
+//     Finds the entry of a client, creating it if it is new. Called with
+//     admitLock held.
+// input parameters: caller - The client's socket address.
+//                   now    - Current time in us.
+// return value: The client's entry, the overflow entry if there is no room.
+//
+// *****************************************************
+static RF_AdmitClient_T *rf_admit_client(struct netbuf *caller, long long now)
+{
+	RF_AdmitClient_T *c, **bucket;
+	unsigned char addr[16];
+	unsigned long h = 2166136261UL;
+	int len;
+
+	if (caller == NULL || caller->buf == NULL || (len = rf_admit_addr(caller->buf, addr)) == 0)
+		return(&overflow);
+	for (int i = 0; i < len; i++)
+		h = (h ^ addr[i]) * 16777619UL;
+	bucket = &table[h % RF_ADMIT_BUCKETS];
+
+	for (c = *bucket; c != NULL; c = c->hashNext)
+		if (c->addrLen == len && memcmp(c->addr, addr, len) == 0)
+			return(c);
+
+	if (numClients >= RF_ADMIT_CLIENTS)
+		rf_admit_sweep(now);
+	if (numClients >= RF_ADMIT_CLIENTS || (c = calloc(1, sizeof(RF_AdmitClient_T))) == NULL)
+		return(&overflow);
+	memcpy(c->addr, addr, len);
+	c->addrLen = len;
+	c->weight = 1;
+	for (int i = 0; i < numWeights; i++)
+		if (weightList[i].addrLen == len && memcmp(weightList[i].addr, addr, len) == 0)
+			c->weight = weightList[i].weight;
+	c->ops = opsRate;
+	c->bytes = bytesRate;
+	c->refilled = now;
+	c->finish = vclock;
+	c->hashNext = *bucket;
+	*bucket = c;
+	numClients++;
+
+	return(c);
+}
+
+// *****************************************************
+//
+// rf_admit_over
+//     Tops up a client's buckets and tells how long its next call must wait
+//     for its rates. Called with admitLock held.
+// input parameters: c   - The client.
+//                   now - Current time in us.
+// return value: Milliseconds to wait, 0 if the call is within the rates.
+//
+// *****************************************************
+static long rf_admit_over(RF_AdmitClient_T *c, long long now)
+{
+	double secs = (now - c->refilled) / 1e6;
+	double wait = 0;
+
+	c->refilled = now;
+	if (opsRate > 0) {
+		if ((c->ops += secs * opsRate) > opsRate)
+			c->ops = opsRate;
+		if (c->ops < 1)
+			wait = (1 - c->ops) / opsRate;
+	}
+	if (bytesRate > 0) {
+		if ((c->bytes += secs * bytesRate) > bytesRate)
+			c->bytes = bytesRate;
+		if (c->bytes < 0 && -c->bytes / bytesRate > wait)
+			wait = -c->bytes / bytesRate;
+	}
+
+	return(wait > 0 ? (long)(wait * 1000) + 1 : 0);
+}
+
+// *****************************************************
+//
+// rf_admit_busy
+//     Makes a wait into the retry-after of a call turned away.
+// input parameters: ms - Milliseconds.
+// return value: ms, at least 1 and at most RF_BUSY_MAXWAIT.
+//
+// *****************************************************
+static long rf_admit_busy(long ms)
+{
+	if (ms < 1)
+		return(1);
+
+	return(ms > RF_BUSY_MAXWAIT ? RF_BUSY_MAXWAIT : ms);
+}
+
+// *****************************************************
+//
+// rf_admit_enter
+//     Lets a call in, in its turn, or turns it away. A call let in must be
+//     followed by rf_admit_leave on the same thread once it has been served.
+// input parameters: caller - The client's socket address.
+//                   flags  - RF_ADMIT_BUSY and RF_ADMIT_NOWAIT, as they
+//                            apply to the call; with neither it may wait.
+// return value: 0 if the call was let in, else the milliseconds the client
+//               should wait before calling again.
+//
+// *****************************************************
+long rf_admit_enter(struct netbuf *caller, int flags)
+{
+	RF_AdmitWaiter_T me;
+	RF_AdmitClient_T *c;
+	struct timespec ts;
+	long long now;
+	long wait;
+
+	current = NULL;
+	currentBytes = 0;
+	if (!enabled)
+		return(0);
+
+	now = rf_admit_now();
+	pthread_mutex_lock(&admitLock);
+	c = rf_admit_client(caller, now);
+	c->lastUsed = now;
+
+	if ((wait = rf_admit_over(c, now)) > 0) {
+		if (flags != 0) {
+			numLimited++;
+			pthread_mutex_unlock(&admitLock);
+			return(rf_admit_busy(wait));
+		}
+		/* A version 1 client over TCP only gets slower; the connection is its own. */
+		pthread_mutex_unlock(&admitLock);
+		if (wait > RF_ADMIT_MAXSLEEP)
+			wait = RF_ADMIT_MAXSLEEP;
+		ts.tv_sec = wait / 1000;
+		ts.tv_nsec = (wait % 1000) * 1000000;
+		while (nanosleep(&ts, &ts) != 0 && errno == EINTR)
+			;
+		pthread_mutex_lock(&admitLock);
+		now = rf_admit_now();
+		rf_admit_over(c, now);
+	}
+
+	/* Calls have been waiting too long: turn away those of clients already in. */
+	if (flags != 0 && target > 0 && queue != NULL && (c->running > 0 || c->waiting > 0)) {
+		long long oldest = now;
+
+		for (RF_AdmitWaiter_T *w = queue; w != NULL; w = w->next)
+			if (w->since < oldest)
+				oldest = w->since;
+		if (now - oldest > target) {
+			numShed++;
+			pthread_mutex_unlock(&admitLock);
+			return(rf_admit_busy((now - oldest) / 1000));
+		}
+	}
+
+	/* A UDP call must not hold its worker, and with it a socket other clients share. */
+	if ((flags & RF_ADMIT_NOWAIT) && (active >= maxActive || queue != NULL)) {
+		numShed++;
+		pthread_mutex_unlock(&admitLock);
+		return(RF_ADMIT_RETRY);
+	}
+
+	c->ops -= 1;
+	me.tag = (c->finish > vclock) ? c->finish : vclock;
+	c->finish = me.tag + 1 / c->weight;
+	if (active < maxActive && queue == NULL) {
+		active++;
+	} else {
+		me.since = now;
+		me.admitted = 0;
+		pthread_cond_init(&me.cond, NULL);
+		me.next = queue;
+		queue = &me;
+		c->waiting++;
+		numWaited++;
+		while (!me.admitted)
+			pthread_cond_wait(&me.cond, &admitLock);
+		c->waiting--;
+		pthread_cond_destroy(&me.cond);
+		/* rf_admit_leave took the call out of the queue and handed it its slot. */
+	}
+	if (me.tag > vclock)
+		vclock = me.tag;
+	c->running++;
+	current = c;
+	pthread_mutex_unlock(&admitLock);
+
+	return(0);
+}
+
+// *****************************************************
+//
+// rf_admit_bytes
+//     Adds to the bytes the call this thread is serving moved, to be charged
+//     to its client by rf_admit_leave.
+// input parameters: bytes - Payload bytes.
+//
+// *****************************************************
+void rf_admit_bytes(long long bytes)
+{
+	if (bytes > 0)
+		currentBytes += bytes;
+}
+
+// *****************************************************
+//
+// rf_admit_leave
+//     Ends the call this thread is serving: charges its bytes to the client
+//     and lets the waiting call with the lowest start tag in. Does nothing if
+//     the call was not let in by rf_admit_enter.
+//
+// *****************************************************
+void rf_admit_leave(void)
+{
+	RF_AdmitWaiter_T *w, **pp, **next;
+	RF_AdmitClient_T *c = current;
+
+	if (c == NULL)
+		return;
+	current = NULL;
+
+	pthread_mutex_lock(&admitLock);
+	c->running--;
+	c->bytes -= currentBytes;
+	c->finish += (double)currentBytes / RF_ADMIT_BYTEUNIT / c->weight;
+
+	/* The slot goes straight to the next call in the queue, if any. */
+	next = NULL;
+	for (pp = &queue; (w = *pp) != NULL; pp = &w->next)
+		if (next == NULL || w->tag < (*next)->tag)
+			next = pp;
+	if (next != NULL) {
+		w = *next;
+		*next = w->next;
+		w->admitted = 1;
+		pthread_cond_signal(&w->cond);
+	} else {
+		active--;
+	}
+	pthread_mutex_unlock(&admitLock);
+}
+
+// *****************************************************
+//
+// rf_admit_counts
+//     Reports what admission control did.
+// input parameters: waited  - Set to the calls that had to queue.
+//                   limited - Set to the calls turned away for their client's rate.
+//                   shed    - Set to the calls turned away because calls queued too long.
+//
+// *****************************************************
+void rf_admit_counts(long long *waited, long long *limited, long long *shed)
+{
+	pthread_mutex_lock(&admitLock);
+	*waited = numWaited;
+	*limited = numLimited;
+	*shed = numShed;
+	pthread_mutex_unlock(&admitLock);
+}
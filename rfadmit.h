@@ -0,0 +1,57 @@
+/* rfadmit.h */
+
+/* Server admission control: per-client rate limits and fair queuing.
+// Every call except rf_stats and the null procedure goes through
+// rf_admit_enter before it is dispatched and rf_admit_leave after it. Both do
+// nothing unless the server was started with a limit, so an unlimited server
+// pays nothing for them. Clients
+// are told apart by IP address, so all the connections and UDP sockets of one
+// host count as one client.
+//
+// A client may be held to a rate of calls and a rate of bytes per second.
+// Each rate is a token bucket that holds up to one second's worth. The bytes
+// of a call are only known once it has run (rf_admit_bytes), so a client can
+// run into debt, and it is held back until the debt is paid.
+//
+// Only so many calls run at once; the rest wait. Waiting calls are let in in
+// start-time fair queuing order. Each client has a virtual finish time that
+// moves on by the cost of each of its calls, divided by its weight. The cost
+// is one per call plus the bytes it moved, in units of RF_ADMIT_BYTEUNIT.
+// So a client sending a stream of calls gets its weighted share, and a client
+// with one call now and then gets in ahead of the stream.
+//
+// A version 2 call is turned away with a retry-after (see RF_BUSY in rf.x) in
+// two cases:
+//   - its client is over a rate;
+//   - calls have waited longer than the latency target, and its client
+//     already has calls running or waiting.
+// A client with nothing in is never turned away. Version 1 clients do not
+// know RF_BUSY, so their calls wait for their rate instead.
+//
+// A call waits on the worker serving it, and the worker's socket is not
+// served meanwhile. That is harmless for a TCP connection, which is one
+// client's own, but a UDP socket is shared by every client the kernel sends
+// to it. So a UDP call never waits: where it would, a version 2 call is turned
+// away and a version 1 call is dropped, to be retransmitted by its client.
+// The queue thus only holds TCP calls, at most one per worker, and fair
+// queuing orders at most as many calls as there are workers beyond the limit.
+*/
+
+#ifndef RFADMIT_H
+#define RFADMIT_H
+
+#include <rpc/rpc.h>
+
+#define RF_ADMIT_BYTEUNIT (64 * 1024)   /* bytes that cost as much as a call in the fair queue */
+
+/* How rf_admit_enter may hold back a call, or'ed together. */
+#define RF_ADMIT_BUSY   1   /* its client knows RF_BUSY: turn it away instead of making it wait for its rate */
+#define RF_ADMIT_NOWAIT 2   /* it came over UDP: never make it wait, turn it away */
+
+int  rf_admit_init(int maxRunning, long opsPerSec, long long bytesPerSec, int targetMs, char *weights);
+long rf_admit_enter(struct netbuf *caller, int flags);
+void rf_admit_bytes(long long bytes);
+void rf_admit_leave(void);
+void rf_admit_counts(long long *waited, long long *limited, long long *shed);
+
+#endif /* RFADMIT_H */
@@ -0,0 +1,283 @@
+/* rfarena.c */
+
+/* This file implements the per-worker arenas (see rfarena.h).
+// Each thread has its own chain of blocks, the one being filled first. Pieces
+// are aligned to 16 bytes. The blocks are malloc'ed; a large one is mapped by
+// malloc straight from the system, so room handed out for a field that turns
+// out short costs address space but not memory.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <rpc/rpc.h>
+
+#include "rf.h"
+#include "rfarena.h"
+
+#define OKAY 0
+#define FAILED -1
+
+#define RF_ARENA_ALIGN 16
+
+typedef struct RF_ArenaBlock_T
+{
+	struct RF_ArenaBlock_T	*next;	/* the block filled before this one */
+	size_t					size;	/* bytes of room after the header */
+	size_t					used;
+} RF_ArenaBlock_T;
+
+/* Header of a block, rounded up so the room after it is aligned. */
+#define RF_ARENA_HEAD ((sizeof(RF_ArenaBlock_T) + RF_ARENA_ALIGN - 1) & ~(size_t)(RF_ARENA_ALIGN - 1))
+
+/* Room for a path decoded by XDR, with its terminating NUL. */
+#define RF_ARENA_PATH (RF_MAXPATHLEN + 1)
+
+static __thread RF_ArenaBlock_T *arena = NULL;   /* the block being filled */
+
+
+// *****************************************************
+//
+// rf_arena_block
+//     Allocates an empty block.
+// input parameters: size - Bytes of room in it.
+// return value: The block, or NULL if there is no memory.
+//
+// *****************************************************
+static RF_ArenaBlock_T *rf_arena_block(size_t size)
+{
+	RF_ArenaBlock_T *b;
+
+	if ((b = malloc(RF_ARENA_HEAD + size)) == NULL)
+		return(NULL);
+	b->next = NULL;
+	b->size = size;
+	b->used = 0;
+
+	return(b);
+}
+
+// *****************************************************
+//
+// rf_arena_alloc
+//     Takes memory from the calling thread's arena, for use until its next
+//     rf_arena_reset.
+// input parameters: size - Bytes wanted.
+// return value: The memory, not cleared, or NULL if there is no memory.
+//
+// *****************************************************
+void *rf_arena_alloc(size_t size)
+{
+	RF_ArenaBlock_T *b;
+	size_t want;
+	char *p;
+
+	size = (size > 0) ? (size + RF_ARENA_ALIGN - 1) & ~(size_t)(RF_ARENA_ALIGN - 1) : RF_ARENA_ALIGN;
+	if (size < (size_t)RF_ARENA_ALIGN)
+		return(NULL);   /* wrapped around */
+
+	if (arena == NULL || arena->size - arena->used < size) {
+		want = (arena != NULL) ? arena->size * 2 : RF_ARENA_FIRST;
+		if (want < size)
+			want = size;
+		if ((b = rf_arena_block(want)) == NULL)
+			return(NULL);
+		b->next = arena;
+		arena = b;
+	}
+	p = (char *)arena + RF_ARENA_HEAD + arena->used;
+	arena->used += size;
+
+	return(p);
+}
+
+// *****************************************************
+//
+// rf_arena_calloc
+//     Takes cleared memory from the calling thread's arena.
+// input parameters: num  - Number of elements.
+//                   size - Bytes per element.
+// return value: The memory, or NULL if there is no memory.
+//
+// *****************************************************
+void *rf_arena_calloc(size_t num, size_t size)
+{
+	void *p;
+
+	if (size > 0 && num > (size_t)-1 / size)
+		return(NULL);
+	if ((p = rf_arena_alloc(num * size)) != NULL)
+		memset(p, 0, num * size);
+
+	return(p);
+}
+
+// *****************************************************
+//
+// rf_arena_strdup
+//     Copies a string into the calling thread's arena.
+// input parameters: s - The string.
+// return value: The copy, or NULL if there is no memory.
+//
+// *****************************************************
+char *rf_arena_strdup(const char *s)
+{
+	size_t len = strlen(s) + 1;
+	char *p;
+
+	if ((p = rf_arena_alloc(len)) != NULL)
+		memcpy(p, s, len);
+
+	return(p);
+}
+
+// *****************************************************
+//
+// rf_arena_reset
+//     Takes back everything the calling thread's arena handed out. If it
+//     took more than one block, they are swapped for one block holding as
+//     much, at most RF_ARENA_KEEP bytes.
+//
+// *****************************************************
+void rf_arena_reset(void)
+{
+	RF_ArenaBlock_T *next;
+	size_t total = 0;
+
+	if (arena == NULL)
+		return;
+	if (arena->next == NULL && arena->size <= RF_ARENA_KEEP) {
+		arena->used = 0;
+		return;
+	}
+
+	for (; arena != NULL; arena = next) {
+		next = arena->next;
+		total += arena->size;
+		free(arena);
+	}
+	/* Without memory the arena starts again from nothing at its next use. */
+	arena = rf_arena_block(total < RF_ARENA_KEEP ? total : RF_ARENA_KEEP);
+}
+
+// *****************************************************
+//
+// rf_arena_room
+//     Takes room for a field to be decoded into, noting a failure.
+// input parameters: size   - Bytes of room.
+//                   failed - Set to 1 if there is no memory.
+// return value: The room, or NULL.
+//
+// *****************************************************
+static char *rf_arena_room(size_t size, int *failed)
+{
+	char *p = rf_arena_alloc(size);
+
+	if (p == NULL)
+		*failed = 1;
+
+	return(p);
+}
+
+// *****************************************************
+//
+// rf_arena_args
+//     Points the variable length fields of a request about to be decoded at
+//     room in the calling thread's arena. Requests of version 1, and of
+//     version 2 procedures with no such fields, are left alone.
+// input parameters: xdrArgs - XDR routine of the request.
+//                   args    - The request, cleared.
+//                   maxData - Most file data bytes the transport can carry.
+// return value: OKAY if the request will be decoded into the arena, and so
+//               must not be freed with xdr_free; FAILED if XDR is left to
+//               allocate for it as usual.
+//
+// *****************************************************
+int rf_arena_args(xdrproc_t xdrArgs, void *args, u_int maxData)
+{
+	RF_PathWriteRequest_T *w = NULL;
+	RF_Data_T *data = NULL;
+	RF_Path_T **paths = NULL;
+	size_t size = 0;
+	int failed = 0;
+
+	if (xdrArgs == (xdrproc_t)xdr_RF_OpenFile2Request_T) {
+		RF_OpenFile2Request_T *a = args;
+		size = sizeof(*a);
+		a->filename = rf_arena_room(RF_ARENA_PATH, &failed);
+		a->mode = rf_arena_room(4, &failed);
+	} else if (xdrArgs == (xdrproc_t)xdr_RF_WriteFile2Request_T) {
+		size = sizeof(RF_WriteFile2Request_T);
+		data = &((RF_WriteFile2Request_T *)args)->data;
+	} else if (xdrArgs == (xdrproc_t)xdr_RF_PWriteRequest_T) {
+		size = sizeof(RF_PWriteRequest_T);
+		data = &((RF_PWriteRequest_T *)args)->data;
+	} else if (xdrArgs == (xdrproc_t)xdr_RF_FetchRequest_T) {
+		size = sizeof(RF_FetchRequest_T);
+		((RF_FetchRequest_T *)args)->filename = rf_arena_room(RF_ARENA_PATH, &failed);
+	} else if (xdrArgs == (xdrproc_t)xdr_RF_StoreRequest_T) {
+		RF_StoreRequest_T *a = args;
+		size = sizeof(*a);
+		a->filename = rf_arena_room(RF_ARENA_PATH, &failed);
+		a->mode = rf_arena_room(4, &failed);
+		data = &a->data;
+	} else if (xdrArgs == (xdrproc_t)xdr_RF_FetchManyRequest_T) {
+		RF_FetchManyRequest_T *a = args;
+		size = sizeof(*a);
+		if ((a->files.files_val = (RF_FetchRequest_T *)rf_arena_room(RF_MAXFETCH * sizeof(RF_FetchRequest_T), &failed)) != NULL)
+			for (int i = 0; i < RF_MAXFETCH; i++)
+				a->files.files_val[i].filename = rf_arena_room(RF_ARENA_PATH, &failed);
+	} else if (xdrArgs == (xdrproc_t)xdr_RF_PathReadRequest_T) {
+		size = sizeof(RF_PathReadRequest_T);
+		((RF_PathReadRequest_T *)args)->filename = rf_arena_room(RF_ARENA_PATH, &failed);
+	} else if (xdrArgs == (xdrproc_t)xdr_RF_PathWriteRequest_T) {
+		size = sizeof(RF_PathWriteRequest_T);
+		w = args;
+	} else if (xdrArgs == (xdrproc_t)xdr_RF_SumWriteRequest_T) {
+		size = sizeof(RF_SumWriteRequest_T);
+		w = &((RF_SumWriteRequest_T *)args)->write;
+	} else if (xdrArgs == (xdrproc_t)xdr_RF_ZWriteRequest_T) {
+		size = sizeof(RF_ZWriteRequest_T);
+		w = &((RF_ZWriteRequest_T *)args)->sum.write;
+	} else if (xdrArgs == (xdrproc_t)xdr_RF_DigestRequest_T) {
+		size = sizeof(RF_DigestRequest_T);
+		((RF_DigestRequest_T *)args)->filename = rf_arena_room(RF_ARENA_PATH, &failed);
+	} else if (xdrArgs == (xdrproc_t)xdr_RF_DeltaRequest_T) {
+		RF_DeltaRequest_T *a = args;
+		size = sizeof(*a);
+		a->filename = rf_arena_room(RF_ARENA_PATH, &failed);
+		a->sigs.sigs_val = (RF_BlockSig_T *)rf_arena_room(RF_MAXDELTASIGS * sizeof(RF_BlockSig_T), &failed);
+	} else if (xdrArgs == (xdrproc_t)xdr_RF_ZReadRequest_T) {
+		size = sizeof(RF_ZReadRequest_T);
+		((RF_ZReadRequest_T *)args)->read.filename = rf_arena_room(RF_ARENA_PATH, &failed);
+	} else if (xdrArgs == (xdrproc_t)xdr_RF_ReadDirRequest_T) {
+		size = sizeof(RF_ReadDirRequest_T);
+		((RF_ReadDirRequest_T *)args)->dirname = rf_arena_room(RF_ARENA_PATH, &failed);
+	} else if (xdrArgs == (xdrproc_t)xdr_RF_StatManyRequest_T) {
+		size = sizeof(RF_StatManyRequest_T);
+		paths = &((RF_StatManyRequest_T *)args)->paths.paths_val;
+	} else if (xdrArgs == (xdrproc_t)xdr_RF_GetAttrRequest_T) {
+		size = sizeof(RF_GetAttrRequest_T);
+		paths = &((RF_GetAttrRequest_T *)args)->paths.paths_val;
+	} else {
+		return(FAILED);
+	}
+
+	if (w != NULL) {
+		w->filename = rf_arena_room(RF_ARENA_PATH, &failed);
+		data = &w->data;
+	}
+	if (data != NULL)
+		data->RF_Data_T_val = rf_arena_room(maxData, &failed);
+	if (paths != NULL && (*paths = (RF_Path_T *)rf_arena_room(RF_MAXSTAT * sizeof(RF_Path_T), &failed)) != NULL)
+		for (int i = 0; i < RF_MAXSTAT; i++)
+			(*paths)[i] = rf_arena_room(RF_ARENA_PATH, &failed);
+
+	/* Fields left NULL would be malloc'ed by XDR and never freed. */
+	if (failed) {
+		memset(args, 0, size);
+		return(FAILED);
+	}
+
+	return(OKAY);
+}
@@ -0,0 +1,36 @@
+/* rfarena.h */
+
+/* Per-worker memory arenas for the server's calls.
+// A call needs memory for its decoded arguments, for its reply and for
+// scratch work, all of it given up once the reply has been sent. Instead of
+// a malloc and a free for each piece, a worker thread hands it out of an
+// arena of its own, a pointer bump per piece, and takes all of it back at
+// once with rf_arena_reset. No lock is taken, since no other thread uses it.
+//
+// An arena is one block of memory. A call that needs more gets further
+// blocks, and the next reset swaps them all for one block as large as they
+// were together, up to RF_ARENA_KEEP bytes; so once a worker has served the
+// largest calls of its load it takes nothing more from the heap.
+//
+// XDR allocates only for the variable length fields a decode finds NULL.
+// rf_arena_args points those of an RFILE version 2 request at room in the
+// arena beforehand, as large as the field may be, so the request is decoded
+// in place and nothing of it needs freeing.
+*/
+
+#ifndef RFARENA_H
+#define RFARENA_H
+
+#include <stddef.h>
+#include <rpc/rpc.h>
+
+#define RF_ARENA_FIRST (256 * 1024)         /* first block of an arena */
+#define RF_ARENA_KEEP  (16 * 1024 * 1024)   /* most an arena keeps across a reset */
+
+void *rf_arena_alloc(size_t size);
+void *rf_arena_calloc(size_t num, size_t size);
+char *rf_arena_strdup(const char *s);
+void  rf_arena_reset(void);
+int   rf_arena_args(xdrproc_t xdrArgs, void *args, u_int maxData);
+
+#endif /* RFARENA_H */
@@ -0,0 +1,483 @@
+/* rfasync.c */
+
+/* This file implements asynchronous RFILE calls (see rfasync.h).
+// Each channel has a thread of its own that owns the pipe: it sends the calls
+// other threads queue, as far as the window goes, waits for replies, decodes
+// them and ends their calls. A thread queueing a call wakes it through an
+// eventfd, which it watches along with the socket. Once the pipe fails, every
+// call in flight or still to come ends with the reason.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <rpc/rpc.h>
+
+#include "rf.h"
+#include "rfasync.h"
+#include "rfpipe.h"
+
+#define OKAY 0
+#define FAILED -1
+
+struct RF_Future_T
+{
+	RF_Async_T		*as;
+	u_long			proc;
+	xdrproc_t		xdrArgs;
+	void			*args;
+	xdrproc_t		xdrRes;
+	void			*res;
+	RF_AsyncDone_T	done;	/* callback, NULL for a future that is waited on */
+	void			*arg;	/* passed to done */
+	int				ended;
+	enum clnt_stat	stat;	/* how the call ended */
+	RF_Future_T		*next;	/* next call waiting to be sent */
+};
+
+struct RF_Async_T
+{
+	RF_Pipe_T		*rp;
+	pthread_t		thread;
+	pthread_mutex_t	lock;		/* guards the fields below, and ended of every future */
+	pthread_cond_t	ended;		/* broadcast when a future ends */
+	RF_Future_T		*head;		/* calls waiting to be sent, oldest first */
+	RF_Future_T		*tail;
+	int				stopping;	/* rf_async_destroy was called */
+	enum clnt_stat	broken;		/* why the pipe failed, RPC_SUCCESS while it works */
+	int				wakeFd;		/* eventfd the thread watches besides the socket */
+	RF_Future_T		**inFlight;	/* call in each pipe slot, used by the thread only */
+	int				window;
+	int				busy;		/* calls in flight */
+};
+
+
+// *****************************************************
+//
+// rf_async_end
+//     Ends a call: runs its callback and frees it, or wakes whoever waits on it.
+// input parameters: as   - The channel.
+//                   f    - The call.
+//                   stat - How it ended.
+//
+// *****************************************************
+static void rf_async_end(RF_Async_T *as, RF_Future_T *f, enum clnt_stat stat)
+{
+	if (f->done != NULL) {
+		f->done(stat, f->res, f->arg);
+		free(f);
+		return;
+	}
+
+	pthread_mutex_lock(&as->lock);
+	f->stat = stat;
+	f->ended = 1;
+	pthread_cond_broadcast(&as->ended);
+	pthread_mutex_unlock(&as->lock);
+}
+
+// *****************************************************
+//
+// rf_async_break
+//     Gives up on the pipe after it failed, ending every call in flight.
+// input parameters: as   - The channel.
+//                   stat - Why the pipe failed.
+//
+// *****************************************************
+static void rf_async_break(RF_Async_T *as, enum clnt_stat stat)
+{
+	pthread_mutex_lock(&as->lock);
+	as->broken = (stat != RPC_SUCCESS) ? stat : RPC_FAILED;
+	pthread_mutex_unlock(&as->lock);
+
+	for (int i = 0; i < as->window; i++) {
+		if (as->inFlight[i] != NULL) {
+			rf_async_end(as, as->inFlight[i], as->broken);
+			as->inFlight[i] = NULL;
+		}
+	}
+	as->busy = 0;
+}
+
+// *****************************************************
+//
+// rf_async_run
+//     The channel's thread: sends queued calls and ends them as their replies
+//     arrive, until the channel is destroyed and no call is left.
+// input parameters: arg - The RF_Async_T.
+// return value: NULL.
+//
+// *****************************************************
+static void *rf_async_run(void *arg)
+{
+	RF_Async_T *as = arg;
+	RF_Future_T *f;
+	enum clnt_stat stat;
+	u_int64_t count;
+	XDR xdrs;
+	int slot;
+
+	for (;;) {
+		/* Send what is queued, as far as the window goes. */
+		pthread_mutex_lock(&as->lock);
+		while (as->head != NULL && (as->broken != RPC_SUCCESS || as->busy < as->window)) {
+			f = as->head;
+			if ((as->head = f->next) == NULL)
+				as->tail = NULL;
+			stat = as->broken;
+			pthread_mutex_unlock(&as->lock);
+
+			slot = rf_pipe_free_slot(as->rp);
+			if (stat != RPC_SUCCESS) {
+				rf_async_end(as, f, stat);
+			} else if (rf_pipe_call(as->rp, slot, f->proc, f->xdrArgs, f->args) == OKAY) {
+				as->inFlight[slot] = f;
+				as->busy++;
+			} else {
+				/* Arguments that do not encode only fail their own call. */
+				stat = rf_pipe_error(as->rp);
+				rf_async_end(as, f, stat);
+				if (stat != RPC_CANTENCODEARGS)
+					rf_async_break(as, stat);
+			}
+			pthread_mutex_lock(&as->lock);
+		}
+		if (as->stopping && as->head == NULL && as->busy == 0) {
+			pthread_mutex_unlock(&as->lock);
+			break;
+		}
+		stat = as->broken;
+		pthread_mutex_unlock(&as->lock);
+
+		/* A failed pipe is not touched again; only new calls, to be ended, wake the thread. */
+		if (stat != RPC_SUCCESS) {
+			if (read(as->wakeFd, &count, sizeof(count)) < 0)
+				usleep(1000);
+			continue;
+		}
+
+		slot = rf_pipe_next(as->rp, &xdrs, as->wakeFd, &stat);
+		if (slot == RF_PIPE_WOKEN) {
+			if (read(as->wakeFd, &count, sizeof(count)) < 0)
+				perror("rf_async_run");
+			continue;
+		}
+		if (slot == FAILED) {
+			rf_async_break(as, rf_pipe_error(as->rp));
+			continue;
+		}
+
+		f = as->inFlight[slot];
+		as->inFlight[slot] = NULL;
+		as->busy--;
+		if (stat == RPC_SUCCESS && !f->xdrRes(&xdrs, f->res))
+			stat = RPC_CANTDECODERES;
+		rf_async_end(as, f, stat);
+	}
+
+	return(NULL);
+}
+
+// *****************************************************
+//
+// rf_async_create
+//     Creates a channel for asynchronous calls on the socket of a CLIENT handle.
+// input parameters: clnt     - CLIENT handle talking RFILE_VERS2 (see rf_connect).
+//                   window   - Largest number of calls in flight.
+//                   callMax  - Largest encoded call, arguments included.
+//                   replyMax - Largest encoded reply, results included.
+// return value: The channel, or NULL if it could not be created.
+//
+// *****************************************************
+RF_Async_T *rf_async_create(CLIENT *clnt, int window, u_int callMax, u_int replyMax)
+{
+	RF_Async_T *as;
+
+	if ((as = calloc(1, sizeof(RF_Async_T))) == NULL)
+		return(NULL);
+
+	as->window = window;
+	as->broken = RPC_SUCCESS;
+	as->wakeFd = eventfd(0, EFD_CLOEXEC);
+	as->rp = rf_pipe_create(clnt, RFILE, RFILE_VERS2, window, callMax, replyMax);
+	as->inFlight = calloc(window > 0 ? window : 1, sizeof(RF_Future_T *));
+	if (as->wakeFd < 0 || as->rp == NULL || as->inFlight == NULL) {
+		if (as->wakeFd >= 0)
+			close(as->wakeFd);
+		rf_pipe_destroy(as->rp);
+		free(as->inFlight);
+		free(as);
+		return(NULL);
+	}
+	pthread_mutex_init(&as->lock, NULL);
+	pthread_cond_init(&as->ended, NULL);
+
+	if (pthread_create(&as->thread, NULL, rf_async_run, as) != 0) {
+		pthread_mutex_destroy(&as->lock);
+		pthread_cond_destroy(&as->ended);
+		close(as->wakeFd);
+		rf_pipe_destroy(as->rp);
+		free(as->inFlight);
+		free(as);
+		return(NULL);
+	}
+
+	return(as);
+}
+
+// *****************************************************
+//
+// rf_async_destroy
+//     Waits for every call made on a channel to end, then frees the channel.
+//     The CLIENT handle is left alone. Futures are not freed.
+// input parameters: as - The channel.
+//
+// *****************************************************
+void rf_async_destroy(RF_Async_T *as)
+{
+	u_int64_t one = 1;
+
+	if (as == NULL)
+		return;
+
+	pthread_mutex_lock(&as->lock);
+	as->stopping = 1;
+	pthread_mutex_unlock(&as->lock);
+	if (write(as->wakeFd, &one, sizeof(one)) < 0)
+		perror("rf_async_destroy");
+	pthread_join(as->thread, NULL);
+
+	pthread_mutex_destroy(&as->lock);
+	pthread_cond_destroy(&as->ended);
+	close(as->wakeFd);
+	rf_pipe_destroy(as->rp);
+	free(as->inFlight);
+	free(as);
+}
+
+// *****************************************************
+//
+// rf_async_queue
+//     Queues a call for the channel's thread to send.
+// input parameters: as - The channel.
+//                   f  - The call.
+// return value: OKAY, or FAILED if the channel is being destroyed.
+//
+// *****************************************************
+static int rf_async_queue(RF_Async_T *as, RF_Future_T *f)
+{
+	u_int64_t one = 1;
+
+	pthread_mutex_lock(&as->lock);
+	if (as->stopping) {
+		pthread_mutex_unlock(&as->lock);
+		return(FAILED);
+	}
+	f->next = NULL;
+	if (as->tail != NULL)
+		as->tail->next = f;
+	else
+		as->head = f;
+	as->tail = f;
+	pthread_mutex_unlock(&as->lock);
+
+	if (write(as->wakeFd, &one, sizeof(one)) < 0)
+		perror("rf_async_queue");
+
+	return(OKAY);
+}
+
+// *****************************************************
+//
+// rf_async_new
+//     Allocates a call.
+// input parameters: as - The channel.
+//                   The others as for rf_async_call_cb.
+// return value: The call, or NULL if out of memory.
+//
+// *****************************************************
+static RF_Future_T *rf_async_new(RF_Async_T *as, u_long proc, xdrproc_t xdrArgs, void *args, xdrproc_t xdrRes, void *res,
+                                 RF_AsyncDone_T done, void *arg)
+{
+	RF_Future_T *f;
+
+	if ((f = calloc(1, sizeof(RF_Future_T))) == NULL)
+		return(NULL);
+
+	f->as = as;
+	f->proc = proc;
+	f->xdrArgs = xdrArgs;
+	f->args = args;
+	f->xdrRes = xdrRes;
+	f->res = res;
+	f->done = done;
+	f->arg = arg;
+	f->stat = RPC_SUCCESS;
+
+	return(f);
+}
+
+// *****************************************************
+//
+// rf_async_call
+//     Makes a call without waiting for it to end.
+// input parameters: as      - The channel.
+//                   proc    - Procedure number, e.g. rf_readpath.
+//                   xdrArgs - XDR routine of the arguments.
+//                   args    - The arguments. Must stay as they are until the call ends.
+//                   xdrRes  - XDR routine of the results.
+//                   res     - Where the results are decoded, zeroed, so that XDR
+//                             allocates what they point to.
+// return value: The future of the call, to be waited on and freed, or NULL if
+//               out of memory or the channel is being destroyed.
+//
+// *****************************************************
+RF_Future_T *rf_async_call(RF_Async_T *as, u_long proc, xdrproc_t xdrArgs, void *args, xdrproc_t xdrRes, void *res)
+{
+	RF_Future_T *f;
+
+	if ((f = rf_async_new(as, proc, xdrArgs, args, xdrRes, res, NULL, NULL)) == NULL)
+		return(NULL);
+	if (rf_async_queue(as, f) != OKAY) {
+		free(f);
+		return(NULL);
+	}
+
+	return(f);
+}
+
+// *****************************************************
+//
+// rf_async_call_cb
+//     Makes a call without waiting for it to end, and has a function run when
+//     it does.
+// input parameters: as, proc, xdrArgs, args, xdrRes, res - As for rf_async_call.
+//                   done - Run on the channel's thread when the call ends.
+//                   arg  - Passed to done.
+// return value: OKAY, or FAILED if out of memory or the channel is being
+//               destroyed; done is then not run.
+//
+// *****************************************************
+int rf_async_call_cb(RF_Async_T *as, u_long proc, xdrproc_t xdrArgs, void *args, xdrproc_t xdrRes, void *res,
+                     RF_AsyncDone_T done, void *arg)
+{
+	RF_Future_T *f;
+
+	if ((f = rf_async_new(as, proc, xdrArgs, args, xdrRes, res, done, arg)) == NULL)
+		return(FAILED);
+	if (rf_async_queue(as, f) != OKAY) {
+		free(f);
+		return(FAILED);
+	}
+
+	return(OKAY);
+}
+
+// *****************************************************
+//
+// rf_future_done
+//     Tells whether a call has ended, without waiting.
+// input parameters: f - The future of the call.
+// return value: Non zero if it has.
+//
+// *****************************************************
+int rf_future_done(RF_Future_T *f)
+{
+	int ended;
+
+	pthread_mutex_lock(&f->as->lock);
+	ended = f->ended;
+	pthread_mutex_unlock(&f->as->lock);
+
+	return(ended);
+}
+
+// *****************************************************
+//
+// rf_future_wait
+//     Waits for a call to end.
+// input parameters: f - The future of the call.
+// return value: RPC_SUCCESS if the results are in the reply given to the call,
+//               else why the call failed.
+//
+// *****************************************************
+enum clnt_stat rf_future_wait(RF_Future_T *f)
+{
+	RF_Async_T *as = f->as;
+
+	pthread_mutex_lock(&as->lock);
+	while (!f->ended)
+		pthread_cond_wait(&as->ended, &as->lock);
+	pthread_mutex_unlock(&as->lock);
+
+	return(f->stat);
+}
+
+// *****************************************************
+//
+// rf_future_free
+//     Frees the future of a call that has ended. The reply is left alone.
+// input parameters: f - The future, or NULL.
+//
+// *****************************************************
+void rf_future_free(RF_Future_T *f)
+{
+	free(f);
+}
+
+// *****************************************************
+//
+// rf_async_readpath
+//     Reads part of a file by name (rf_readpath) without waiting.
+// input parameters: as  - The channel.
+//                   req - The request.
+//                   res - Where the reply goes.
+// return value: The future of the call, or NULL as for rf_async_call.
+//
+// *****************************************************
+RF_Future_T *rf_async_readpath(RF_Async_T *as, RF_PathReadRequest_T *req, RF_PReadReply_T *res)
+{
+	memset(res, 0, sizeof(*res));
+
+	return(rf_async_call(as, rf_readpath, (xdrproc_t)xdr_RF_PathReadRequest_T, req,
+	                     (xdrproc_t)xdr_RF_PReadReply_T, res));
+}
+
+// *****************************************************
+//
+// rf_async_writepath
+//     Writes part of a file by name (rf_writepath) without waiting.
+// input parameters: as  - The channel.
+//                   req - The request.
+//                   res - Where the reply goes.
+// return value: The future of the call, or NULL as for rf_async_call.
+//
+// *****************************************************
+RF_Future_T *rf_async_writepath(RF_Async_T *as, RF_PathWriteRequest_T *req, RF_PWriteReply_T *res)
+{
+	memset(res, 0, sizeof(*res));
+
+	return(rf_async_call(as, rf_writepath, (xdrproc_t)xdr_RF_PathWriteRequest_T, req,
+	                     (xdrproc_t)xdr_RF_PWriteReply_T, res));
+}
+
+// *****************************************************
+//
+// rf_async_digest
+//     Asks for the digest of a file (rf_digest) without waiting.
+// input parameters: as  - The channel.
+//                   req - The request.
+//                   res - Where the reply goes.
+// return value: The future of the call, or NULL as for rf_async_call.
+//
+// *****************************************************
+RF_Future_T *rf_async_digest(RF_Async_T *as, RF_DigestRequest_T *req, RF_DigestReply_T *res)
+{
+	memset(res, 0, sizeof(*res));
+
+	return(rf_async_call(as, rf_digest, (xdrproc_t)xdr_RF_DigestRequest_T, req,
+	                     (xdrproc_t)xdr_RF_DigestReply_T, res));
+}
@@ -0,0 +1,51 @@
+/* rfasync.h */
+
+/* Asynchronous RFILE calls.
+// The rpcgen stubs block their caller until the reply arrives. A channel
+// created with rf_async_create instead sends calls from any thread without
+// waiting: rf_async_call returns a future to wait on when the results are
+// wanted, and rf_async_call_cb runs a function once the call has ended. The
+// calls of every thread share the socket of one CLIENT handle, which keeps up
+// to window of them in flight and matches replies to them by XID (see
+// rfpipe.h), so a reply may complete its call before those of calls made
+// earlier. Calls beyond the window wait their turn. A channel talks RFILE
+// version 2; its CLIENT handle must not be used for other calls while the
+// channel exists.
+//
+// Arguments are encoded when a call is sent, which may be after rf_async_call
+// returned, so they must stay as they are until the call has ended. Results
+// are decoded into a reply the caller provides, as with rpcgen -M; what XDR
+// allocates in it is freed with xdr_free. Callbacks run on the channel's own
+// thread, one at a time: they may make more calls but must not wait on a
+// future of the same channel.
+*/
+
+#ifndef RFASYNC_H
+#define RFASYNC_H
+
+#include <rpc/rpc.h>
+
+#include "rf.h"
+
+typedef struct RF_Async_T RF_Async_T;
+typedef struct RF_Future_T RF_Future_T;
+
+/* Called when a call made with rf_async_call_cb has ended. stat is RPC_SUCCESS
+// if res holds the results.
+*/
+typedef void (*RF_AsyncDone_T)(enum clnt_stat stat, void *res, void *arg);
+
+RF_Async_T *rf_async_create(CLIENT *clnt, int window, u_int callMax, u_int replyMax);
+void rf_async_destroy(RF_Async_T *as);
+RF_Future_T *rf_async_call(RF_Async_T *as, u_long proc, xdrproc_t xdrArgs, void *args, xdrproc_t xdrRes, void *res);
+int  rf_async_call_cb(RF_Async_T *as, u_long proc, xdrproc_t xdrArgs, void *args, xdrproc_t xdrRes, void *res,
+                      RF_AsyncDone_T done, void *arg);
+int  rf_future_done(RF_Future_T *f);
+enum clnt_stat rf_future_wait(RF_Future_T *f);
+void rf_future_free(RF_Future_T *f);
+
+RF_Future_T *rf_async_readpath(RF_Async_T *as, RF_PathReadRequest_T *req, RF_PReadReply_T *res);
+RF_Future_T *rf_async_writepath(RF_Async_T *as, RF_PathWriteRequest_T *req, RF_PWriteReply_T *res);
+RF_Future_T *rf_async_digest(RF_Async_T *as, RF_DigestRequest_T *req, RF_DigestReply_T *res);
+
+#endif /* RFASYNC_H */
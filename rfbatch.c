@@ -0,0 +1,455 @@
+/* rfbatch.c */
+
+/* This file implements batch transfers (see rfbatch.h).
+// Workers share the entry list and a cursor into it under one mutex. Results
+// are printed as each transfer finishes, followed by a summary line for the
+// whole batch.
+// A worker takes runs of consecutive gets as a group and fetches them with one
+// rf_fetchmany call; files too large for it are then copied one by one, each
+// over streams connections of its own when it is large (see rfstripe.h).
+// With a client cache open (see rfccache.h), the worker first asks the server
+// about the whole group with one rf_getattr call and serves the gets the
+// cache holds a current copy of from it; the files it does fetch are asked
+// about once more afterwards and kept in the cache if they did not change.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <rpc/rpc.h>
+
+#include "rf.h"
+#include "rfccache.h"
+#include "rfconnect.h"
+#include "rfxfer.h"
+#include "rfresume.h"
+#include "rfstripe.h"
+#include "rfbatch.h"
+
+#define OKAY 0
+#define FAILED -1
+
+#define RF_BATCH_GROUP 16   /* most gets one worker fetches in one call */
+
+typedef struct RF_Batch_T
+{
+	char			*server;
+	char			*proto;
+	int				window;
+	int				streams;	/* streams per large file */
+	int				jobs;		/* number of workers */
+	RF_BatchEntry_T	*entries;
+	int				numEntries;
+	int				next;		/* first entry no worker has taken yet */
+	int				failed;		/* transfers that failed */
+	long long		bytes;		/* bytes moved by transfers that succeeded */
+	pthread_mutex_t	lock;		/* protects next, failed, bytes and stdout */
+} RF_Batch_T;
+
+
+// *****************************************************
+//
+// rf_batch_seconds
+//     Reads the monotonic clock.
+// return value: Current time in seconds.
+//
+// *****************************************************
+static double rf_batch_seconds(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return(ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+// *****************************************************
+//
+// rf_batch_load
+//     Reads a manifest file (format in rfbatch.h).
+// input parameters: manifest - Name of the manifest file.
+//                   entries  - Set to a malloc'ed array of the transfers.
+// return value: Number of transfers, or FAILED if the manifest could not be
+//               read or has a bad line.
+//
+// *****************************************************
+int rf_batch_load(char *manifest, RF_BatchEntry_T **entries)
+{
+	RF_BatchEntry_T *list = NULL, *grown;
+	char line[2 * RF_MAXPATHLEN + 16];
+	char *op, *first, *second, *save;
+	int num = 0, max = 0, lineNo = 0;
+	FILE *fp;
+
+	if ((fp = fopen(manifest, "r")) == NULL) {
+		printf("Cannot open manifest %s.\n", manifest);
+		return(FAILED);
+	}
+
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		lineNo++;
+		if ((op = strtok_r(line, " \t\r\n", &save)) == NULL || op[0] == '#')
+			continue;
+		first = strtok_r(NULL, " \t\r\n", &save);
+		second = strtok_r(NULL, " \t\r\n", &save);
+		if ((strcmp(op, "get") != 0 && strcmp(op, "put") != 0 && strcmp(op, "sync") != 0) || second == NULL ||
+		    strtok_r(NULL, " \t\r\n", &save) != NULL) {
+			printf("%s:%d: expected \"get REMOTE LOCAL\", \"put LOCAL REMOTE\" or \"sync REMOTE LOCAL\".\n", manifest, lineNo);
+			fclose(fp);
+			free(list);
+			return(FAILED);
+		}
+
+		if (num == max) {
+			max = max * 2 + 64;
+			if ((grown = realloc(list, max * sizeof(RF_BatchEntry_T))) == NULL) {
+				printf("Out of memory reading %s.\n", manifest);
+				fclose(fp);
+				free(list);
+				return(FAILED);
+			}
+			list = grown;
+		}
+		list[num].put = (op[0] == 'p');
+		list[num].sync = (op[0] == 's');
+		list[num].resume = 0;
+		list[num].local = strdup(list[num].put ? first : second);
+		list[num].remote = strdup(list[num].put ? second : first);
+		num++;
+	}
+
+	fclose(fp);
+	*entries = list;
+
+	return(num);
+}
+
+// *****************************************************
+//
+// rf_batch_report
+//     Prints the outcome of one transfer. Called with the batch lock held.
+// input parameters: entry  - The transfer.
+//                   status - OKAY or FAILED.
+//                   stats  - What the transfer did.
+//
+// *****************************************************
+static void rf_batch_report(RF_BatchEntry_T *entry, int status, RF_XferStats_T *stats)
+{
+	if (entry->put)
+		printf("put %s -> %s: ", entry->local, entry->remote);
+	else
+		printf("%s %s -> %s: ", entry->sync ? "sync" : "get", entry->remote, entry->local);
+
+	if (status == OKAY) {
+		printf("%lld bytes, %.3f s, %.1f MB/s", stats->bytes, stats->seconds,
+		       stats->seconds > 0 ? stats->bytes / stats->seconds / 1e6 : 0.0);
+		if (stats->cached)
+			printf(", from cache");
+		else if (entry->sync)
+			printf(", %lld sent", stats->literal);
+		else if (stats->wire > 0 && stats->wire < stats->bytes)
+			printf(", %lld on the wire", stats->wire);
+		if (stats->resumed > 0)
+			printf(", resumed at %lld", stats->resumed);
+		if (stats->resent > 0)
+			printf(", %lld resent", stats->resent);
+		if (stats->retransmits > 0)
+			printf(", %ld retransmits", stats->retransmits);
+		printf("\n");
+	} else {
+		printf("FAILED, %s", stats->failure != NULL ? stats->failure : "unknown error");
+		if (stats->rpcError != RPC_SUCCESS)
+			printf(" (%s)", clnt_sperrno(stats->rpcError));
+		printf("\n");
+	}
+}
+
+// *****************************************************
+//
+// rf_batch_take
+//     Takes the next transfers off the list: one put or sync, or a run of up
+//     to RF_BATCH_GROUP gets. Runs are kept short enough that every worker gets
+//     a share of what is left.
+// input parameters: batch - The batch.
+//                   first - Set to the index of the first transfer taken.
+// return value: Number of transfers taken, 0 when none are left.
+//
+// *****************************************************
+static int rf_batch_take(RF_Batch_T *batch, int *first)
+{
+	int num = 0, max;
+
+	pthread_mutex_lock(&batch->lock);
+	max = (batch->numEntries - batch->next + batch->jobs - 1) / batch->jobs;
+	if (max > RF_BATCH_GROUP)
+		max = RF_BATCH_GROUP;
+	*first = batch->next;
+	if (batch->next < batch->numEntries) {
+		num = 1;
+		if (!batch->entries[batch->next].put && !batch->entries[batch->next].sync)
+			while (num < max && !batch->entries[batch->next + num].put && !batch->entries[batch->next + num].sync)
+				num++;
+	}
+	batch->next += num;
+	pthread_mutex_unlock(&batch->lock);
+
+	return(num);
+}
+
+// *****************************************************
+//
+// rf_batch_done
+//     Counts and prints the outcome of one transfer.
+// input parameters: batch  - The batch.
+//                   entry  - The transfer.
+//                   status - OKAY or FAILED.
+//                   stats  - What the transfer did.
+//
+// *****************************************************
+static void rf_batch_done(RF_Batch_T *batch, RF_BatchEntry_T *entry, int status, RF_XferStats_T *stats)
+{
+	pthread_mutex_lock(&batch->lock);
+	if (status == OKAY)
+		batch->bytes += stats->bytes;
+	else
+		batch->failed++;
+	rf_batch_report(entry, status, stats);
+	fflush(stdout);
+	pthread_mutex_unlock(&batch->lock);
+}
+
+// *****************************************************
+//
+// rf_batch_cached
+//     Serves the gets of a group the client cache holds a current copy of.
+// input parameters: batch    - The batch.
+//                   clnt     - The worker's CLIENT handle.
+//                   first    - Index of the first get of the group.
+//                   num      - Number of gets in the group.
+//                   attrs    - Set to what the server said of each file.
+//                   done     - done[i] is set to 1 for every get served.
+//                   stats    - stats[i] is filled in for every get served.
+//                   useCache - Cleared if the server has no rf_getattr.
+// return value: OKAY, or FAILED if the server could not be asked; attrs is
+//               then not set.
+//
+// *****************************************************
+static int rf_batch_cached(RF_Batch_T *batch, CLIENT *clnt, int first, int num, RF_GetAttrResult_T *attrs,
+                           int *done, RF_XferStats_T *stats, int *useCache)
+{
+	char *remote[RF_BATCH_GROUP];
+	enum clnt_stat rpcError;
+	double seconds = rf_batch_seconds();
+
+	for (int i = 0; i < num; i++)
+		remote[i] = batch->entries[first + i].remote;
+	if (rf_ccache_attrs(clnt, num, remote, attrs, &rpcError) != OKAY) {
+		if (rpcError == RPC_PROCUNAVAIL)
+			*useCache = 0;
+		return(FAILED);
+	}
+
+	for (int i = 0; i < num; i++) {
+		memset(&stats[i], 0, sizeof(RF_XferStats_T));
+		if (rf_ccache_fetch(batch->server, remote[i], &attrs[i], batch->entries[first + i].local, &stats[i].bytes) == OKAY) {
+			stats[i].cached = 1;
+			stats[i].seconds = rf_batch_seconds() - seconds;
+			done[i] = 1;
+		}
+	}
+
+	return(OKAY);
+}
+
+// *****************************************************
+//
+// rf_batch_keep
+//     Keeps in the client cache the files of a group that were fetched, if
+//     the server said they were stable before and they have not changed since.
+// input parameters: batch  - The batch.
+//                   clnt   - The worker's CLIENT handle.
+//                   first  - Index of the first get of the group.
+//                   num    - Number of gets in the group.
+//                   attrs  - What the server said of each file before the group ran.
+//                   status - status[i] is OKAY if get i succeeded.
+//                   stats  - What each get did.
+//
+// *****************************************************
+static void rf_batch_keep(RF_Batch_T *batch, CLIENT *clnt, int first, int num, RF_GetAttrResult_T *attrs,
+                          int *status, RF_XferStats_T *stats)
+{
+	RF_GetAttrResult_T after[RF_BATCH_GROUP], *a, *b;
+	char *remote[RF_BATCH_GROUP];
+	enum clnt_stat rpcError;
+	int which[RF_BATCH_GROUP];
+	int n = 0;
+
+	for (int i = 0; i < num; i++) {
+		if (status[i] == OKAY && !stats[i].cached && attrs[i].getattrStatus == OKAY && attrs[i].stable) {
+			which[n] = i;
+			remote[n++] = batch->entries[first + i].remote;
+		}
+	}
+	if (n == 0 || rf_ccache_attrs(clnt, n, remote, after, &rpcError) != OKAY)
+		return;
+
+	for (int k = 0; k < n; k++) {
+		a = &attrs[which[k]];
+		b = &after[k];
+		if (b->getattrStatus == OKAY && a->size == b->size && a->mtime == b->mtime &&
+		    a->change == b->change && a->inode == b->inode)
+			rf_ccache_store(batch->server, remote[k], a, batch->entries[first + which[k]].local);
+	}
+}
+
+// *****************************************************
+//
+// rf_batch_worker
+//     Worker thread body. Connects, then runs transfers until none are left.
+// input parameters: arg - The RF_Batch_T shared by all workers.
+// return value: NULL.
+//
+// *****************************************************
+static void *rf_batch_worker(void *arg)
+{
+	RF_Batch_T *batch = arg;
+	RF_BatchEntry_T *entry;
+	RF_XferStats_T stats[RF_BATCH_GROUP], part[RF_BATCH_GROUP];
+	RF_GetAttrResult_T attrs[RF_BATCH_GROUP];
+	char *remote[RF_BATCH_GROUP], *local[RF_BATCH_GROUP];
+	int done[RF_BATCH_GROUP], got[RF_BATCH_GROUP], which[RF_BATCH_GROUP], status[RF_BATCH_GROUP];
+	int useCache = rf_ccache_enabled();
+	CLIENT *clnt;
+	long maxBlock;
+	int first, num, n, checked;
+
+	if ((clnt = rf_connect(batch->server, RFILE_VERS2, batch->proto, &maxBlock)) == NULL) {
+		pthread_mutex_lock(&batch->lock);
+		clnt_pcreateerror(batch->server);
+		pthread_mutex_unlock(&batch->lock);
+		return(NULL);
+	}
+
+	while ((num = rf_batch_take(batch, &first)) > 0) {
+		memset(done, 0, sizeof(done));
+		checked = 0;
+		if (useCache && !batch->entries[first].put && !batch->entries[first].sync)
+			checked = (rf_batch_cached(batch, clnt, first, num, attrs, done, stats, &useCache) == OKAY);
+
+		/* A group of gets: whatever one call can not bring whole goes one by one. */
+		for (int i = n = 0; i < num; i++) {
+			if (!done[i]) {
+				which[n] = i;
+				remote[n] = batch->entries[first + i].remote;
+				local[n++] = batch->entries[first + i].local;
+			}
+		}
+		if (n > 1) {
+			rf_xfer_get_many(clnt, n, remote, local, maxBlock, got, part);
+			for (int k = 0; k < n; k++) {
+				if (got[k]) {
+					done[which[k]] = 1;
+					stats[which[k]] = part[k];
+				}
+			}
+		}
+
+		for (int i = 0; i < num; i++) {
+			entry = &batch->entries[first + i];
+			if (done[i])
+				status[i] = (stats[i].failure == NULL) ? OKAY : FAILED;
+			else if (entry->sync)
+				status[i] = rf_xfer_sync(clnt, entry->remote, entry->local, maxBlock, batch->window, &stats[i]);
+			else if (entry->resume && entry->put)
+				status[i] = rf_resume_put(&clnt, batch->server, batch->proto, entry->local, entry->remote, maxBlock,
+				                          batch->window, &stats[i]);
+			else if (entry->resume)
+				status[i] = rf_resume_get(&clnt, batch->server, batch->proto, entry->remote, entry->local, maxBlock,
+				                          batch->window, &stats[i]);
+			else if (entry->put)
+				status[i] = rf_stripe_put(clnt, batch->server, batch->proto, entry->local, entry->remote, maxBlock,
+				                          batch->streams, batch->window, &stats[i]);
+			else
+				status[i] = rf_stripe_get(clnt, batch->server, batch->proto, entry->remote, entry->local, maxBlock,
+				                          batch->streams, batch->window, &stats[i]);
+			rf_batch_done(batch, entry, status[i], &stats[i]);
+		}
+
+		if (checked)
+			rf_batch_keep(batch, clnt, first, num, attrs, status, stats);
+	}
+
+	clnt_destroy(clnt);
+
+	return(NULL);
+}
+
+// *****************************************************
+//
+// rf_batch_run
+//     Runs a list of transfers with up to jobs of them at once, printing a line
+//     per transfer and a summary with the aggregate throughput.
+// input parameters: server     - Server as accepted by rf_connect.
+//                   proto      - "udp" or "tcp".
+//                   window     - Calls in flight within each transfer.
+//                   streams    - Connections each large file is split over.
+//                   jobs       - Number of workers, each with its own CLIENT.
+//                   entries    - The transfers.
+//                   numEntries - Number of transfers.
+// return value: Number of transfers that failed or could not be run.
+//
+// *****************************************************
+int rf_batch_run(char *server, char *proto, int window, int streams, int jobs, RF_BatchEntry_T *entries, int numEntries)
+{
+	RF_Batch_T batch;
+	pthread_t *threads;
+	double seconds;
+	int started = 0;
+
+	if (jobs > numEntries)
+		jobs = numEntries;
+	if (jobs < 1)
+		jobs = 1;
+
+	memset(&batch, 0, sizeof(batch));
+	batch.server = server;
+	batch.proto = proto;
+	batch.window = window;
+	batch.streams = streams;
+	batch.jobs = jobs;
+	batch.entries = entries;
+	batch.numEntries = numEntries;
+	pthread_mutex_init(&batch.lock, NULL);
+
+	seconds = rf_batch_seconds();
+	if ((threads = calloc(jobs, sizeof(pthread_t))) != NULL) {
+		for (started = 0; started < jobs; started++)
+			if (pthread_create(&threads[started], NULL, rf_batch_worker, &batch) != 0)
+				break;
+	}
+	if (started == 0)
+		rf_batch_worker(&batch);
+	for (int i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+	seconds = rf_batch_seconds() - seconds;
+	free(threads);
+
+	/* Transfers left over when every worker failed to connect. */
+	for (; batch.next < numEntries; batch.next++) {
+		RF_XferStats_T stats;
+
+		memset(&stats, 0, sizeof(stats));
+		stats.failure = "not run, no connection to server";
+		rf_batch_report(&entries[batch.next], FAILED, &stats);
+		batch.failed++;
+	}
+
+	printf("%d files, %d failed, %lld bytes in %.3f s, %.1f MB/s with %d jobs.\n",
+	       numEntries, batch.failed, batch.bytes, seconds,
+	       seconds > 0 ? batch.bytes / seconds / 1e6 : 0.0, started > 0 ? started : 1);
+	pthread_mutex_destroy(&batch.lock);
+
+	return(batch.failed);
+}
@@ -0,0 +1,37 @@
+/* rfbatch.h */
+
+/* Batch transfers.
+// Runs a list of gets and puts over a pool of worker threads. Each worker owns
+// one CLIENT handle (CLIENT handles are not thread safe) and takes the next
+// transfer off the list when it finishes one, so many files move at once.
+//
+// A manifest file holds one transfer per line:
+//       get REMOTE LOCAL
+//       put LOCAL REMOTE
+//       sync REMOTE LOCAL
+// Blank lines and lines starting with # are ignored. File names can not
+// contain white space. sync is a get that only fetches the parts of the
+// remote file LOCAL does not already have (see rf_xfer_sync). Once
+// rf_ccache_init has opened a client cache, gets are served from it where it
+// holds a current copy, and the files fetched are kept in it. Gets and puts
+// marked resume go through rf_resume_get and rf_resume_put, in one stream.
+*/
+
+#ifndef RFBATCH_H
+#define RFBATCH_H
+
+#define RF_DEFAULT_JOBS 4   /* transfers run at once when the caller has no preference */
+
+typedef struct RF_BatchEntry_T
+{
+	int		put;		/* 0 for get REMOTE LOCAL, 1 for put LOCAL REMOTE */
+	int		sync;		/* 1 for sync REMOTE LOCAL, with put 0 */
+	int		resume;		/* 1 to keep a checkpoint and carry on after failures (see rfresume.h) */
+	char	*local;		/* name of the local file */
+	char	*remote;	/* name of the file on the server */
+} RF_BatchEntry_T;
+
+int rf_batch_load(char *manifest, RF_BatchEntry_T **entries);
+int rf_batch_run(char *server, char *proto, int window, int streams, int jobs, RF_BatchEntry_T *entries, int numEntries);
+
+#endif /* RFBATCH_H */
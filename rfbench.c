@@ -0,0 +1,396 @@
+/* rfbench.c
+// Load generator for the RF server.
+//
+// Run this program as
+//       rfbench [-t protos] [-c clients] [-s sizes] [-d seconds] [-D dir] [-f csv|json] [-o file] server[:port]
+//
+//   -t protos   Comma separated transports to measure (default udp,tcp).
+//   -c clients  Comma separated client counts (default 1,4). Every client is a
+//               thread with its own CLIENT handle.
+//   -s sizes    Comma separated payload sizes in bytes (default 64,4096,61440,1048576).
+//               Sizes larger than a transport can carry are skipped for it.
+//   -d seconds  How long each combination runs (default 2).
+//   -D dir      Directory on the server for the scratch files (default /tmp).
+//   -f format   Output format, csv (default) or json (one object per line).
+//   -o file     Write the results to file instead of stdout.
+//
+// For every combination of transport, client count and size, each client
+// repeats open, write, read and close on its own scratch file, named
+// dir/rfbench.PID.N, until the time is up. The latency of every call is
+// recorded; one result row per procedure gives the call count, calls per
+// second, MB/s for the payload procedures, and the p50, p99 and p999
+// latencies in microseconds.
+//
+// The scratch files are left on the server; the protocol can not remove them.
+// "make bench" runs this against a server started on localhost.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <rpc/rpc.h>
+
+#include "rf.h"
+#include "rfconnect.h"
+
+#define OKAY 0
+#define FAILED -1
+
+#define RF_BENCH_SPAN 16   /* blocks a client cycles over in its scratch file */
+
+enum { RF_BENCH_OPEN, RF_BENCH_WRITE, RF_BENCH_READ, RF_BENCH_CLOSE, RF_BENCH_PROCS };
+
+static const char *procNames[RF_BENCH_PROCS] = { "open", "write", "read", "close" };
+
+typedef struct RF_BenchLat_T
+{
+	u_int32_t	*ns;	/* latency of every call, in nanoseconds */
+	long		n;
+	long		max;
+} RF_BenchLat_T;
+
+typedef struct RF_BenchClient_T
+{
+	pthread_t		thread;
+	int				id;
+	CLIENT			*clnt;
+	long			size;		/* payload bytes per read or write */
+	double			duration;	/* seconds to run once every client is ready */
+	long			errors;		/* calls that failed */
+	RF_BenchLat_T	lat[RF_BENCH_PROCS];
+} RF_BenchClient_T;
+
+static char *scratchDir = "/tmp";
+static char *format = "csv";
+static FILE *out;
+static pthread_barrier_t startLine;
+
+
+// *****************************************************
+//
+// rf_bench_seconds
+//     Reads the monotonic clock.
+// return value: Current time in seconds.
+//
+// *****************************************************
+static double rf_bench_seconds(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return(ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+// *****************************************************
+//
+// rf_bench_record
+//     Adds one latency sample.
+// input parameters: lat   - The samples of one procedure.
+//                   start - rf_bench_seconds() when the call was made.
+//
+// *****************************************************
+static void rf_bench_record(RF_BenchLat_T *lat, double start)
+{
+	double ns = (rf_bench_seconds() - start) * 1e9;
+	u_int32_t *grown;
+
+	if (lat->n == lat->max) {
+		if ((grown = realloc(lat->ns, (lat->max * 2 + 4096) * sizeof(u_int32_t))) == NULL)
+			return;
+		lat->ns = grown;
+		lat->max = lat->max * 2 + 4096;
+	}
+	lat->ns[lat->n++] = (ns > 4e9) ? 4000000000u : (u_int32_t)ns;
+}
+
+// *****************************************************
+//
+// rf_bench_client
+//     Client thread body. Repeats open, write, read, close until the deadline.
+// input parameters: arg - The RF_BenchClient_T of this thread.
+// return value: NULL.
+//
+// *****************************************************
+static void *rf_bench_client(void *arg)
+{
+	RF_BenchClient_T *c = arg;
+	RF_OpenFile2Request_T openReq;
+	RF_OpenFile2Reply_T openRes;
+	RF_PWriteRequest_T writeReq;
+	RF_PWriteReply_T writeRes;
+	RF_PReadRequest_T readReq;
+	RF_PReadReply_T readRes;
+	RF_CloseFileRequest_T closeReq;
+	RF_CloseFileReply_T closeRes;
+	char filename[RF_MAXPATHLEN];
+	double start, deadline;
+	long i = 0;
+	int ok;
+
+	snprintf(filename, sizeof(filename), "%s/rfbench.%d.%d", scratchDir, (int)getpid(), c->id);
+	openReq.filename = filename;
+	writeReq.data.RF_Data_T_len = c->size;
+	writeReq.data.RF_Data_T_val = malloc(c->size);
+	memset(writeReq.data.RF_Data_T_val, 'x', c->size);
+	readReq.bytesToRead = c->size;
+	memset(&readRes, 0, sizeof(readRes));
+
+	/* Create the scratch file outside the measurement. */
+	openReq.mode = "w";
+	if (rf_openfile_2(&openReq, &openRes, c->clnt) == RPC_SUCCESS && openRes.openStatus == OKAY) {
+		closeReq.fd = openRes.fd;
+		rf_closefile_2(&closeReq, &closeRes, c->clnt);
+	}
+	openReq.mode = "r+";
+
+	pthread_barrier_wait(&startLine);
+	deadline = rf_bench_seconds() + c->duration;
+
+	while (rf_bench_seconds() < deadline) {
+		start = rf_bench_seconds();
+		ok = (rf_openfile_2(&openReq, &openRes, c->clnt) == RPC_SUCCESS && openRes.openStatus == OKAY);
+		rf_bench_record(&c->lat[RF_BENCH_OPEN], start);
+		if (!ok) {
+			c->errors++;
+			continue;
+		}
+
+		writeReq.fd = readReq.fd = closeReq.fd = openRes.fd;
+		writeReq.offset = readReq.offset = (i++ % RF_BENCH_SPAN) * c->size;
+
+		start = rf_bench_seconds();
+		if (rf_pwritefile_2(&writeReq, &writeRes, c->clnt) != RPC_SUCCESS || writeRes.writeStatus != OKAY)
+			c->errors++;
+		rf_bench_record(&c->lat[RF_BENCH_WRITE], start);
+
+		start = rf_bench_seconds();
+		if (rf_preadfile_2(&readReq, &readRes, c->clnt) != RPC_SUCCESS || readRes.readStatus != OKAY)
+			c->errors++;
+		rf_bench_record(&c->lat[RF_BENCH_READ], start);
+		xdr_free((xdrproc_t)xdr_RF_PReadReply_T, (char *)&readRes);
+
+		start = rf_bench_seconds();
+		if (rf_closefile_2(&closeReq, &closeRes, c->clnt) != RPC_SUCCESS || closeRes.closeStatus != OKAY)
+			c->errors++;
+		rf_bench_record(&c->lat[RF_BENCH_CLOSE], start);
+	}
+
+	free(writeReq.data.RF_Data_T_val);
+
+	return(NULL);
+}
+
+// *****************************************************
+//
+// rf_bench_compare
+//     qsort comparison of two latency samples.
+//
+// *****************************************************
+static int rf_bench_compare(const void *a, const void *b)
+{
+	u_int32_t x = *(const u_int32_t *)a, y = *(const u_int32_t *)b;
+
+	return((x > y) - (x < y));
+}
+
+// *****************************************************
+//
+// rf_bench_report
+//     Merges the samples of every client for one procedure and prints its row.
+// input parameters: proto, numClients, size - The combination measured.
+//                   clients - The client threads, after they finished.
+//                   proc    - Which procedure.
+//                   seconds - How long the combination ran.
+//
+// *****************************************************
+static void rf_bench_report(char *proto, int numClients, long size, RF_BenchClient_T *clients, int proc, double seconds)
+{
+	RF_BenchLat_T all;
+	double p50, p99, p999, mbps;
+	long k = 0;
+
+	all.n = 0;
+	for (int i = 0; i < numClients; i++)
+		all.n += clients[i].lat[proc].n;
+	if (all.n == 0 || (all.ns = malloc(all.n * sizeof(u_int32_t))) == NULL)
+		return;
+	for (int i = 0; i < numClients; i++) {
+		memcpy(all.ns + k, clients[i].lat[proc].ns, clients[i].lat[proc].n * sizeof(u_int32_t));
+		k += clients[i].lat[proc].n;
+	}
+	qsort(all.ns, all.n, sizeof(u_int32_t), rf_bench_compare);
+
+	p50 = all.ns[(long)(all.n * 0.50)] / 1e3;
+	p99 = all.ns[(long)(all.n * 0.99)] / 1e3;
+	p999 = all.ns[(long)(all.n * 0.999)] / 1e3;
+	mbps = (proc == RF_BENCH_READ || proc == RF_BENCH_WRITE) ? all.n * (double)size / seconds / 1e6 : 0.0;
+
+	if (strcmp(format, "json") == 0)
+		fprintf(out, "{\"proto\":\"%s\",\"clients\":%d,\"size\":%ld,\"proc\":\"%s\",\"ops\":%ld,"
+		        "\"ops_per_sec\":%.1f,\"mb_per_sec\":%.1f,\"p50_us\":%.1f,\"p99_us\":%.1f,\"p999_us\":%.1f}\n",
+		        proto, numClients, size, procNames[proc], all.n, all.n / seconds, mbps, p50, p99, p999);
+	else
+		fprintf(out, "%s,%d,%ld,%s,%ld,%.1f,%.1f,%.1f,%.1f,%.1f\n",
+		        proto, numClients, size, procNames[proc], all.n, all.n / seconds, mbps, p50, p99, p999);
+
+	free(all.ns);
+}
+
+// *****************************************************
+//
+// rf_bench_run
+//     Measures one combination of transport, client count and payload size.
+// input parameters: server     - Server as accepted by rf_connect.
+//                   proto      - "udp" or "tcp".
+//                   numClients - Number of client threads.
+//                   size       - Payload bytes per read and write.
+//                   duration   - Seconds to run.
+// return value: OKAY, also when size is too large for proto and the
+//               combination was skipped. FAILED if the clients could not connect.
+//
+// *****************************************************
+static int rf_bench_run(char *server, char *proto, int numClients, long size, double duration)
+{
+	RF_BenchClient_T *clients;
+	long maxBlock, errors = 0;
+	double seconds;
+	int status = OKAY;
+	int skip = 0;
+
+	if ((clients = calloc(numClients, sizeof(RF_BenchClient_T))) == NULL)
+		return(FAILED);
+
+	for (int i = 0; i < numClients; i++) {
+		clients[i].id = i;
+		clients[i].size = size;
+		clients[i].duration = duration;
+		if ((clients[i].clnt = rf_connect(server, RFILE_VERS2, proto, &maxBlock)) == NULL) {
+			clnt_pcreateerror(server);
+			status = FAILED;
+			break;
+		}
+		if (size > maxBlock) {
+			fprintf(stderr, "rfbench: %s carries at most %ld bytes per call, skipping size %ld.\n", proto, maxBlock, size);
+			skip = 1;
+			break;
+		}
+	}
+
+	if (status == OKAY && !skip) {
+		pthread_barrier_init(&startLine, NULL, numClients + 1);
+		for (int i = 0; i < numClients; i++)
+			pthread_create(&clients[i].thread, NULL, rf_bench_client, &clients[i]);
+
+		/* The clock starts once every client has created its scratch file. */
+		pthread_barrier_wait(&startLine);
+		seconds = rf_bench_seconds();
+		for (int i = 0; i < numClients; i++) {
+			pthread_join(clients[i].thread, NULL);
+			errors += clients[i].errors;
+		}
+		seconds = rf_bench_seconds() - seconds;
+		pthread_barrier_destroy(&startLine);
+
+		for (int proc = 0; proc < RF_BENCH_PROCS; proc++)
+			rf_bench_report(proto, numClients, size, clients, proc, seconds);
+		fflush(out);
+		if (errors > 0)
+			fprintf(stderr, "rfbench: %s, %d clients, size %ld: %ld calls failed.\n", proto, numClients, size, errors);
+	}
+
+	for (int i = 0; i < numClients; i++) {
+		if (clients[i].clnt != NULL)
+			clnt_destroy(clients[i].clnt);
+		for (int proc = 0; proc < RF_BENCH_PROCS; proc++)
+			free(clients[i].lat[proc].ns);
+	}
+	free(clients);
+
+	return(status);
+}
+
+// *****************************************************
+//
+// main
+//     Entry point for the benchmark. Runs every combination of the -t, -c and
+//     -s lists and prints one row per procedure for each.
+// input parameters: See the usage at the top of this file.
+// return value: Exit status. 0 if every combination could be measured.
+//
+// *****************************************************
+int main(int argc, char *argv[])
+{
+	char *protos = "udp,tcp";
+	char *counts = "1,4";
+	char *sizes = "64,4096,61440,1048576";
+	double duration = 2;
+	char *proto, *count, *size;
+	char *p1, *p2, *p3, *list1, *list2, *list3;
+	int status = 0;
+	int opt;
+
+	out = stdout;
+	while ((opt = getopt(argc, argv, "t:c:s:d:D:f:o:")) != -1) {
+		switch (opt) {
+		case 't':
+			protos = optarg;
+			break;
+		case 'c':
+			counts = optarg;
+			break;
+		case 's':
+			sizes = optarg;
+			break;
+		case 'd':
+			duration = atof(optarg);
+			break;
+		case 'D':
+			scratchDir = optarg;
+			break;
+		case 'f':
+			format = optarg;
+			break;
+		case 'o':
+			if ((out = fopen(optarg, "w")) == NULL) {
+				printf("Cannot open %s.\n", optarg);
+				exit(-1);
+			}
+			break;
+		default:
+			optind = argc;
+		}
+	}
+	if (optind != argc - 1 || (strcmp(format, "csv") != 0 && strcmp(format, "json") != 0)) {
+		printf("Usage: %s [-t protos] [-c clients] [-s sizes] [-d seconds] [-D dir] [-f csv|json] [-o file] server[:port]\n", argv[0]);
+		exit(-1);
+	}
+
+	if (strcmp(format, "csv") == 0)
+		fprintf(out, "proto,clients,size,proc,ops,ops_per_sec,mb_per_sec,p50_us,p99_us,p999_us\n");
+
+	/* strtok_r modifies its input, so walk private copies of the lists. */
+	list1 = strdup(protos);
+	for (proto = strtok_r(list1, ",", &p1); proto != NULL; proto = strtok_r(NULL, ",", &p1)) {
+		list2 = strdup(counts);
+		for (count = strtok_r(list2, ",", &p2); count != NULL; count = strtok_r(NULL, ",", &p2)) {
+			list3 = strdup(sizes);
+			for (size = strtok_r(list3, ",", &p3); size != NULL; size = strtok_r(NULL, ",", &p3)) {
+				if (atoi(count) < 1 || atol(size) < 0 ||
+				    rf_bench_run(argv[optind], proto, atoi(count), atol(size), duration) != OKAY)
+					status = 1;
+			}
+			free(list3);
+		}
+		free(list2);
+	}
+	free(list1);
+
+	if (out != stdout)
+		fclose(out);
+
+	return(status);
+}
@@ -0,0 +1,114 @@
+/* rfbusy.c */
+
+/* This file implements the table of reply statuses (see rfbusy.h).
+// The accessors are made by two macros, one per reply type: RF_BUSY_FIRST
+// for a reply that starts with its status, RF_BUSY_LIST for a list of
+// results that each start with one. Both assert that the status comes first.
+*/
+
+#include <stddef.h>
+#include <rpc/rpc.h>
+
+#include "rf.h"
+#include "rfbusy.h"
+
+#define RF_BUSY_FIRST(T, field) \
+	_Static_assert(offsetof(T, field) == 0, #T " must start with its status"); \
+	static long rf_busy_get_##T(void *res) { return(((T *)res)->field); } \
+	static void rf_busy_set_##T(void *res, long status) { ((T *)res)->field = status; }
+
+#define RF_BUSY_LIST(T, items, E, field) \
+	_Static_assert(offsetof(E, field) == 0, #E " must start with its status"); \
+	static long rf_busy_get_##T(void *res) \
+	{ \
+		T *r = res; \
+		return(r->items.items##_len > 0 ? r->items.items##_val[0].field : 0); \
+	} \
+	static void rf_busy_set_##T(void *res, long status) \
+	{ \
+		T *r = res; \
+		for (u_int i = 0; i < r->items.items##_len; i++) \
+			r->items.items##_val[i].field = status; \
+	}
+
+RF_BUSY_FIRST(RF_OpenFile2Reply_T, openStatus)
+RF_BUSY_FIRST(RF_ReadFile2Reply_T, readStatus)
+RF_BUSY_FIRST(RF_CloseFileReply_T, closeStatus)
+RF_BUSY_FIRST(RF_WriteFile2Reply_T, writeStatus)
+RF_BUSY_FIRST(RF_PReadReply_T, readStatus)
+RF_BUSY_FIRST(RF_PWriteReply_T, writeStatus)
+RF_BUSY_FIRST(RF_FetchReply_T, fetchStatus)
+RF_BUSY_FIRST(RF_StoreReply_T, storeStatus)
+RF_BUSY_FIRST(RF_SumReadReply_T, read.readStatus)
+RF_BUSY_FIRST(RF_DigestReply_T, digestStatus)
+RF_BUSY_FIRST(RF_DeltaReply_T, deltaStatus)
+RF_BUSY_FIRST(RF_ZReadReply_T, sum.read.readStatus)
+RF_BUSY_FIRST(RF_CloseSyncReply_T, closeStatus)
+RF_BUSY_FIRST(RF_ReadDirReply_T, readdirStatus)
+RF_BUSY_LIST(RF_FetchManyReply_T, files, RF_FetchReply_T, fetchStatus)
+RF_BUSY_LIST(RF_StatManyReply_T, results, RF_StatResult_T, statStatus)
+RF_BUSY_LIST(RF_GetAttrReply_T, results, RF_GetAttrResult_T, getattrStatus)
+
+#define RF_BUSY_REPLY(T, list) { (xdrproc_t)xdr_##T, sizeof(T), list, rf_busy_get_##T, rf_busy_set_##T }
+
+/* By procedure number. The null procedure and rf_stats are never turned away. */
+static const RF_BusyReply_T replies[] = {
+	[rf_openfile]    = RF_BUSY_REPLY(RF_OpenFile2Reply_T, 0),
+	[rf_readfile]    = RF_BUSY_REPLY(RF_ReadFile2Reply_T, 0),
+	[rf_closefile]   = RF_BUSY_REPLY(RF_CloseFileReply_T, 0),
+	[rf_writefile]   = RF_BUSY_REPLY(RF_WriteFile2Reply_T, 0),
+	[rf_preadfile]   = RF_BUSY_REPLY(RF_PReadReply_T, 0),
+	[rf_pwritefile]  = RF_BUSY_REPLY(RF_PWriteReply_T, 0),
+	[rf_fetchfile]   = RF_BUSY_REPLY(RF_FetchReply_T, 0),
+	[rf_storefile]   = RF_BUSY_REPLY(RF_StoreReply_T, 0),
+	[rf_fetchmany]   = RF_BUSY_REPLY(RF_FetchManyReply_T, 1),
+	[rf_readpath]    = RF_BUSY_REPLY(RF_PReadReply_T, 0),
+	[rf_writepath]   = RF_BUSY_REPLY(RF_PWriteReply_T, 0),
+	[rf_readsum]     = RF_BUSY_REPLY(RF_SumReadReply_T, 0),
+	[rf_writesum]    = RF_BUSY_REPLY(RF_PWriteReply_T, 0),
+	[rf_digest]      = RF_BUSY_REPLY(RF_DigestReply_T, 0),
+	[rf_delta]       = RF_BUSY_REPLY(RF_DeltaReply_T, 0),
+	[rf_readz]       = RF_BUSY_REPLY(RF_ZReadReply_T, 0),
+	[rf_writez]      = RF_BUSY_REPLY(RF_PWriteReply_T, 0),
+	[rf_closesync]   = RF_BUSY_REPLY(RF_CloseSyncReply_T, 0),
+	[rf_readdirplus] = RF_BUSY_REPLY(RF_ReadDirReply_T, 0),
+	[rf_statmany]    = RF_BUSY_REPLY(RF_StatManyReply_T, 1),
+	[rf_getattr]     = RF_BUSY_REPLY(RF_GetAttrReply_T, 1)
+};
+
+
+// *****************************************************
+//
+// rf_busy_reply
+//     Tells where the status of a version 2 procedure's reply is.
+// input parameters: proc - The procedure number.
+// return value: The reply's entry, or NULL for a procedure that is never
+//               turned away or does not exist.
+//
+// *****************************************************
+const RF_BusyReply_T *rf_busy_reply(u_long proc)
+{
+	if (proc >= sizeof(replies) / sizeof(replies[0]) || replies[proc].xdrRes == NULL)
+		return(NULL);
+
+	return(&replies[proc]);
+}
+
+// *****************************************************
+//
+// rf_busy_wait
+//     Tells whether a reply status says the call was turned away.
+// input parameters: status - The status, as decoded.
+// return value: Milliseconds the server asked the client to wait, 0 if the
+//               call was not turned away.
+//
+// *****************************************************
+long rf_busy_wait(long status)
+{
+	int s = (int)status;   /* a long travels as 32 bits, and is not always sign extended when decoded */
+
+	if (s > RF_BUSY)
+		return(0);
+
+	return(RF_BUSY - s < RF_BUSY_MAXWAIT ? RF_BUSY - s : RF_BUSY_MAXWAIT);
+}
@@ -0,0 +1,33 @@
+/* rfbusy.h */
+
+/* Where the status of each RFILE version 2 reply is.
+// A call the server turns away (RF_BUSY in rf.x) is answered with the reply
+// of its procedure, cleared but for the status: for the list replies, the
+// status of every result. The server sets it and the clients read it through
+// the same table, rf_busy_reply, so both agree on where it is.
+//
+// Every such status is also the first field of its reply, or of each result
+// after the length of the list, so a client can peek at it while the reply is
+// still encoded (see rfpipe.c). rfbusy.c checks that when it is compiled; a
+// reply type that breaks it must be left out of the table.
+*/
+
+#ifndef RFBUSY_H
+#define RFBUSY_H
+
+#include <stddef.h>
+#include <rpc/rpc.h>
+
+typedef struct RF_BusyReply_T
+{
+	xdrproc_t	xdrRes;		/* XDR routine of the reply */
+	size_t		size;		/* bytes of the reply */
+	int			list;		/* the reply is a list of results, each with a status */
+	long		(*get)(void *res);				/* the status, of the first result of a list; 0 for an empty list */
+	void		(*set)(void *res, long status);	/* sets the status, of every result of a list */
+} RF_BusyReply_T;
+
+const RF_BusyReply_T *rf_busy_reply(u_long proc);
+long rf_busy_wait(long status);
+
+#endif /* RFBUSY_H */
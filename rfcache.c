@@ -0,0 +1,532 @@
+/* rfcache.c */
+
+/* This file implements the server block cache (see rfcache.h).
+// Each shard owns a fixed array of entries, which is also its CLOCK ring, and
+// a hash table over them. A miss reads the whole block into a per-thread
+// buffer without holding any lock, copies out what the caller asked for,
+// and then stores the block in the entry the CLOCK hand picks. A write may
+// land between that read and the store, too late for it to drop anything; so
+// each shard counts the writes that touch it, and a block is only stored if
+// the count did not move while it was read.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "rfhandle.h"
+#include "rfcache.h"
+
+#define OKAY 0
+#define FAILED -1
+
+#define RF_CACHE_SHARDS 16        /* independent locks */
+#define RF_CACHE_QUEUE 256        /* read-ahead requests waiting at most */
+
+typedef struct RF_CacheEntry_T
+{
+	dev_t			dev;
+	ino_t			ino;
+	long long		block;		/* offset / RF_CACHE_BLOCK */
+	off_t			size;		/* file size when the block was read */
+	struct timespec	mtime;		/* file modification time when the block was read */
+	int				len;		/* valid bytes, less than a block only at end of file */
+	int				used;		/* the entry holds a block */
+	int				ref;		/* CLOCK reference bit */
+	int				trigger;	/* a hit here starts the next read-ahead window */
+	char			*data;
+	struct RF_CacheEntry_T *hashNext;
+} RF_CacheEntry_T;
+
+typedef struct RF_CacheShard_T
+{
+	pthread_mutex_t	lock;
+	RF_CacheEntry_T	*entries;	/* the CLOCK ring */
+	int				numEntries;
+	int				hand;
+	RF_CacheEntry_T	**hash;
+	int				hashSize;
+	long long		hits;
+	long long		misses;
+	unsigned long long	invalidations;	/* bumped by every write that touches the shard */
+} RF_CacheShard_T;
+
+typedef struct RF_CacheAhead_T
+{
+	long		handle;
+	dev_t		dev;
+	ino_t		ino;
+	long long	block;		/* first block of the window */
+} RF_CacheAhead_T;
+
+static RF_CacheShard_T *shards = NULL;   /* NULL while the cache is off */
+static __thread char *blockBuf;          /* a miss reads its block here */
+
+static RF_CacheAhead_T aheadQueue[RF_CACHE_QUEUE];
+static int aheadHead, aheadCount;
+static pthread_mutex_t aheadLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t aheadReady = PTHREAD_COND_INITIALIZER;
+
+
+// *****************************************************
+//
+// rf_cache_hash
+//     Hashes a block key.
+// input parameters: dev, ino, block - The key.
+// return value: The hash; the low bits pick the shard.
+//
+// *****************************************************
+static unsigned long rf_cache_hash(dev_t dev, ino_t ino, long long block)
+{
+	unsigned long long h = (unsigned long long)ino * 0x9E3779B97F4A7C15ULL;
+
+	h ^= (unsigned long long)dev + 0x632BE59BD9B4E019ULL + (h << 6) + (h >> 2);
+	h ^= (unsigned long long)block * 0xC2B2AE3D27D4EB4FULL;
+	h ^= h >> 29;
+
+	return((unsigned long)h);
+}
+
+// *****************************************************
+//
+// rf_cache_lookup
+//     Finds a block in its shard. Called with the shard locked.
+// input parameters: shard          - The shard of the key.
+//                   h              - rf_cache_hash of the key.
+//                   dev, ino, block - The key.
+// return value: The entry, or NULL.
+//
+// *****************************************************
+static RF_CacheEntry_T *rf_cache_lookup(RF_CacheShard_T *shard, unsigned long h, dev_t dev, ino_t ino, long long block)
+{
+	RF_CacheEntry_T *e;
+
+	for (e = shard->hash[(h / RF_CACHE_SHARDS) % shard->hashSize]; e != NULL; e = e->hashNext)
+		if (e->block == block && e->ino == ino && e->dev == dev)
+			return(e);
+
+	return(NULL);
+}
+
+// *****************************************************
+//
+// rf_cache_unlink
+//     Removes an entry from its shard's hash table. Called with the shard locked.
+// input parameters: shard - The shard.
+//                   e     - An entry in use.
+//
+// *****************************************************
+static void rf_cache_unlink(RF_CacheShard_T *shard, RF_CacheEntry_T *e)
+{
+	unsigned long h = rf_cache_hash(e->dev, e->ino, e->block);
+	RF_CacheEntry_T **pp = &shard->hash[(h / RF_CACHE_SHARDS) % shard->hashSize];
+
+	while (*pp != e)
+		pp = &(*pp)->hashNext;
+	*pp = e->hashNext;
+	e->used = 0;
+}
+
+// *****************************************************
+//
+// rf_cache_valid
+//     Tells whether a cached block still matches the file.
+// input parameters: e  - The entry.
+//                   st - Current attributes of the file.
+// return value: Non zero if the block can be used.
+//
+// *****************************************************
+static int rf_cache_valid(RF_CacheEntry_T *e, struct stat *st)
+{
+	return(e->size == st->st_size && e->mtime.tv_sec == st->st_mtim.tv_sec &&
+	       e->mtime.tv_nsec == st->st_mtim.tv_nsec);
+}
+
+// *****************************************************
+//
+// rf_cache_insert
+//     Stores a block that was just read, replacing whatever the CLOCK hand
+//     picks. A block that another thread stored meanwhile is refreshed instead.
+// input parameters: st    - Attributes of the file, taken before the read.
+//                   block - Block number.
+//                   data  - The block's bytes.
+//                   len   - Number of bytes.
+//                   stamp - The shard's invalidation count, taken before the read.
+// return value: The entry, locked in its shard; the caller unlocks the shard.
+//               NULL if a write touched the shard since stamp was taken, or
+//               if no memory was available.
+//
+// *****************************************************
+static RF_CacheEntry_T *rf_cache_insert(struct stat *st, long long block, char *data, int len, unsigned long long stamp)
+{
+	unsigned long h = rf_cache_hash(st->st_dev, st->st_ino, block);
+	RF_CacheShard_T *shard = &shards[h % RF_CACHE_SHARDS];
+	RF_CacheEntry_T *e, **bucket;
+
+	pthread_mutex_lock(&shard->lock);
+	if (shard->invalidations != stamp) {
+		pthread_mutex_unlock(&shard->lock);
+		return(NULL);
+	}
+	if ((e = rf_cache_lookup(shard, h, st->st_dev, st->st_ino, block)) == NULL) {
+		/* Advance the hand, clearing reference bits, to an entry not used lately. */
+		for (;;) {
+			e = &shard->entries[shard->hand];
+			shard->hand = (shard->hand + 1) % shard->numEntries;
+			if (!e->used)
+				break;
+			if (!e->ref) {
+				rf_cache_unlink(shard, e);
+				break;
+			}
+			e->ref = 0;
+		}
+		if (e->data == NULL && (e->data = malloc(RF_CACHE_BLOCK)) == NULL) {
+			pthread_mutex_unlock(&shard->lock);
+			return(NULL);
+		}
+		e->dev = st->st_dev;
+		e->ino = st->st_ino;
+		e->block = block;
+		e->used = 1;
+		bucket = &shard->hash[(h / RF_CACHE_SHARDS) % shard->hashSize];
+		e->hashNext = *bucket;
+		*bucket = e;
+	}
+
+	memcpy(e->data, data, len);
+	e->len = len;
+	e->size = st->st_size;
+	e->mtime = st->st_mtim;
+	e->ref = 1;
+	e->trigger = 0;
+
+	return(e);
+}
+
+// *****************************************************
+//
+// rf_cache_cached
+//     Tells whether a valid copy of a block is in the cache.
+// input parameters: st    - Current attributes of the file.
+//                   block - Block number.
+//                   stamp - Set to the invalidation count of the block's
+//                           shard, for rf_cache_insert; may be NULL.
+// return value: Non zero if it is.
+//
+// *****************************************************
+static int rf_cache_cached(struct stat *st, long long block, unsigned long long *stamp)
+{
+	unsigned long h = rf_cache_hash(st->st_dev, st->st_ino, block);
+	RF_CacheShard_T *shard = &shards[h % RF_CACHE_SHARDS];
+	RF_CacheEntry_T *e;
+	int found;
+
+	pthread_mutex_lock(&shard->lock);
+	e = rf_cache_lookup(shard, h, st->st_dev, st->st_ino, block);
+	found = (e != NULL && rf_cache_valid(e, st));
+	if (stamp != NULL)
+		*stamp = shard->invalidations;
+	pthread_mutex_unlock(&shard->lock);
+
+	return(found);
+}
+
+// *****************************************************
+//
+// rf_cache_ahead
+//     Queues a read-ahead window. Dropped if the queue is full.
+// input parameters: handle - Handle the reader uses for the file.
+//                   st     - Attributes of the file.
+//                   block  - First block of the window.
+//
+// *****************************************************
+static void rf_cache_ahead(long handle, struct stat *st, long long block)
+{
+	RF_CacheAhead_T *a;
+
+	if (handle < 0 || block * RF_CACHE_BLOCK >= st->st_size)
+		return;
+
+	pthread_mutex_lock(&aheadLock);
+	if (aheadCount < RF_CACHE_QUEUE) {
+		a = &aheadQueue[(aheadHead + aheadCount++) % RF_CACHE_QUEUE];
+		a->handle = handle;
+		a->dev = st->st_dev;
+		a->ino = st->st_ino;
+		a->block = block;
+		pthread_cond_signal(&aheadReady);
+	}
+	pthread_mutex_unlock(&aheadLock);
+}
+
+// *****************************************************
+//
+// rf_cache_reader
+//     Read-ahead thread body. Reads the missing blocks of each queued window.
+// input parameters: arg - Unused.
+// return value: Never returns.
+//
+// *****************************************************
+static void *rf_cache_reader(void *arg)
+{
+	RF_CacheAhead_T a;
+	RF_CacheEntry_T *e;
+	struct stat st;
+	unsigned long long stamp;
+	ssize_t n;
+	int fd;
+
+	blockBuf = malloc(RF_CACHE_BLOCK);
+
+	for (;;) {
+		pthread_mutex_lock(&aheadLock);
+		while (aheadCount == 0)
+			pthread_cond_wait(&aheadReady, &aheadLock);
+		a = aheadQueue[aheadHead];
+		aheadHead = (aheadHead + 1) % RF_CACHE_QUEUE;
+		aheadCount--;
+		pthread_mutex_unlock(&aheadLock);
+
+		/* The handle keeps the file open while it is read, or tells that it was closed. */
+		if (blockBuf == NULL || (fd = rf_handle_get(a.handle)) < 0)
+			continue;
+		if (fstat(fd, &st) == 0 && st.st_dev == a.dev && st.st_ino == a.ino) {
+			for (long long b = a.block; b < a.block + RF_CACHE_AHEAD && b * RF_CACHE_BLOCK < st.st_size; b++) {
+				if (rf_cache_cached(&st, b, &stamp))
+					continue;
+				if ((n = pread(fd, blockBuf, RF_CACHE_BLOCK, b * RF_CACHE_BLOCK)) <= 0)
+					break;
+				/* A file being written is left alone. */
+				if ((e = rf_cache_insert(&st, b, blockBuf, n, stamp)) == NULL)
+					break;
+				e->ref = 0;   /* not used yet; the first hit sets it */
+				e->trigger = (b == a.block + RF_CACHE_AHEAD / 2);
+				pthread_mutex_unlock(&shards[rf_cache_hash(st.st_dev, st.st_ino, b) % RF_CACHE_SHARDS].lock);
+			}
+		}
+		rf_handle_put(a.handle);
+	}
+
+	return(NULL);
+}
+
+// *****************************************************
+//
+// rf_cache_init
+//     Allocates the cache and starts the read-ahead thread.
+// input parameters: bytes - Memory for cached blocks; 0 or less turns the cache off.
+// return value: OKAY, or FAILED if it could not be set up (the cache is then off).
+//
+// *****************************************************
+int rf_cache_init(long long bytes)
+{
+	long long blocks = bytes / RF_CACHE_BLOCK;
+	RF_CacheShard_T *table;
+	pthread_t thread;
+
+	if (blocks <= 0)
+		return(OKAY);
+	if (blocks < RF_CACHE_SHARDS)
+		blocks = RF_CACHE_SHARDS;
+
+	if ((table = calloc(RF_CACHE_SHARDS, sizeof(RF_CacheShard_T))) == NULL)
+		return(FAILED);
+	for (int i = 0; i < RF_CACHE_SHARDS; i++) {
+		RF_CacheShard_T *shard = &table[i];
+
+		pthread_mutex_init(&shard->lock, NULL);
+		shard->numEntries = blocks / RF_CACHE_SHARDS;
+		shard->hashSize = shard->numEntries * 2 + 1;
+		shard->entries = calloc(shard->numEntries, sizeof(RF_CacheEntry_T));
+		shard->hash = calloc(shard->hashSize, sizeof(RF_CacheEntry_T *));
+		if (shard->entries == NULL || shard->hash == NULL)
+			return(FAILED);
+	}
+
+	if (pthread_create(&thread, NULL, rf_cache_reader, NULL) != 0)
+		return(FAILED);
+	pthread_detach(thread);
+	shards = table;
+
+	return(OKAY);
+}
+
+// *****************************************************
+//
+// rf_cache_pread
+//     Reads from a file at an offset, through the cache. Behaves like pread.
+// input parameters: handle - The client's handle of the file, for read-ahead;
+//                            FAILED for a file without one, which is not read ahead.
+//                   fd     - The file, from rf_handle_get(handle).
+//                   buf    - Where to put the bytes.
+//                   count  - Bytes to read.
+//                   offset - File offset.
+// return value: Bytes read, fewer than count only at end of file; -1 on error.
+//
+// *****************************************************
+ssize_t rf_cache_pread(long handle, int fd, char *buf, size_t count, off_t offset)
+{
+	struct stat st;
+	RF_CacheShard_T *shard;
+	RF_CacheEntry_T *e;
+	unsigned long h;
+	unsigned long long stamp;
+	long long block, end;
+	size_t done = 0;
+	ssize_t n;
+	int skip, len, trigger, sequential;
+
+	if (shards == NULL || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+		return(pread(fd, buf, count, offset));
+	if (offset >= st.st_size || count == 0)
+		return(0);
+
+	end = (offset + (long long)count < st.st_size) ? offset + (long long)count : st.st_size;
+	while (offset + (off_t)done < end) {
+		block = (offset + done) / RF_CACHE_BLOCK;
+		skip = (offset + done) % RF_CACHE_BLOCK;
+		h = rf_cache_hash(st.st_dev, st.st_ino, block);
+		shard = &shards[h % RF_CACHE_SHARDS];
+
+		pthread_mutex_lock(&shard->lock);
+		e = rf_cache_lookup(shard, h, st.st_dev, st.st_ino, block);
+		if (e != NULL && rf_cache_valid(e, &st)) {
+			shard->hits++;
+			e->ref = 1;
+			trigger = e->trigger;
+			e->trigger = 0;
+			len = (e->len - skip < end - offset - (long long)done) ? e->len - skip : end - offset - done;
+			if (len > 0)
+				memcpy(buf + done, e->data + skip, len);
+			pthread_mutex_unlock(&shard->lock);
+			if (trigger)
+				rf_cache_ahead(handle, &st, block + 1);
+		} else {
+			shard->misses++;
+			stamp = shard->invalidations;
+			pthread_mutex_unlock(&shard->lock);
+
+			if (blockBuf == NULL && (blockBuf = malloc(RF_CACHE_BLOCK)) == NULL)
+				return(done > 0 ? (ssize_t)done : pread(fd, buf, count, offset));
+			if ((n = pread(fd, blockBuf, RF_CACHE_BLOCK, block * RF_CACHE_BLOCK)) < 0)
+				return(done > 0 ? (ssize_t)done : -1);
+			len = (n - skip < end - offset - (long long)done) ? n - skip : end - offset - done;
+			if (len > 0)
+				memcpy(buf + done, blockBuf + skip, len);
+
+			sequential = (block == 0 || rf_cache_cached(&st, block - 1, NULL));
+			if ((e = rf_cache_insert(&st, block, blockBuf, n, stamp)) != NULL)
+				pthread_mutex_unlock(&shards[h % RF_CACHE_SHARDS].lock);
+			if (sequential)
+				rf_cache_ahead(handle, &st, block + 1);
+		}
+
+		/* The file shrank after fstat. */
+		if (len <= 0)
+			break;
+		done += len;
+	}
+
+	return(done);
+}
+
+// *****************************************************
+//
+// rf_cache_read
+//     Reads from a file at its current position, through the cache, and
+//     moves the position past the bytes read. Behaves like read.
+// input parameters: handle - The client's handle of the file, for read-ahead.
+//                   fd     - The file, from rf_handle_get(handle).
+//                   buf    - Where to put the bytes.
+//                   count  - Bytes to read.
+// return value: Bytes read, 0 at end of file, -1 on error.
+//
+// *****************************************************
+ssize_t rf_cache_read(long handle, int fd, char *buf, size_t count)
+{
+	off_t pos;
+	ssize_t n;
+
+	if (shards == NULL || (pos = lseek(fd, 0, SEEK_CUR)) < 0)
+		return(read(fd, buf, count));
+
+	if ((n = rf_cache_pread(handle, fd, buf, count, pos)) > 0)
+		lseek(fd, pos + n, SEEK_SET);
+
+	return(n);
+}
+
+// *****************************************************
+//
+// rf_cache_invalidate
+//     Drops the cached blocks a write touched.
+// input parameters: fd     - The file written.
+//                   offset - Where the write started.
+//                   len    - Bytes written.
+//
+// *****************************************************
+void rf_cache_invalidate(int fd, off_t offset, size_t len)
+{
+	struct stat st;
+	RF_CacheShard_T *shard;
+	RF_CacheEntry_T *e;
+	unsigned long h;
+
+	if (shards == NULL || len == 0 || fstat(fd, &st) != 0)
+		return;
+
+	for (long long b = offset / RF_CACHE_BLOCK; b <= (offset + (long long)len - 1) / RF_CACHE_BLOCK; b++) {
+		h = rf_cache_hash(st.st_dev, st.st_ino, b);
+		shard = &shards[h % RF_CACHE_SHARDS];
+		pthread_mutex_lock(&shard->lock);
+		shard->invalidations++;
+		if ((e = rf_cache_lookup(shard, h, st.st_dev, st.st_ino, b)) != NULL)
+			rf_cache_unlink(shard, e);
+		pthread_mutex_unlock(&shard->lock);
+	}
+}
+
+// *****************************************************
+//
+// rf_cache_wrote
+//     Drops the cached blocks a write at the file position touched. Call it
+//     right after the write, while the position is just past the bytes written.
+// input parameters: fd  - The file written.
+//                   len - Bytes written.
+//
+// *****************************************************
+void rf_cache_wrote(int fd, size_t len)
+{
+	off_t pos;
+
+	if (shards == NULL || len == 0 || (pos = lseek(fd, 0, SEEK_CUR)) < 0)
+		return;
+
+	rf_cache_invalidate(fd, pos - len, len);
+}
+
+// *****************************************************
+//
+// rf_cache_counts
+//     Reports how often reads found their blocks in the cache.
+// input parameters: hits   - Set to the blocks found.
+//                   misses - Set to the blocks read from the file.
+//
+// *****************************************************
+void rf_cache_counts(long long *hits, long long *misses)
+{
+	*hits = *misses = 0;
+	if (shards == NULL)
+		return;
+
+	for (int i = 0; i < RF_CACHE_SHARDS; i++) {
+		pthread_mutex_lock(&shards[i].lock);
+		*hits += shards[i].hits;
+		*misses += shards[i].misses;
+		pthread_mutex_unlock(&shards[i].lock);
+	}
+}
@@ -0,0 +1,39 @@
+/* rfcache.h */
+
+/* Server block cache.
+// Holds recently read file blocks of RF_CACHE_BLOCK bytes in memory, keyed by
+// (device, inode, block number), so clients reading the same files share one
+// copy. The cache is split into shards with a lock each; within a shard,
+// blocks are evicted in CLOCK order.
+//
+// A block is only used while the file's size and modification time still
+// match those seen when it was read, and the server's own writes drop the
+// blocks they touch, or keep a block read while they land from being stored,
+// so readers never see stale data.
+//
+// A miss on the first block of a file, or right after a block that is cached,
+// looks like a sequential reader: a background thread then reads the next
+// RF_CACHE_AHEAD blocks. Reaching the middle of that window starts the next one.
+//
+// The read-ahead thread works on handles (see rfhandle.h), so a file closed
+// meanwhile is simply skipped. Files read without a handle are cached but
+// not read ahead.
+*/
+
+#ifndef RFCACHE_H
+#define RFCACHE_H
+
+#include <sys/types.h>
+
+#define RF_CACHE_BLOCK (64 * 1024)           /* bytes per cached block */
+#define RF_CACHE_AHEAD 8                     /* blocks per read-ahead window */
+#define RF_CACHE_DEFAULT_MB 64               /* cache size when the caller has no preference */
+
+int     rf_cache_init(long long bytes);
+ssize_t rf_cache_pread(long handle, int fd, char *buf, size_t count, off_t offset);
+ssize_t rf_cache_read(long handle, int fd, char *buf, size_t count);
+void    rf_cache_invalidate(int fd, off_t offset, size_t len);
+void    rf_cache_wrote(int fd, size_t len);
+void    rf_cache_counts(long long *hits, long long *misses);
+
+#endif /* RFCACHE_H */
@@ -0,0 +1,633 @@
+/* rfccache.c */
+
+/* This file implements the client cache of remote files (see rfccache.h).
+// The cache directory holds:
+//       index/HASH        one per server and remote path, HASH being an FNV-1a
+//                         hash of both: a RF_CCacheHeader_T, its blocks, then
+//                         the server and path names it is for;
+//       blocks/XX/CRC-LEN-SEQ
+//                         a block of LEN bytes with that CRC32C, XX the top
+//                         byte of it; SEQ tells apart blocks that differ but
+//                         share both.
+// New files are made under a name starting with "tmp" and linked or renamed
+// into place once written. The modification time of an index is the last
+// time its copy was used, for rf_ccache_trim.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <rpc/rpc.h>
+
+#include "rf.h"
+#include "rfccache.h"
+#include "rfcrc.h"
+
+#define OKAY 0
+#define FAILED -1
+
+#define RF_CCACHE_MAGIC  0x52464331   /* "RFC1" */
+#define RF_CCACHE_MAXSEQ 16           /* different blocks kept under one CRC and length */
+#define RF_CCACHE_YOUNG  60           /* seconds a file is left alone by a trim after it was made */
+
+typedef struct RF_CCacheHeader_T
+{
+	u_int32_t			magic;
+	u_int32_t			numBlocks;
+	long long			size;		/* the attributes the copy was taken with, see RF_GetAttrResult_T */
+	long long			mtime;
+	long long			change;
+	unsigned long long	inode;
+	u_int32_t			serverLen;
+	u_int32_t			remoteLen;
+} RF_CCacheHeader_T;
+
+typedef struct RF_CCacheBlock_T
+{
+	u_int32_t	crc;
+	u_int32_t	length;
+	u_int32_t	seq;
+} RF_CCacheBlock_T;
+
+typedef struct RF_CCacheCopy_T
+{
+	char		name[32];	/* of the index */
+	time_t		used;
+	long long	size;
+} RF_CCacheCopy_T;
+
+static char cacheDir[PATH_MAX - 64];
+static long long cacheMax = 0;
+static int cacheOn = 0;
+static int cacheStored = 0;   /* copies stored since rf_ccache_init */
+static pthread_mutex_t cacheLock = PTHREAD_MUTEX_INITIALIZER;
+
+
+// *****************************************************
+//
+// rf_ccache_index_path
+//     Works out the index file of a remote file.
+// input parameters: server - Server as given to rf_connect.
+//                   remote - Path of the file on the server.
+//                   path   - Set to the index file, PATH_MAX bytes.
+//
+// *****************************************************
+static void rf_ccache_index_path(char *server, char *remote, char *path)
+{
+	unsigned long long h = 14695981039346656037ULL;
+
+	for (char *s = server; *s != '\0'; s++)
+		h = (h ^ (unsigned char)*s) * 1099511628211ULL;
+	h *= 1099511628211ULL;
+	for (char *s = remote; *s != '\0'; s++)
+		h = (h ^ (unsigned char)*s) * 1099511628211ULL;
+
+	snprintf(path, PATH_MAX, "%s/index/%016llx", cacheDir, h);
+}
+
+// *****************************************************
+//
+// rf_ccache_block_path
+//     Works out the file of a block.
+// input parameters: block - The block.
+//                   path  - Set to its file, PATH_MAX bytes.
+//
+// *****************************************************
+static void rf_ccache_block_path(RF_CCacheBlock_T *block, char *path)
+{
+	snprintf(path, PATH_MAX, "%s/blocks/%02x/%08x-%x-%u", cacheDir, block->crc >> 24,
+	         block->crc, block->length, block->seq);
+}
+
+// *****************************************************
+//
+// rf_ccache_write_all
+//     Writes a whole buffer to a file.
+// input parameters: fd  - The file.
+//                   buf - The bytes.
+//                   len - Number of bytes.
+// return value: OKAY, or FAILED if a write failed.
+//
+// *****************************************************
+static int rf_ccache_write_all(int fd, const char *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		if ((n = write(fd, buf, len)) < 0) {
+			if (errno == EINTR)
+				continue;
+			return(FAILED);
+		}
+		buf += n;
+		len -= n;
+	}
+
+	return(OKAY);
+}
+
+// *****************************************************
+//
+// rf_ccache_map
+//     Maps a block file into memory.
+// input parameters: path   - The block file.
+//                   length - Bytes it must hold.
+// return value: The mapping, of length bytes, or NULL if the file is missing
+//               or of another length.
+//
+// *****************************************************
+static char *rf_ccache_map(char *path, u_int32_t length)
+{
+	struct stat st;
+	char *map;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+		return(NULL);
+	if (fstat(fd, &st) != 0 || st.st_size != length ||
+	    (map = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+		map = NULL;
+	close(fd);
+
+	return(map);
+}
+
+// *****************************************************
+//
+// rf_ccache_load
+//     Reads and checks an index file.
+// input parameters: path - The index file.
+// return value: Its contents, malloc'ed, starting with its RF_CCacheHeader_T,
+//               or NULL if it is missing or damaged.
+//
+// *****************************************************
+static char *rf_ccache_load(char *path)
+{
+	RF_CCacheHeader_T *hdr;
+	struct stat st;
+	char *buf = NULL;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+		return(NULL);
+	if (fstat(fd, &st) == 0 && st.st_size >= sizeof(RF_CCacheHeader_T) && st.st_size <= 64 * 1024 * 1024 &&
+	    (buf = malloc(st.st_size)) != NULL && read(fd, buf, st.st_size) == st.st_size) {
+		hdr = (RF_CCacheHeader_T *)buf;
+		if (hdr->magic != RF_CCACHE_MAGIC || hdr->size < 0 ||
+		    hdr->numBlocks != (hdr->size + RF_CCACHE_BLOCK - 1) / RF_CCACHE_BLOCK ||
+		    st.st_size != sizeof(RF_CCacheHeader_T) + (long long)hdr->numBlocks * sizeof(RF_CCacheBlock_T) +
+		                  hdr->serverLen + hdr->remoteLen) {
+			free(buf);
+			buf = NULL;
+		}
+	} else {
+		free(buf);
+		buf = NULL;
+	}
+	close(fd);
+
+	return(buf);
+}
+
+// *****************************************************
+//
+// rf_ccache_put_block
+//     Finds or makes the file of a block.
+// input parameters: data  - The bytes of the block.
+//                   block - Its crc and length set; seq is set here.
+// return value: OKAY, or FAILED if it could not be stored.
+//
+// *****************************************************
+static int rf_ccache_put_block(const char *data, RF_CCacheBlock_T *block)
+{
+	char path[PATH_MAX], temp[PATH_MAX];
+	char *map;
+	int fd, tries = 0;
+
+	snprintf(temp, sizeof(temp), "%s/blocks/%02x", cacheDir, block->crc >> 24);
+	mkdir(temp, 0777);
+	strcat(temp, "/tmpXXXXXX");
+
+	for (block->seq = 0; block->seq < RF_CCACHE_MAXSEQ; block->seq++) {
+		rf_ccache_block_path(block, path);
+		if ((map = rf_ccache_map(path, block->length)) != NULL) {
+			if (memcmp(map, data, block->length) == 0) {
+				/* Kept already; a trim running now must not take it for an unused one. */
+				munmap(map, block->length);
+				utimensat(AT_FDCWD, path, NULL, 0);
+				return(OKAY);
+			}
+			munmap(map, block->length);
+			continue;
+		}
+		if (access(path, F_OK) == 0)
+			continue;   /* of another length: damaged */
+
+		strcpy(temp + strlen(temp) - 6, "XXXXXX");
+		if ((fd = mkstemp(temp)) < 0)
+			return(FAILED);
+		if (rf_ccache_write_all(fd, data, block->length) != OKAY || close(fd) != 0) {
+			unlink(temp);
+			return(FAILED);
+		}
+		if (link(temp, path) == 0) {
+			unlink(temp);
+			return(OKAY);
+		}
+		unlink(temp);
+		/* Another client stored a block under this name meanwhile: look at it again. */
+		if (errno != EEXIST || ++tries > 2)
+			return(FAILED);
+		block->seq--;
+	}
+
+	return(FAILED);
+}
+
+// *****************************************************
+//
+// rf_ccache_init
+//     Opens the cache, making its directory if need be. Until it is called,
+//     the cache holds nothing.
+// input parameters: dir      - The cache directory.
+//                   maxBytes - Size rf_ccache_trim keeps the cache under.
+// return value: OKAY, or FAILED if the directory could not be made.
+//
+// *****************************************************
+int rf_ccache_init(char *dir, long long maxBytes)
+{
+	char path[PATH_MAX];
+
+	if (snprintf(cacheDir, sizeof(cacheDir), "%s", dir) >= sizeof(cacheDir))
+		return(FAILED);
+	mkdir(cacheDir, 0777);
+	snprintf(path, sizeof(path), "%s/index", cacheDir);
+	mkdir(path, 0777);
+	snprintf(path, sizeof(path), "%s/blocks", cacheDir);
+	mkdir(path, 0777);
+
+	snprintf(path, sizeof(path), "%s/index", cacheDir);
+	if (access(path, W_OK | X_OK) != 0)
+		return(FAILED);
+	snprintf(path, sizeof(path), "%s/blocks", cacheDir);
+	if (access(path, W_OK | X_OK) != 0)
+		return(FAILED);
+
+	cacheMax = maxBytes;
+	cacheOn = 1;
+
+	return(OKAY);
+}
+
+// *****************************************************
+//
+// rf_ccache_enabled
+//     Tells whether rf_ccache_init opened a cache.
+// return value: Non zero if it did.
+//
+// *****************************************************
+int rf_ccache_enabled(void)
+{
+	return(cacheOn);
+}
+
+// *****************************************************
+//
+// rf_ccache_attrs
+//     Gets what tells whether copies of remote files are current, with one
+//     rf_getattr call.
+// input parameters: clnt     - CLIENT handle talking RFILE_VERS2.
+//                   num      - Number of files, at most RF_MAXSTAT.
+//                   remote   - Paths of the files on the server.
+//                   attrs    - Room for num results, set in the order of remote.
+//                   rpcError - Set to why the call failed, RPC_SUCCESS if it did
+//                              not; RPC_PROCUNAVAIL from a server without rf_getattr.
+// return value: OKAY, or FAILED if the call failed.
+//
+// *****************************************************
+int rf_ccache_attrs(CLIENT *clnt, int num, char **remote, RF_GetAttrResult_T *attrs, enum clnt_stat *rpcError)
+{
+	RF_GetAttrRequest_T req;
+	RF_GetAttrReply_T res;
+	int status = OKAY;
+
+	if (num > RF_MAXSTAT)
+		return(FAILED);
+
+	req.paths.paths_len = num;
+	req.paths.paths_val = remote;
+	memset(&res, 0, sizeof(res));
+	if ((*rpcError = rf_getattr_2(&req, &res, clnt)) != RPC_SUCCESS)
+		return(FAILED);
+	if (res.results.results_len == num)
+		memcpy(attrs, res.results.results_val, num * sizeof(RF_GetAttrResult_T));
+	else
+		status = FAILED;
+	xdr_free((xdrproc_t)xdr_RF_GetAttrReply_T, (char *)&res);
+
+	return(status);
+}
+
+// *****************************************************
+//
+// rf_ccache_fetch
+//     Copies a remote file out of the cache, if the cache holds a copy with
+//     the attributes the file has now.
+// input parameters: server - Server as given to rf_connect.
+//                   remote - Path of the file on the server.
+//                   attr   - What rf_ccache_attrs said of the file.
+//                   local  - Name of the local file, created or truncated.
+//                   bytes  - Set to the size of the file.
+// return value: OKAY if local holds the file, FAILED if the cache has no
+//               current copy or it could not be read; local may then have
+//               been written in part.
+//
+// *****************************************************
+int rf_ccache_fetch(char *server, char *remote, RF_GetAttrResult_T *attr, char *local, long long *bytes)
+{
+	RF_CCacheHeader_T *hdr;
+	RF_CCacheBlock_T *blocks;
+	char index[PATH_MAX], path[PATH_MAX];
+	char *buf, *names, *map;
+	int localFd, status = OKAY;
+
+	if (!cacheOn || attr->getattrStatus != OKAY)
+		return(FAILED);
+
+	rf_ccache_index_path(server, remote, index);
+	if ((buf = rf_ccache_load(index)) == NULL)
+		return(FAILED);
+	hdr = (RF_CCacheHeader_T *)buf;
+	blocks = (RF_CCacheBlock_T *)(buf + sizeof(RF_CCacheHeader_T));
+	names = (char *)(blocks + hdr->numBlocks);
+	if (hdr->size != attr->size || hdr->mtime != attr->mtime || hdr->change != attr->change ||
+	    hdr->inode != attr->inode || hdr->serverLen != strlen(server) || hdr->remoteLen != strlen(remote) ||
+	    memcmp(names, server, hdr->serverLen) != 0 || memcmp(names + hdr->serverLen, remote, hdr->remoteLen) != 0 ||
+	    (localFd = open(local, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0) {
+		free(buf);
+		return(FAILED);
+	}
+
+	for (u_int32_t i = 0; status == OKAY && i < hdr->numBlocks; i++) {
+		rf_ccache_block_path(&blocks[i], path);
+		if ((map = rf_ccache_map(path, blocks[i].length)) == NULL)
+			status = FAILED;
+		else if (rf_crc32c(0, map, blocks[i].length) != blocks[i].crc ||
+		         rf_ccache_write_all(localFd, map, blocks[i].length) != OKAY)
+			status = FAILED;
+		if (map != NULL)
+			munmap(map, blocks[i].length);
+	}
+	if (close(localFd) != 0)
+		status = FAILED;
+
+	if (status == OKAY) {
+		utimensat(AT_FDCWD, index, NULL, 0);
+		*bytes = hdr->size;
+	}
+	free(buf);
+
+	return(status);
+}
+
+// *****************************************************
+//
+// rf_ccache_store
+//     Keeps a copy of a remote file just fetched. Nothing is kept unless the
+//     server said the file was stable when attr was taken; the caller must
+//     also have made sure it did not change during the transfer.
+// input parameters: server - Server as given to rf_connect.
+//                   remote - Path of the file on the server.
+//                   attr   - What rf_ccache_attrs said of the file before it was fetched.
+//                   local  - Name of the local file holding it.
+// return value: OKAY if the copy was kept, FAILED otherwise.
+//
+// *****************************************************
+int rf_ccache_store(char *server, char *remote, RF_GetAttrResult_T *attr, char *local)
+{
+	RF_CCacheHeader_T hdr;
+	RF_CCacheBlock_T *blocks;
+	char index[PATH_MAX], temp[PATH_MAX];
+	struct stat st;
+	char *map = NULL;
+	int fd, status = OKAY;
+
+	if (!cacheOn || attr->getattrStatus != OKAY || !attr->stable)
+		return(FAILED);
+	if ((fd = open(local, O_RDONLY | O_CLOEXEC)) < 0)
+		return(FAILED);
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size != attr->size ||
+	    (st.st_size > 0 && (map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)) {
+		close(fd);
+		return(FAILED);
+	}
+	close(fd);
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = RF_CCACHE_MAGIC;
+	hdr.numBlocks = (st.st_size + RF_CCACHE_BLOCK - 1) / RF_CCACHE_BLOCK;
+	hdr.size = attr->size;
+	hdr.mtime = attr->mtime;
+	hdr.change = attr->change;
+	hdr.inode = attr->inode;
+	hdr.serverLen = strlen(server);
+	hdr.remoteLen = strlen(remote);
+	if ((blocks = malloc((hdr.numBlocks > 0 ? hdr.numBlocks : 1) * sizeof(RF_CCacheBlock_T))) == NULL)
+		status = FAILED;
+
+	for (u_int32_t i = 0; status == OKAY && i < hdr.numBlocks; i++) {
+		long long offset = (long long)i * RF_CCACHE_BLOCK;
+
+		blocks[i].length = (st.st_size - offset < RF_CCACHE_BLOCK) ? st.st_size - offset : RF_CCACHE_BLOCK;
+		blocks[i].crc = rf_crc32c(0, map + offset, blocks[i].length);
+		status = rf_ccache_put_block(map + offset, &blocks[i]);
+	}
+	if (map != NULL)
+		munmap(map, st.st_size);
+
+	/* The index goes in last, once every block it names is there. */
+	snprintf(temp, sizeof(temp), "%s/index/tmpXXXXXX", cacheDir);
+	if (status == OKAY && (fd = mkstemp(temp)) >= 0) {
+		if (rf_ccache_write_all(fd, (char *)&hdr, sizeof(hdr)) != OKAY ||
+		    rf_ccache_write_all(fd, (char *)blocks, hdr.numBlocks * sizeof(RF_CCacheBlock_T)) != OKAY ||
+		    rf_ccache_write_all(fd, server, hdr.serverLen) != OKAY ||
+		    rf_ccache_write_all(fd, remote, hdr.remoteLen) != OKAY)
+			status = FAILED;
+		if (close(fd) != 0)
+			status = FAILED;
+		rf_ccache_index_path(server, remote, index);
+		if (status != OKAY || rename(temp, index) != 0) {
+			unlink(temp);
+			status = FAILED;
+		}
+	} else {
+		status = FAILED;
+	}
+	free(blocks);
+
+	if (status == OKAY) {
+		pthread_mutex_lock(&cacheLock);
+		cacheStored++;
+		pthread_mutex_unlock(&cacheLock);
+	}
+
+	return(status);
+}
+
+// *****************************************************
+//
+// rf_ccache_compare_copies
+//     Orders copies for qsort, most recently used first.
+// input parameters: a, b - Pointers to the RF_CCacheCopy_T.
+// return value: As strcmp.
+//
+// *****************************************************
+static int rf_ccache_compare_copies(const void *a, const void *b)
+{
+	const RF_CCacheCopy_T *x = a, *y = b;
+
+	return((x->used < y->used) - (x->used > y->used));
+}
+
+// *****************************************************
+//
+// rf_ccache_compare_blocks
+//     Orders blocks for qsort and bsearch.
+// input parameters: a, b - Pointers to the RF_CCacheBlock_T.
+// return value: As strcmp.
+//
+// *****************************************************
+static int rf_ccache_compare_blocks(const void *a, const void *b)
+{
+	const RF_CCacheBlock_T *x = a, *y = b;
+
+	if (x->crc != y->crc)
+		return((x->crc > y->crc) - (x->crc < y->crc));
+	if (x->length != y->length)
+		return((x->length > y->length) - (x->length < y->length));
+
+	return((x->seq > y->seq) - (x->seq < y->seq));
+}
+
+// *****************************************************
+//
+// rf_ccache_trim
+//     Brings the cache under its size, if copies were stored since it was
+//     opened: drops the copies used least recently until the rest add up to
+//     no more than the size, counting each at its full size, then removes the
+//     blocks no copy left uses. Blocks and temporary files made in the last
+//     minute are left alone, as another client may be storing a copy with them.
+//
+// *****************************************************
+void rf_ccache_trim(void)
+{
+	RF_CCacheCopy_T *copies = NULL, *moreCopies;
+	RF_CCacheBlock_T *used = NULL, *moreUsed, key;
+	RF_CCacheHeader_T *hdr;
+	char path[PATH_MAX];
+	struct dirent *d;
+	struct stat st;
+	long long total = 0;
+	int numCopies = 0, maxCopies = 0, numUsed = 0, maxUsed = 0;
+	char *buf;
+	time_t now = time(NULL);
+	DIR *dir;
+
+	if (!cacheOn || cacheStored == 0)
+		return;
+
+	snprintf(path, sizeof(path), "%s/index", cacheDir);
+	if ((dir = opendir(path)) == NULL)
+		return;
+	while ((d = readdir(dir)) != NULL) {
+		if (d->d_name[0] == '.' || strlen(d->d_name) >= sizeof(copies->name))
+			continue;
+		snprintf(path, sizeof(path), "%s/index/%s", cacheDir, d->d_name);
+		if (stat(path, &st) != 0)
+			continue;
+		if (strncmp(d->d_name, "tmp", 3) == 0) {
+			if (now - st.st_mtime > RF_CCACHE_YOUNG)
+				unlink(path);
+			continue;
+		}
+		if (numCopies == maxCopies) {
+			if ((moreCopies = realloc(copies, (maxCopies * 2 + 64) * sizeof(RF_CCacheCopy_T))) == NULL)
+				break;
+			copies = moreCopies;
+			maxCopies = maxCopies * 2 + 64;
+		}
+		strcpy(copies[numCopies].name, d->d_name);
+		copies[numCopies].used = st.st_mtime;
+		copies[numCopies].size = st.st_size;
+		numCopies++;
+	}
+	closedir(dir);
+	if (d != NULL) {
+		/* Out of memory: keep everything rather than lose track of blocks in use. */
+		free(copies);
+		return;
+	}
+	qsort(copies, numCopies, sizeof(RF_CCacheCopy_T), rf_ccache_compare_copies);
+
+	/* Keep the most recent copies that fit, and note the blocks they use. */
+	for (int i = 0; i < numCopies; i++) {
+		snprintf(path, sizeof(path), "%s/index/%s", cacheDir, copies[i].name);
+		if ((buf = rf_ccache_load(path)) == NULL) {
+			if (now - copies[i].used > RF_CCACHE_YOUNG)
+				unlink(path);
+			continue;
+		}
+		hdr = (RF_CCacheHeader_T *)buf;
+		if (total + hdr->size > cacheMax) {
+			unlink(path);
+			free(buf);
+			continue;
+		}
+		total += hdr->size;
+		if (numUsed + hdr->numBlocks > maxUsed) {
+			if ((moreUsed = realloc(used, ((numUsed + hdr->numBlocks) * 2 + 64) * sizeof(RF_CCacheBlock_T))) == NULL) {
+				free(buf);
+				free(copies);
+				free(used);
+				return;
+			}
+			used = moreUsed;
+			maxUsed = (numUsed + hdr->numBlocks) * 2 + 64;
+		}
+		memcpy(used + numUsed, buf + sizeof(RF_CCacheHeader_T), hdr->numBlocks * sizeof(RF_CCacheBlock_T));
+		numUsed += hdr->numBlocks;
+		free(buf);
+	}
+	free(copies);
+	if (used != NULL)
+		qsort(used, numUsed, sizeof(RF_CCacheBlock_T), rf_ccache_compare_blocks);
+
+	/* Remove the blocks none of them use. */
+	for (int top = 0; top < 256; top++) {
+		snprintf(path, sizeof(path), "%s/blocks/%02x", cacheDir, top);
+		if ((dir = opendir(path)) == NULL)
+			continue;
+		while ((d = readdir(dir)) != NULL) {
+			if (d->d_name[0] == '.')
+				continue;
+			snprintf(path, sizeof(path), "%s/blocks/%02x/%s", cacheDir, top, d->d_name);
+			if (stat(path, &st) != 0 || now - st.st_mtime <= RF_CCACHE_YOUNG)
+				continue;
+			if (sscanf(d->d_name, "%8x-%x-%u", &key.crc, &key.length, &key.seq) == 3 && numUsed > 0 &&
+			    bsearch(&key, used, numUsed, sizeof(RF_CCacheBlock_T), rf_ccache_compare_blocks) != NULL)
+				continue;
+			unlink(path);
+		}
+		closedir(dir);
+	}
+	free(used);
+}
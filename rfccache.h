@@ -0,0 +1,44 @@
+/* rfccache.h */
+
+/* Client cache of remote files, kept on disk between runs.
+// A get of a file the cache holds a current copy of is served from the cache,
+// without moving the file again. Whether the copy is current is asked of the
+// server with rf_getattr, for a group of files in one call: the copy is used
+// only if the file's size, modification time, inode and change counter are
+// those it had when it was copied. A file is kept after a get only if the
+// server says it had not changed for longer than a clock tick beforehand, and
+// it had not changed afterwards, so a change made during the transfer can not
+// go unseen.
+//
+// The cache directory holds an index file per server and remote path, with
+// the attributes of the copy and the blocks it is made of, and the blocks
+// themselves, RF_CCACHE_BLOCK bytes of the file each. Blocks are named after
+// their content (CRC32C and length), so a block common to several files or
+// versions of a file is kept once; blocks with the same name are told apart
+// byte by byte when stored, and checked against their CRC32C when read.
+// Blocks are mapped into memory to be copied out.
+//
+// Files are written under temporary names and renamed, so several clients may
+// share the cache. rf_ccache_trim keeps the cache under its size, dropping the
+// copies used least recently first; a copy whose blocks a trim removed is
+// simply fetched again.
+*/
+
+#ifndef RFCCACHE_H
+#define RFCCACHE_H
+
+#include <rpc/rpc.h>
+
+#include "rf.h"
+
+#define RF_CCACHE_BLOCK (1024 * 1024)   /* bytes of a file per cache block */
+#define RF_CCACHE_DEFAULT_MB 1024       /* cache size when the caller has no preference */
+
+int  rf_ccache_init(char *dir, long long maxBytes);
+int  rf_ccache_enabled(void);
+int  rf_ccache_attrs(CLIENT *clnt, int num, char **remote, RF_GetAttrResult_T *attrs, enum clnt_stat *rpcError);
+int  rf_ccache_fetch(char *server, char *remote, RF_GetAttrResult_T *attr, char *local, long long *bytes);
+int  rf_ccache_store(char *server, char *remote, RF_GetAttrResult_T *attr, char *local);
+void rf_ccache_trim(void);
+
+#endif /* RFCCACHE_H */
@@ -0,0 +1,310 @@
+/* rfcomp.c */
+
+/* This file implements block compression (see rfcomp.h).
+// A block is a series of sequences: a token byte holding the number of
+// literal bytes and the length of the match after them, the literal bytes,
+// and the match as a 16 bit distance back into the bytes already produced.
+// Lengths of 15 or more go on in further bytes. The last sequence holds
+// literals only, and as in LZ4 no match starts in the last 12 bytes or runs
+// into the last 5, so fast decoders may copy in whole words.
+// The compressor is greedy: at each position it takes the longest match among
+// the earlier positions with the same hash of their first four bytes, kept in
+// chains over the last 64 KB. Each thread keeps its own tables from one block
+// to the next, freed when the thread ends.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "rfcomp.h"
+
+#define OKAY 0
+#define FAILED -1
+
+#define RF_COMP_MINMATCH 4       /* shortest match */
+#define RF_COMP_LASTLIT  5       /* bytes at the end of a block that are always literals */
+#define RF_COMP_MFLIMIT  12      /* bytes at the end of a block where no match starts */
+#define RF_COMP_MAXDIST  65535   /* farthest a match may reach back */
+#define RF_COMP_HASHLOG  14      /* the hash table has 2^14 chains */
+#define RF_COMP_MIN      256     /* smaller blocks are sent as they are */
+
+/* Hash chains of the compressor. */
+typedef struct RF_CompTables_T
+{
+	int	head[1 << RF_COMP_HASHLOG];	/* latest position of each hash, -1 for none */
+	int	chain[RF_COMP_MAXDIST + 1];	/* the position before it with the same hash */
+} RF_CompTables_T;
+
+/* Each thread's RF_CompTables_T. */
+static pthread_key_t tablesKey;
+static pthread_once_t tablesOnce = PTHREAD_ONCE_INIT;
+#define RF_COMP_PROBE    4096    /* bytes compressed first to see if a block is worth it */
+
+
+// *****************************************************
+//
+// rf_comp_hash
+//     Picks the hash chain of four bytes.
+// input parameters: p - The bytes.
+// return value: The chain.
+//
+// *****************************************************
+static u_int rf_comp_hash(const unsigned char *p)
+{
+	u_int32_t v;
+
+	memcpy(&v, p, 4);
+
+	return((v * 2654435761U) >> (32 - RF_COMP_HASHLOG));
+}
+
+// *****************************************************
+//
+// rf_comp_length
+//     Writes the part of a literal or match length that does not fit in its
+//     token: bytes of 255 followed by the remainder.
+// input parameters: op  - Where to write.
+//                   len - The length less 15.
+// return value: Where the next byte goes.
+//
+// *****************************************************
+static unsigned char *rf_comp_length(unsigned char *op, long len)
+{
+	while (len >= 255) {
+		*op++ = 255;
+		len -= 255;
+	}
+	*op++ = len;
+
+	return(op);
+}
+
+// *****************************************************
+//
+// rf_comp_key
+//     Creates the key of the threads' tables, once.
+//
+// *****************************************************
+static void rf_comp_key(void)
+{
+	pthread_key_create(&tablesKey, free);
+}
+
+// *****************************************************
+//
+// rf_comp_tables
+//     Finds the calling thread's tables, allocating them on its first block.
+// return value: The tables, or NULL if there is no memory.
+//
+// *****************************************************
+static RF_CompTables_T *rf_comp_tables(void)
+{
+	RF_CompTables_T *t;
+
+	pthread_once(&tablesOnce, rf_comp_key);
+	if ((t = pthread_getspecific(tablesKey)) == NULL && (t = malloc(sizeof(RF_CompTables_T))) != NULL &&
+	    pthread_setspecific(tablesKey, t) != 0) {
+		free(t);
+		t = NULL;
+	}
+
+	return(t);
+}
+
+// *****************************************************
+//
+// rf_comp_lz4
+//     Compresses a block.
+// input parameters: src    - The block.
+//                   len    - Bytes in the block.
+//                   dst    - Where the compressed block goes.
+//                   dstMax - Most bytes to write to dst.
+//                   level  - 1 to RF_COMP_MAXLEVEL.
+// return value: Bytes written to dst, or 0 if they would not fit.
+//
+// *****************************************************
+static long rf_comp_lz4(const unsigned char *src, long len, unsigned char *dst, long dstMax, int level)
+{
+	const unsigned char *ip = src, *anchor = src;
+	const unsigned char *end = src + len;
+	const unsigned char *matchLimit = end - RF_COMP_LASTLIT;
+	unsigned char *op = dst, *opEnd = dst + dstMax;
+	unsigned char *token;
+	long pos, cand, bestPos = 0, bestLen, matchLen, litLen;
+	int attempts = 1 << (level - 1);
+	RF_CompTables_T *t;
+	int *head, *chain;
+	u_int h;
+
+	if ((t = rf_comp_tables()) == NULL)
+		return(0);
+	head = t->head;
+	chain = t->chain;
+	memset(head, 0xff, sizeof(t->head));
+
+	while (len > RF_COMP_MFLIMIT && ip < end - RF_COMP_MFLIMIT) {
+		pos = ip - src;
+		h = rf_comp_hash(ip);
+		bestLen = 0;
+		cand = head[h];
+		for (int n = attempts; n > 0 && cand >= 0 && pos - cand <= RF_COMP_MAXDIST; n--) {
+			if (memcmp(src + cand, ip, RF_COMP_MINMATCH) == 0) {
+				matchLen = RF_COMP_MINMATCH;
+				while (ip + matchLen < matchLimit && src[cand + matchLen] == ip[matchLen])
+					matchLen++;
+				if (matchLen > bestLen) {
+					bestLen = matchLen;
+					bestPos = cand;
+				}
+			}
+			cand = chain[cand & RF_COMP_MAXDIST];
+		}
+		chain[pos & RF_COMP_MAXDIST] = head[h];
+		head[h] = pos;
+		if (bestLen == 0) {
+			ip++;
+			continue;
+		}
+
+		/* Literals since the last match, then the match. */
+		litLen = ip - anchor;
+		if (litLen + litLen / 255 + bestLen / 255 + 6 > opEnd - op) {
+			op = NULL;
+			break;
+		}
+		token = op++;
+		*token = (litLen >= 15 ? 15 : litLen) << 4;
+		if (litLen >= 15)
+			op = rf_comp_length(op, litLen - 15);
+		memcpy(op, anchor, litLen);
+		op += litLen;
+		*op++ = (pos - bestPos) & 0xff;
+		*op++ = (pos - bestPos) >> 8;
+		matchLen = bestLen - RF_COMP_MINMATCH;
+		*token |= (matchLen >= 15 ? 15 : matchLen);
+		if (matchLen >= 15)
+			op = rf_comp_length(op, matchLen - 15);
+
+		/* Above level 1 the positions inside the match are remembered too. */
+		if (level > 1) {
+			for (long p = pos + 1; p < pos + bestLen && p < len - RF_COMP_MFLIMIT; p++) {
+				h = rf_comp_hash(src + p);
+				chain[p & RF_COMP_MAXDIST] = head[h];
+				head[h] = p;
+			}
+		}
+		ip += bestLen;
+		anchor = ip;
+	}
+
+	/* The rest of the block as literals. */
+	litLen = end - anchor;
+	if (op != NULL && litLen + litLen / 255 + 2 <= opEnd - op) {
+		token = op++;
+		*token = (litLen >= 15 ? 15 : litLen) << 4;
+		if (litLen >= 15)
+			op = rf_comp_length(op, litLen - 15);
+		memcpy(op, anchor, litLen);
+		op += litLen;
+	} else {
+		op = NULL;
+	}
+
+	return(op != NULL ? op - dst : 0);
+}
+
+// *****************************************************
+//
+// rf_comp_pack
+//     Compresses a block if that is worth it.
+// input parameters: src   - The block.
+//                   len   - Bytes in the block.
+//                   dst   - Where the compressed block goes, room for len bytes.
+//                   level - 1 to RF_COMP_MAXLEVEL; 0 or less never compresses.
+// return value: Bytes in the compressed block, or 0 to send the block as it is.
+//
+// *****************************************************
+long rf_comp_pack(const char *src, long len, char *dst, int level)
+{
+	if (level < 1 || len < RF_COMP_MIN)
+		return(0);
+	if (level > RF_COMP_MAXLEVEL)
+		level = RF_COMP_MAXLEVEL;
+
+	/* A piece from the front that does not shrink by an eighth says the rest will not either. */
+	if (len > 2 * RF_COMP_PROBE &&
+	    rf_comp_lz4((const unsigned char *)src, RF_COMP_PROBE, (unsigned char *)dst, RF_COMP_PROBE - RF_COMP_PROBE / 8, level) == 0)
+		return(0);
+
+	/* Less than a sixteenth saved is not worth the receiver's time. */
+	return(rf_comp_lz4((const unsigned char *)src, len, (unsigned char *)dst, len - len / 16, level));
+}
+
+// *****************************************************
+//
+// rf_comp_unpack
+//     Decompresses a block, checking every length and distance against the
+//     buffers, so a damaged or hostile block can not overrun them.
+// input parameters: src    - The compressed block.
+//                   len    - Bytes in the compressed block.
+//                   dst    - Where the block goes.
+//                   dstMax - Room in dst.
+// return value: Bytes in the block, or FAILED if the compressed block is bad.
+//
+// *****************************************************
+long rf_comp_unpack(const char *src, long len, char *dst, long dstMax)
+{
+	const unsigned char *ip = (const unsigned char *)src, *end = ip + len;
+	unsigned char *op = (unsigned char *)dst, *opEnd = op + dstMax;
+	long litLen, matchLen, dist;
+	u_int token, b;
+
+	while (ip < end) {
+		token = *ip++;
+		litLen = token >> 4;
+		if (litLen == 15) {
+			do {
+				if (ip >= end)
+					return(FAILED);
+				b = *ip++;
+				litLen += b;
+			} while (b == 255);
+		}
+		if (litLen > end - ip || litLen > opEnd - op)
+			return(FAILED);
+		memcpy(op, ip, litLen);
+		op += litLen;
+		ip += litLen;
+		if (ip == end)
+			break;   /* the last sequence has no match */
+
+		if (end - ip < 2)
+			return(FAILED);
+		dist = ip[0] | ip[1] << 8;
+		ip += 2;
+		matchLen = (token & 15) + RF_COMP_MINMATCH;
+		if ((token & 15) == 15) {
+			do {
+				if (ip >= end)
+					return(FAILED);
+				b = *ip++;
+				matchLen += b;
+			} while (b == 255);
+		}
+		if (dist == 0 || dist > op - (unsigned char *)dst || matchLen > opEnd - op)
+			return(FAILED);
+		if (dist >= matchLen) {
+			memcpy(op, op - dist, matchLen);
+			op += matchLen;
+		} else {
+			/* The match overlaps what it produces, as in a run of one byte. */
+			for (long i = 0; i < matchLen; i++, op++)
+				*op = *(op - dist);
+		}
+	}
+
+	return(op - (unsigned char *)dst);
+}
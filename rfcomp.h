@@ -0,0 +1,24 @@
+/* rfcomp.h */
+
+/* Block compression for rf_readz and rf_writez.
+// Every block is compressed on its own in the LZ4 block format, so any LZ4
+// decoder can read it. The level (1 to RF_COMP_MAXLEVEL) is how hard the
+// compressor looks for earlier copies of the data: each level up tries twice
+// as many, which is slower and packs text a little tighter.
+//
+// rf_comp_pack only returns a compressed block when it is clearly smaller
+// than the original. It first compresses a small piece from the front of the
+// block and gives up if that does not shrink, so data that is already
+// compressed (archives, media) costs next to nothing to send as it is.
+*/
+
+#ifndef RFCOMP_H
+#define RFCOMP_H
+
+#define RF_COMP_DEFAULT_LEVEL 1   /* level when the caller has no preference */
+#define RF_COMP_MAXLEVEL      9
+
+long rf_comp_pack(const char *src, long len, char *dst, int level);
+long rf_comp_unpack(const char *src, long len, char *dst, long dstMax);
+
+#endif /* RFCOMP_H */
@@ -0,0 +1,187 @@
+/* rfconnect.c */
+
+/* This file creates CLIENT handles for the RF server (see rfconnect.h).
+// The clnt_call of a version 2 handle is hooked: a reply saying the server
+// turned the call away (RF_BUSY in rf.x) is dropped, and the call made again
+// after the wait the server asked for.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <rpc/rpc.h>
+#include <rpc/pmap_clnt.h>
+
+#include "rf.h"
+#include "rfbusy.h"
+#include "rfconnect.h"
+
+/* Datagram buffer size: the largest UDP block plus room for the RPC header. */
+#define RF_UDP_BUFSIZE (RF_MAXBLOCK_UDP + 4096)
+
+/* Interval between UDP retransmissions, unless RFCLIENT_RETRY_MS is set. The
+// server's duplicate request cache makes retransmitted calls harmless, so on a
+// lossy network a much shorter interval can be used.
+*/
+static struct timeval RETRY = { 5, 0 };
+
+/* Longest a call is made again for a server that keeps turning it away, in ms. */
+#define RF_CONNECT_BUSY_GIVEUP 120000
+
+/* The hooked ops of a version 2 handle. ops is first, so the handle's cl_ops
+// can point at the whole.
+*/
+typedef struct RF_BusyOps_T
+{
+	struct clnt_ops	ops;	/* copy of the real ops with cl_call and cl_destroy hooked */
+	struct clnt_ops	*real;	/* the handle's own ops */
+} RF_BusyOps_T;
+
+
+// *****************************************************
+//
+// rf_connect_call
+//     Replacement cl_call of version 2 handles. Makes the call with the real
+//     cl_call, and again for as long as the server turns it away, waiting as
+//     asked in between, up to RF_CONNECT_BUSY_GIVEUP in all. The last reply
+//     is then handed back as it is.
+// input parameters: See clnt_call.
+// return value: See clnt_call.
+//
+// *****************************************************
+static enum clnt_stat rf_connect_call(CLIENT *clnt, rpcproc_t proc, xdrproc_t xdrArgs, void *args,
+                                      xdrproc_t xdrRes, void *res, struct timeval timeout)
+{
+	RF_BusyOps_T *busy = (RF_BusyOps_T *)clnt->cl_ops;
+	const RF_BusyReply_T *reply = rf_busy_reply(proc);
+	struct timespec ts;
+	enum clnt_stat stat;
+	long waited = 0, wait;
+
+	/* Only a reply of the procedure's own type is looked at. */
+	if (reply != NULL && reply->xdrRes != xdrRes)
+		reply = NULL;
+
+	for (;;) {
+		stat = busy->real->cl_call(clnt, proc, xdrArgs, args, xdrRes, res, timeout);
+		if (stat != RPC_SUCCESS || reply == NULL || (wait = rf_busy_wait(reply->get(res))) == 0 ||
+		    waited + wait > RF_CONNECT_BUSY_GIVEUP)
+			return(stat);
+
+		/* Only a list of results was allocated for the reply; the caller cleared
+		// it before the call, and other replies may point at the caller's buffers.
+		*/
+		if (reply->list) {
+			xdr_free(xdrRes, res);
+			memset(res, 0, reply->size);
+		}
+
+		ts.tv_sec = wait / 1000;
+		ts.tv_nsec = (wait % 1000) * 1000000;
+		while (nanosleep(&ts, &ts) != 0 && errno == EINTR)
+			;
+		waited += wait;
+	}
+}
+
+// *****************************************************
+//
+// rf_connect_destroy
+//     Replacement cl_destroy of version 2 handles. Puts the real ops back and
+//     destroys the handle with them.
+// input parameters: clnt - The handle.
+//
+// *****************************************************
+static void rf_connect_destroy(CLIENT *clnt)
+{
+	RF_BusyOps_T *busy = (RF_BusyOps_T *)clnt->cl_ops;
+
+	clnt->cl_ops = busy->real;
+	free(busy);
+	clnt_destroy(clnt);
+}
+
+
+// *****************************************************
+//
+// rf_connect
+//     Creates a CLIENT handle for the RFILE program on a server.
+// input parameters: server   - Server host name or IP address, optionally followed by :port.
+//                              Without a port the server's portmapper is asked.
+//                   vers     - RFILE version to talk.
+//                   proto    - "udp" or "tcp".
+//                   maxBlock - Set to the largest block this handle can carry in one call.
+// return value: The CLIENT, or NULL on failure (use clnt_pcreateerror to report it).
+//
+// *****************************************************
+CLIENT *rf_connect(char *server, u_long vers, char *proto, long *maxBlock)
+{
+	struct sockaddr_in addr;
+	struct addrinfo hints, *found;
+	char hostname[256];
+	char *colon;
+	int sock = RPC_ANYSOCK;
+	int tcp = (strcmp(proto, "tcp") == 0);
+	u_short port = 0;
+	struct timeval retry = RETRY;
+	char *env;
+	RF_BusyOps_T *busy;
+	CLIENT *clnt;
+
+	/* Split host:port. */
+	strncpy(hostname, server, sizeof(hostname) - 1);
+	hostname[sizeof(hostname) - 1] = '\0';
+	if ((colon = strrchr(hostname, ':')) != NULL) {
+		*colon = '\0';
+		port = atoi(colon + 1);
+	}
+
+	if (!tcp && strcmp(proto, "udp") != 0) {
+		rpc_createerr.cf_stat = RPC_UNKNOWNPROTO;
+		return(NULL);
+	}
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	if (getaddrinfo(hostname, NULL, &hints, &found) != 0) {
+		rpc_createerr.cf_stat = RPC_UNKNOWNHOST;
+		return(NULL);
+	}
+	memcpy(&addr, found->ai_addr, sizeof(addr));
+	freeaddrinfo(found);
+
+	/* Ask the portmapper unless a port was given. */
+	if (port == 0) {
+		port = pmap_getport(&addr, RFILE, vers, tcp ? IPPROTO_TCP : IPPROTO_UDP);
+		if (port == 0)
+			return(NULL);
+	}
+	addr.sin_port = htons(port);
+
+	if (tcp) {
+		clnt = clnttcp_create(&addr, RFILE, vers, &sock, 0, 0);
+		*maxBlock = RF_MAXBLOCK_TCP;
+	} else {
+		if ((env = getenv("RFCLIENT_RETRY_MS")) != NULL && atol(env) > 0) {
+			retry.tv_sec = atol(env) / 1000;
+			retry.tv_usec = (atol(env) % 1000) * 1000;
+		}
+		clnt = clntudp_bufcreate(&addr, RFILE, vers, retry, &sock, RF_UDP_BUFSIZE, RF_UDP_BUFSIZE);
+		*maxBlock = RF_MAXBLOCK_UDP;
+	}
+
+	/* Without memory for the hook the handle still works, just without waiting out RF_BUSY. */
+	if (clnt != NULL && vers == RFILE_VERS2 && (busy = malloc(sizeof(RF_BusyOps_T))) != NULL) {
+		busy->ops = *clnt->cl_ops;
+		busy->ops.cl_call = rf_connect_call;
+		busy->ops.cl_destroy = rf_connect_destroy;
+		busy->real = clnt->cl_ops;
+		clnt->cl_ops = &busy->ops;
+	}
+
+	return(clnt);
+}
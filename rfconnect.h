@@ -0,0 +1,16 @@
+/* rfconnect.h */
+
+/* Client side helper that creates a CLIENT handle for the RF server.
+// Unlike clnt_create, the transport buffers are sized for the largest
+// RFILE version 2 block, and a server started with rfserver -p can be
+// reached without a portmapper by naming it as host:port.
+*/
+
+#ifndef RFCONNECT_H
+#define RFCONNECT_H
+
+#include <rpc/rpc.h>
+
+CLIENT *rf_connect(char *server, u_long vers, char *proto, long *maxBlock);
+
+#endif /* RFCONNECT_H */
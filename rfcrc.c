@@ -0,0 +1,222 @@
+/* rfcrc.c */
+
+/* This file implements CRC32C checksums (see rfcrc.h).
+// The table driven version works on 8 bytes at a time ("slicing by 8"); its
+// tables are built on first use. The SSE4.2 version is picked at run time, so
+// one binary runs on every x86-64 processor.
+// Combining follows zlib's crc32_combine: a checksum is moved past n bytes by
+// multiplying it by x^(8n) modulo the polynomial, using precomputed powers x^(2^k).
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "rfcrc.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <nmmintrin.h>
+#define RF_CRC_SSE42
+#endif
+
+#define RF_CRC_POLY 0x82f63b78   /* Castagnoli polynomial, bit reversed */
+
+static u_int32_t crcTable[8][256];
+static u_int32_t x2nTable[32];   /* x^(2^n) modulo the polynomial */
+static int haveSse42;
+static pthread_once_t crcOnce = PTHREAD_ONCE_INIT;
+
+
+// *****************************************************
+//
+// rf_crc_multiply
+//     Multiplies two polynomials modulo the CRC polynomial.
+// input parameters: a, b - The polynomials, bit reversed.
+// return value: a * b modulo the polynomial.
+//
+// *****************************************************
+static u_int32_t rf_crc_multiply(u_int32_t a, u_int32_t b)
+{
+	u_int32_t m = 1U << 31;
+	u_int32_t p = 0;
+
+	for (;;) {
+		if (a & m) {
+			p ^= b;
+			if ((a & (m - 1)) == 0)
+				break;
+		}
+		m >>= 1;
+		b = (b & 1) ? (b >> 1) ^ RF_CRC_POLY : b >> 1;
+	}
+
+	return(p);
+}
+
+// *****************************************************
+//
+// rf_crc_init
+//     Builds the tables and checks for SSE4.2. Run once through crcOnce.
+//
+// *****************************************************
+static void rf_crc_init(void)
+{
+	u_int32_t crc;
+
+	for (int i = 0; i < 256; i++) {
+		crc = i;
+		for (int j = 0; j < 8; j++)
+			crc = (crc & 1) ? (crc >> 1) ^ RF_CRC_POLY : crc >> 1;
+		crcTable[0][i] = crc;
+	}
+	for (int i = 0; i < 256; i++)
+		for (int t = 1; t < 8; t++)
+			crcTable[t][i] = (crcTable[t - 1][i] >> 8) ^ crcTable[0][crcTable[t - 1][i] & 0xff];
+
+	x2nTable[0] = 1U << 30;   /* x^1 */
+	for (int n = 1; n < 32; n++)
+		x2nTable[n] = rf_crc_multiply(x2nTable[n - 1], x2nTable[n - 1]);
+
+#ifdef RF_CRC_SSE42
+	haveSse42 = __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+#ifdef RF_CRC_SSE42
+// *****************************************************
+//
+// rf_crc32c_sse42
+//     Continues a checksum with the SSE4.2 crc32 instruction.
+// input parameters: crc - Running value, already inverted.
+//                   p   - The bytes.
+//                   len - Number of bytes.
+// return value: The new running value.
+//
+// *****************************************************
+__attribute__((target("sse4.2")))
+static u_int32_t rf_crc32c_sse42(u_int32_t crc, const unsigned char *p, size_t len)
+{
+	u_int64_t crc64;
+	u_int64_t word;
+
+	while (len > 0 && ((uintptr_t)p & 7) != 0) {
+		crc = _mm_crc32_u8(crc, *p++);
+		len--;
+	}
+	crc64 = crc;
+	while (len >= 8) {
+		memcpy(&word, p, 8);
+		crc64 = _mm_crc32_u64(crc64, word);
+		p += 8;
+		len -= 8;
+	}
+	crc = (u_int32_t)crc64;
+	while (len > 0) {
+		crc = _mm_crc32_u8(crc, *p++);
+		len--;
+	}
+
+	return(crc);
+}
+#endif
+
+// *****************************************************
+//
+// rf_crc32c_table
+//     Continues a checksum with the slicing by 8 tables.
+// input parameters: crc - Running value, already inverted.
+//                   p   - The bytes.
+//                   len - Number of bytes.
+// return value: The new running value.
+//
+// *****************************************************
+static u_int32_t rf_crc32c_table(u_int32_t crc, const unsigned char *p, size_t len)
+{
+	u_int32_t lo, hi;
+
+	while (len > 0 && ((uintptr_t)p & 7) != 0) {
+		crc = (crc >> 8) ^ crcTable[0][(crc ^ *p++) & 0xff];
+		len--;
+	}
+	while (len >= 8) {
+		lo = crc ^ (p[0] | p[1] << 8 | p[2] << 16 | (u_int32_t)p[3] << 24);
+		hi = p[4] | p[5] << 8 | p[6] << 16 | (u_int32_t)p[7] << 24;
+		crc = crcTable[7][lo & 0xff] ^ crcTable[6][(lo >> 8) & 0xff] ^
+		      crcTable[5][(lo >> 16) & 0xff] ^ crcTable[4][lo >> 24] ^
+		      crcTable[3][hi & 0xff] ^ crcTable[2][(hi >> 8) & 0xff] ^
+		      crcTable[1][(hi >> 16) & 0xff] ^ crcTable[0][hi >> 24];
+		p += 8;
+		len -= 8;
+	}
+	while (len > 0) {
+		crc = (crc >> 8) ^ crcTable[0][(crc ^ *p++) & 0xff];
+		len--;
+	}
+
+	return(crc);
+}
+
+// *****************************************************
+//
+// rf_crc32c
+//     Continues a CRC32C checksum over more bytes.
+// input parameters: crc - Checksum of the bytes before buf, 0 to start one.
+//                   buf - The bytes.
+//                   len - Number of bytes.
+// return value: Checksum of the earlier bytes followed by buf.
+//
+// *****************************************************
+u_int32_t rf_crc32c(u_int32_t crc, const void *buf, size_t len)
+{
+	pthread_once(&crcOnce, rf_crc_init);
+
+#ifdef RF_CRC_SSE42
+	if (haveSse42)
+		return(~rf_crc32c_sse42(~crc, buf, len));
+#endif
+
+	return(~rf_crc32c_table(~crc, buf, len));
+}
+
+// *****************************************************
+//
+// rf_crc32c_shift
+//     Moves a checksum past more bytes: the result is what the checksum of some
+//     data adds to the checksum of that data followed by len other bytes.
+// input parameters: crc - Checksum of the data.
+//                   len - Number of bytes that follow.
+// return value: The moved checksum.
+//
+// *****************************************************
+u_int32_t rf_crc32c_shift(u_int32_t crc, long long len)
+{
+	u_int32_t power = 1U << 31;   /* x^0 */
+	int k = 3;                    /* len counts bytes, x^(2^3) per byte */
+
+	pthread_once(&crcOnce, rf_crc_init);
+
+	while (len > 0) {
+		if (len & 1)
+			power = rf_crc_multiply(x2nTable[k & 31], power);
+		len >>= 1;
+		k++;
+	}
+
+	return(rf_crc_multiply(power, crc));
+}
+
+// *****************************************************
+//
+// rf_crc32c_combine
+//     Works out the checksum of two pieces of data put together.
+// input parameters: crc1 - Checksum of the first piece.
+//                   crc2 - Checksum of the second piece.
+//                   len2 - Bytes in the second piece.
+// return value: Checksum of the first piece followed by the second.
+//
+// *****************************************************
+u_int32_t rf_crc32c_combine(u_int32_t crc1, u_int32_t crc2, long long len2)
+{
+	return(rf_crc32c_shift(crc1, len2) ^ crc2);
+}
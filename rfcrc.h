@@ -0,0 +1,25 @@
+/* rfcrc.h */
+
+/* CRC32C (Castagnoli) checksums, as used by iSCSI and ext4.
+// Blocks moved by rf_readsum and rf_writesum carry one, and rf_digest returns
+// the one of a whole file. On x86-64 processors with SSE4.2 the crc32
+// instruction computes it at several GB/s; elsewhere a table driven version
+// is used, with the same results.
+//
+// rf_crc32c continues a checksum: rf_crc32c(rf_crc32c(0, a, n), b, m) is the
+// checksum of a followed by b. rf_crc32c_combine gets the same result from the
+// checksums of a and b alone, so blocks checksummed apart, in any order, add up
+// to the checksum of the file.
+*/
+
+#ifndef RFCRC_H
+#define RFCRC_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+u_int32_t rf_crc32c(u_int32_t crc, const void *buf, size_t len);
+u_int32_t rf_crc32c_shift(u_int32_t crc, long long len);
+u_int32_t rf_crc32c_combine(u_int32_t crc1, u_int32_t crc2, long long len2);
+
+#endif /* RFCRC_H */
@@ -0,0 +1,392 @@
+/* rfdelta.c */
+
+/* This file implements delta transfers (see rfdelta.h).
+// The weak checksum is the one rsync uses: a is the sum of the bytes of the
+// block and b the sum of the running values of a, both modulo 2^16, so a byte
+// can be dropped from the front of the block and another added at the back in
+// a few operations. Where a whole block has to be summed, when signing and
+// after every match, it is done 16 bytes at a time with SSE2, which every
+// x86-64 processor has.
+// The server looks the weak checksums up in a hash table built from the
+// signatures of each call. The block after the last one matched is tried
+// first, so an unchanged stretch of the file comes out as a single run.
+// A scan allocates nothing: its table, read buffer and reply all live in a
+// workspace the caller provides, of rf_delta_scan_space bytes.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <rpc/rpc.h>
+
+#include "rf.h"
+#include "rfcrc.h"
+#include "rfdelta.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#define RF_DELTA_SSE2
+#endif
+
+#define OKAY 0
+#define FAILED -1
+
+#define RF_DELTA_CHUNK  (1024 * 1024)   /* bytes read from a file at a time */
+#define RF_DELTA_MAXRUN (1L << 30)      /* longest run in one RF_DeltaOp_T */
+#define RF_DELTA_NONE   -1              /* end of a hash chain */
+
+
+// *****************************************************
+//
+// rf_delta_block_size
+//     Picks the block size for a delta transfer of a file: about the square
+//     root of its size, as rsync does, rounded up to a power of two.
+// input parameters: size - Size of the client's copy.
+// return value: Block size, RF_DELTA_MINBLOCK to RF_DELTA_MAXBLOCK.
+//
+// *****************************************************
+long rf_delta_block_size(long long size)
+{
+	long blockSize = RF_DELTA_MINBLOCK;
+
+	while (blockSize < RF_DELTA_MAXBLOCK && (long long)blockSize * blockSize < size)
+		blockSize *= 2;
+
+	return(blockSize);
+}
+
+// *****************************************************
+//
+// rf_delta_weak
+//     Works out the weak checksum of a block.
+// input parameters: buf - The block.
+//                   len - Bytes in the block.
+// return value: The checksum, a in the low and b in the high 16 bits.
+//
+// *****************************************************
+u_int32_t rf_delta_weak(const unsigned char *buf, size_t len)
+{
+	u_int32_t a = 0, b = 0;
+	size_t i = 0;
+
+#ifdef RF_DELTA_SSE2
+	/* b of 16 byte pieces: 16 times the sum of a before each piece, plus the
+	// bytes of each piece weighted 16 down to 1.
+	*/
+	if (len >= 16) {
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i weightLo = _mm_setr_epi16(16, 15, 14, 13, 12, 11, 10, 9);
+		const __m128i weightHi = _mm_setr_epi16(8, 7, 6, 5, 4, 3, 2, 1);
+		__m128i sumA = zero, sumPrev = zero, sumWeighted = zero, piece;
+		u_int64_t lanes[2];
+		u_int32_t words[4];
+
+		for (; i + 16 <= len; i += 16) {
+			piece = _mm_loadu_si128((const __m128i *)(buf + i));
+			sumPrev = _mm_add_epi64(sumPrev, sumA);
+			sumA = _mm_add_epi64(sumA, _mm_sad_epu8(piece, zero));
+			sumWeighted = _mm_add_epi32(sumWeighted, _mm_madd_epi16(_mm_unpacklo_epi8(piece, zero), weightLo));
+			sumWeighted = _mm_add_epi32(sumWeighted, _mm_madd_epi16(_mm_unpackhi_epi8(piece, zero), weightHi));
+		}
+		_mm_storeu_si128((__m128i *)lanes, sumA);
+		a = lanes[0] + lanes[1];
+		_mm_storeu_si128((__m128i *)lanes, sumPrev);
+		b = 16 * (u_int32_t)(lanes[0] + lanes[1]);
+		_mm_storeu_si128((__m128i *)words, sumWeighted);
+		b += words[0] + words[1] + words[2] + words[3];
+	}
+#endif
+
+	for (; i < len; i++) {
+		a += buf[i];
+		b += a;
+	}
+
+	return((a & 0xffff) | (b << 16));
+}
+
+// *****************************************************
+//
+// rf_delta_sign
+//     Signs a file block by block for rf_delta.
+// input parameters: fd        - File descriptor open for reading.
+//                   size      - Bytes to sign, from the start of the file.
+//                   blockSize - Bytes per block, at most RF_DELTA_MAXBLOCK.
+//                   sigs      - Set to the signature of each block; room for
+//                               (size + blockSize - 1) / blockSize of them.
+// return value: OKAY, or FAILED if the file could not be read.
+//
+// *****************************************************
+int rf_delta_sign(int fd, long long size, long blockSize, RF_BlockSig_T *sigs)
+{
+	long chunk = RF_DELTA_CHUNK / blockSize * blockSize;
+	long long offset = 0;
+	unsigned char *buf;
+	long n, len;
+
+	if ((buf = malloc(chunk)) == NULL)
+		return(FAILED);
+
+	while (offset < size) {
+		n = (size - offset < chunk) ? size - offset : chunk;
+		if (pread(fd, buf, n, offset) != n) {
+			free(buf);
+			return(FAILED);
+		}
+		for (long i = 0; i < n; i += blockSize) {
+			len = (n - i < blockSize) ? n - i : blockSize;
+			sigs->weak = rf_delta_weak(buf + i, len);
+			sigs->strong = rf_crc32c(0, buf + i, len);
+			sigs++;
+		}
+		offset += n;
+	}
+	free(buf);
+
+	return(OKAY);
+}
+
+// *****************************************************
+//
+// rf_delta_hash
+//     Picks the hash chain of a weak checksum.
+// input parameters: weak - The checksum.
+//                   mask - Number of chains less one, a power of two less one.
+// return value: The chain.
+//
+// *****************************************************
+static u_int rf_delta_hash(u_int32_t weak, u_int mask)
+{
+	return(((weak * 2654435761U) >> 16) & mask);
+}
+
+// *****************************************************
+//
+// rf_delta_same
+//     Tells whether the data at the scan position is a given client block.
+//     The CRC32C of the data is only worked out once the weak checksum
+//     matches, and then kept for the other blocks tried at the same position.
+// input parameters: sig        - Signature of the block.
+//                   len        - Bytes in the block.
+//                   weak       - Weak checksum of the data.
+//                   p, n       - The data.
+//                   strong     - CRC32C of the data, once haveStrong is set.
+//                   haveStrong - Set when strong holds the CRC32C.
+// return value: Non zero if the block matches.
+//
+// *****************************************************
+static int rf_delta_same(RF_BlockSig_T *sig, long len, u_int32_t weak, const unsigned char *p, long n,
+                         u_int32_t *strong, int *haveStrong)
+{
+	if (len != n || sig->weak != weak)
+		return(0);
+	if (!*haveStrong) {
+		*strong = rf_crc32c(0, p, n);
+		*haveStrong = 1;
+	}
+
+	return(sig->strong == *strong);
+}
+
+// *****************************************************
+//
+// rf_delta_mask
+//     Sizes the hash table of a scan.
+// input parameters: numSigs - Number of signatures in the request.
+// return value: Number of chains less one, at least twice numSigs.
+//
+// *****************************************************
+static u_int rf_delta_mask(long numSigs)
+{
+	u_int mask;
+
+	for (mask = 15; mask < 2 * numSigs; mask = mask * 2 + 1)
+		;
+
+	return(mask);
+}
+
+// *****************************************************
+//
+// rf_delta_scan_space
+//     Tells how large a workspace rf_delta_scan needs for a request.
+// input parameters: req    - The request, with the client's signatures.
+//                   budget - As for rf_delta_scan.
+// return value: Bytes of workspace.
+//
+// *****************************************************
+size_t rf_delta_scan_space(RF_DeltaRequest_T *req, long budget)
+{
+	long blockSize = (req->blockSize > 0 && req->blockSize <= RF_DELTA_MAXBLOCK) ? req->blockSize : 0;
+
+	return(RF_MAXDELTAOPS * sizeof(RF_DeltaOp_T) + (rf_delta_mask(req->sigs.sigs_len) + 1) * sizeof(int) +
+	       (req->sigs.sigs_len + 1) * sizeof(int) + (budget > 0 ? budget : 0) + RF_DELTA_CHUNK + blockSize + 1);
+}
+
+// *****************************************************
+//
+// rf_delta_scan
+//     Runs one rf_delta call over the server's copy of a file: from
+//     req->offset on, every client block found is turned into a run to copy,
+//     and the bytes in between into literal data. Stops after req->length
+//     bytes, at the end of the file, or when the reply is full.
+// input parameters: fd     - File descriptor open for reading.
+//                   req    - The request, with the client's signatures.
+//                   budget - Most reply bytes, literal data plus
+//                            RF_DELTA_OPSIZE per run.
+//                   work   - Workspace of rf_delta_scan_space(req, budget)
+//                            bytes, aligned for a RF_DeltaOp_T.
+//                   res    - Filled in; ops and data point into work.
+// return value: OKAY, or FAILED for a bad request or if the file could not
+//               be read.
+//
+// *****************************************************
+int rf_delta_scan(int fd, RF_DeltaRequest_T *req, long budget, void *work, RF_DeltaReply_T *res)
+{
+	RF_BlockSig_T *sigs = req->sigs.sigs_val;
+	long numSigs = req->sigs.sigs_len;
+	long blockSize = req->blockSize;
+	long long lastBlock, lastLen;    /* the client's last block, which may be short */
+	long long pos = req->offset;     /* start of the window */
+	long long stop, bufOff = pos, prevBlock = -2, match, k;
+	long bufMax, bufLen = 0, avail, n = 0;
+	long litLen = 0, litRun = 0, numOps = 0;
+	u_int32_t a = 0, b = 0, weak, strong = 0, crc = 0;
+	int have = 0, haveStrong, eof = 0;
+	RF_DeltaOp_T *ops;
+	unsigned char *data, *buf, *p;
+	int *head, *next;
+	u_int mask;
+	ssize_t got = 0;
+	struct stat st;
+
+	memset(res, 0, sizeof(RF_DeltaReply_T));
+	res->deltaStatus = FAILED;
+
+	if (blockSize < 1 || blockSize > RF_DELTA_MAXBLOCK || pos < 0 || req->length < 1 || req->localSize < 0 ||
+	    req->firstBlock < 0 || budget < 4 * RF_DELTA_OPSIZE || work == NULL || fstat(fd, &st) != 0)
+		return(FAILED);
+	lastBlock = (req->localSize + blockSize - 1) / blockSize - 1;
+	lastLen = req->localSize - lastBlock * blockSize;
+	if (req->firstBlock + numSigs > lastBlock + 1)
+		return(FAILED);
+	stop = (st.st_size - pos < req->length) ? st.st_size : pos + req->length;
+
+	/* Carve the workspace up, as rf_delta_scan_space sized it. */
+	mask = rf_delta_mask(numSigs);
+	bufMax = RF_DELTA_CHUNK + blockSize + 1;
+	ops = work;
+	head = (int *)(ops + RF_MAXDELTAOPS);
+	next = head + mask + 1;
+	data = (unsigned char *)(next + numSigs + 1);
+	buf = data + budget;
+
+	for (u_int h = 0; h <= mask; h++)
+		head[h] = RF_DELTA_NONE;
+	for (long i = numSigs - 1; i >= 0; i--) {
+		next[i] = head[rf_delta_hash(sigs[i].weak, mask)];
+		head[rf_delta_hash(sigs[i].weak, mask)] = i;
+	}
+
+	/* Two runs are kept free: one for a literal run still open, one for a new run. */
+	while (pos < stop && litLen + RF_DELTA_OPSIZE * (numOps + 2) < budget && numOps + 2 <= RF_MAXDELTAOPS) {
+		/* Keep the window and the byte after it in the buffer. */
+		if (!eof && pos + blockSize + 1 > bufOff + bufLen) {
+			memmove(buf, buf + (pos - bufOff), bufOff + bufLen - pos);
+			bufLen = bufOff + bufLen - pos;
+			bufOff = pos;
+			while (!eof && bufLen < bufMax) {
+				if ((got = pread(fd, buf + bufLen, bufMax - bufLen, bufOff + bufLen)) < 0)
+					break;
+				eof = (got == 0);
+				bufLen += got;
+			}
+			if (got < 0)
+				return(FAILED);
+		}
+		if ((avail = bufOff + bufLen - pos) <= 0)
+			break;
+		p = buf + (pos - bufOff);
+
+		if (!have) {
+			n = (avail < blockSize) ? avail : blockSize;
+			weak = rf_delta_weak(p, n);
+			a = weak & 0xffff;
+			b = weak >> 16;
+			have = 1;
+		}
+
+		/* Look the window up, trying the block after the last match first. */
+		match = -1;
+		if (n == blockSize || n == lastLen) {
+			weak = (a & 0xffff) | (b << 16);
+			haveStrong = 0;
+			k = prevBlock + 1;
+			if (k >= req->firstBlock && k < req->firstBlock + numSigs &&
+			    rf_delta_same(&sigs[k - req->firstBlock], k == lastBlock ? lastLen : blockSize, weak, p, n, &strong, &haveStrong))
+				match = k;
+			for (int i = head[rf_delta_hash(weak, mask)]; match < 0 && i != RF_DELTA_NONE; i = next[i]) {
+				k = req->firstBlock + i;
+				if (rf_delta_same(&sigs[i], k == lastBlock ? lastLen : blockSize, weak, p, n, &strong, &haveStrong))
+					match = k;
+			}
+		}
+
+		if (match >= 0) {
+			if (litRun > 0) {
+				ops[numOps].block = -1;
+				ops[numOps].length = litRun;
+				numOps++;
+				crc = rf_crc32c(crc, data + litLen - litRun, litRun);
+				litRun = 0;
+			}
+			crc = rf_crc32c_combine(crc, strong, n);
+			if (numOps > 0 && ops[numOps - 1].block >= 0 && match == prevBlock + 1 &&
+			    ops[numOps - 1].length < RF_DELTA_MAXRUN) {
+				ops[numOps - 1].length += n;
+			} else {
+				ops[numOps].block = match;
+				ops[numOps].length = n;
+				numOps++;
+			}
+			prevBlock = match;
+			pos += n;
+			have = 0;
+		} else {
+			/* The first byte of the window is literal data; roll on by one. */
+			data[litLen++] = p[0];
+			litRun++;
+			a -= p[0];
+			b -= n * p[0];
+			n--;
+			if (avail > n + 1) {
+				a += p[n + 1];
+				b += a;
+				n++;
+			}
+			pos++;
+			if (n == 0)
+				have = 0;
+		}
+	}
+
+	if (litRun > 0) {
+		ops[numOps].block = -1;
+		ops[numOps].length = litRun;
+		numOps++;
+		crc = rf_crc32c(crc, data + litLen - litRun, litRun);
+	}
+
+	res->deltaStatus = OKAY;
+	res->fileSize = st.st_size;
+	res->nextOffset = pos;
+	res->crc = crc;
+	res->ops.ops_len = numOps;
+	res->ops.ops_val = ops;
+	res->data.RF_Data_T_len = litLen;
+	res->data.RF_Data_T_val = (char *)data;
+
+	return(OKAY);
+}
@@ -0,0 +1,30 @@
+/* rfdelta.h */
+
+/* Delta transfers, after rsync (see rf_delta in rf.x).
+// The client signs its copy of a file block by block with rf_delta_sign: a
+// weak checksum that can be rolled along the data a byte at a time, and a
+// CRC32C. The server runs rf_delta_scan over its own file, rolling the weak
+// checksum from byte to byte and working out the CRC32C only where the weak
+// one matches; every block found is sent as a reference to the client's copy
+// instead of as data.
+*/
+
+#ifndef RFDELTA_H
+#define RFDELTA_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "rf.h"
+
+#define RF_DELTA_MINBLOCK 2048    /* smallest block a client signs */
+#define RF_DELTA_MAXBLOCK 65536   /* largest block a client signs, and rf_delta accepts */
+#define RF_DELTA_OPSIZE   12      /* reply bytes taken by one RF_DeltaOp_T */
+
+long      rf_delta_block_size(long long size);
+u_int32_t rf_delta_weak(const unsigned char *buf, size_t len);
+int       rf_delta_sign(int fd, long long size, long blockSize, RF_BlockSig_T *sigs);
+size_t    rf_delta_scan_space(RF_DeltaRequest_T *req, long budget);
+int       rf_delta_scan(int fd, RF_DeltaRequest_T *req, long budget, void *work, RF_DeltaReply_T *res);
+
+#endif /* RFDELTA_H */
@@ -0,0 +1,162 @@
+/* rfdir.c */
+
+/* This file implements directory listing and bulk stat for clients (see rfdir.h).
+// The entries of each rf_readdirplus page are moved into one growing array;
+// their names, allocated by XDR, go with them, and only the page's own array
+// is freed.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <rpc/rpc.h>
+
+#include "rf.h"
+#include "rfdir.h"
+
+#define OKAY 0
+#define FAILED -1
+
+
+// *****************************************************
+//
+// rf_dir_list
+//     Lists a remote directory with the attributes of its entries.
+// input parameters: clnt       - CLIENT handle talking RFILE_VERS2.
+//                   dir        - Path of the directory on the server.
+//                   entries    - Set to the entries, sorted by name, to be freed
+//                                with rf_dir_free.
+//                   numEntries - Set to the number of entries.
+//                   rpcError   - Set to why a call failed, RPC_SUCCESS if none did.
+// return value: OKAY, or FAILED if a call failed, the server could not list
+//               the directory, or it kept changing.
+//
+// *****************************************************
+int rf_dir_list(CLIENT *clnt, char *dir, RF_DirEntry_T **entries, u_int *numEntries, enum clnt_stat *rpcError)
+{
+	RF_ReadDirRequest_T req;
+	RF_ReadDirReply_T res;
+	RF_DirEntry_T *all, *more;
+	u_int num, max;
+	int stale;
+
+	*rpcError = RPC_SUCCESS;
+	for (int tries = 0; tries <= RF_DIR_RETRIES; tries++) {
+		all = NULL;
+		num = max = 0;
+		stale = 0;
+		req.dirname = dir;
+		req.cookie = 0;
+		req.verifier = 0;
+		req.count = RF_MAXDIRPAGE;
+
+		for (;;) {
+			memset(&res, 0, sizeof(res));
+			if ((*rpcError = rf_readdirplus_2(&req, &res, clnt)) != RPC_SUCCESS) {
+				rf_dir_free(all, num);
+				return(FAILED);
+			}
+			if (res.readdirStatus == RF_READDIR_STALE) {
+				stale = 1;
+				xdr_free((xdrproc_t)xdr_RF_ReadDirReply_T, (char *)&res);
+				break;
+			}
+			/* A page that does not move on would never end the listing. */
+			if (res.readdirStatus != OKAY || (!res.eof && res.cookie <= req.cookie)) {
+				xdr_free((xdrproc_t)xdr_RF_ReadDirReply_T, (char *)&res);
+				rf_dir_free(all, num);
+				return(FAILED);
+			}
+
+			if (num + res.entries.entries_len > max) {
+				max = (num + res.entries.entries_len) * 2;
+				if ((more = realloc(all, max * sizeof(RF_DirEntry_T))) == NULL) {
+					xdr_free((xdrproc_t)xdr_RF_ReadDirReply_T, (char *)&res);
+					rf_dir_free(all, num);
+					return(FAILED);
+				}
+				all = more;
+			}
+			memcpy(all + num, res.entries.entries_val, res.entries.entries_len * sizeof(RF_DirEntry_T));
+			num += res.entries.entries_len;
+			res.entries.entries_len = 0;
+			xdr_free((xdrproc_t)xdr_RF_ReadDirReply_T, (char *)&res);
+
+			if (res.eof)
+				break;
+			req.cookie = res.cookie;
+			req.verifier = res.verifier;
+		}
+
+		if (!stale) {
+			*entries = all;
+			*numEntries = num;
+			return(OKAY);
+		}
+		rf_dir_free(all, num);
+	}
+
+	return(FAILED);
+}
+
+// *****************************************************
+//
+// rf_dir_free
+//     Frees a listing from rf_dir_list.
+// input parameters: entries    - The entries, or NULL.
+//                   numEntries - Number of entries.
+//
+// *****************************************************
+void rf_dir_free(RF_DirEntry_T *entries, u_int numEntries)
+{
+	for (u_int i = 0; i < numEntries; i++)
+		free(entries[i].name);
+	free(entries);
+}
+
+// *****************************************************
+//
+// rf_dir_stat
+//     Gets the attributes of remote paths, in as few calls as the transport allows.
+// input parameters: clnt     - CLIENT handle talking RFILE_VERS2.
+//                   maxBlock - Largest block the client handle can carry.
+//                   num      - Number of paths.
+//                   paths    - The paths on the server.
+//                   results  - Room for num results, set in the order of paths;
+//                              statStatus tells which paths were found.
+//                   rpcError - Set to why a call failed, RPC_SUCCESS if none did.
+// return value: OKAY, or FAILED if a call failed.
+//
+// *****************************************************
+int rf_dir_stat(CLIENT *clnt, long maxBlock, int num, char **paths, RF_StatResult_T *results, enum clnt_stat *rpcError)
+{
+	RF_StatManyRequest_T req;
+	RF_StatManyReply_T res;
+	long size;
+	int done = 0, k;
+
+	*rpcError = RPC_SUCCESS;
+	while (done < num) {
+		/* As many paths as fit in one call, at least one. */
+		for (k = 0, size = 0; done + k < num && k < RF_MAXSTAT; k++) {
+			size += 4 + ((strlen(paths[done + k]) + 3) & ~3);
+			if (k > 0 && size > maxBlock)
+				break;
+		}
+
+		req.paths.paths_len = k;
+		req.paths.paths_val = paths + done;
+		memset(&res, 0, sizeof(res));
+		if ((*rpcError = rf_statmany_2(&req, &res, clnt)) != RPC_SUCCESS)
+			return(FAILED);
+		if (res.results.results_len != k) {
+			xdr_free((xdrproc_t)xdr_RF_StatManyReply_T, (char *)&res);
+			return(FAILED);
+		}
+		memcpy(results + done, res.results.results_val, k * sizeof(RF_StatResult_T));
+		xdr_free((xdrproc_t)xdr_RF_StatManyReply_T, (char *)&res);
+		done += k;
+	}
+
+	return(OKAY);
+}
@@ -0,0 +1,25 @@
+/* rfdir.h */
+
+/* Client side directory listing and bulk stat.
+// rf_dir_list reads a whole remote directory with rf_readdirplus, one page
+// per call. If the directory changes before the last page, the server says
+// so and the listing starts again, a few times at most, so the entries
+// returned are those of one moment. rf_dir_stat gets the attributes of any
+// number of remote paths with rf_statmany, as many paths per call as the
+// transport takes.
+*/
+
+#ifndef RFDIR_H
+#define RFDIR_H
+
+#include <rpc/rpc.h>
+
+#include "rf.h"
+
+#define RF_DIR_RETRIES 3   /* listings started again before giving up on a changing directory */
+
+int  rf_dir_list(CLIENT *clnt, char *dir, RF_DirEntry_T **entries, u_int *numEntries, enum clnt_stat *rpcError);
+void rf_dir_free(RF_DirEntry_T *entries, u_int numEntries);
+int  rf_dir_stat(CLIENT *clnt, long maxBlock, int num, char **paths, RF_StatResult_T *results, enum clnt_stat *rpcError);
+
+#endif /* RFDIR_H */
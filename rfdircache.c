@@ -0,0 +1,312 @@
+/* rfdircache.c */
+
+/* This file implements the server's cache of directory scans (see rfdircache.h).
+// Scans are found by path through a hash table and kept on a list in order of
+// use, most recent first; one mutex guards both. Directories are read outside
+// the lock. A scan is freed once it has left the cache and the last request
+// using it lets go of it.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "rfdircache.h"
+
+#define OKAY 0
+#define FAILED -1
+
+static RF_DirScan_T **hash = NULL;
+static int hashSize;
+static RF_DirScan_T *mostRecent = NULL, *leastRecent = NULL;
+static int numDirs = 0;
+static int maxScans = 0;   /* 0 keeps no scan past its call */
+static pthread_mutex_t cacheLock = PTHREAD_MUTEX_INITIALIZER;
+
+
+// *****************************************************
+//
+// rf_dircache_bucket
+//     Finds the hash chain of a path.
+// input parameters: path - The path.
+// return value: Pointer to the head of the chain.
+//
+// *****************************************************
+static RF_DirScan_T **rf_dircache_bucket(char *path)
+{
+	unsigned long h = 2166136261UL;
+
+	while (*path != '\0')
+		h = (h ^ (unsigned char)*path++) * 16777619UL;
+
+	return(&hash[h % hashSize]);
+}
+
+// *****************************************************
+//
+// rf_dircache_free
+//     Frees a scan.
+// input parameters: scan - The scan, out of the cache and unused.
+//
+// *****************************************************
+static void rf_dircache_free(RF_DirScan_T *scan)
+{
+	for (int i = 0; i < scan->numNames; i++)
+		free(scan->names[i]);
+	free(scan->names);
+	free(scan->path);
+	free(scan);
+}
+
+// *****************************************************
+//
+// rf_dircache_remove
+//     Takes a scan out of the hash table and the use list, and frees it if no
+//     request is using it. Called with cacheLock held.
+// input parameters: scan - A cached scan.
+//
+// *****************************************************
+static void rf_dircache_remove(RF_DirScan_T *scan)
+{
+	RF_DirScan_T **p;
+
+	for (p = rf_dircache_bucket(scan->path); *p != scan; p = &(*p)->hashNext)
+		;
+	*p = scan->hashNext;
+	if (scan->prev != NULL)
+		scan->prev->next = scan->next;
+	else
+		mostRecent = scan->next;
+	if (scan->next != NULL)
+		scan->next->prev = scan->prev;
+	else
+		leastRecent = scan->prev;
+	scan->cached = 0;
+	numDirs--;
+	if (scan->refs == 0)
+		rf_dircache_free(scan);
+}
+
+// *****************************************************
+//
+// rf_dircache_same
+//     Tells whether a scan still lists a directory as it is.
+// input parameters: scan - The scan.
+//                   st   - fstat of the directory now.
+// return value: Non zero if it does.
+//
+// *****************************************************
+static int rf_dircache_same(RF_DirScan_T *scan, struct stat *st)
+{
+	return(scan->dev == st->st_dev && scan->ino == st->st_ino &&
+	       scan->mtime.tv_sec == st->st_mtim.tv_sec && scan->mtime.tv_nsec == st->st_mtim.tv_nsec &&
+	       scan->ctime.tv_sec == st->st_ctim.tv_sec && scan->ctime.tv_nsec == st->st_ctim.tv_nsec);
+}
+
+// *****************************************************
+//
+// rf_dircache_compare
+//     Orders names for qsort.
+// input parameters: a, b - Pointers to the names.
+// return value: As strcmp.
+//
+// *****************************************************
+static int rf_dircache_compare(const void *a, const void *b)
+{
+	return(strcmp(*(char * const *)a, *(char * const *)b));
+}
+
+// *****************************************************
+//
+// rf_dircache_scan
+//     Reads the names in a directory.
+// input parameters: path  - Path of the directory.
+//                   dirFd - The directory, open. Left open.
+//                   st    - fstat of the directory before it was read.
+// return value: The scan, with one reference, or NULL if it could not be read.
+//
+// *****************************************************
+static RF_DirScan_T *rf_dircache_scan(char *path, int dirFd, struct stat *st)
+{
+	RF_DirScan_T *scan;
+	struct dirent *d;
+	struct stat after;
+	struct timespec now;
+	DIR *dir;
+	int fd, maxNames = 0;
+	char **more;
+
+	if ((scan = calloc(1, sizeof(RF_DirScan_T))) == NULL || (scan->path = strdup(path)) == NULL) {
+		free(scan);
+		return(NULL);
+	}
+	if ((fd = dup(dirFd)) < 0 || (dir = fdopendir(fd)) == NULL) {
+		if (fd >= 0)
+			close(fd);
+		rf_dircache_free(scan);
+		return(NULL);
+	}
+	rewinddir(dir);
+
+	while ((d = readdir(dir)) != NULL) {
+		if (strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0)
+			continue;
+		if (scan->numNames == maxNames) {
+			if ((more = realloc(scan->names, (maxNames * 2 + 64) * sizeof(char *))) == NULL)
+				break;
+			scan->names = more;
+			maxNames = maxNames * 2 + 64;
+		}
+		if ((scan->names[scan->numNames] = strdup(d->d_name)) == NULL)
+			break;
+		scan->numNames++;
+	}
+	if (d != NULL) {
+		/* Out of memory: a partial listing must not pass for the whole directory. */
+		closedir(dir);
+		rf_dircache_free(scan);
+		return(NULL);
+	}
+	closedir(dir);
+	qsort(scan->names, scan->numNames, sizeof(char *), rf_dircache_compare);
+
+	scan->dev = st->st_dev;
+	scan->ino = st->st_ino;
+	scan->mtime = st->st_mtim;
+	scan->ctime = st->st_ctim;
+	scan->verifier = ((unsigned long long)st->st_ino * 0x9E3779B97F4A7C15ULL) ^
+	                 ((unsigned long long)st->st_mtim.tv_sec * 1000000000ULL + st->st_mtim.tv_nsec) ^
+	                 ((unsigned long long)st->st_ctim.tv_sec * 1000000000ULL + st->st_ctim.tv_nsec) * 0xC2B2AE3D27D4EB4FULL;
+	scan->refs = 1;
+
+	/* A change in the clock tick the directory last changed in would not show in its times. */
+	clock_gettime(CLOCK_REALTIME, &now);
+	if (fstat(dirFd, &after) != 0 || !rf_dircache_same(scan, &after) ||
+	    now.tv_sec - st->st_mtim.tv_sec < 2 || now.tv_sec - st->st_ctim.tv_sec < 2)
+		scan->racy = 1;
+
+	return(scan);
+}
+
+// *****************************************************
+//
+// rf_dircache_init
+//     Allocates the cache.
+// input parameters: maxDirs - Most scans kept; 0 or less reads the directory
+//                             again for every call.
+// return value: OKAY, or FAILED if it could not be allocated.
+//
+// *****************************************************
+int rf_dircache_init(int maxDirs)
+{
+	maxScans = (maxDirs > 0) ? maxDirs : 0;
+	hashSize = maxScans * 2 + 1;
+	if ((hash = calloc(hashSize, sizeof(RF_DirScan_T *))) == NULL)
+		return(FAILED);
+
+	return(OKAY);
+}
+
+// *****************************************************
+//
+// rf_dircache_get
+//     Opens a directory and finds its scan, reading the directory if no
+//     cached scan lists it as it is now. Every successful call must be
+//     matched by rf_dircache_put, and the directory closed.
+// input parameters: path  - Path of the directory.
+//                   dirFd - Set to the directory, open, for fstatat on its entries.
+// return value: The scan, or NULL if the path is not a directory that can be read.
+//
+// *****************************************************
+RF_DirScan_T *rf_dircache_get(char *path, int *dirFd)
+{
+	RF_DirScan_T *scan, *old;
+	struct stat st;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0)
+		return(NULL);
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		return(NULL);
+	}
+
+	pthread_mutex_lock(&cacheLock);
+	if (hash != NULL) {
+		for (scan = *rf_dircache_bucket(path); scan != NULL; scan = scan->hashNext) {
+			if (strcmp(scan->path, path) != 0)
+				continue;
+			if (!rf_dircache_same(scan, &st)) {
+				rf_dircache_remove(scan);
+				break;
+			}
+			/* Move to the front of the use list. */
+			if (scan->prev != NULL) {
+				scan->prev->next = scan->next;
+				if (scan->next != NULL)
+					scan->next->prev = scan->prev;
+				else
+					leastRecent = scan->prev;
+				scan->prev = NULL;
+				scan->next = mostRecent;
+				mostRecent->prev = scan;
+				mostRecent = scan;
+			}
+			scan->refs++;
+			pthread_mutex_unlock(&cacheLock);
+			*dirFd = fd;
+			return(scan);
+		}
+	}
+	pthread_mutex_unlock(&cacheLock);
+
+	if ((scan = rf_dircache_scan(path, fd, &st)) == NULL) {
+		close(fd);
+		return(NULL);
+	}
+
+	/* Cache it, unless another request cached a scan of the same path meanwhile. */
+	pthread_mutex_lock(&cacheLock);
+	for (old = (hash != NULL) ? *rf_dircache_bucket(path) : NULL; old != NULL; old = old->hashNext)
+		if (strcmp(old->path, path) == 0)
+			break;
+	if (maxScans > 0 && old == NULL && !scan->racy) {
+		while (numDirs >= maxScans)
+			rf_dircache_remove(leastRecent);
+		scan->hashNext = *rf_dircache_bucket(path);
+		*rf_dircache_bucket(path) = scan;
+		scan->next = mostRecent;
+		if (mostRecent != NULL)
+			mostRecent->prev = scan;
+		else
+			leastRecent = scan;
+		mostRecent = scan;
+		scan->cached = 1;
+		numDirs++;
+	}
+	pthread_mutex_unlock(&cacheLock);
+
+	*dirFd = fd;
+
+	return(scan);
+}
+
+// *****************************************************
+//
+// rf_dircache_put
+//     Lets go of a scan from rf_dircache_get.
+// input parameters: scan - The scan.
+//
+// *****************************************************
+void rf_dircache_put(RF_DirScan_T *scan)
+{
+	pthread_mutex_lock(&cacheLock);
+	if (--scan->refs == 0 && !scan->cached)
+		rf_dircache_free(scan);
+	pthread_mutex_unlock(&cacheLock);
+}
@@ -0,0 +1,51 @@
+/* rfdircache.h */
+
+/* Server cache of directory scans for rf_readdirplus.
+// A listing is read in pages, each call picking up where the last one
+// stopped, so the names of a directory are read once, sorted, and kept here
+// for the calls that follow instead of being read again for every page. The
+// attributes of the entries are not kept: every page stats its own entries,
+// so sizes and times are those at the time of the call.
+//
+// A scan is used as long as the directory is the same one (device and inode)
+// and its modification and change times are those seen when it was scanned,
+// which every creation, removal or rename in the directory updates. A scan
+// taken within two seconds of the directory's last change may have missed a
+// change made in the same clock tick, so it is not trusted past the call it
+// was made for. At most maxDirs scans are kept, least recently used dropped
+// first.
+*/
+
+#ifndef RFDIRCACHE_H
+#define RFDIRCACHE_H
+
+#include <sys/types.h>
+#include <time.h>
+
+#define RF_DIRCACHE_DEFAULT_DIRS 64   /* scans kept when the caller has no preference */
+
+typedef struct RF_DirScan_T
+{
+	unsigned long long	verifier;	/* changes whenever the directory does */
+	int					numNames;
+	char				**names;	/* the entries, sorted, without . and .. */
+
+	/* Kept by rfdircache.c. */
+	char				*path;
+	dev_t				dev;
+	ino_t				ino;
+	struct timespec		mtime;
+	struct timespec		ctime;
+	int					racy;		/* too close to a change of the directory to be cached */
+	int					refs;		/* rf_dircache_get calls not yet matched by rf_dircache_put */
+	int					cached;		/* still in the cache */
+	struct RF_DirScan_T	*hashNext;
+	struct RF_DirScan_T	*prev;		/* towards the most recently used */
+	struct RF_DirScan_T	*next;		/* towards the least recently used */
+} RF_DirScan_T;
+
+int  rf_dircache_init(int maxDirs);
+RF_DirScan_T *rf_dircache_get(char *path, int *dirFd);
+void rf_dircache_put(RF_DirScan_T *scan);
+
+#endif /* RFDIRCACHE_H */
@@ -0,0 +1,289 @@
+/* rfdrc.c */
+
+/* This file implements the duplicate request cache (see rfdrc.h).
+// Entries sit in a hash table and on a list in arrival order; one mutex
+// guards both. An entry is created, without a reply, when a call is first
+// seen and gets its reply when the call has been served. Eviction always
+// takes the oldest entries, served or not; a call whose entry was evicted
+// while it ran is simply not remembered.
+// Evicted entries are kept on a spare list, with their reply buffer if it is
+// small, and reused for the next calls, so a full cache turning over its
+// entries does not go to the heap for every call.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <rpc/rpc.h>
+
+#include "rf.h"
+#include "rfdrc.h"
+
+#define OKAY 0
+#define FAILED -1
+
+#define RF_DRC_KEEPBUF 1024   /* largest reply buffer kept with a spare entry */
+
+typedef struct RF_DrcEntry_T
+{
+	RF_DrcKey_T	key;
+	char		*reply;		/* encoded reply, in buf; NULL while the call is being served */
+	u_int		len;
+	char		*buf;		/* memory for the reply */
+	u_int		bufSize;
+	struct RF_DrcEntry_T *hashNext;	/* also links the spare entries */
+	struct RF_DrcEntry_T *newer;	/* next entry in arrival order */
+	struct RF_DrcEntry_T *older;
+} RF_DrcEntry_T;
+
+static RF_DrcEntry_T **hash = NULL;   /* NULL while the cache is off */
+static int hashSize;
+static RF_DrcEntry_T *oldest = NULL, *newest = NULL;
+static RF_DrcEntry_T *spare = NULL;   /* evicted entries kept for reuse */
+static int numEntries = 0, maxEntries;
+static long numBytes = 0, maxBytes;
+static long long numHits = 0, numDropped = 0;
+static pthread_mutex_t drcLock = PTHREAD_MUTEX_INITIALIZER;
+
+
+// *****************************************************
+//
+// rf_drc_init
+//     Allocates the cache.
+// input parameters: entries - Most calls remembered; 0 or less turns the cache off.
+//                   bytes   - Most reply bytes kept.
+// return value: OKAY, or FAILED if it could not be allocated (the cache is then off).
+//
+// *****************************************************
+int rf_drc_init(int entries, long bytes)
+{
+	if (entries <= 0)
+		return(OKAY);
+
+	maxEntries = entries;
+	maxBytes = bytes;
+	hashSize = entries + 1;
+	if ((hash = calloc(hashSize, sizeof(RF_DrcEntry_T *))) == NULL)
+		return(FAILED);
+
+	return(OKAY);
+}
+
+// *****************************************************
+//
+// rf_drc_wanted
+//     Tells whether calls to a procedure go through the cache: those that
+//     change server state, so that running them twice is not harmless.
+// input parameters: vers - RFILE version.
+//                   proc - Procedure number.
+// return value: Non zero if the procedure's calls are cached.
+//
+// *****************************************************
+int rf_drc_wanted(u_int32_t vers, u_int32_t proc)
+{
+	if (hash == NULL)
+		return(0);
+
+	switch (proc) {
+	case rf_openfile:
+	case rf_readfile:
+	case rf_closefile:
+	case rf_writefile:
+		return(vers == RFILE_VERS || vers == RFILE_VERS2);
+	case rf_storefile:
+	case rf_closesync:
+		return(vers == RFILE_VERS2);
+	default:
+		return(0);
+	}
+}
+
+// *****************************************************
+//
+// rf_drc_bucket
+//     Finds the hash chain of a key.
+// input parameters: key - The key.
+// return value: Pointer to the head of the chain.
+//
+// *****************************************************
+static RF_DrcEntry_T **rf_drc_bucket(RF_DrcKey_T *key)
+{
+	unsigned long h = key->xid * 2654435761UL;
+
+	for (socklen_t i = 0; i < key->addrLen; i++)
+		h = (h ^ ((unsigned char *)&key->addr)[i]) * 16777619UL;
+	h ^= key->proc + (key->vers << 8);
+
+	return(&hash[h % hashSize]);
+}
+
+// *****************************************************
+//
+// rf_drc_find
+//     Looks up a key. Called with drcLock held.
+// input parameters: key - The key.
+// return value: The entry, or NULL.
+//
+// *****************************************************
+static RF_DrcEntry_T *rf_drc_find(RF_DrcKey_T *key)
+{
+	RF_DrcEntry_T *e;
+
+	for (e = *rf_drc_bucket(key); e != NULL; e = e->hashNext)
+		if (e->key.xid == key->xid && e->key.proc == key->proc && e->key.vers == key->vers &&
+		    e->key.prog == key->prog && e->key.addrLen == key->addrLen &&
+		    memcmp(&e->key.addr, &key->addr, key->addrLen) == 0)
+			return(e);
+
+	return(NULL);
+}
+
+// *****************************************************
+//
+// rf_drc_remove
+//     Takes an entry out of the cache and puts it on the spare list. Called
+//     with drcLock held.
+// input parameters: e - The entry.
+//
+// *****************************************************
+static void rf_drc_remove(RF_DrcEntry_T *e)
+{
+	RF_DrcEntry_T **pp = rf_drc_bucket(&e->key);
+
+	while (*pp != e)
+		pp = &(*pp)->hashNext;
+	*pp = e->hashNext;
+
+	if (e->older != NULL)
+		e->older->newer = e->newer;
+	else
+		oldest = e->newer;
+	if (e->newer != NULL)
+		e->newer->older = e->older;
+	else
+		newest = e->older;
+
+	numEntries--;
+	numBytes -= e->len;
+	if (e->bufSize > RF_DRC_KEEPBUF) {
+		free(e->buf);
+		e->buf = NULL;
+		e->bufSize = 0;
+	}
+	e->hashNext = spare;
+	spare = e;
+}
+
+// *****************************************************
+//
+// rf_drc_begin
+//     Checks a call against the cache before it is served. A call seen before
+//     is answered here with the kept reply, or dropped if its first copy is
+//     still being served; a new call is remembered as being served.
+// input parameters: key  - The call.
+//                   sock - The datagram socket the call came in on.
+// return value: RF_DRC_NEW if the call must be served and then passed to
+//               rf_drc_end, RF_DRC_DUPLICATE if it has been dealt with.
+//
+// *****************************************************
+int rf_drc_begin(RF_DrcKey_T *key, int sock)
+{
+	RF_DrcEntry_T *e;
+
+	if (hash == NULL)
+		return(RF_DRC_NEW);
+
+	pthread_mutex_lock(&drcLock);
+	if ((e = rf_drc_find(key)) != NULL) {
+		if (e->reply != NULL) {
+			sendto(sock, e->reply, e->len, 0, (struct sockaddr *)&key->addr, key->addrLen);
+			numHits++;
+		} else {
+			numDropped++;
+		}
+		pthread_mutex_unlock(&drcLock);
+		return(RF_DRC_DUPLICATE);
+	}
+
+	/* Without memory the call is served, just not remembered. */
+	if ((e = spare) != NULL)
+		spare = e->hashNext;
+	else
+		e = calloc(1, sizeof(RF_DrcEntry_T));
+	if (e != NULL) {
+		RF_DrcEntry_T **bucket = rf_drc_bucket(key);
+
+		e->key = *key;
+		e->reply = NULL;
+		e->len = 0;
+		e->newer = NULL;
+		e->hashNext = *bucket;
+		*bucket = e;
+		e->older = newest;
+		if (newest != NULL)
+			newest->newer = e;
+		else
+			oldest = e;
+		newest = e;
+		numEntries++;
+		while (numEntries > maxEntries)
+			rf_drc_remove(oldest);
+	}
+	pthread_mutex_unlock(&drcLock);
+
+	return(RF_DRC_NEW);
+}
+
+// *****************************************************
+//
+// rf_drc_end
+//     Keeps the reply to a call rf_drc_begin found new.
+// input parameters: key   - The call.
+//                   reply - The encoded reply as sent, or NULL if none was
+//                           sent; the call is then forgotten.
+//                   len   - Bytes in reply.
+//
+// *****************************************************
+void rf_drc_end(RF_DrcKey_T *key, char *reply, u_int len)
+{
+	RF_DrcEntry_T *e;
+
+	if (hash == NULL)
+		return;
+
+	pthread_mutex_lock(&drcLock);
+	if ((e = rf_drc_find(key)) != NULL && e->reply == NULL) {
+		if (reply != NULL && len <= maxBytes && e->bufSize < len) {
+			free(e->buf);
+			e->bufSize = ((e->buf = malloc(len)) != NULL) ? len : 0;
+		}
+		if (reply == NULL || len > maxBytes || e->bufSize < len || e->buf == NULL) {
+			rf_drc_remove(e);
+		} else {
+			e->reply = e->buf;
+			memcpy(e->reply, reply, len);
+			e->len = len;
+			numBytes += len;
+			while (numBytes > maxBytes)
+				rf_drc_remove(oldest);
+		}
+	}
+	pthread_mutex_unlock(&drcLock);
+}
+
+// *****************************************************
+//
+// rf_drc_counts
+//     Reports how many duplicate calls the cache dealt with.
+// input parameters: hits    - Set to the duplicates answered with a kept reply.
+//                   dropped - Set to the duplicates dropped while their first copy was served.
+//
+// *****************************************************
+void rf_drc_counts(long long *hits, long long *dropped)
+{
+	pthread_mutex_lock(&drcLock);
+	*hits = numHits;
+	*dropped = numDropped;
+	pthread_mutex_unlock(&drcLock);
+}
@@ -0,0 +1,46 @@
+/* rfdrc.h */
+
+/* Server duplicate request cache.
+// A UDP client that does not get a reply in time sends the same call again,
+// with the same XID. For procedures that change state (open, read and write
+// at the file position, close, store) running the call twice gives the wrong
+// result: a write is appended twice, a read skips data, an open leaks a handle.
+//
+// The transport layer asks rf_drc_begin about every such call before it is
+// dispatched. The first copy of a call is served and its encoded reply is
+// kept with rf_drc_end; a copy arriving later gets that same reply back, and
+// a copy arriving while the first is still being served is dropped.
+//
+// Calls are keyed by client address, XID, program, version and procedure,
+// and found through a hash table. The oldest replies are dropped when the
+// cache holds more than its number of entries or bytes.
+*/
+
+#ifndef RFDRC_H
+#define RFDRC_H
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#define RF_DRC_DEFAULT_ENTRIES 4096      /* calls remembered when the caller has no preference */
+#define RF_DRC_DEFAULT_BYTES (16 << 20)  /* most reply bytes kept */
+
+enum { RF_DRC_NEW, RF_DRC_DUPLICATE };
+
+typedef struct RF_DrcKey_T
+{
+	struct sockaddr_storage	addr;	/* client address */
+	socklen_t	addrLen;
+	u_int32_t	xid;
+	u_int32_t	prog;
+	u_int32_t	vers;
+	u_int32_t	proc;
+} RF_DrcKey_T;
+
+int  rf_drc_init(int entries, long bytes);
+int  rf_drc_wanted(u_int32_t vers, u_int32_t proc);
+int  rf_drc_begin(RF_DrcKey_T *key, int sock);
+void rf_drc_end(RF_DrcKey_T *key, char *reply, u_int len);
+void rf_drc_counts(long long *hits, long long *dropped);
+
+#endif /* RFDRC_H */
@@ -0,0 +1,340 @@
+/* rffdcache.c */
+
+/* This file implements the server's open file cache (see rffdcache.h).
+// Entries are found by path through a hash table and kept on a list in order
+// of use, most recent first; one mutex guards both. Files are opened, and
+// closed, outside the lock: a close goes through rf_handle_release, which
+// waits for requests still using the file.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "rfhandle.h"
+#include "rffdcache.h"
+
+#define OKAY 0
+#define FAILED -1
+
+typedef struct RF_FdEntry_T
+{
+	char		*path;
+	long		handle;		/* slot in the handle table holding the open file */
+	dev_t		dev;		/* identity of the file that was opened */
+	ino_t		ino;
+	int			write;		/* opened for reading and writing */
+	time_t		lastUsed;	/* rf_fdcache_now() of the last lookup */
+	struct RF_FdEntry_T *hashNext;
+	struct RF_FdEntry_T *prev;	/* towards the most recently used */
+	struct RF_FdEntry_T *next;	/* towards the least recently used */
+} RF_FdEntry_T;
+
+static RF_FdEntry_T **hash = NULL;
+static int hashSize;
+static RF_FdEntry_T *mostRecent = NULL, *leastRecent = NULL;
+static int numFiles = 0;
+static int maxOpen;
+static int idleTimeout;
+static pthread_mutex_t cacheLock = PTHREAD_MUTEX_INITIALIZER;
+
+
+// *****************************************************
+//
+// rf_fdcache_now
+//     Reads the monotonic clock.
+// return value: Current time in seconds.
+//
+// *****************************************************
+static time_t rf_fdcache_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return(ts.tv_sec);
+}
+
+// *****************************************************
+//
+// rf_fdcache_bucket
+//     Finds the hash chain of a path.
+// input parameters: path - The path.
+// return value: Pointer to the head of the chain.
+//
+// *****************************************************
+static RF_FdEntry_T **rf_fdcache_bucket(char *path)
+{
+	unsigned long h = 2166136261UL;
+
+	while (*path != '\0')
+		h = (h ^ (unsigned char)*path++) * 16777619UL;
+
+	return(&hash[h % hashSize]);
+}
+
+// *****************************************************
+//
+// rf_fdcache_unlink
+//     Takes an entry out of the hash table and the use list. Called with
+//     cacheLock held; the caller closes the entry afterwards.
+// input parameters: e - The entry.
+//
+// *****************************************************
+static void rf_fdcache_unlink(RF_FdEntry_T *e)
+{
+	RF_FdEntry_T **pp = rf_fdcache_bucket(e->path);
+
+	while (*pp != e)
+		pp = &(*pp)->hashNext;
+	*pp = e->hashNext;
+	e->hashNext = NULL;
+
+	if (e->prev != NULL)
+		e->prev->next = e->next;
+	else
+		mostRecent = e->next;
+	if (e->next != NULL)
+		e->next->prev = e->prev;
+	else
+		leastRecent = e->prev;
+	numFiles--;
+}
+
+// *****************************************************
+//
+// rf_fdcache_link
+//     Puts an entry in the hash table, as the most recently used. Called with
+//     cacheLock held.
+// input parameters: e - The entry.
+//
+// *****************************************************
+static void rf_fdcache_link(RF_FdEntry_T *e)
+{
+	RF_FdEntry_T **bucket = rf_fdcache_bucket(e->path);
+
+	e->hashNext = *bucket;
+	*bucket = e;
+
+	e->prev = NULL;
+	e->next = mostRecent;
+	if (mostRecent != NULL)
+		mostRecent->prev = e;
+	else
+		leastRecent = e;
+	mostRecent = e;
+	numFiles++;
+}
+
+// *****************************************************
+//
+// rf_fdcache_close
+//     Closes the files of a chain of unlinked entries (chained by hashNext)
+//     and frees them. Called without cacheLock.
+// input parameters: e - First entry, or NULL.
+//
+// *****************************************************
+static void rf_fdcache_close(RF_FdEntry_T *e)
+{
+	RF_FdEntry_T *next;
+	int fd;
+
+	for (; e != NULL; e = next) {
+		next = e->hashNext;
+		if ((fd = rf_handle_release(e->handle)) >= 0)
+			close(fd);
+		free(e->path);
+		free(e);
+	}
+}
+
+// *****************************************************
+//
+// rf_fdcache_sweeper
+//     Sweeper thread body. Closes files that have not been used for idleTimeout seconds.
+// input parameters: arg - Unused.
+// return value: Never returns.
+//
+// *****************************************************
+static void *rf_fdcache_sweeper(void *arg)
+{
+	RF_FdEntry_T *idle, *e;
+
+	for (;;) {
+		sleep(idleTimeout > 4 ? idleTimeout / 4 : 1);
+
+		idle = NULL;
+		pthread_mutex_lock(&cacheLock);
+		while ((e = leastRecent) != NULL && rf_fdcache_now() - e->lastUsed >= idleTimeout) {
+			rf_fdcache_unlink(e);
+			e->hashNext = idle;
+			idle = e;
+		}
+		pthread_mutex_unlock(&cacheLock);
+		rf_fdcache_close(idle);
+	}
+
+	return(NULL);
+}
+
+// *****************************************************
+//
+// rf_fdcache_init
+//     Allocates the cache and starts the sweeper thread.
+// input parameters: maxFiles - Most files kept open, at least 1. Each one
+//                              takes a slot of the handle table.
+//                   idleSec  - Seconds an unused file stays open; 0 or less
+//                              keeps files open until room is needed.
+// return value: OKAY, or FAILED if it could not be set up.
+//
+// *****************************************************
+int rf_fdcache_init(int maxFiles, int idleSec)
+{
+	pthread_t thread;
+
+	maxOpen = (maxFiles > 0) ? maxFiles : 1;
+	idleTimeout = idleSec;
+	hashSize = maxOpen * 2 + 1;
+	if ((hash = calloc(hashSize, sizeof(RF_FdEntry_T *))) == NULL)
+		return(FAILED);
+
+	if (idleTimeout > 0) {
+		if (pthread_create(&thread, NULL, rf_fdcache_sweeper, NULL) != 0)
+			return(FAILED);
+		pthread_detach(thread);
+	}
+
+	return(OKAY);
+}
+
+// *****************************************************
+//
+// rf_fdcache_get
+//     Looks up an open file by path, opening it if it is not cached, and takes
+//     a reference on it. Every successful call must be matched by
+//     rf_handle_put(*handle).
+// input parameters: path   - Path of the file.
+//                   write  - Non zero if the file will be written; it is then
+//                            opened for reading and writing, and created if needed.
+//                   handle - Set to the file's handle.
+// return value: The open file descriptor, or FAILED if the file can not be opened.
+//
+// *****************************************************
+int rf_fdcache_get(char *path, int write, long *handle)
+{
+	RF_FdEntry_T *e, *stale = NULL, *victims = NULL;
+	struct stat st;
+	int found, fd;
+
+	if (hash == NULL)
+		return(FAILED);
+
+	/* The path may name another file than the cached one by now. */
+	found = (stat(path, &st) == 0);
+	if (!found && (!write || errno != ENOENT))
+		return(FAILED);
+
+	pthread_mutex_lock(&cacheLock);
+	for (e = *rf_fdcache_bucket(path); e != NULL; e = e->hashNext)
+		if (strcmp(e->path, path) == 0)
+			break;
+	if (e != NULL && (!found || e->dev != st.st_dev || e->ino != st.st_ino || (write && !e->write))) {
+		rf_fdcache_unlink(e);
+		stale = e;
+		e = NULL;
+	}
+	if (e != NULL) {
+		/* Move to the front of the use list. */
+		rf_fdcache_unlink(e);
+		rf_fdcache_link(e);
+		e->lastUsed = rf_fdcache_now();
+		*handle = e->handle;
+		fd = rf_handle_get(e->handle);
+		pthread_mutex_unlock(&cacheLock);
+		return(fd);
+	}
+	pthread_mutex_unlock(&cacheLock);
+	rf_fdcache_close(stale);
+
+	if ((e = calloc(1, sizeof(RF_FdEntry_T))) == NULL || (e->path = strdup(path)) == NULL) {
+		free(e);
+		return(FAILED);
+	}
+	if ((fd = open(path, write ? O_RDWR | O_CREAT : O_RDONLY, 0666)) < 0 || fstat(fd, &st) != 0) {
+		if (fd >= 0)
+			close(fd);
+		free(e->path);
+		free(e);
+		return(FAILED);
+	}
+	e->dev = st.st_dev;
+	e->ino = st.st_ino;
+	e->write = write;
+
+	/* A full handle table gives up the least recently used cached file. */
+	if ((e->handle = rf_handle_alloc(fd)) == FAILED) {
+		pthread_mutex_lock(&cacheLock);
+		if ((stale = leastRecent) != NULL)
+			rf_fdcache_unlink(stale);
+		pthread_mutex_unlock(&cacheLock);
+		if (stale != NULL) {
+			rf_fdcache_close(stale);
+			e->handle = rf_handle_alloc(fd);
+		}
+		if (e->handle == FAILED) {
+			close(fd);
+			free(e->path);
+			free(e);
+			return(FAILED);
+		}
+	}
+
+	pthread_mutex_lock(&cacheLock);
+	/* Another request may have opened the same path meanwhile; the newer open wins. */
+	for (stale = *rf_fdcache_bucket(path); stale != NULL; stale = stale->hashNext)
+		if (strcmp(stale->path, path) == 0)
+			break;
+	if (stale != NULL) {
+		rf_fdcache_unlink(stale);
+		stale->hashNext = victims;
+		victims = stale;
+	}
+	e->lastUsed = rf_fdcache_now();
+	rf_fdcache_link(e);
+	while (numFiles > maxOpen) {
+		stale = leastRecent;
+		rf_fdcache_unlink(stale);
+		stale->hashNext = victims;
+		victims = stale;
+	}
+	*handle = e->handle;
+	fd = rf_handle_get(e->handle);
+	pthread_mutex_unlock(&cacheLock);
+	rf_fdcache_close(victims);
+
+	return(fd);
+}
+
+// *****************************************************
+//
+// rf_fdcache_count
+//     Reports how many files the cache holds open.
+// return value: Number of cached files.
+//
+// *****************************************************
+long rf_fdcache_count(void)
+{
+	long count;
+
+	pthread_mutex_lock(&cacheLock);
+	count = numFiles;
+	pthread_mutex_unlock(&cacheLock);
+
+	return(count);
+}
@@ -0,0 +1,29 @@
+/* rffdcache.h */
+
+/* Server cache of open files for the stateless procedures.
+// rf_readpath and rf_writepath name a file by path on every call instead of
+// by a handle from rf_openfile, so the server keeps no per-client state and
+// a lost close can not leak anything. To avoid an open and a close per call,
+// the files they use are kept open here, most recently used first.
+//
+// Each cached file holds a slot in the handle table (see rfhandle.h), which
+// keeps it from being closed while a request is still using it and lets the
+// block cache read ahead on it. At most maxFiles are open at once; the least
+// recently used one is closed to make room, and a sweeper thread closes files
+// that were not used for idleSec seconds.
+//
+// Every lookup checks with stat that the path still names the cached file, so
+// a file that was renamed over or deleted and created again is reopened.
+*/
+
+#ifndef RFFDCACHE_H
+#define RFFDCACHE_H
+
+#define RF_FDCACHE_DEFAULT_FILES 256   /* files kept open when the caller has no preference */
+#define RF_FDCACHE_DEFAULT_IDLE 30     /* seconds a file stays open unused */
+
+int  rf_fdcache_init(int maxFiles, int idleSec);
+int  rf_fdcache_get(char *path, int write, long *handle);
+long rf_fdcache_count(void);
+
+#endif /* RFFDCACHE_H */
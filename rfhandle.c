@@ -0,0 +1,248 @@
+/* rfhandle.c */
+
+/* This file implements the server's file handle table (see rfhandle.h).
+// Slots are allocated and released in O(1) through a singly linked free list
+// threaded through the unused slots. Each slot carries a generation number
+// that is bumped on release, and that generation is encoded in the handle
+// given to the RF_CLIENT.
+// The table is shared by every server worker thread and is guarded by one mutex.
+// rf_handle_get takes a reference on the slot which rf_handle_put drops, and
+// rf_handle_release waits for those references so a file is never closed
+// while another thread is still reading or writing it.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "rfhandle.h"
+
+#define OKAY 0
+#define FAILED -1
+
+typedef struct RF_HandleSlot_T
+{
+	int		fd;			/* open file descriptor, -1 when the slot is free */
+	long	gen;		/* generation of the slot, bumped on every release */
+	long	nextFree;	/* index of the next free slot, -1 terminates the list */
+	long	refs;		/* rf_handle_get calls not yet matched by rf_handle_put */
+	int		closing;	/* set by rf_handle_release, blocks new lookups */
+} RF_HandleSlot_T;
+
+static RF_HandleSlot_T *slots = NULL; /* the table itself */
+static long numSlots = 0;             /* size of the table */
+static long freeHead = -1;            /* first free slot, -1 if the table is full */
+static long numOpen = 0;              /* number of slots in use */
+static pthread_mutex_t tableLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t refsDropped = PTHREAD_COND_INITIALIZER;
+
+
+// *****************************************************
+//
+// rf_handle_init
+//     Allocates the handle table. Called once before the first allocation;
+//     rf_handle_alloc calls it lazily with the default size if needed.
+// input parameters: maxHandles - Upper bound on simultaneously open handles.
+//                                If <= 0, RFSERVER_MAX_HANDLES or RF_MAX_HANDLES is used.
+// return value: OKAY if the table is ready, FAILED otherwise.
+//
+// *****************************************************
+int rf_handle_init(long maxHandles)
+{
+	char *env;
+	RF_HandleSlot_T *table;
+
+	pthread_mutex_lock(&tableLock);
+	if (slots != NULL) {
+		pthread_mutex_unlock(&tableLock);
+		return(OKAY);
+	}
+
+	if (maxHandles <= 0) {
+		maxHandles = RF_MAX_HANDLES;
+		if ((env = getenv("RFSERVER_MAX_HANDLES")) != NULL && atol(env) > 0)
+			maxHandles = atol(env);
+	}
+	if (maxHandles > RF_HANDLE_INDEX_MASK + 1)
+		maxHandles = RF_HANDLE_INDEX_MASK + 1;
+
+	table = calloc(maxHandles, sizeof(RF_HandleSlot_T));
+	if (table == NULL) {
+		pthread_mutex_unlock(&tableLock);
+		return(FAILED);
+	}
+
+	/* Chain every slot into the free list, lowest index first. */
+	for (long i = 0; i < maxHandles; i++) {
+		table[i].fd = -1;
+		table[i].gen = 1;
+		table[i].nextFree = (i + 1 < maxHandles) ? i + 1 : -1;
+	}
+	slots = table;
+	numSlots = maxHandles;
+	freeHead = 0;
+	numOpen = 0;
+	pthread_mutex_unlock(&tableLock);
+
+	return(OKAY);
+}
+
+// *****************************************************
+//
+// rf_handle_lookup
+//     Decodes a handle into its slot, checking range, generation and use.
+//     Caller must hold tableLock.
+// input parameters: handle - A handle previously returned by rf_handle_alloc.
+// return value: Pointer to the slot, or NULL if the handle is not valid.
+//
+// *****************************************************
+static RF_HandleSlot_T *rf_handle_lookup(long handle)
+{
+	long index = handle & RF_HANDLE_INDEX_MASK;
+	long gen = (handle >> RF_HANDLE_INDEX_BITS) & RF_HANDLE_GEN_MASK;
+
+	if (slots == NULL || handle < 0 || index >= numSlots)
+		return(NULL);
+	if (slots[index].fd < 0 || slots[index].closing || (slots[index].gen & RF_HANDLE_GEN_MASK) != gen)
+		return(NULL);
+
+	return(&slots[index]);
+}
+
+// *****************************************************
+//
+// rf_handle_alloc
+//     Stores an open file in a free slot.
+// input parameters: fd - The open file descriptor to store.
+// return value: The handle to give to the RF_CLIENT, or FAILED if the table is full.
+//
+// *****************************************************
+long rf_handle_alloc(int fd)
+{
+	long index, handle;
+
+	if (fd < 0 || rf_handle_init(0) != OKAY)
+		return(FAILED);
+
+	pthread_mutex_lock(&tableLock);
+	if (freeHead < 0) {
+		pthread_mutex_unlock(&tableLock);
+		return(FAILED);
+	}
+	index = freeHead;
+	freeHead = slots[index].nextFree;
+	slots[index].fd = fd;
+	slots[index].nextFree = -1;
+	slots[index].refs = 0;
+	slots[index].closing = 0;
+	numOpen++;
+	handle = ((slots[index].gen & RF_HANDLE_GEN_MASK) << RF_HANDLE_INDEX_BITS) | index;
+	pthread_mutex_unlock(&tableLock);
+
+	return(handle);
+}
+
+// *****************************************************
+//
+// rf_handle_get
+//     Looks up the file behind a handle and takes a reference on it.
+//     Every successful call must be matched by rf_handle_put.
+// input parameters: handle - A handle previously returned by rf_handle_alloc.
+// return value: The open file descriptor, or FAILED if the handle is unknown, stale or closing.
+//
+// *****************************************************
+int rf_handle_get(long handle)
+{
+	RF_HandleSlot_T *slot;
+	int fd;
+
+	pthread_mutex_lock(&tableLock);
+	slot = rf_handle_lookup(handle);
+	fd = FAILED;
+	if (slot != NULL) {
+		slot->refs++;
+		fd = slot->fd;
+	}
+	pthread_mutex_unlock(&tableLock);
+
+	return(fd);
+}
+
+// *****************************************************
+//
+// rf_handle_put
+//     Drops the reference taken by a successful rf_handle_get.
+// input parameters: handle - The handle passed to rf_handle_get.
+//
+// *****************************************************
+void rf_handle_put(long handle)
+{
+	long index = handle & RF_HANDLE_INDEX_MASK;
+
+	pthread_mutex_lock(&tableLock);
+	if (slots != NULL && index < numSlots && slots[index].refs > 0) {
+		slots[index].refs--;
+		if (slots[index].refs == 0 && slots[index].closing)
+			pthread_cond_broadcast(&refsDropped);
+	}
+	pthread_mutex_unlock(&tableLock);
+}
+
+// *****************************************************
+//
+// rf_handle_release
+//     Frees the slot behind a handle and puts it back on the free list.
+//     Waits until no other thread holds a reference to the slot.
+//     The file itself is not closed; that is up to the caller.
+// input parameters: handle - A handle previously returned by rf_handle_alloc.
+// return value: The file descriptor that was stored, or FAILED if the handle is unknown or stale.
+//
+// *****************************************************
+int rf_handle_release(long handle)
+{
+	RF_HandleSlot_T *slot;
+	int fd;
+
+	pthread_mutex_lock(&tableLock);
+	slot = rf_handle_lookup(handle);
+	if (slot == NULL) {
+		pthread_mutex_unlock(&tableLock);
+		return(FAILED);
+	}
+
+	slot->closing = 1;
+	while (slot->refs > 0)
+		pthread_cond_wait(&refsDropped, &tableLock);
+
+	fd = slot->fd;
+	slot->fd = -1;
+	slot->closing = 0;
+	slot->gen++;
+	/* Generation 0 is never handed out, so a zeroed handle is never valid. */
+	if ((slot->gen & RF_HANDLE_GEN_MASK) == 0)
+		slot->gen++;
+	slot->nextFree = freeHead;
+	freeHead = slot - slots;
+	numOpen--;
+	pthread_mutex_unlock(&tableLock);
+
+	return(fd);
+}
+
+// *****************************************************
+//
+// rf_handle_count
+//     Reports how many handles are currently open.
+// return value: Number of slots in use.
+//
+// *****************************************************
+long rf_handle_count(void)
+{
+	long count;
+
+	pthread_mutex_lock(&tableLock);
+	count = numOpen;
+	pthread_mutex_unlock(&tableLock);
+
+	return(count);
+}
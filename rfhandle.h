@@ -0,0 +1,32 @@
+/* rfhandle.h */
+
+/* Server side file handle table.
+// Every file opened through rf_openfile_1 is stored in one slot of the table.
+// The fd returned to a RF_CLIENT is a handle made of the slot index and a
+// generation number, so a stale fd (closed, then slot reused) is rejected
+// instead of silently operating on somebody else's file.
+*/
+
+#ifndef RFHANDLE_H
+#define RFHANDLE_H
+
+/* Default upper bound on open handles. Override at build time with
+// -DRF_MAX_HANDLES=n, or at run time with the RFSERVER_MAX_HANDLES
+// environment variable.
+*/
+#ifndef RF_MAX_HANDLES
+#define RF_MAX_HANDLES 1024
+#endif
+
+#define RF_HANDLE_INDEX_BITS 20                        /* up to 1M slots */
+#define RF_HANDLE_INDEX_MASK ((1L << RF_HANDLE_INDEX_BITS) - 1)
+#define RF_HANDLE_GEN_MASK   0x7FFL                    /* keeps handles positive in 32 bits */
+
+int   rf_handle_init(long maxHandles);
+long  rf_handle_alloc(int fd);
+int   rf_handle_get(long handle);
+void  rf_handle_put(long handle);
+int   rf_handle_release(long handle);
+long  rf_handle_count(void);
+
+#endif /* RFHANDLE_H */
@@ -0,0 +1,269 @@
+/* rflog.c */
+
+/* This file implements server logging (see rflog.h).
+// Callers format a record into the next free slot of a ring under a mutex
+// and return. A writer thread moves every pending record into its own buffer,
+// drops the mutex, and writes the batch with one fwrite.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "rflog.h"
+
+#define OKAY 0
+#define FAILED -1
+
+#define RF_LOG_RECORDS 4096   /* records the ring holds */
+#define RF_LOG_LINEMAX 256    /* longest record, longer ones are cut */
+#define RF_LOG_DUMPLINE 64    /* payload bytes per rf_log_dump line */
+
+int rf_log_level = RF_LOG_INFO;
+
+static const char *levelNames[] = { "ERROR", "WARN", "INFO", "DEBUG", "TRACE" };
+
+static FILE *logOut = NULL;           /* NULL until rf_log_init started the writer */
+static long logSample = RF_LOG_DEFAULT_SAMPLE;
+static char (*ring)[RF_LOG_LINEMAX];
+static char *batch;                   /* writer's copy of the pending records */
+static int ringHead;                  /* oldest pending record */
+static int ringCount;                 /* pending records */
+static long dropped;                  /* records lost to a full ring since the last batch */
+static int writing;                   /* the writer holds a batch not yet written */
+static pthread_t writer;
+static pthread_mutex_t logLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t logReady = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t logDrained = PTHREAD_COND_INITIALIZER;
+
+
+// *****************************************************
+//
+// rf_log_writer
+//     Writer thread body. Writes out pending records in batches.
+// input parameters: arg - Unused.
+// return value: Never returns.
+//
+// *****************************************************
+static void *rf_log_writer(void *arg)
+{
+	size_t len;
+	long lost;
+
+	for (;;) {
+		pthread_mutex_lock(&logLock);
+		while (ringCount == 0 && dropped == 0)
+			pthread_cond_wait(&logReady, &logLock);
+
+		len = 0;
+		while (ringCount > 0) {
+			size_t n = strlen(ring[ringHead]);
+			memcpy(batch + len, ring[ringHead], n);
+			len += n;
+			ringHead = (ringHead + 1) % RF_LOG_RECORDS;
+			ringCount--;
+		}
+		lost = dropped;
+		dropped = 0;
+		writing = 1;
+		pthread_mutex_unlock(&logLock);
+
+		fwrite(batch, 1, len, logOut);
+		if (lost > 0)
+			fprintf(logOut, "WARN  log ring full, %ld records dropped\n", lost);
+		fflush(logOut);
+
+		pthread_mutex_lock(&logLock);
+		writing = 0;
+		if (ringCount == 0)
+			pthread_cond_broadcast(&logDrained);
+		pthread_mutex_unlock(&logLock);
+	}
+
+	return(NULL);
+}
+
+// *****************************************************
+//
+// rf_log_init
+//     Sets the level and request sampling and starts the writer thread.
+//     Until this is called, records are written directly to stdout.
+// input parameters: out    - Stream to log to.
+//                   level  - Most detailed level logged, RF_LOG_ERROR to RF_LOG_TRACE.
+//                   sample - Keep one in this many request records, 0 keeps none.
+// return value: OKAY, or FAILED if the writer could not be started.
+//
+// *****************************************************
+int rf_log_init(FILE *out, int level, long sample)
+{
+	rf_log_level = level;
+	logSample = sample;
+
+	if (logOut != NULL)
+		return(OKAY);
+
+	ring = malloc(RF_LOG_RECORDS * RF_LOG_LINEMAX);
+	batch = malloc(RF_LOG_RECORDS * RF_LOG_LINEMAX);
+	if (ring == NULL || batch == NULL) {
+		free(ring);
+		free(batch);
+		return(FAILED);
+	}
+
+	logOut = out;
+	if (pthread_create(&writer, NULL, rf_log_writer, NULL) != 0) {
+		logOut = NULL;
+		return(FAILED);
+	}
+	pthread_detach(writer);
+
+	/* Records still in the ring are written before the process exits. */
+	atexit(rf_log_flush);
+
+	return(OKAY);
+}
+
+// *****************************************************
+//
+// rf_log_flush
+//     Waits until every record logged so far has been written.
+//
+// *****************************************************
+void rf_log_flush(void)
+{
+	if (logOut == NULL) {
+		fflush(stdout);
+		return;
+	}
+
+	pthread_mutex_lock(&logLock);
+	while (ringCount > 0 || writing)
+		pthread_cond_wait(&logDrained, &logLock);
+	pthread_mutex_unlock(&logLock);
+}
+
+// *****************************************************
+//
+// rf_log_parse_level
+//     Converts a level name (error, warn, info, debug, trace) or number.
+// input parameters: name - The level as given on the command line.
+// return value: The level, or FAILED if name is not one.
+//
+// *****************************************************
+int rf_log_parse_level(const char *name)
+{
+	for (int i = 0; i <= RF_LOG_TRACE; i++)
+		if (strcasecmp(name, levelNames[i]) == 0)
+			return(i);
+
+	if (isdigit((unsigned char)name[0]) && atoi(name) <= RF_LOG_TRACE)
+		return(atoi(name));
+
+	return(FAILED);
+}
+
+#ifndef RF_LOG_DISABLE
+
+// *****************************************************
+//
+// rf_log_write
+//     Logs one message. Use the RF_LOG macro, which skips the call when the
+//     level is not logged.
+// input parameters: level - Level of the message.
+//                   fmt   - printf format, without the trailing newline.
+//
+// *****************************************************
+void rf_log_write(int level, const char *fmt, ...)
+{
+	char line[RF_LOG_LINEMAX];
+	struct timespec ts;
+	struct tm tm;
+	va_list ap;
+	int len;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	localtime_r(&ts.tv_sec, &tm);
+	len = strftime(line, sizeof(line), "%Y-%m-%d %H:%M:%S", &tm);
+	len += snprintf(line + len, sizeof(line) - len, ".%06ld %-5s ", ts.tv_nsec / 1000, levelNames[level]);
+
+	va_start(ap, fmt);
+	vsnprintf(line + len, sizeof(line) - len - 1, fmt, ap);
+	va_end(ap);
+	strcat(line, "\n");
+
+	if (logOut == NULL) {
+		fputs(line, stdout);
+		return;
+	}
+
+	pthread_mutex_lock(&logLock);
+	if (ringCount == RF_LOG_RECORDS) {
+		dropped++;
+	} else {
+		memcpy(ring[(ringHead + ringCount) % RF_LOG_RECORDS], line, sizeof(line));
+		ringCount++;
+		pthread_cond_signal(&logReady);
+	}
+	pthread_mutex_unlock(&logLock);
+}
+
+// *****************************************************
+//
+// rf_log_dump
+//     Logs payload bytes at RF_LOG_TRACE, RF_LOG_DUMPLINE per record.
+//     Bytes that are not printable are shown as '.'.
+// input parameters: what - Label for the dump, e.g. "read fd 3".
+//                   buf  - The bytes.
+//                   len  - Number of bytes.
+//
+// *****************************************************
+void rf_log_dump(const char *what, const char *buf, long len)
+{
+	char text[RF_LOG_DUMPLINE + 1];
+	long n;
+
+	if (rf_log_level < RF_LOG_TRACE)
+		return;
+
+	rf_log_write(RF_LOG_TRACE, "%s: %ld bytes", what, len);
+	for (long i = 0; i < len; i += n) {
+		n = (len - i < RF_LOG_DUMPLINE) ? len - i : RF_LOG_DUMPLINE;
+		for (long j = 0; j < n; j++)
+			text[j] = isprint((unsigned char)buf[i + j]) ? buf[i + j] : '.';
+		text[n] = '\0';
+		rf_log_write(RF_LOG_TRACE, "  %s", text);
+	}
+}
+
+// *****************************************************
+//
+// rf_log_request
+//     Logs the structured record of a finished request. At RF_LOG_INFO only one
+//     in every `sample` requests of the calling thread is kept; at RF_LOG_DEBUG
+//     and above all of them are.
+// input parameters: proc   - Procedure name.
+//                   fd     - Handle the request used.
+//                   bytes  - Payload bytes moved.
+//                   status - Status returned to the client.
+//                   usec   - How long the request took.
+//
+// *****************************************************
+void rf_log_request(const char *proc, long fd, long long bytes, long status, long long usec)
+{
+	static __thread long seen;
+
+	if (rf_log_level < RF_LOG_INFO)
+		return;
+	if (rf_log_level < RF_LOG_DEBUG && (logSample <= 0 || ++seen % logSample != 0))
+		return;
+
+	rf_log_write(RF_LOG_INFO, "req proc=%s fd=%ld bytes=%lld status=%ld usec=%lld",
+	             proc, fd, bytes, status, usec);
+}
+
+#endif /* RF_LOG_DISABLE */
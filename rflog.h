@@ -0,0 +1,57 @@
+/* rflog.h */
+
+/* Server logging.
+// Messages are formatted by the calling thread into a ring of records and
+// written out by a background thread, so a slow terminal or log pipe never
+// stalls a request. When the ring is full, new records are dropped and
+// counted instead of blocking.
+//
+// Each message has a level. RF_LOG only formats a message whose level is at
+// or below the level chosen with rf_log_init. Payload dumps are logged at
+// RF_LOG_TRACE, so they are off unless explicitly asked for.
+//
+// Per-request records go through rf_log_request, which keeps only one in every
+// `sample` requests of each thread. They look like
+//       req proc=rf_preadfile_2 fd=1048577 bytes=4194304 status=0 usec=812
+//
+// Building with -DRF_LOG_DISABLE compiles every RF_LOG, rf_log_dump and
+// rf_log_request call out.
+*/
+
+#ifndef RFLOG_H
+#define RFLOG_H
+
+#include <stdio.h>
+
+#define RF_LOG_ERROR 0   /* the server or a request can not go on */
+#define RF_LOG_WARN  1   /* a request failed */
+#define RF_LOG_INFO  2   /* startup, and the sampled request records */
+#define RF_LOG_DEBUG 3   /* every request */
+#define RF_LOG_TRACE 4   /* every request, with its payload bytes */
+
+#define RF_LOG_DEFAULT_SAMPLE 100   /* request records kept: one in this many */
+
+extern int rf_log_level;
+
+int  rf_log_init(FILE *out, int level, long sample);
+void rf_log_flush(void);
+int  rf_log_parse_level(const char *name);
+
+#ifdef RF_LOG_DISABLE
+
+#define RF_LOG(level, ...) do { } while (0)
+#define rf_log_dump(what, buf, len) do { } while (0)
+#define rf_log_request(proc, fd, bytes, status, usec) do { } while (0)
+
+#else
+
+#define RF_LOG(level, ...) \
+	do { if ((level) <= rf_log_level) rf_log_write((level), __VA_ARGS__); } while (0)
+
+void rf_log_write(int level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+void rf_log_dump(const char *what, const char *buf, long len);
+void rf_log_request(const char *proc, long fd, long long bytes, long status, long long usec);
+
+#endif /* RF_LOG_DISABLE */
+
+#endif /* RFLOG_H */
@@ -0,0 +1,642 @@
+/* rfpipe.c */
+
+/* This file implements the pipelined RPC channel (see rfpipe.h).
+// Calls are encoded with xdr_callmsg into a per-slot buffer, which is kept so a
+// UDP call can be sent again unchanged (same XID) if its reply is late. The
+// retransmission timeout adapts to the measured round trip time the same way
+// TCP does (smoothed RTT plus four times its variance, doubled per retry, with
+// samples only taken from calls that were sent once).
+//
+// An RFILE version 2 call the server turns away (RF_BUSY in rf.x) keeps its
+// slot: it is held until the wait the server asked for is over, then sent
+// again under a new XID, so a late copy of the busy reply can not be taken
+// for the answer.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <rpc/rpc.h>
+
+#include "rf.h"
+#include "rfbusy.h"
+#include "rfpipe.h"
+
+#define OKAY 0
+#define FAILED -1
+
+#define RF_PIPE_RTO_INIT   1000   /* ms, before the first RTT sample */
+#define RF_PIPE_RTO_MIN    100    /* ms */
+#define RF_PIPE_RTO_MAX    5000   /* ms */
+#define RF_PIPE_MAX_TRIES  8      /* sends of one UDP call before giving up */
+#define RF_PIPE_TCP_WAIT   25000  /* ms, same as the TIMEOUT of the rpcgen stubs */
+#define RF_PIPE_RECMARK    4      /* bytes of TCP record mark in front of a call */
+#define RF_PIPE_BUSY_GIVEUP 120000 /* ms a call is sent again for a server that keeps turning it away */
+
+typedef struct RF_PipeSlot_T
+{
+	int			busy;		/* call sent, reply not yet taken */
+	u_int32_t	xid;		/* XID of the call */
+	char		*msg;		/* record mark followed by the encoded call */
+	u_int		msgLen;		/* length of the encoded call, without record mark */
+	long long	sentAt;		/* ms, time of the first send */
+	long long	deadline;	/* ms, when to retransmit (UDP) or give up (TCP) */
+	int			tries;		/* number of times the call was sent */
+	u_long		proc;		/* procedure number of the call */
+	int			held;		/* turned away, waiting until deadline to be sent again */
+	long long	busyUntil;	/* ms, when to stop sending the call again, 0 before it was turned away */
+} RF_PipeSlot_T;
+
+struct RF_Pipe_T
+{
+	int				sock;		/* socket of the CLIENT handle */
+	int				stream;		/* non zero for TCP */
+	struct sockaddr_storage addr;	/* server address, for UDP sendto */
+	socklen_t		addrLen;
+	u_long			prog;
+	u_long			vers;
+	u_int32_t		nextXid;
+	RF_PipeSlot_T	*slots;
+	int				window;		/* number of slots */
+	u_int			callMax;	/* largest encoded call */
+	char			*reply;		/* receive buffer */
+	u_int			replyMax;	/* largest reply */
+	long			srtt;		/* ms, smoothed round trip time, 0 before the first sample */
+	long			rttvar;		/* ms, round trip time variance */
+	long			rto;		/* ms, retransmission timeout */
+	long			retransmits;
+	enum clnt_stat	error;		/* why the last call failed */
+};
+
+static u_int32_t pipeCount;   /* pipes created so far, spreads their XIDs apart */
+
+
+// *****************************************************
+//
+// rf_pipe_now
+//     Reads the monotonic clock.
+// return value: Current time in milliseconds.
+//
+// *****************************************************
+static long long rf_pipe_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return((long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+// *****************************************************
+//
+// rf_pipe_create
+//     Creates a pipe on the socket of a CLIENT handle. The handle stays usable
+//     for ordinary calls while the pipe has no calls in flight.
+// input parameters: clnt     - CLIENT handle created by rf_connect or clnt_create.
+//                   prog     - RPC program number.
+//                   vers     - RPC program version.
+//                   window   - Largest number of calls in flight.
+//                   callMax  - Largest encoded call, arguments included.
+//                   replyMax - Largest encoded reply, results included.
+// return value: The pipe, or NULL if it could not be created.
+//
+// *****************************************************
+RF_Pipe_T *rf_pipe_create(CLIENT *clnt, u_long prog, u_long vers, int window, u_int callMax, u_int replyMax)
+{
+	RF_Pipe_T *rp;
+	int type;
+	int rcvbuf;
+	socklen_t len = sizeof(type);
+
+	if (window < 1 || (rp = calloc(1, sizeof(RF_Pipe_T))) == NULL)
+		return(NULL);
+
+	if (!clnt_control(clnt, CLGET_FD, (char *)&rp->sock) ||
+	    getsockopt(rp->sock, SOL_SOCKET, SO_TYPE, &type, &len) < 0) {
+		free(rp);
+		return(NULL);
+	}
+	rp->stream = (type == SOCK_STREAM);
+	if (!rp->stream) {
+		if (!clnt_control(clnt, CLGET_SERVER_ADDR, (char *)&rp->addr)) {
+			free(rp);
+			return(NULL);
+		}
+		rp->addrLen = (rp->addr.ss_family == AF_INET6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+		/* Leave room for a whole window of replies arriving back to back. */
+		rcvbuf = window * replyMax;
+		setsockopt(rp->sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+	}
+
+	rp->prog = prog;
+	rp->vers = vers;
+	rp->window = window;
+	rp->callMax = callMax;
+	rp->replyMax = replyMax;
+	rp->rto = RF_PIPE_RTO_INIT;
+	rp->error = RPC_SUCCESS;
+	/* Pipes created back to back on one handle must not share XIDs, or late
+	// replies to an abandoned pipe's calls are taken for replies to the next's.
+	*/
+	rp->nextXid = (u_int32_t)time(NULL) ^ ((u_int32_t)getpid() << 16) ^ (u_int32_t)rf_pipe_now() ^
+	              (__sync_fetch_and_add(&pipeCount, 1) * 0x9e3779b9U);
+
+	rp->slots = calloc(window, sizeof(RF_PipeSlot_T));
+	rp->reply = malloc(replyMax);
+	if (rp->slots == NULL || rp->reply == NULL) {
+		rf_pipe_destroy(rp);
+		return(NULL);
+	}
+	for (int i = 0; i < window; i++) {
+		if ((rp->slots[i].msg = malloc(RF_PIPE_RECMARK + callMax)) == NULL) {
+			rf_pipe_destroy(rp);
+			return(NULL);
+		}
+	}
+
+	return(rp);
+}
+
+// *****************************************************
+//
+// rf_pipe_destroy
+//     Frees a pipe. The CLIENT handle and its socket are left alone.
+// input parameters: rp   - The pipe to free.
+//
+// *****************************************************
+void rf_pipe_destroy(RF_Pipe_T *rp)
+{
+	if (rp == NULL)
+		return;
+
+	if (rp->slots != NULL) {
+		for (int i = 0; i < rp->window; i++)
+			free(rp->slots[i].msg);
+		free(rp->slots);
+	}
+	free(rp->reply);
+	free(rp);
+}
+
+// *****************************************************
+//
+// rf_pipe_free_slot
+//     Finds a slot with no call in flight.
+// input parameters: rp   - The pipe.
+// return value: The slot index, or FAILED if the whole window is in flight.
+//
+// *****************************************************
+int rf_pipe_free_slot(RF_Pipe_T *rp)
+{
+	for (int i = 0; i < rp->window; i++) {
+		if (!rp->slots[i].busy)
+			return(i);
+	}
+
+	return(FAILED);
+}
+
+// *****************************************************
+//
+// rf_pipe_send
+//     Sends (or sends again) the call held by a slot and arms its timer.
+// input parameters: rp   - The pipe.
+//                   slot - The slot to send.
+// return value: OKAY, or FAILED if the socket refused the call.
+//
+// *****************************************************
+static int rf_pipe_send(RF_Pipe_T *rp, RF_PipeSlot_T *slot)
+{
+	long long now = rf_pipe_now();
+	long wait;
+
+	if (rp->stream) {
+		char *p = slot->msg;
+		u_int left = RF_PIPE_RECMARK + slot->msgLen;
+
+		while (left > 0) {
+			ssize_t n = write(rp->sock, p, left);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0) {
+				rp->error = RPC_CANTSEND;
+				return(FAILED);
+			}
+			p += n;
+			left -= n;
+		}
+		wait = RF_PIPE_TCP_WAIT;
+	} else {
+		if (sendto(rp->sock, slot->msg + RF_PIPE_RECMARK, slot->msgLen, 0,
+		           (struct sockaddr *)&rp->addr, rp->addrLen) < 0) {
+			rp->error = RPC_CANTSEND;
+			return(FAILED);
+		}
+		/* Back off exponentially on every retry. */
+		wait = rp->rto << slot->tries;
+		if (wait > RF_PIPE_RTO_MAX)
+			wait = RF_PIPE_RTO_MAX;
+	}
+
+	if (slot->tries == 0)
+		slot->sentAt = now;
+	slot->tries++;
+	slot->deadline = now + wait;
+
+	return(OKAY);
+}
+
+// *****************************************************
+//
+// rf_pipe_call
+//     Encodes a call into a free slot and sends it. Does not wait for the reply.
+// input parameters: rp      - The pipe.
+//                   slot    - A slot returned by rf_pipe_free_slot.
+//                   proc    - Procedure number.
+//                   xdrArgs - XDR routine of the arguments.
+//                   args    - The arguments. They are encoded right away and
+//                             may be reused as soon as this returns.
+// return value: OKAY, or FAILED (see rf_pipe_error).
+//
+// *****************************************************
+int rf_pipe_call(RF_Pipe_T *rp, int slot, u_long proc, xdrproc_t xdrArgs, void *args)
+{
+	RF_PipeSlot_T *s = &rp->slots[slot];
+	struct rpc_msg call;
+	XDR xdrs;
+
+	call.rm_xid = rp->nextXid++;
+	call.rm_direction = CALL;
+	call.rm_call.cb_rpcvers = RPC_MSG_VERSION;
+	call.rm_call.cb_prog = rp->prog;
+	call.rm_call.cb_vers = rp->vers;
+	call.rm_call.cb_proc = proc;
+	call.rm_call.cb_cred = _null_auth;
+	call.rm_call.cb_verf = _null_auth;
+
+	xdrmem_create(&xdrs, s->msg + RF_PIPE_RECMARK, rp->callMax, XDR_ENCODE);
+	if (!xdr_callmsg(&xdrs, &call) || !xdrArgs(&xdrs, args)) {
+		xdr_destroy(&xdrs);
+		rp->error = RPC_CANTENCODEARGS;
+		return(FAILED);
+	}
+	s->msgLen = xdr_getpos(&xdrs);
+	xdr_destroy(&xdrs);
+
+	/* Single fragment record: last fragment bit plus length. */
+	*(u_int32_t *)s->msg = htonl(0x80000000u | s->msgLen);
+
+	s->xid = call.rm_xid;
+	s->tries = 0;
+	s->proc = proc;
+	s->held = 0;
+	s->busyUntil = 0;
+	s->busy = 1;
+	if (rf_pipe_send(rp, s) != OKAY) {
+		s->busy = 0;
+		return(FAILED);
+	}
+
+	return(OKAY);
+}
+
+// *****************************************************
+//
+// rf_pipe_read_exact
+//     Reads exactly len bytes from a stream socket.
+// input parameters: sock - The socket.
+//                   buf  - Where to store the bytes.
+//                   len  - Number of bytes wanted.
+// return value: OKAY, or FAILED on error or end of stream.
+//
+// *****************************************************
+static int rf_pipe_read_exact(int sock, char *buf, u_int len)
+{
+	while (len > 0) {
+		ssize_t n = read(sock, buf, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return(FAILED);
+		buf += n;
+		len -= n;
+	}
+
+	return(OKAY);
+}
+
+// *****************************************************
+//
+// rf_pipe_recv
+//     Receives one reply message into the pipe's buffer. For TCP the record
+//     fragments are joined.
+// input parameters: rp   - The pipe.
+// return value: Length of the message, 0 for a message to be ignored, or FAILED
+//               if the connection is gone.
+//
+// *****************************************************
+static long rf_pipe_recv(RF_Pipe_T *rp)
+{
+	u_int32_t mark;
+	u_int len = 0, frag;
+	int last = 0;
+	ssize_t n;
+
+	if (!rp->stream) {
+		n = recv(rp->sock, rp->reply, rp->replyMax, 0);
+		return(n < 0 ? 0 : n);
+	}
+
+	while (!last) {
+		if (rf_pipe_read_exact(rp->sock, (char *)&mark, sizeof(mark)) != OKAY)
+			return(FAILED);
+		mark = ntohl(mark);
+		last = (mark & 0x80000000u) != 0;
+		frag = mark & 0x7fffffffu;
+		if (len + frag > rp->replyMax) {
+			/* The stream can not be resynchronized after an oversized record. */
+			rp->error = RPC_CANTDECODERES;
+			return(FAILED);
+		}
+		if (rf_pipe_read_exact(rp->sock, rp->reply + len, frag) != OKAY)
+			return(FAILED);
+		len += frag;
+	}
+
+	return(len);
+}
+
+// *****************************************************
+//
+// rf_pipe_reply_error
+//     Translates a rejected or unsuccessful reply into a clnt_stat.
+// input parameters: reply - The decoded reply header.
+// return value: The clnt_stat describing it, RPC_SUCCESS if the call succeeded.
+//
+// *****************************************************
+static enum clnt_stat rf_pipe_reply_error(struct rpc_msg *reply)
+{
+	if (reply->rm_reply.rp_stat != MSG_ACCEPTED)
+		return(reply->rjcted_rply.rj_stat == RPC_MISMATCH ? RPC_VERSMISMATCH : RPC_AUTHERROR);
+
+	switch (reply->acpted_rply.ar_stat) {
+	case SUCCESS:
+		return(RPC_SUCCESS);
+	case PROG_UNAVAIL:
+		return(RPC_PROGUNAVAIL);
+	case PROG_MISMATCH:
+		return(RPC_PROGVERSMISMATCH);
+	case PROC_UNAVAIL:
+		return(RPC_PROCUNAVAIL);
+	case GARBAGE_ARGS:
+		return(RPC_CANTDECODEARGS);
+	default:
+		return(RPC_SYSTEMERROR);
+	}
+}
+
+// *****************************************************
+//
+// rf_pipe_rtt_sample
+//     Folds a round trip time measurement into the retransmission timeout.
+// input parameters: rp   - The pipe.
+//                   rtt  - Measured round trip time in ms.
+//
+// *****************************************************
+static void rf_pipe_rtt_sample(RF_Pipe_T *rp, long rtt)
+{
+	if (rp->srtt == 0) {
+		rp->srtt = rtt > 0 ? rtt : 1;
+		rp->rttvar = rtt / 2;
+	} else {
+		long delta = rtt - rp->srtt;
+		rp->srtt += delta / 8;
+		rp->rttvar += ((delta < 0 ? -delta : delta) - rp->rttvar) / 4;
+	}
+
+	rp->rto = rp->srtt + 4 * rp->rttvar;
+	if (rp->rto < RF_PIPE_RTO_MIN)
+		rp->rto = RF_PIPE_RTO_MIN;
+	if (rp->rto > RF_PIPE_RTO_MAX)
+		rp->rto = RF_PIPE_RTO_MAX;
+}
+
+// *****************************************************
+//
+// rf_pipe_busy
+//     Tells whether the results of an RFILE version 2 reply say the server
+//     turned the call away. The results are left unread.
+// input parameters: rp   - The pipe.
+//                   slot - The slot of the call.
+//                   xdrs - Positioned at the results.
+// return value: Milliseconds the server asked the client to wait, 0 if the
+//               call was not turned away.
+//
+// *****************************************************
+static long rf_pipe_busy(RF_Pipe_T *rp, RF_PipeSlot_T *slot, XDR *xdrs)
+{
+	const RF_BusyReply_T *reply;
+	u_int pos = xdr_getpos(xdrs);
+	int status = 0, len = 0;
+
+	if (rp->prog != RFILE || rp->vers != RFILE_VERS2 || (reply = rf_busy_reply(slot->proc)) == NULL)
+		return(0);
+
+	/* The status comes first (see rfbusy.h), in a list after the length of the list. */
+	if (reply->list) {
+		if (!xdr_int(xdrs, &len) || len <= 0 || !xdr_int(xdrs, &status))
+			status = 0;
+	} else if (!xdr_int(xdrs, &status)) {
+		status = 0;
+	}
+	xdr_setpos(xdrs, pos);
+
+	return(rf_busy_wait(status));
+}
+
+// *****************************************************
+//
+// rf_pipe_next
+//     Waits for the reply of any call in flight, retransmitting late UDP calls
+//     meanwhile, or for a wake descriptor to become readable. Replies for
+//     unknown XIDs (duplicates, or late replies to calls made through the
+//     CLIENT handle) are dropped.
+// input parameters: rp     - The pipe.
+//                   xdrs   - Set up to decode the results of the returned slot
+//                            if stat is RPC_SUCCESS. It reads from the pipe's
+//                            buffer, so it must be used before the next wait.
+//                   wakeFd - Descriptor that ends the wait when readable, or -1.
+//                            With a descriptor the wait goes on while no call
+//                            is in flight. It is not read.
+//                   stat   - Set to how the call of the returned slot ended:
+//                            RPC_SUCCESS, why the server rejected it, or
+//                            RPC_TIMEDOUT for a UDP call sent too often.
+// return value: The slot whose call ended (the slot is free again),
+//               RF_PIPE_WOKEN, or FAILED if the connection failed or a TCP call
+//               timed out (see rf_pipe_error). After FAILED the pipe must not
+//               be used.
+//
+// *****************************************************
+int rf_pipe_next(RF_Pipe_T *rp, XDR *xdrs, int wakeFd, enum clnt_stat *stat)
+{
+	struct rpc_msg reply;
+	struct pollfd pfd[2];
+	RF_PipeSlot_T *late;
+	long long now;
+	long len, wait;
+	int i;
+
+	for (;;) {
+		/* Find the call whose timer runs out first. */
+		late = NULL;
+		for (i = 0; i < rp->window; i++) {
+			if (rp->slots[i].busy && (late == NULL || rp->slots[i].deadline < late->deadline))
+				late = &rp->slots[i];
+		}
+		if (late == NULL && wakeFd < 0) {
+			rp->error = RPC_FAILED;
+			return(FAILED);
+		}
+
+		now = rf_pipe_now();
+		if (late != NULL && late->deadline <= now) {
+			if (late->held) {
+				/* New XID, the first word of the call. */
+				late->xid = rp->nextXid++;
+				*(u_int32_t *)(late->msg + RF_PIPE_RECMARK) = htonl(late->xid);
+				late->held = 0;
+				late->tries = 0;
+				if (rf_pipe_send(rp, late) != OKAY)
+					return(FAILED);
+				continue;
+			}
+			if (rp->stream) {
+				rp->error = RPC_TIMEDOUT;
+				return(FAILED);
+			}
+			if (late->tries >= RF_PIPE_MAX_TRIES) {
+				late->busy = 0;
+				*stat = RPC_TIMEDOUT;
+				return(late - rp->slots);
+			}
+			rp->retransmits++;
+			if (rf_pipe_send(rp, late) != OKAY)
+				return(FAILED);
+			continue;
+		}
+
+		pfd[0].fd = rp->sock;
+		pfd[0].events = POLLIN;
+		pfd[0].revents = 0;
+		pfd[1].fd = wakeFd;
+		pfd[1].events = POLLIN;
+		pfd[1].revents = 0;
+		if (poll(pfd, wakeFd >= 0 ? 2 : 1, late != NULL ? (int)(late->deadline - now) : -1) <= 0)
+			continue;
+		if (pfd[1].revents & POLLIN)
+			return(RF_PIPE_WOKEN);
+		if (!(pfd[0].revents & (POLLIN | POLLHUP | POLLERR)))
+			continue;
+
+		if ((len = rf_pipe_recv(rp)) < 0) {
+			if (rp->error == RPC_SUCCESS)
+				rp->error = RPC_CANTRECV;
+			return(FAILED);
+		}
+		if (len == 0)
+			continue;
+
+		memset(&reply, 0, sizeof(reply));
+		reply.acpted_rply.ar_verf = _null_auth;
+		reply.acpted_rply.ar_results.where = NULL;
+		reply.acpted_rply.ar_results.proc = (xdrproc_t)xdr_void;
+		xdrmem_create(xdrs, rp->reply, len, XDR_DECODE);
+		if (!xdr_replymsg(xdrs, &reply))
+			continue;
+
+		for (i = 0; i < rp->window; i++) {
+			if (rp->slots[i].busy && rp->slots[i].xid == reply.rm_xid)
+				break;
+		}
+		if (i == rp->window)
+			continue;
+
+		if (reply.rm_reply.rp_stat == MSG_ACCEPTED && reply.acpted_rply.ar_stat == SUCCESS &&
+		    (wait = rf_pipe_busy(rp, &rp->slots[i], xdrs)) > 0) {
+			now = rf_pipe_now();
+			if (rp->slots[i].busyUntil == 0)
+				rp->slots[i].busyUntil = now + RF_PIPE_BUSY_GIVEUP;
+			if (now + wait < rp->slots[i].busyUntil) {
+				rp->slots[i].held = 1;
+				rp->slots[i].deadline = now + wait;
+				continue;
+			}
+		}
+
+		rp->slots[i].busy = 0;
+		if ((*stat = rf_pipe_reply_error(&reply)) == RPC_SUCCESS && rp->slots[i].tries == 1) {
+			/* Karn's rule: only calls sent once give an unambiguous sample. */
+			rf_pipe_rtt_sample(rp, (long)(rf_pipe_now() - rp->slots[i].sentAt));
+		}
+
+		return(i);
+	}
+}
+
+// *****************************************************
+//
+// rf_pipe_wait
+//     Waits for the reply of any call in flight (see rf_pipe_next).
+// input parameters: rp   - The pipe.
+//                   xdrs - Set up to decode the results of the returned slot. It
+//                          reads from the pipe's buffer, so it must be used
+//                          before the next rf_pipe_wait.
+// return value: The slot whose reply arrived (the slot is free again), or FAILED
+//               if a call timed out, was rejected, or the connection failed
+//               (see rf_pipe_error). After FAILED the pipe must not be used.
+//
+// *****************************************************
+int rf_pipe_wait(RF_Pipe_T *rp, XDR *xdrs)
+{
+	enum clnt_stat stat;
+	int slot;
+
+	if ((slot = rf_pipe_next(rp, xdrs, -1, &stat)) >= 0 && stat != RPC_SUCCESS) {
+		rp->error = stat;
+		return(FAILED);
+	}
+
+	return(slot);
+}
+
+// *****************************************************
+//
+// rf_pipe_retransmits
+//     Reports how many UDP calls had to be sent again.
+// input parameters: rp   - The pipe.
+// return value: Number of retransmissions since the pipe was created.
+//
+// *****************************************************
+long rf_pipe_retransmits(RF_Pipe_T *rp)
+{
+	return(rp->retransmits);
+}
+
+// *****************************************************
+//
+// rf_pipe_error
+//     Reports why the last rf_pipe_call or rf_pipe_wait failed.
+// input parameters: rp   - The pipe.
+// return value: A clnt_stat, printable with clnt_sperrno.
+//
+// *****************************************************
+enum clnt_stat rf_pipe_error(RF_Pipe_T *rp)
+{
+	return(rp->error);
+}
@@ -0,0 +1,35 @@
+/* rfpipe.h */
+
+/* Pipelined RPC channel.
+// The rpcgen stubs send one call and wait for its reply. A pipe instead keeps
+// a window of calls in flight on the socket of an existing CLIENT handle and
+// matches replies to calls by XID, in whatever order they arrive. Over UDP it
+// also retransmits calls whose reply did not arrive in time.
+//
+// Each call occupies one of the pipe's slots until its reply has been taken
+// with rf_pipe_wait. Callers keep their own per-slot state indexed by slot.
+// rf_pipe_next is the same wait for callers that keep calls of unrelated
+// requests in one pipe (see rfasync.h): it can be woken by another file
+// descriptor, and a call that was rejected or got no reply over UDP fails on
+// its own instead of taking the pipe down.
+*/
+
+#ifndef RFPIPE_H
+#define RFPIPE_H
+
+#include <rpc/rpc.h>
+
+#define RF_PIPE_WOKEN -2   /* rf_pipe_next returned because its wake descriptor was readable */
+
+typedef struct RF_Pipe_T RF_Pipe_T;
+
+RF_Pipe_T *rf_pipe_create(CLIENT *clnt, u_long prog, u_long vers, int window, u_int callMax, u_int replyMax);
+void rf_pipe_destroy(RF_Pipe_T *rp);
+int  rf_pipe_free_slot(RF_Pipe_T *rp);
+int  rf_pipe_call(RF_Pipe_T *rp, int slot, u_long proc, xdrproc_t xdrArgs, void *args);
+int  rf_pipe_wait(RF_Pipe_T *rp, XDR *xdrs);
+int  rf_pipe_next(RF_Pipe_T *rp, XDR *xdrs, int wakeFd, enum clnt_stat *stat);
+long rf_pipe_retransmits(RF_Pipe_T *rp);
+enum clnt_stat rf_pipe_error(RF_Pipe_T *rp);
+
+#endif /* RFPIPE_H */
@@ -0,0 +1,665 @@
+/* rfresume.c */
+
+/* This file implements resumable transfers (see rfresume.h).
+// The checkpoint file holds one line:
+//       get|put SIZE MTIME CHANGE INODE OFFSET CRC REMOTE
+// where SIZE to INODE are the version of the file copied from, OFFSET is how
+// many bytes are known to have arrived and CRC (in hex) is their CRC32C. It is
+// written to LOCAL.rfresume.tmp and renamed over the old one, so a transfer
+// killed at any point leaves a whole checkpoint. Nothing is synced: whatever
+// a crash loses shows up as a prefix that no longer matches the checksum, and
+// the transfer starts over.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <rpc/rpc.h>
+
+#include "rf.h"
+#include "rfconnect.h"
+#include "rfccache.h"
+#include "rfxfer.h"
+#include "rfcrc.h"
+#include "rfresume.h"
+
+#define OKAY 0
+#define FAILED -1
+
+#define RF_RESUME_READ (1024 * 1024)   /* bytes read at a time to checksum a local prefix */
+
+typedef struct RF_Checkpoint_T
+{
+	int					put;		/* 0 for a get, 1 for a put */
+	long long			size;		/* version of the file copied from */
+	long long			mtime;		/* nanoseconds since the epoch */
+	long long			change;		/* inode change time, nanoseconds */
+	unsigned long long	inode;
+	long long			offset;		/* bytes known to have arrived */
+	u_int32_t			crc;		/* CRC32C of those bytes */
+	char				remote[RF_MAXPATHLEN + 1];
+} RF_Checkpoint_T;
+
+static int resumeTries = RF_RESUME_TRIES;   /* reconnects after a failure in RPC */
+
+
+// *****************************************************
+//
+// rf_resume_seconds
+//     Reads the monotonic clock.
+// return value: Current time in seconds.
+//
+// *****************************************************
+static double rf_resume_seconds(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return(ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+// *****************************************************
+//
+// rf_resume_tries
+//     Sets how many times a resumable transfer reconnects and carries on
+//     after a failure in RPC.
+// input parameters: tries - Number of reconnects; 0 leaves a failed transfer
+//                           to be run again.
+//
+// *****************************************************
+void rf_resume_tries(int tries)
+{
+	resumeTries = (tries < 0) ? 0 : tries;
+}
+
+// *****************************************************
+//
+// rf_resume_load
+//     Reads a checkpoint file.
+// input parameters: ckpt - Name of the checkpoint file.
+//                   cp   - Set to the checkpoint.
+// return value: OKAY, or FAILED if there is none or it can not be read.
+//
+// *****************************************************
+static int rf_resume_load(char *ckpt, RF_Checkpoint_T *cp)
+{
+	char line[RF_MAXPATHLEN + 128];
+	char dir[4];
+	size_t len;
+	FILE *f;
+	int n = 0;
+
+	if ((f = fopen(ckpt, "r")) == NULL)
+		return(FAILED);
+	if (fgets(line, sizeof(line), f) == NULL) {
+		fclose(f);
+		return(FAILED);
+	}
+	fclose(f);
+
+	if (sscanf(line, "%3s %lld %lld %lld %llu %lld %x %n", dir, &cp->size, &cp->mtime, &cp->change,
+	           &cp->inode, &cp->offset, &cp->crc, &n) != 7 || n == 0 || cp->offset < 0)
+		return(FAILED);
+	if ((len = strlen(line + n)) == 0 || line[n + len - 1] != '\n' || len - 1 > RF_MAXPATHLEN)
+		return(FAILED);
+	memcpy(cp->remote, line + n, len - 1);
+	cp->remote[len - 1] = '\0';
+	cp->put = (strcmp(dir, "put") == 0);
+	if (!cp->put && strcmp(dir, "get") != 0)
+		return(FAILED);
+
+	return(OKAY);
+}
+
+// *****************************************************
+//
+// rf_resume_save
+//     Writes a checkpoint file in place of the one there was.
+// input parameters: ckpt - Name of the checkpoint file.
+//                   cp   - The checkpoint.
+// return value: OKAY or FAILED.
+//
+// *****************************************************
+static int rf_resume_save(char *ckpt, RF_Checkpoint_T *cp)
+{
+	char tmp[RF_MAXPATHLEN + 32];
+	FILE *f;
+	int status = OKAY;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", ckpt);
+	if ((f = fopen(tmp, "w")) == NULL)
+		return(FAILED);
+	if (fprintf(f, "%s %lld %lld %lld %llu %lld %08x %s\n", cp->put ? "put" : "get", cp->size, cp->mtime,
+	            cp->change, cp->inode, cp->offset, cp->crc, cp->remote) < 0)
+		status = FAILED;
+	if (fclose(f) != 0 || status != OKAY || rename(tmp, ckpt) != 0) {
+		unlink(tmp);
+		return(FAILED);
+	}
+
+	return(OKAY);
+}
+
+// *****************************************************
+//
+// rf_resume_prefix
+//     Works out the CRC32C of the start of a local file.
+// input parameters: fd     - Local file descriptor open for reading.
+//                   length - Bytes to checksum.
+//                   crc    - Set to their checksum.
+// return value: OKAY, or FAILED if the file is shorter or can not be read.
+//
+// *****************************************************
+static int rf_resume_prefix(int fd, long long length, u_int32_t *crc)
+{
+	char *buf;
+	long long done = 0;
+	ssize_t got;
+
+	if ((buf = malloc(RF_RESUME_READ)) == NULL)
+		return(FAILED);
+	*crc = 0;
+	while (done < length) {
+		got = pread(fd, buf, (length - done < RF_RESUME_READ) ? length - done : RF_RESUME_READ, done);
+		if (got <= 0)
+			break;
+		*crc = rf_crc32c(*crc, buf, got);
+		done += got;
+	}
+	free(buf);
+
+	return(done == length ? OKAY : FAILED);
+}
+
+// *****************************************************
+//
+// rf_resume_segment
+//     Works out how many bytes to move between checkpoints: whole windows of
+//     blocks, as few as make up RF_RESUME_CHECKPOINT.
+// input parameters: maxBlock - Bytes per call.
+//                   window   - Largest number of calls in flight.
+// return value: Bytes per segment, a multiple of maxBlock.
+//
+// *****************************************************
+static long long rf_resume_segment(long maxBlock, int window)
+{
+	long long full = (long long)(window > 0 ? window : 1) * maxBlock;
+
+	return((RF_RESUME_CHECKPOINT + full - 1) / full * full);
+}
+
+// *****************************************************
+//
+// rf_resume_add
+//     Adds what one segment did to the whole transfer. Until the transfer is
+//     done, bytes counts everything moved, again or not (see rf_resume_done).
+// input parameters: stats - The whole transfer.
+//                   seg   - The segment.
+//
+// *****************************************************
+static void rf_resume_add(RF_XferStats_T *stats, RF_XferStats_T *seg)
+{
+	stats->bytes += seg->bytes;
+	stats->blocks += seg->blocks;
+	stats->retransmits += seg->retransmits;
+	stats->wire += seg->wire;
+	stats->rpcError = seg->rpcError;
+	stats->failure = seg->failure;
+}
+
+// *****************************************************
+//
+// rf_resume_done
+//     Splits what a finished transfer moved into the bytes after the point it
+//     carried on from, and the bytes moved again after failures.
+// input parameters: stats - The whole transfer.
+//                   size  - Bytes in the file.
+//                   start - Lowest offset any attempt carried on from.
+//
+// *****************************************************
+static void rf_resume_done(RF_XferStats_T *stats, long long size, long long start)
+{
+	stats->resumed = start;
+	stats->resent = stats->bytes - (size - start);
+	stats->bytes = size - start;
+}
+
+// *****************************************************
+//
+// rf_resume_reconnect
+//     Pauses, then replaces a handle with a new connection to the server. The
+//     old handle is kept if the server can not be reached yet.
+// input parameters: clnt     - The handle to replace.
+//                   server   - Server as accepted by rf_connect.
+//                   proto    - "udp" or "tcp".
+//                   attempt  - Reconnects so far; each doubles the pause.
+//                   maxBlock - Lowered to the largest block the new handle can carry.
+//
+// *****************************************************
+static void rf_resume_reconnect(CLIENT **clnt, char *server, char *proto, int attempt, long *maxBlock)
+{
+	CLIENT *c;
+	long max;
+
+	sleep((attempt < 5 && (1 << attempt) < RF_RESUME_MAXPAUSE) ? 1 << attempt : RF_RESUME_MAXPAUSE);
+	if ((c = rf_connect(server, RFILE_VERS2, proto, &max)) == NULL)
+		return;
+	clnt_destroy(*clnt);
+	*clnt = c;
+	if (max < *maxBlock)
+		*maxBlock = max;
+}
+
+// *****************************************************
+//
+// rf_resume_attr
+//     Gets the version of a remote file with rf_getattr.
+// input parameters: clnt   - CLIENT handle talking RFILE_VERS2.
+//                   remote - Name of the file on the server.
+//                   attr   - Set to its attributes.
+//                   stats  - failure and rpcError are set if the call failed.
+// return value: OKAY, FAILED, or RF_XFER_UNSUPPORTED if the server has not
+//               got rf_getattr.
+//
+// *****************************************************
+static int rf_resume_attr(CLIENT *clnt, char *remote, RF_GetAttrResult_T *attr, RF_XferStats_T *stats)
+{
+	enum clnt_stat rpcError;
+
+	if (rf_ccache_attrs(clnt, 1, &remote, attr, &rpcError) != OKAY) {
+		if (rpcError == RPC_PROCUNAVAIL)
+			return(RF_XFER_UNSUPPORTED);
+		stats->rpcError = rpcError;
+		stats->failure = "getattr call failed";
+		return(FAILED);
+	}
+	if (attr->getattrStatus != OKAY) {
+		stats->failure = "cannot open remote file";
+		return(FAILED);
+	}
+
+	return(OKAY);
+}
+
+// *****************************************************
+//
+// rf_resume_get_run
+//     One attempt at a resumable get: carries on from the checkpoint if it
+//     still holds, and moves the rest of the file into the part file.
+// input parameters: clnt     - CLIENT handle talking RFILE_VERS2.
+//                   remote   - Name of the file on the server.
+//                   part     - Name of the part file.
+//                   ckpt     - Name of the checkpoint file.
+//                   maxBlock - Largest block clnt can carry.
+//                   window   - Largest number of read calls in flight.
+//                   start    - Lowest offset an attempt carried on from, -1 before
+//                              the first; lowered to this attempt's.
+//                   stats    - bytes, blocks, retransmits and wire are added to;
+//                              crc, failure and rpcError are set, and once the
+//                              part file is complete resumed and resent.
+// return value: OKAY once the part file is complete, FAILED, or
+//               RF_XFER_UNSUPPORTED if the server has not got rf_getattr.
+//
+// *****************************************************
+static int rf_resume_get_run(CLIENT *clnt, char *remote, char *part, char *ckpt, long maxBlock, int window,
+                             long long *start, RF_XferStats_T *stats)
+{
+	RF_GetAttrResult_T attr, now;
+	RF_Checkpoint_T cp;
+	RF_XferStats_T seg;
+	long long segment = rf_resume_segment(maxBlock, window);
+	long long len;
+	u_int32_t crc;
+	int fd, status;
+
+	stats->rpcError = RPC_SUCCESS;
+	stats->failure = NULL;
+	if ((status = rf_resume_attr(clnt, remote, &attr, stats)) != OKAY)
+		return(status);
+
+	if ((fd = open(part, O_RDWR | O_CREAT, 0666)) < 0) {
+		stats->failure = "cannot open local file";
+		return(FAILED);
+	}
+
+	/* Carry on only from the same version of the file, and a prefix still there. */
+	if (rf_resume_load(ckpt, &cp) != OKAY || cp.put || strcmp(cp.remote, remote) != 0 ||
+	    cp.size != attr.size || cp.mtime != attr.mtime || cp.change != attr.change || cp.inode != attr.inode ||
+	    cp.offset > attr.size || rf_resume_prefix(fd, cp.offset, &crc) != OKAY || crc != cp.crc) {
+		memset(&cp, 0, sizeof(cp));
+		cp.size = attr.size;
+		cp.mtime = attr.mtime;
+		cp.change = attr.change;
+		cp.inode = attr.inode;
+		strcpy(cp.remote, remote);
+		if (ftruncate(fd, 0) != 0) {
+			stats->failure = "cannot truncate local file";
+			close(fd);
+			return(FAILED);
+		}
+	}
+	if (*start < 0 || cp.offset < *start)
+		*start = cp.offset;
+
+	while (cp.offset < attr.size) {
+		len = (attr.size - cp.offset < segment) ? attr.size - cp.offset : segment;
+		memset(&seg, 0, sizeof(seg));
+		status = rf_xfer_get_range(clnt, remote, fd, cp.offset, len, maxBlock, window, &seg);
+		rf_resume_add(stats, &seg);
+		if (status != OKAY)
+			break;
+		if (seg.bytes != len) {
+			stats->failure = "remote file changed during the transfer";
+			unlink(ckpt);
+			status = FAILED;
+			break;
+		}
+		cp.crc = rf_crc32c_combine(cp.crc, seg.crc, len);
+		cp.offset += len;
+		if (rf_resume_save(ckpt, &cp) != OKAY) {
+			stats->failure = "cannot write checkpoint";
+			status = FAILED;
+			break;
+		}
+	}
+
+	/* A file that changed under the transfer is not worth resuming. */
+	if (status == OKAY && (status = rf_resume_attr(clnt, remote, &now, stats)) == OKAY &&
+	    (now.size != attr.size || now.mtime != attr.mtime || now.change != attr.change || now.inode != attr.inode)) {
+		stats->failure = "remote file changed during the transfer";
+		unlink(ckpt);
+		status = FAILED;
+	}
+	if (status == OKAY && ftruncate(fd, attr.size) != 0) {
+		stats->failure = "cannot truncate local file";
+		status = FAILED;
+	}
+	if (close(fd) != 0 && status == OKAY) {
+		stats->failure = "cannot close local file";
+		status = FAILED;
+	}
+	stats->crc = cp.crc;
+	if (status == OKAY)
+		rf_resume_done(stats, attr.size, *start);
+
+	return(status == OKAY ? OKAY : FAILED);
+}
+
+// *****************************************************
+//
+// rf_resume_remote_prefix
+//     Checks that the start of a remote file is what a checkpoint says.
+// input parameters: clnt  - CLIENT handle talking RFILE_VERS2.
+//                   cp    - The checkpoint.
+//                   stats - failure and rpcError are set if the call failed.
+// return value: OKAY if it matches, RF_XFER_UNSUPPORTED if it does not or
+//               the server has not got rf_digest, FAILED if the call failed.
+//
+// *****************************************************
+static int rf_resume_remote_prefix(CLIENT *clnt, RF_Checkpoint_T *cp, RF_XferStats_T *stats)
+{
+	RF_DigestRequest_T req;
+	RF_DigestReply_T res;
+	enum clnt_stat rpcError;
+
+	req.filename = cp->remote;
+	req.offset = 0;
+	req.length = cp->offset;
+	if ((rpcError = rf_digest_2(&req, &res, clnt)) == RPC_PROCUNAVAIL)
+		return(RF_XFER_UNSUPPORTED);
+	if (rpcError != RPC_SUCCESS) {
+		stats->rpcError = rpcError;
+		stats->failure = "digest call failed";
+		return(FAILED);
+	}
+
+	return((res.digestStatus == OKAY && res.bytes == cp->offset && res.crc == cp->crc) ? OKAY : RF_XFER_UNSUPPORTED);
+}
+
+// *****************************************************
+//
+// rf_resume_put_run
+//     One attempt at a resumable put: carries on from the checkpoint if it
+//     still holds, or starts the remote file over, and moves the rest.
+// input parameters: clnt     - CLIENT handle talking RFILE_VERS2.
+//                   local    - Name of the local file.
+//                   remote   - Name of the file on the server.
+//                   ckpt     - Name of the checkpoint file.
+//                   maxBlock - Largest block clnt can carry.
+//                   window   - Largest number of write calls in flight.
+//                   start    - Lowest offset an attempt carried on from, -1 before
+//                              the first; lowered to this attempt's.
+//                   stats    - bytes, blocks, retransmits and wire are added to;
+//                              crc, failure and rpcError are set, and once the
+//                              remote file is complete resumed and resent.
+// return value: OKAY once the remote file is complete and checks out, FAILED,
+//               or RF_XFER_UNSUPPORTED if the server has not got rf_storefile.
+//
+// *****************************************************
+static int rf_resume_put_run(CLIENT *clnt, char *local, char *remote, char *ckpt, long maxBlock, int window,
+                             long long *start, RF_XferStats_T *stats)
+{
+	RF_StoreRequest_T req;
+	RF_StoreReply_T res;
+	RF_Checkpoint_T cp;
+	RF_XferStats_T seg;
+	enum clnt_stat rpcError;
+	struct stat st;
+	long long segment = rf_resume_segment(maxBlock, window);
+	long long len, size = 0;
+	u_int32_t crc = 0;
+	int fd, status = RF_XFER_UNSUPPORTED;
+
+	stats->rpcError = RPC_SUCCESS;
+	stats->failure = NULL;
+	if ((fd = open(local, O_RDONLY)) < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+		if (fd >= 0)
+			close(fd);
+		stats->failure = "cannot open local file";
+		return(FAILED);
+	}
+
+	/* Carry on only from the same version of the local file, and a remote prefix still there. */
+	if (rf_resume_load(ckpt, &cp) == OKAY && cp.put && strcmp(cp.remote, remote) == 0 && cp.size == st.st_size &&
+	    cp.mtime == st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec &&
+	    cp.change == st.st_ctim.tv_sec * 1000000000LL + st.st_ctim.tv_nsec &&
+	    cp.inode == (unsigned long long)st.st_ino && cp.offset > 0 && cp.offset <= cp.size)
+		status = rf_resume_remote_prefix(clnt, &cp, stats);
+	if (status == FAILED) {
+		close(fd);
+		return(FAILED);
+	}
+	if (status != OKAY) {
+		memset(&cp, 0, sizeof(cp));
+		cp.put = 1;
+		cp.size = st.st_size;
+		cp.mtime = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+		cp.change = st.st_ctim.tv_sec * 1000000000LL + st.st_ctim.tv_nsec;
+		cp.inode = st.st_ino;
+		strcpy(cp.remote, remote);
+
+		req.filename = remote;
+		req.mode = "w";
+		req.data.RF_Data_T_len = 0;
+		req.data.RF_Data_T_val = NULL;
+		if ((rpcError = rf_storefile_2(&req, &res, clnt)) == RPC_PROCUNAVAIL) {
+			close(fd);
+			return(RF_XFER_UNSUPPORTED);
+		}
+		if (rpcError != RPC_SUCCESS || res.storeStatus != OKAY) {
+			stats->rpcError = rpcError;
+			stats->failure = (rpcError != RPC_SUCCESS) ? "store call failed" : "server write failed";
+			close(fd);
+			return(FAILED);
+		}
+	}
+	if (*start < 0 || cp.offset < *start)
+		*start = cp.offset;
+
+	status = OKAY;
+	while (cp.offset < cp.size) {
+		len = (cp.size - cp.offset < segment) ? cp.size - cp.offset : segment;
+		memset(&seg, 0, sizeof(seg));
+		status = rf_xfer_put_range(clnt, fd, remote, cp.offset, len, maxBlock, window, &seg);
+		rf_resume_add(stats, &seg);
+		if (status != OKAY)
+			break;
+		if (seg.bytes != len) {
+			stats->failure = "local file changed during the transfer";
+			unlink(ckpt);
+			status = FAILED;
+			break;
+		}
+		cp.crc = rf_crc32c_combine(cp.crc, seg.crc, len);
+		cp.offset += len;
+		if (rf_resume_save(ckpt, &cp) != OKAY) {
+			stats->failure = "cannot write checkpoint";
+			status = FAILED;
+			break;
+		}
+	}
+	close(fd);
+	stats->crc = cp.crc;
+
+	/* The whole remote file must be what was sent, nothing more. */
+	if (status == OKAY && (status = rf_xfer_digest(clnt, remote, &crc, &size, stats)) == OKAY &&
+	    (crc != cp.crc || size != cp.size)) {
+		stats->failure = "checksum mismatch";
+		unlink(ckpt);
+		status = FAILED;
+	}
+	if (status == OKAY || status == RF_XFER_UNSUPPORTED) {
+		rf_resume_done(stats, cp.size, *start);
+		return(OKAY);
+	}
+
+	return(FAILED);
+}
+
+// *****************************************************
+//
+// rf_resume_names
+//     Works out the names of the checkpoint and part files of a local file.
+// input parameters: local - Name of the local file.
+//                   ckpt  - Set to LOCAL.rfresume, room for RF_MAXPATHLEN + 16.
+//                   part  - Set to LOCAL.rfpart, room for RF_MAXPATHLEN + 16.
+//                   stats - failure is set if the names are too long.
+// return value: OKAY or FAILED.
+//
+// *****************************************************
+static int rf_resume_names(char *local, char *ckpt, char *part, RF_XferStats_T *stats)
+{
+	if (strlen(local) > RF_MAXPATHLEN) {
+		stats->failure = "local file name too long";
+		return(FAILED);
+	}
+	sprintf(ckpt, "%s.rfresume", local);
+	sprintf(part, "%s.rfpart", local);
+
+	return(OKAY);
+}
+
+// *****************************************************
+//
+// rf_resume_get
+//     Copies a remote file into a local file, carrying on from where an
+//     earlier attempt stopped and reconnecting after failures in RPC.
+// input parameters: clnt     - CLIENT handle talking RFILE_VERS2; replaced by
+//                              a new connection if the transfer reconnects.
+//                   server   - Server as accepted by rf_connect.
+//                   proto    - "udp" or "tcp".
+//                   remote   - Name of the file on the server.
+//                   local    - Name of the local file.
+//                   maxBlock - Largest block the handle can carry (see rf_connect).
+//                   window   - Largest number of read calls in flight.
+//                   stats    - Filled in with what the transfer did; bytes are
+//                              those after resumed, the offset it carried on
+//                              from, and resent those moved again after failures.
+// return value: OKAY if the whole file was copied, FAILED otherwise.
+//
+// *****************************************************
+int rf_resume_get(CLIENT **clnt, char *server, char *proto, char *remote, char *local, long maxBlock,
+                  int window, RF_XferStats_T *stats)
+{
+	char ckpt[RF_MAXPATHLEN + 16], part[RF_MAXPATHLEN + 16];
+	double seconds = rf_resume_seconds();
+	long long start = -1;
+	int status;
+
+	memset(stats, 0, sizeof(RF_XferStats_T));
+	if (rf_resume_names(local, ckpt, part, stats) != OKAY)
+		return(FAILED);
+
+	for (int attempt = 0; ; attempt++) {
+		status = rf_resume_get_run(*clnt, remote, part, ckpt, maxBlock, window, &start, stats);
+		if (status != FAILED || stats->rpcError == RPC_SUCCESS || stats->rpcError == RPC_PROCUNAVAIL ||
+		    attempt >= resumeTries)
+			break;
+		rf_resume_reconnect(clnt, server, proto, attempt, &maxBlock);
+	}
+	if (status == RF_XFER_UNSUPPORTED) {
+		unlink(part);
+		return(rf_xfer_get_file(*clnt, remote, local, maxBlock, window, stats));
+	}
+	if (status == OKAY && rename(part, local) != 0) {
+		stats->failure = "cannot rename part file";
+		status = FAILED;
+	}
+	if (status == OKAY)
+		unlink(ckpt);
+	stats->seconds = rf_resume_seconds() - seconds;
+
+	return(status);
+}
+
+// *****************************************************
+//
+// rf_resume_put
+//     Copies a local file into a remote file, carrying on from where an
+//     earlier attempt stopped and reconnecting after failures in RPC.
+// input parameters: clnt     - CLIENT handle talking RFILE_VERS2; replaced by
+//                              a new connection if the transfer reconnects.
+//                   server   - Server as accepted by rf_connect.
+//                   proto    - "udp" or "tcp".
+//                   local    - Name of the local file.
+//                   remote   - Name of the file on the server.
+//                   maxBlock - Largest block the handle can carry (see rf_connect).
+//                   window   - Largest number of write calls in flight.
+//                   stats    - Filled in with what the transfer did; bytes are
+//                              those after resumed, the offset it carried on
+//                              from, and resent those moved again after failures.
+// return value: OKAY if the whole file was copied and checks out, FAILED otherwise.
+//
+// *****************************************************
+int rf_resume_put(CLIENT **clnt, char *server, char *proto, char *local, char *remote, long maxBlock,
+                  int window, RF_XferStats_T *stats)
+{
+	char ckpt[RF_MAXPATHLEN + 16], part[RF_MAXPATHLEN + 16];
+	double seconds = rf_resume_seconds();
+	long long start = -1;
+	int status;
+
+	memset(stats, 0, sizeof(RF_XferStats_T));
+	if (rf_resume_names(local, ckpt, part, stats) != OKAY)
+		return(FAILED);
+
+	for (int attempt = 0; ; attempt++) {
+		status = rf_resume_put_run(*clnt, local, remote, ckpt, maxBlock, window, &start, stats);
+		if (status != FAILED || stats->rpcError == RPC_SUCCESS || stats->rpcError == RPC_PROCUNAVAIL ||
+		    attempt >= resumeTries)
+			break;
+		rf_resume_reconnect(clnt, server, proto, attempt, &maxBlock);
+	}
+	if (status == RF_XFER_UNSUPPORTED)
+		return(rf_xfer_put_file(*clnt, local, remote, maxBlock, window, stats));
+	if (status == OKAY)
+		unlink(ckpt);
+	stats->seconds = rf_resume_seconds() - seconds;
+
+	return(status);
+}
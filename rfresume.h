@@ -0,0 +1,53 @@
+/* rfresume.h */
+
+/* Resumable gets and puts.
+// A transfer that fails half way, on a timeout or because the server was
+// restarted, normally leaves nothing to go on, and the next attempt starts
+// again from byte zero. A resumable transfer moves the file in segments with
+// the stateless rf_readpath and rf_writepath, and after each segment notes in
+// a checkpoint file, LOCAL.rfresume, how far it got: the offset, the CRC32C of
+// everything before it, and the version of the file being copied from (its
+// size, modification time, change counter and inode). A segment is the fewest
+// whole windows of blocks that make up RF_RESUME_CHECKPOINT; a failure moves
+// at most that much again.
+//
+// A get writes into LOCAL.rfpart and renames it to LOCAL once complete. It
+// carries on from the checkpoint if rf_getattr finds the remote file still at
+// the same version and the part file still holds the checksummed prefix.
+// A put carries on if the local file has not changed and the server's
+// rf_digest of the remote prefix matches the checkpoint; otherwise the remote
+// file is created or truncated with rf_storefile and the put starts over. A
+// finished put is checked against the rf_digest of the whole remote file.
+//
+// When a segment fails in RPC, the transfer reconnects after a pause that
+// doubles each time, up to RF_RESUME_MAXPAUSE seconds, and carries on from the
+// checkpoint, up to rf_resume_tries times. The reconnected handle replaces
+// the caller's. A transfer that still fails leaves its checkpoint, so running
+// it again later carries on where it stopped.
+//
+// A finished transfer reports as bytes the size of the file less the offset
+// it carried on from, and the bytes it moved again after failures as resent.
+//
+// Servers without rf_getattr get a plain rf_xfer_get_file instead, and
+// servers without rf_storefile a plain rf_xfer_put_file. A put to a server
+// without rf_digest can not check the remote prefix, so it starts over.
+*/
+
+#ifndef RFRESUME_H
+#define RFRESUME_H
+
+#include <rpc/rpc.h>
+
+#include "rfxfer.h"
+
+#define RF_RESUME_CHECKPOINT (4 * 1024 * 1024)  /* bytes moved between checkpoints, at least */
+#define RF_RESUME_TRIES 8                       /* reconnects when the caller has no preference */
+#define RF_RESUME_MAXPAUSE 30                   /* longest pause before a reconnect, seconds */
+
+int  rf_resume_get(CLIENT **clnt, char *server, char *proto, char *remote, char *local, long maxBlock,
+                   int window, RF_XferStats_T *stats);
+int  rf_resume_put(CLIENT **clnt, char *server, char *proto, char *local, char *remote, long maxBlock,
+                   int window, RF_XferStats_T *stats);
+void rf_resume_tries(int tries);
+
+#endif /* RFRESUME_H */
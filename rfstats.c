@@ -0,0 +1,329 @@
+/* rfstats.c */
+
+/* This file implements server metrics (see rfstats.h).
+// A thread's counter block is allocated and added to a global list the first
+// time the thread records something; the list lock is taken only then and by
+// readers. The owner updates its counters with relaxed atomic stores, and
+// readers load them the same way, so a snapshot never sees torn values but
+// may be a few calls behind.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "rfadmit.h"
+#include "rfcache.h"
+#include "rfdrc.h"
+#include "rfhandle.h"
+#include "rfstats.h"
+
+#define OKAY 0
+#define FAILED -1
+
+#define RF_HIST_SUBBITS 4
+#define RF_HIST_SUB (1 << RF_HIST_SUBBITS)          /* buckets per power of two */
+#define RF_HIST_BUCKETS ((32 - RF_HIST_SUBBITS + 1) * RF_HIST_SUB)
+
+typedef struct RF_ProcCounters_T
+{
+	long long	calls;
+	long long	errors;
+	long long	bytes;
+	long long	sumUsec;
+	long long	maxUsec;
+	long long	hist[RF_HIST_BUCKETS];
+} RF_ProcCounters_T;
+
+typedef struct RF_StatsThread_T
+{
+	RF_ProcCounters_T		procs[RF_STAT_PROCS];
+	struct RF_StatsThread_T	*next;
+} RF_StatsThread_T;
+
+static const char *procNames[RF_STAT_PROCS] =
+{
+	"rf_openfile_1", "rf_readfile_1", "rf_writefile_1", "rf_closefile_1",
+	"rf_openfile_2", "rf_readfile_2", "rf_writefile_2", "rf_closefile_2",
+	"rf_preadfile_2", "rf_pwritefile_2", "rf_stats_2",
+	"rf_fetchfile_2", "rf_storefile_2", "rf_fetchmany_2",
+	"rf_readpath_2", "rf_writepath_2",
+	"rf_readsum_2", "rf_writesum_2", "rf_digest_2", "rf_delta_2",
+	"rf_readz_2", "rf_writez_2", "rf_closesync_2",
+	"rf_readdirplus_2", "rf_statmany_2", "rf_getattr_2"
+};
+
+static RF_StatsThread_T *threads = NULL;
+static pthread_mutex_t threadsLock = PTHREAD_MUTEX_INITIALIZER;
+static __thread RF_StatsThread_T *mine;
+static long long startUsec;
+
+#define RF_LOAD(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define RF_ADD(x, v) __atomic_store_n(&(x), (x) + (v), __ATOMIC_RELAXED)
+
+
+// *****************************************************
+//
+// rf_stats_clock
+//     Reads the monotonic clock, for the start time of a request.
+// return value: Current time in microseconds.
+//
+// *****************************************************
+long long rf_stats_clock(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return(ts.tv_sec * 1000000LL + ts.tv_nsec / 1000);
+}
+
+// *****************************************************
+//
+// rf_hist_bucket
+//     Maps a latency to its histogram bucket.
+// input parameters: usec - The latency.
+// return value: Bucket index.
+//
+// *****************************************************
+static int rf_hist_bucket(long long usec)
+{
+	int e;
+
+	if (usec < RF_HIST_SUB)
+		return(usec < 0 ? 0 : (int)usec);
+	if (usec > 0xFFFFFFFFLL)
+		usec = 0xFFFFFFFFLL;
+
+	/* e is the position of the highest bit; keep RF_HIST_SUBBITS bits below it. */
+	e = 63 - __builtin_clzll(usec);
+
+	return((e - RF_HIST_SUBBITS + 1) * RF_HIST_SUB + (int)((usec >> (e - RF_HIST_SUBBITS)) & (RF_HIST_SUB - 1)));
+}
+
+// *****************************************************
+//
+// rf_hist_upper
+//     Reports the largest latency that falls into a bucket.
+// input parameters: bucket - Bucket index.
+// return value: Latency in microseconds.
+//
+// *****************************************************
+static long long rf_hist_upper(int bucket)
+{
+	int e;
+	long long m;
+
+	if (bucket < RF_HIST_SUB)
+		return(bucket);
+
+	e = bucket / RF_HIST_SUB + RF_HIST_SUBBITS - 1;
+	m = bucket % RF_HIST_SUB + RF_HIST_SUB;
+
+	return(((m + 1) << (e - RF_HIST_SUBBITS)) - 1);
+}
+
+// *****************************************************
+//
+// rf_stats_record
+//     Records one finished request on the calling thread's counters.
+// input parameters: proc   - RF_STAT_ procedure.
+//                   bytes  - Payload bytes moved.
+//                   status - Status returned to the client, OKAY or not.
+//                   usec   - Latency, from rf_stats_clock() differences.
+//
+// *****************************************************
+void rf_stats_record(int proc, long long bytes, long status, long long usec)
+{
+	RF_ProcCounters_T *c;
+
+	if (mine == NULL) {
+		if ((mine = calloc(1, sizeof(RF_StatsThread_T))) == NULL)
+			return;
+		pthread_mutex_lock(&threadsLock);
+		mine->next = threads;
+		threads = mine;
+		pthread_mutex_unlock(&threadsLock);
+	}
+
+	c = &mine->procs[proc];
+	RF_ADD(c->calls, 1);
+	if (status != OKAY)
+		RF_ADD(c->errors, 1);
+	if (bytes > 0)
+		RF_ADD(c->bytes, bytes);
+	RF_ADD(c->sumUsec, usec);
+	if (usec > c->maxUsec)
+		__atomic_store_n(&c->maxUsec, usec, __ATOMIC_RELAXED);
+	RF_ADD(c->hist[rf_hist_bucket(usec)], 1);
+}
+
+// *****************************************************
+//
+// rf_stats_snapshot
+//     Adds up the counters of every thread for one procedure.
+// input parameters: proc - RF_STAT_ procedure.
+//                   snap - Filled in with the totals and percentiles.
+//
+// *****************************************************
+void rf_stats_snapshot(int proc, RF_StatsSnap_T *snap)
+{
+	static long long hist[RF_HIST_BUCKETS];
+	long long seen, p50, p99, p999;
+	RF_StatsThread_T *t;
+
+	memset(snap, 0, sizeof(RF_StatsSnap_T));
+
+	/* threadsLock also serializes use of the static hist. */
+	pthread_mutex_lock(&threadsLock);
+	memset(hist, 0, sizeof(hist));
+	for (t = threads; t != NULL; t = t->next) {
+		RF_ProcCounters_T *c = &t->procs[proc];
+		long long max = RF_LOAD(c->maxUsec);
+
+		snap->calls += RF_LOAD(c->calls);
+		snap->errors += RF_LOAD(c->errors);
+		snap->bytes += RF_LOAD(c->bytes);
+		snap->sumUsec += RF_LOAD(c->sumUsec);
+		if (max > snap->maxUsec)
+			snap->maxUsec = max;
+		for (int b = 0; b < RF_HIST_BUCKETS; b++)
+			hist[b] += RF_LOAD(c->hist[b]);
+	}
+
+	/* The counts were read one by one, so use their own total for the ranks. */
+	seen = 0;
+	for (int b = 0; b < RF_HIST_BUCKETS; b++)
+		seen += hist[b];
+	p50 = (seen * 50 + 99) / 100;
+	p99 = (seen * 99 + 99) / 100;
+	p999 = (seen * 999 + 999) / 1000;
+	seen = 0;
+	for (int b = 0; b < RF_HIST_BUCKETS && seen < p999; b++) {
+		if (hist[b] == 0)
+			continue;
+		seen += hist[b];
+		if (snap->p50Usec == 0 && seen >= p50)
+			snap->p50Usec = rf_hist_upper(b);
+		if (snap->p99Usec == 0 && seen >= p99)
+			snap->p99Usec = rf_hist_upper(b);
+		if (seen >= p999)
+			snap->p999Usec = rf_hist_upper(b);
+	}
+	pthread_mutex_unlock(&threadsLock);
+
+	/* A bucket edge can lie past the largest latency actually seen. */
+	if (snap->p50Usec > snap->maxUsec)
+		snap->p50Usec = snap->maxUsec;
+	if (snap->p99Usec > snap->maxUsec)
+		snap->p99Usec = snap->maxUsec;
+	if (snap->p999Usec > snap->maxUsec)
+		snap->p999Usec = snap->maxUsec;
+}
+
+// *****************************************************
+//
+// rf_stats_name
+//     Names a procedure.
+// input parameters: proc - RF_STAT_ procedure.
+// return value: The procedure's name in rf.x, with its version.
+//
+// *****************************************************
+const char *rf_stats_name(int proc)
+{
+	return(proc >= 0 && proc < RF_STAT_PROCS ? procNames[proc] : "unknown");
+}
+
+// *****************************************************
+//
+// rf_stats_uptime
+//     Reports how long the server has been running.
+// return value: Microseconds since rf_stats_init.
+//
+// *****************************************************
+long long rf_stats_uptime(void)
+{
+	return(rf_stats_clock() - startUsec);
+}
+
+// *****************************************************
+//
+// rf_stats_dump
+//     Writes all metrics as a text table, one line per procedure that was called.
+// input parameters: out - Stream to write to.
+//
+// *****************************************************
+void rf_stats_dump(FILE *out)
+{
+	RF_StatsSnap_T snap;
+	long long hits, misses, replayed, dropped, waited, limited, shed;
+
+	rf_cache_counts(&hits, &misses);
+	rf_drc_counts(&replayed, &dropped);
+	rf_admit_counts(&waited, &limited, &shed);
+	fprintf(out, "RF Server stats: up %.1f s, %ld files open, cache %lld hits %lld misses, "
+	        "%lld duplicate calls replayed %lld dropped, %lld calls queued %lld rate limited %lld shed\n",
+	        rf_stats_uptime() / 1e6, rf_handle_count(), hits, misses, replayed, dropped, waited, limited, shed);
+	fprintf(out, "%-16s %12s %8s %14s %10s %10s %10s %10s %10s\n",
+	        "procedure", "calls", "errors", "bytes", "mean_us", "p50_us", "p99_us", "p999_us", "max_us");
+	for (int proc = 0; proc < RF_STAT_PROCS; proc++) {
+		rf_stats_snapshot(proc, &snap);
+		if (snap.calls == 0)
+			continue;
+		fprintf(out, "%-16s %12lld %8lld %14lld %10.1f %10lld %10lld %10lld %10lld\n",
+		        procNames[proc], snap.calls, snap.errors, snap.bytes, (double)snap.sumUsec / snap.calls,
+		        snap.p50Usec, snap.p99Usec, snap.p999Usec, snap.maxUsec);
+	}
+	fflush(out);
+}
+
+// *****************************************************
+//
+// rf_stats_signals
+//     Signal thread body. Dumps the metrics to stderr on every SIGUSR1.
+// input parameters: arg - The signal set to wait for.
+// return value: Never returns.
+//
+// *****************************************************
+static void *rf_stats_signals(void *arg)
+{
+	sigset_t *set = arg;
+	int sig;
+
+	for (;;) {
+		if (sigwait(set, &sig) == 0 && sig == SIGUSR1)
+			rf_stats_dump(stderr);
+	}
+
+	return(NULL);
+}
+
+// *****************************************************
+//
+// rf_stats_init
+//     Starts the clock for the uptime and the SIGUSR1 dump thread. Must be
+//     called before any other thread is created, because it blocks SIGUSR1 in
+//     the calling thread and every thread started after it.
+// return value: OKAY, or FAILED if the dump thread could not be started.
+//
+// *****************************************************
+int rf_stats_init(void)
+{
+	static sigset_t set;
+	pthread_t thread;
+
+	startUsec = rf_stats_clock();
+
+	sigemptyset(&set);
+	sigaddset(&set, SIGUSR1);
+	if (pthread_sigmask(SIG_BLOCK, &set, NULL) != 0)
+		return(FAILED);
+	if (pthread_create(&thread, NULL, rf_stats_signals, &set) != 0)
+		return(FAILED);
+	pthread_detach(thread);
+
+	return(OKAY);
+}
@@ -0,0 +1,56 @@
+/* rfstats.h */
+
+/* Server metrics.
+// Every server procedure records its calls, errors, payload bytes and latency
+// with rf_stats_record. Each thread has its own block of counters, which only
+// that thread writes, so recording takes no lock and shares no cache lines
+// with other workers. Readers add up the blocks of all threads.
+//
+// Latencies go into a log-linear histogram per procedure (HDR style): exact
+// below 16 microseconds, then 16 buckets per power of two, about 6% apart,
+// up to 2^32 microseconds.
+//
+// rf_stats_init also starts a thread that writes a text dump of all metrics
+// to stderr whenever the server gets SIGUSR1.
+*/
+
+#ifndef RFSTATS_H
+#define RFSTATS_H
+
+#include <stdio.h>
+
+/* The procedures measured. Keep rf_stats_name in step. */
+enum
+{
+	RF_STAT_OPEN1, RF_STAT_READ1, RF_STAT_WRITE1, RF_STAT_CLOSE1,
+	RF_STAT_OPEN2, RF_STAT_READ2, RF_STAT_WRITE2, RF_STAT_CLOSE2,
+	RF_STAT_PREAD2, RF_STAT_PWRITE2, RF_STAT_STATS2,
+	RF_STAT_FETCH2, RF_STAT_STORE2, RF_STAT_FETCHMANY2,
+	RF_STAT_READPATH2, RF_STAT_WRITEPATH2,
+	RF_STAT_READSUM2, RF_STAT_WRITESUM2, RF_STAT_DIGEST2, RF_STAT_DELTA2,
+	RF_STAT_READZ2, RF_STAT_WRITEZ2, RF_STAT_CLOSESYNC2,
+	RF_STAT_READDIRPLUS2, RF_STAT_STATMANY2, RF_STAT_GETATTR2,
+	RF_STAT_PROCS
+};
+
+typedef struct RF_StatsSnap_T
+{
+	long long	calls;
+	long long	errors;		/* calls that returned a status other than OKAY */
+	long long	bytes;		/* payload bytes read or written */
+	long long	sumUsec;	/* total latency, for the mean */
+	long long	maxUsec;
+	long long	p50Usec;	/* percentiles, as the upper edge of their bucket */
+	long long	p99Usec;
+	long long	p999Usec;
+} RF_StatsSnap_T;
+
+int  rf_stats_init(void);
+long long rf_stats_clock(void);
+void rf_stats_record(int proc, long long bytes, long status, long long usec);
+void rf_stats_snapshot(int proc, RF_StatsSnap_T *snap);
+const char *rf_stats_name(int proc);
+long long rf_stats_uptime(void);
+void rf_stats_dump(FILE *out);
+
+#endif /* RFSTATS_H */
@@ -0,0 +1,383 @@
+/* rfstripe.c */
+
+/* This file implements striped transfers (see rfstripe.h).
+// The file is cut into one range per stream, each a whole number of blocks.
+// The caller's thread runs the first stream over the caller's CLIENT handle;
+// every other stream gets a thread and connects on its own, since CLIENT
+// handles are not thread safe. The streams share nothing but the local file
+// descriptor, which they only use with pread and pwrite.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <rpc/rpc.h>
+
+#include "rf.h"
+#include "rfconnect.h"
+#include "rfxfer.h"
+#include "rfcrc.h"
+#include "rfstripe.h"
+
+#define OKAY 0
+#define FAILED -1
+
+typedef struct RF_Stream_T
+{
+	pthread_t		thread;
+	int				started;	/* thread was created */
+	CLIENT			*clnt;		/* handle to use, NULL to connect one */
+	char			*server;
+	char			*proto;
+	int				put;		/* 0 for a get, 1 for a put */
+	char			*remote;
+	int				localFd;
+	long long		offset;		/* range moved by this stream */
+	long long		length;
+	long			blockSize;
+	int				window;
+	int				status;		/* OKAY or FAILED */
+	RF_XferStats_T	stats;
+} RF_Stream_T;
+
+
+// *****************************************************
+//
+// rf_stripe_seconds
+//     Reads the monotonic clock.
+// return value: Current time in seconds.
+//
+// *****************************************************
+static double rf_stripe_seconds(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return(ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+// *****************************************************
+//
+// rf_stripe_stream
+//     Stream thread body. Connects if the stream has no handle yet, then moves
+//     the stream's range.
+// input parameters: arg - The RF_Stream_T of this stream.
+// return value: NULL.
+//
+// *****************************************************
+static void *rf_stripe_stream(void *arg)
+{
+	RF_Stream_T *s = arg;
+	CLIENT *clnt = s->clnt;
+	long maxBlock;
+
+	memset(&s->stats, 0, sizeof(RF_XferStats_T));
+	if (clnt == NULL && (clnt = rf_connect(s->server, RFILE_VERS2, s->proto, &maxBlock)) == NULL) {
+		s->stats.rpcError = rpc_createerr.cf_stat;
+		s->stats.failure = "no connection to server";
+		s->status = FAILED;
+		return(NULL);
+	}
+
+	if (s->put)
+		s->status = rf_xfer_put_range(clnt, s->localFd, s->remote, s->offset, s->length, s->blockSize, s->window, &s->stats);
+	else
+		s->status = rf_xfer_get_range(clnt, s->remote, s->localFd, s->offset, s->length, s->blockSize, s->window, &s->stats);
+
+	if (s->clnt == NULL)
+		clnt_destroy(clnt);
+
+	return(NULL);
+}
+
+// *****************************************************
+//
+// rf_stripe_run
+//     Moves a file as ranges over several streams at once and adds up what
+//     the streams did.
+// input parameters: clnt     - CLIENT handle for the first stream.
+//                   server   - Server as accepted by rf_connect, for the other streams.
+//                   proto    - "udp" or "tcp".
+//                   put      - 0 for a get, 1 for a put.
+//                   remote   - Name of the file on the server.
+//                   localFd  - Local file descriptor, open for writing for a
+//                              get, for reading for a put.
+//                   size     - Bytes to move.
+//                   maxBlock - Largest block the handles can carry.
+//                   streams  - Number of streams, at most RF_STRIPE_MAX.
+//                   window   - Largest number of calls in flight per stream.
+//                   stats    - bytes, blocks and retransmits are added up,
+//                              crc is that of the whole file; failure and rpcError are set from
+//                              the first stream that failed.
+// return value: OKAY if every stream moved its range, FAILED otherwise.
+//
+// *****************************************************
+static int rf_stripe_run(CLIENT *clnt, char *server, char *proto, int put, char *remote, int localFd,
+                         long long size, long maxBlock, int streams, int window, RF_XferStats_T *stats)
+{
+	RF_Stream_T s[RF_STRIPE_MAX];
+	long long numBlocks = (size + maxBlock - 1) / maxBlock;
+	long long perStream;
+	int status = OKAY;
+
+	if (streams > numBlocks)
+		streams = numBlocks;
+	perStream = (numBlocks + streams - 1) / streams * maxBlock;
+	streams = (size + perStream - 1) / perStream;
+
+	memset(s, 0, sizeof(s));
+	for (int i = 0; i < streams; i++) {
+		s[i].clnt = (i == 0) ? clnt : NULL;
+		s[i].server = server;
+		s[i].proto = proto;
+		s[i].put = put;
+		s[i].remote = remote;
+		s[i].localFd = localFd;
+		s[i].offset = i * perStream;
+		s[i].length = (size - s[i].offset < perStream) ? size - s[i].offset : perStream;
+		s[i].blockSize = maxBlock;
+		s[i].window = window;
+	}
+
+	/* A stream whose thread can not be created is run here after the first. */
+	for (int i = 1; i < streams; i++)
+		s[i].started = (pthread_create(&s[i].thread, NULL, rf_stripe_stream, &s[i]) == 0);
+	rf_stripe_stream(&s[0]);
+	for (int i = 1; i < streams; i++) {
+		if (s[i].started)
+			pthread_join(s[i].thread, NULL);
+		else
+			rf_stripe_stream(&s[i]);
+	}
+
+	for (int i = 0; i < streams; i++) {
+		stats->bytes += s[i].stats.bytes;
+		stats->wire += s[i].stats.wire;
+		stats->blocks += s[i].stats.blocks;
+		stats->retransmits += s[i].stats.retransmits;
+		stats->crc = rf_crc32c_combine(stats->crc, s[i].stats.crc, s[i].length);
+		if (s[i].status != OKAY && status == OKAY) {
+			stats->rpcError = s[i].stats.rpcError;
+			stats->failure = s[i].stats.failure;
+			status = FAILED;
+		}
+	}
+
+	return(status);
+}
+
+// *****************************************************
+//
+// rf_stripe_remote_size
+//     Asks the server for the size of a file with an empty rf_fetchfile.
+// input parameters: clnt   - CLIENT handle talking RFILE_VERS2.
+//                   remote - Name of the file on the server.
+//                   size   - Set to the size of the file.
+//                   stats  - failure and rpcError are set if the call failed.
+// return value: OKAY, FAILED, or RF_XFER_UNSUPPORTED if the server has not
+//               got rf_fetchfile.
+//
+// *****************************************************
+static int rf_stripe_remote_size(CLIENT *clnt, char *remote, long long *size, RF_XferStats_T *stats)
+{
+	RF_FetchRequest_T req;
+	RF_FetchReply_T res;
+	enum clnt_stat rpcError;
+
+	req.filename = remote;
+	req.maxBytes = 0;
+	memset(&res, 0, sizeof(res));
+	if ((rpcError = rf_fetchfile_2(&req, &res, clnt)) == RPC_PROCUNAVAIL)
+		return(RF_XFER_UNSUPPORTED);
+	if (rpcError != RPC_SUCCESS) {
+		stats->rpcError = rpcError;
+		stats->failure = "fetch call failed";
+		return(FAILED);
+	}
+	*size = res.fileSize;
+	xdr_free((xdrproc_t)xdr_RF_FetchReply_T, (char *)&res);
+	if (res.fetchStatus != OKAY) {
+		stats->failure = "cannot open remote file";
+		return(FAILED);
+	}
+
+	return(OKAY);
+}
+
+// *****************************************************
+//
+// rf_stripe_verify
+//     Checks a finished transfer: both copies must be size bytes long and the
+//     server's rf_digest of the remote file must match the checksum of the
+//     bytes moved. Servers without rf_digest only have the sizes checked.
+// input parameters: clnt      - CLIENT handle talking RFILE_VERS2.
+//                   remote    - Name of the file on the server.
+//                   size      - Size the file had when the transfer started.
+//                   localSize - Size of the local file now.
+//                   stats     - The transfer; failure is set if the check fails.
+// return value: OKAY or FAILED.
+//
+// *****************************************************
+static int rf_stripe_verify(CLIENT *clnt, char *remote, long long size, long long localSize, RF_XferStats_T *stats)
+{
+	u_int32_t crc = stats->crc;
+	long long remoteSize = 0;
+	int status;
+
+	if ((status = rf_xfer_digest(clnt, remote, &crc, &remoteSize, stats)) == RF_XFER_UNSUPPORTED)
+		status = rf_stripe_remote_size(clnt, remote, &remoteSize, stats);
+	if (status != OKAY)
+		return(FAILED);
+
+	if (stats->bytes != size || localSize != size || remoteSize != size) {
+		stats->failure = "file changed size during the transfer";
+		return(FAILED);
+	}
+	if (crc != stats->crc) {
+		stats->failure = "checksum mismatch";
+		return(FAILED);
+	}
+
+	return(OKAY);
+}
+
+// *****************************************************
+//
+// rf_stripe_get
+//     Copies a remote file into a local file over several streams. The local
+//     file is created or truncated and preallocated to the remote file's size.
+// input parameters: clnt     - CLIENT handle talking RFILE_VERS2, used by the first stream.
+//                   server   - Server as accepted by rf_connect, for the other streams.
+//                   proto    - "udp" or "tcp".
+//                   remote   - Name of the file on the server.
+//                   local    - Name of the local file.
+//                   maxBlock - Largest block the handles can carry (see rf_connect).
+//                   streams  - Number of streams; 1 or less copies with rf_xfer_get_file.
+//                   window   - Largest number of read calls in flight per stream.
+//                   stats    - Filled in with what the transfer did.
+// return value: OKAY if the whole file was copied and checks out, FAILED otherwise.
+//
+// *****************************************************
+int rf_stripe_get(CLIENT *clnt, char *server, char *proto, char *remote, char *local, long maxBlock,
+                  int streams, int window, RF_XferStats_T *stats)
+{
+	struct stat st;
+	double seconds = rf_stripe_seconds();
+	long long size = 0;
+	int localFd;
+	int status;
+
+	memset(stats, 0, sizeof(RF_XferStats_T));
+	if (streams > RF_STRIPE_MAX)
+		streams = RF_STRIPE_MAX;
+
+	/* Streams only pay off for files of several blocks. */
+	if (streams <= 1 || (status = rf_stripe_remote_size(clnt, remote, &size, stats)) == RF_XFER_UNSUPPORTED ||
+	    (status == OKAY && size <= 2 * maxBlock))
+		return(rf_xfer_get_file(clnt, remote, local, maxBlock, window, stats));
+	if (status != OKAY)
+		return(FAILED);
+
+	if ((localFd = open(local, O_RDWR | O_CREAT | O_TRUNC, 0666)) < 0) {
+		stats->failure = "cannot open local file";
+		return(FAILED);
+	}
+	if (posix_fallocate(localFd, 0, size) != 0) {
+		stats->failure = "cannot preallocate local file";
+		close(localFd);
+		return(FAILED);
+	}
+
+	/* A server that has rf_fetchfile but not rf_readpath fails every stream at once. */
+	status = rf_stripe_run(clnt, server, proto, 0, remote, localFd, size, maxBlock, streams, window, stats);
+	if (status == FAILED && stats->rpcError == RPC_PROCUNAVAIL && stats->bytes == 0) {
+		close(localFd);
+		return(rf_xfer_get_file(clnt, remote, local, maxBlock, window, stats));
+	}
+	if (status == OKAY && (fstat(localFd, &st) != 0 || rf_stripe_verify(clnt, remote, size, st.st_size, stats) != OKAY))
+		status = FAILED;
+	if (close(localFd) != 0 && status == OKAY) {
+		stats->failure = "cannot close local file";
+		status = FAILED;
+	}
+	stats->seconds = rf_stripe_seconds() - seconds;
+
+	return(status);
+}
+
+// *****************************************************
+//
+// rf_stripe_put
+//     Copies a local file into a remote file over several streams. The remote
+//     file is created or truncated first.
+// input parameters: clnt     - CLIENT handle talking RFILE_VERS2, used by the first stream.
+//                   server   - Server as accepted by rf_connect, for the other streams.
+//                   proto    - "udp" or "tcp".
+//                   local    - Name of the local file.
+//                   remote   - Name of the file on the server.
+//                   maxBlock - Largest block the handles can carry (see rf_connect).
+//                   streams  - Number of streams; 1 or less copies with rf_xfer_put_file.
+//                   window   - Largest number of write calls in flight per stream.
+//                   stats    - Filled in with what the transfer did.
+// return value: OKAY if the whole file was copied and checks out, FAILED otherwise.
+//
+// *****************************************************
+int rf_stripe_put(CLIENT *clnt, char *server, char *proto, char *local, char *remote, long maxBlock,
+                  int streams, int window, RF_XferStats_T *stats)
+{
+	RF_StoreRequest_T req;
+	RF_StoreReply_T res;
+	enum clnt_stat rpcError;
+	struct stat st;
+	double seconds = rf_stripe_seconds();
+	int localFd;
+	int status;
+
+	memset(stats, 0, sizeof(RF_XferStats_T));
+	if (streams > RF_STRIPE_MAX)
+		streams = RF_STRIPE_MAX;
+
+	if (streams <= 1 || stat(local, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 2 * maxBlock)
+		return(rf_xfer_put_file(clnt, local, remote, maxBlock, window, stats));
+
+	if ((localFd = open(local, O_RDONLY)) < 0 || fstat(localFd, &st) != 0) {
+		if (localFd >= 0)
+			close(localFd);
+		stats->failure = "cannot open local file";
+		return(FAILED);
+	}
+
+	/* Create or truncate the remote file; the streams write into it. */
+	req.filename = remote;
+	req.mode = "w";
+	req.data.RF_Data_T_len = 0;
+	req.data.RF_Data_T_val = NULL;
+	if ((rpcError = rf_storefile_2(&req, &res, clnt)) == RPC_PROCUNAVAIL) {
+		close(localFd);
+		return(rf_xfer_put_file(clnt, local, remote, maxBlock, window, stats));
+	}
+	if (rpcError != RPC_SUCCESS || res.storeStatus != OKAY) {
+		stats->rpcError = rpcError;
+		stats->failure = (rpcError != RPC_SUCCESS) ? "store call failed" : "server write failed";
+		close(localFd);
+		return(FAILED);
+	}
+
+	status = rf_stripe_run(clnt, server, proto, 1, remote, localFd, st.st_size, maxBlock, streams, window, stats);
+	if (status == FAILED && stats->rpcError == RPC_PROCUNAVAIL && stats->bytes == 0) {
+		close(localFd);
+		return(rf_xfer_put_file(clnt, local, remote, maxBlock, window, stats));
+	}
+	if (status == OKAY && rf_stripe_verify(clnt, remote, st.st_size, st.st_size, stats) != OKAY)
+		status = FAILED;
+	close(localFd);
+	stats->seconds = rf_stripe_seconds() - seconds;
+
+	return(status);
+}
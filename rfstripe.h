@@ -0,0 +1,34 @@
+/* rfstripe.h */
+
+/* Striped transfers of single large files.
+// One stream of calls, however wide its window, is served by one server
+// worker and one connection. A striped transfer splits a large file into as
+// many byte ranges as it has streams and moves the ranges at the same time,
+// each over its own CLIENT handle and thread. The ranges go through the
+// stateless rf_readpath and rf_writepath, so no stream needs a remote handle.
+//
+// A get preallocates the local file and every block is written at its own
+// offset; a put creates or truncates the remote file with rf_storefile first.
+// The CRC32C of each range is combined into that of the whole file, which at
+// the end must match the server's rf_digest of the remote file.
+//
+// Files of only a few blocks, and servers without the newer procedures, get a
+// plain rf_xfer_get_file or rf_xfer_put_file instead.
+*/
+
+#ifndef RFSTRIPE_H
+#define RFSTRIPE_H
+
+#include <rpc/rpc.h>
+
+#include "rfxfer.h"
+
+#define RF_DEFAULT_STREAMS 1   /* streams per file when the caller has no preference */
+#define RF_STRIPE_MAX 64       /* most streams per file */
+
+int rf_stripe_get(CLIENT *clnt, char *server, char *proto, char *remote, char *local, long maxBlock,
+                  int streams, int window, RF_XferStats_T *stats);
+int rf_stripe_put(CLIENT *clnt, char *server, char *proto, char *local, char *remote, long maxBlock,
+                  int streams, int window, RF_XferStats_T *stats);
+
+#endif /* RFSTRIPE_H */
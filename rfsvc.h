@@ -0,0 +1,15 @@
+/* rfsvc.h */
+
+/* Services the server main program (rfsvcmain.c) offers to the procedures.
+*/
+
+#ifndef RFSVC_H
+#define RFSVC_H
+
+#include <sys/types.h>
+#include <rpc/rpc.h>
+
+int rf_svc_reply_file(struct svc_req *rqstp, xdrproc_t xdrHead, void *head, int fd, off_t offset, u_int count);
+int rf_svc_comp_level(void);
+
+#endif /* RFSVC_H */
@@ -5,162 +5,1486 @@
 // write, and close file procedures.
 // The input and return value structures are defined by rf.x and are part of
 // the RPCGEN specification.
+// The stubs are generated with rpcgen -M, so every procedure fills in a reply
+// provided by the caller instead of returning a static one, and may run on
+// several server worker threads at once (see rfsvcmain.c).
+// Files are kept as raw descriptors and read with read/pread, without a stdio
+// buffer in between. Large offset reads over TCP are sent with sendfile, so
+// their data goes from the page cache to the socket without being copied
+// through a reply buffer.
+// The compound procedures rf_fetchfile, rf_storefile and rf_fetchmany do a
+// whole open, transfer and close in one call, for small files.
+// The stateless rf_readpath and rf_writepath name the file by path and keep
+// it open in rffdcache.h between calls; rf_readsum and rf_writesum do the same
+// with a CRC32C (rfcrc.h) on every block, and rf_digest checksums a whole file.
+// rf_delta sends only the parts of a file a client's copy is missing (rfdelta.h).
+// rf_readz and rf_writez carry the blocks compressed (rfcomp.h).
+// rf_writefile goes through a write-behind buffer per handle (rfwb.h), which
+// every other use of the handle writes out first; rf_closesync reports
+// whether the file's data is on stable storage.
+// rf_readdirplus lists a directory a page at a time from a cached scan
+// (rfdircache.h), and rf_statmany stats many paths in one call. rf_getattr
+// gives clients what they need to tell whether a copy they keep is current.
+// Every request is counted and timed in rfstats.h, and logged through rflog.h:
+// a sampled record per request, payload bytes only at RF_LOG_TRACE.
+// Version 2 replies and scratch buffers are taken from the worker's arena
+// (rfarena.h), given back whole once the reply has been sent.
 */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
 #include <rpc/rpc.h>
 
 #include "rf.h"
+#include "rfadmit.h"
+#include "rfarena.h"
+#include "rfcache.h"
+#include "rfcomp.h"
+#include "rfcrc.h"
+#include "rfdelta.h"
+#include "rfdircache.h"
+#include "rffdcache.h"
+#include "rfhandle.h"
+#include "rflog.h"
+#include "rfstats.h"
+#include "rfsvc.h"
+#include "rfwb.h"
 
 #define OKAY 0
 #define FAILED -1
 
-FILE *filedesc[1]; /* can open up to one file at a time. */
-long fd = 0; /* index into filedesc (only one file operation permitted at a time) */
 
+/* Offset reads of at least this many bytes over TCP are sent with sendfile.
+// Below it the extra system calls cost more than the copy they save.
+*/
+#define RF_SENDFILE_MIN (64 * 1024)
+
+/* Bytes rf_digest reads at a time. */
+#define RF_DIGEST_CHUNK (1024 * 1024)
+
+/* A file whose times are at least this many seconds old is stable for
+// rf_getattr: coarser than the clock tick of any file system served.
+*/
+#define RF_ATTR_SETTLE 2
 
 /* Default timeout can be changed using clnt_control() */
 static struct timeval TIMEOUT = { 25,0 };
 
 
+// *****************************************************
+//
+// rf_open_mode
+//     Opens a file with an fopen style mode string ("r", "w", "a", optionally
+//     followed by "+" and/or "b").
+// input parameters: filename - Path of the file.
+//                   mode     - The fopen mode.
+// return value: The file descriptor, or FAILED.
+//
+// *****************************************************
+static int rf_open_mode(char *filename, char *mode)
+{
+	int flags;
+
+	switch (mode[0]) {
+	case 'r':
+		flags = 0;
+		break;
+	case 'w':
+		flags = O_CREAT | O_TRUNC;
+		break;
+	case 'a':
+		flags = O_CREAT | O_APPEND;
+		break;
+	default:
+		return(FAILED);
+	}
+
+	if (strchr(mode, '+') != NULL)
+		flags |= O_RDWR;
+	else
+		flags |= (mode[0] == 'r') ? O_RDONLY : O_WRONLY;
+
+	return(open(filename, flags, 0666));
+}
+
+// *****************************************************
+//
+// rf_request_done
+//     Records a finished request in the metrics and the request log, and
+//     charges its bytes to its client's rate (see rfadmit.h).
+// input parameters: proc   - RF_STAT_ procedure.
+//                   fd     - Handle the request used.
+//                   bytes  - Payload bytes moved.
+//                   status - Status returned to the client.
+//                   start  - rf_stats_clock() when the request started.
+//
+// *****************************************************
+static void rf_request_done(int proc, long fd, long long bytes, long status, long long start)
+{
+	long long usec = rf_stats_clock() - start;
+
+	rf_stats_record(proc, bytes, status, usec);
+	rf_admit_bytes(bytes);
+	rf_log_request(rf_stats_name(proc), fd, bytes, status, usec);
+}
+
+
 /*
  * RPC procedure to open server file
- * NOTE: This file is local to the server and hence fopen is used.
+ * NOTE: This file is local to the server and hence open is used.
  */
 
 // *****************************************************
 //
-// rf_openfile_1
+// rf_openfile_1_svc
 //     Used to open a file based on parameters set by a given RF_OpenFileRequest_T.
 // input parameters: openArg - The RF_OpenFileRequest_T who's members have been populated by a RF_CLIENT.
+//	                 res     - The reply to fill in.
 //	                 rqstp   - The RF_CLIENT that made the request.
-// return value: A RF_OpenFileReply_T who's members reflect the outcome of the rf_openfile_1 procedure.
+// return value: TRUE; the caller's RF_OpenFileReply_T res reflects the outcome of the rf_openfile_1 procedure.
 //
 // *****************************************************
-RF_OpenFileReply_T *rf_openfile_1(RF_OpenFileRequest_T *openArg, struct svc_req *rqstp)
+bool_t rf_openfile_1_svc(RF_OpenFileRequest_T *openArg, RF_OpenFileReply_T *res, struct svc_req *rqstp)
 {
-   static RF_OpenFileReply_T res;
-
-   printf("RF Server: Filename to open %s\n", openArg->filename);
+   long long start = rf_stats_clock();
+   int fd;
 
-   /* Open the specified file. Set openStatus to 0 if successful, -1 otherwise. */
-   filedesc[fd] = fopen(openArg->filename, openArg->mode);
-   if (filedesc[fd] != NULL)
-      res.openStatus = OKAY;
-   else
-      res.openStatus = FAILED;
+   RF_LOG(RF_LOG_DEBUG, "open %s mode %s", openArg->filename, openArg->mode);
 
-   res.fd = fd; /* Set fd to 0 */
+   /* Open the specified file and store it in the handle table.
+   // Set openStatus to 0 if successful, -1 otherwise.
+   */
+   res->fd = FAILED;
+   res->openStatus = FAILED;
+   fd = rf_open_mode(openArg->filename, openArg->mode);
+   if (fd >= 0) {
+      res->fd = rf_handle_alloc(fd);
+      if (res->fd != FAILED) {
+         res->openStatus = OKAY;
+      } else {
+         RF_LOG(RF_LOG_WARN, "handle table full, %ld files open", rf_handle_count());
+         close(fd);
+      }
+   }
+   rf_request_done(RF_STAT_OPEN1, res->fd, 0, res->openStatus, start);
 
-   return(&res);
+   return(TRUE);
 }
 
 /*
  * RPC procedure to read from the server file
- * NOTE: This file is local to the server and hence fread is used.
+ * NOTE: This file is local to the server and hence read is used.
  */
 
 // *****************************************************
 //
-// rf_readfile_1
+// rf_readfile_1_svc
 //     Used to read a file based on the parameters set by a given RF_ReadFileRequest_T.
-//     Prints bytes read or error message depending on success or failure.
+//     The bytes read are logged at RF_LOG_TRACE.
 // input parameters: readArg - The RF_ReadFileRequest_T who's members have been populated by a RF_CLIENT.
+//	                 res     - The reply to fill in.
 //	                 rqstp   - The RF_CLIENT that made the request.
-// return value: A RF_ReadFileReply_T who's members reflect the outcome of the rf_readfile_1 procedure.
+// return value: TRUE; the caller's RF_ReadFileReply_T res reflects the outcome of the rf_readfile_1 procedure.
 //
 // *****************************************************
-RF_ReadFileReply_T *rf_readfile_1(RF_ReadFileRequest_T *readArg, struct svc_req *rqstp)
+bool_t rf_readfile_1_svc(RF_ReadFileRequest_T *readArg, RF_ReadFileReply_T *res, struct svc_req *rqstp)
 {
-	static RF_ReadFileReply_T res;
-
-	printf("RF Server: Recieved file read request.\n");
+	long long start = rf_stats_clock();
+	int fd;
 
 	/* Read the file specified by fd into buf. Set readStatus to 0 if successful, -1 otherwise. */
-	res.bytesRead = fread(res.buf, 1, readArg->bytesToRead, filedesc[readArg->fd]);
+	fd = rf_handle_get(readArg->fd);
+	if (fd >= 0)
+		rf_wb_flush(readArg->fd, fd);
+	if (fd < 0 || readArg->bytesToRead < 0 || readArg->bytesToRead > sizeof(res->buf))
+		res->bytesRead = FAILED;
+	else
+		res->bytesRead = rf_cache_read(readArg->fd, fd, res->buf, readArg->bytesToRead);
+	if (fd >= 0)
+		rf_handle_put(readArg->fd);
 
-	if (res.bytesRead >= 0){
-		res.readStatus = OKAY;
-		printf("Read file OKAY. Printing all %d bytes read...\n\n", res.bytesRead);
-		for(int i=0; i < res.bytesRead; i++){
-			printf("%c", res.buf[i]);
-		}
-		printf("\n");
-		printf("End of bytes read.\n");
+	if (res->bytesRead >= 0){
+		res->readStatus = OKAY;
+		rf_log_dump("rf_readfile_1", res->buf, res->bytesRead);
 	}
 	else{
-		res.readStatus = FAILED;
-		printf("Failed to read file. FD: %d\n", readArg->fd);
+		res->readStatus = FAILED;
+		RF_LOG(RF_LOG_WARN, "rf_readfile_1 failed, fd %ld", readArg->fd);
 	}
-	
-	printf("Returning RF_ReadFileReply_T struct to calling client.\n");
+	rf_request_done(RF_STAT_READ1, readArg->fd, res->bytesRead, res->readStatus, start);
 
-	return(&res);
+	return(TRUE);
 }
 
 /*
  * RPC procedure to write to the server file.
- * NOTE: This file is local to the server, hence fwrite is used.
+ * NOTE: This file is local to the server, hence write is used.
  */
  
 // *****************************************************
 //
-// rf_writefile_1
+// rf_writefile_1_svc
 //     Used to write to a file based on the parameters set by a given RF_WriteFileRequest_T.
 // input parameters: writeArg - The RF_WriteFileRequest_T who's members have been populated by a RF_CLIENT.
+//	                 res      - The reply to fill in.
 //	                 rqstp    - The RF_CLIENT that made the request.
-// return value: A RF_WriteFileReply_T who's members reflect the outcome of the rf_writefile_1 procedure.
+// return value: TRUE; the caller's RF_WriteFileReply_T res reflects the outcome of the rf_writefile_1 procedure.
 //
 // *****************************************************
 
- RF_WriteFileReply_T *rf_writefile_1(RF_WriteFileRequest_T *writeArg, struct svc_req *rqstp){
+ bool_t rf_writefile_1_svc(RF_WriteFileRequest_T *writeArg, RF_WriteFileReply_T *res, struct svc_req *rqstp){
  
-	static RF_WriteFileReply_T res; /* The struct to return */
+	long long start = rf_stats_clock();
+	int fd;
 	
-	/* Write the bytes from buf to the file specified by fd. */
-	res.bytesWritten = fwrite(writeArg->buf, 1, writeArg->bytesToWrite, filedesc[writeArg->fd]);
+	/* Write the bytes from buf to the file specified by fd, through its write-behind buffer. */
+	fd = rf_handle_get(writeArg->fd);
+	if (fd < 0 || writeArg->bytesToWrite < 0 || writeArg->bytesToWrite > sizeof(writeArg->buf))
+		res->bytesWritten = 0;
+	else
+		res->bytesWritten = rf_wb_write(writeArg->fd, fd, writeArg->buf, writeArg->bytesToWrite);
+	if (fd >= 0)
+		rf_handle_put(writeArg->fd);
 	
 	/* If any bytes were written, set writeStatus to 0. Otherwise set writeStatus to -1. */
-	if(res.bytesWritten > 0){
-        res.writeStatus = OKAY;
-		printf("Write file OKAY. Printing all %d bytes written...\n\n", writeArg->bytesToWrite);
-		for(int i=0; i < writeArg->bytesToWrite; i++){
-			printf("%c", writeArg->buf[i]);
-		}
-		printf("\n");
-		printf("End of bytes written.\n");
+	if(res->bytesWritten > 0){
+        res->writeStatus = OKAY;
+		rf_log_dump("rf_writefile_1", writeArg->buf, res->bytesWritten);
     }else{
-        res.writeStatus = FAILED;
-		printf("Failed to write to file. FD: %d\n", writeArg->fd);
+        res->writeStatus = FAILED;
+		RF_LOG(RF_LOG_WARN, "rf_writefile_1 failed, fd %ld", writeArg->fd);
 	}
+	rf_request_done(RF_STAT_WRITE1, writeArg->fd, res->bytesWritten, res->writeStatus, start);
 	
-	printf("Returning RF_WriteFileReply_T struct to calling client.\n");
-	
-	return(&res);
+	return(TRUE);
  }
 
 
 /*
  * RPC procedure to close server file
- * NOTE: This file is local to the server and hence fclose is used.
+ * NOTE: This file is local to the server and hence close is used.
  */
 
 // *****************************************************
 //
-// rf_closefile_1
+// rf_closefile_1_svc
 //     Used to close file based on the parameters set by a given RF_WriteFileRequest_T.
 // input parameters: closeArg - The RF_CloseFileRequest_T who's members have been populated by a RF_CLIENT.
+//	                 res      - The reply to fill in.
+//	                 rqstp    - The RF_CLIENT that made the request.
+// return value: TRUE; the caller's RF_CloseFileReply_T res reflects the outcome of the rf_closefile_1 procedure.
+//
+// *****************************************************
+bool_t rf_closefile_1_svc(RF_CloseFileRequest_T *closeArg, RF_CloseFileReply_T *res, struct svc_req *rqstp)
+{
+   long long start = rf_stats_clock();
+   int fd;
+
+   /* Release the handle, write out its buffer, then close the file it referred to. */
+   fd = rf_handle_release(closeArg->fd);
+   if (fd >= 0)
+      res->closeStatus = (rf_wb_close(closeArg->fd, fd, 0, NULL) | close(fd)) ? FAILED : OKAY;
+   else
+      res->closeStatus = FAILED;
+   rf_request_done(RF_STAT_CLOSE1, closeArg->fd, 0, res->closeStatus, start);
+
+   return(TRUE);
+}
+
+
+/*
+ * Version 2 procedures. These move variable length blocks instead of 64 bytes.
+ */
+
+// *****************************************************
+//
+// rf_max_block
+//     Determines the largest block that may be moved in one call on the
+//     transport a request arrived on.
+// input parameters: rqstp - The RF_CLIENT that made the request.
+// return value: RF_MAXBLOCK_TCP for stream transports, RF_MAXBLOCK_UDP otherwise.
+//
+// *****************************************************
+static long rf_max_block(struct svc_req *rqstp)
+{
+	int type = SOCK_DGRAM;
+	socklen_t len = sizeof(type);
+
+	if (rqstp != NULL)
+		getsockopt(rqstp->rq_xprt->xp_sock, SOL_SOCKET, SO_TYPE, &type, &len);
+
+	return(type == SOCK_STREAM ? RF_MAXBLOCK_TCP : RF_MAXBLOCK_UDP);
+}
+
+// *****************************************************
+//
+// xdr_rf_pread_head
+//     Encodes the part of a RF_PReadReply_T in front of the data bytes:
+//     readStatus, offset and the data length. Used with rf_svc_reply_file.
+// input parameters: xdrs - XDR stream to encode into.
+//                   res  - The reply; data.RF_Data_T_len holds the length.
+// return value: TRUE if it fit.
+//
+// *****************************************************
+static bool_t xdr_rf_pread_head(XDR *xdrs, RF_PReadReply_T *res)
+{
+	return(xdr_long(xdrs, &res->readStatus) &&
+	       xdr_quad_t(xdrs, &res->offset) &&
+	       xdr_u_int(xdrs, &res->data.RF_Data_T_len));
+}
+
+// *****************************************************
+//
+// rf_openfile_2_svc
+//     Used to open a file based on parameters set by a given RF_OpenFile2Request_T.
+// input parameters: openArg - The RF_OpenFile2Request_T who's members have been populated by a RF_CLIENT.
+//	                 res     - The reply to fill in.
+//	                 rqstp   - The RF_CLIENT that made the request.
+// return value: TRUE; res holds the handle and the largest block the client may use.
+//
+// *****************************************************
+bool_t rf_openfile_2_svc(RF_OpenFile2Request_T *openArg, RF_OpenFile2Reply_T *res, struct svc_req *rqstp)
+{
+	long long start = rf_stats_clock();
+	int fd;
+
+	RF_LOG(RF_LOG_DEBUG, "open %s mode %s", openArg->filename, openArg->mode);
+
+	res->fd = FAILED;
+	res->openStatus = FAILED;
+	res->maxBlock = rf_max_block(rqstp);
+	fd = rf_open_mode(openArg->filename, openArg->mode);
+	if (fd >= 0) {
+		res->fd = rf_handle_alloc(fd);
+		if (res->fd != FAILED) {
+			res->openStatus = OKAY;
+		} else {
+			RF_LOG(RF_LOG_WARN, "handle table full, %ld files open", rf_handle_count());
+			close(fd);
+		}
+	}
+	rf_request_done(RF_STAT_OPEN2, res->fd, 0, res->openStatus, start);
+
+	return(TRUE);
+}
+
+// *****************************************************
+//
+// rf_readfile_2_svc
+//     Used to read one block of a file based on the parameters set by a given RF_ReadFile2Request_T.
+//     bytesToRead is clamped to the largest block of the request's transport.
+// input parameters: readArg - The RF_ReadFile2Request_T who's members have been populated by a RF_CLIENT.
+//	                 res     - The reply to fill in.
+//	                 rqstp   - The RF_CLIENT that made the request.
+// return value: TRUE; res holds the bytes read, data_len is 0 at end of file.
+//               The block is taken from the worker's arena.
+//
+// *****************************************************
+bool_t rf_readfile_2_svc(RF_ReadFile2Request_T *readArg, RF_ReadFile2Reply_T *res, struct svc_req *rqstp)
+{
+	long long start = rf_stats_clock();
+	long count = readArg->bytesToRead;
+	ssize_t bytesRead;
+	int fd;
+
+	res->readStatus = FAILED;
+	res->data.RF_Data_T_val = NULL;
+	res->data.RF_Data_T_len = 0;
+
+	if (count > rf_max_block(rqstp))
+		count = rf_max_block(rqstp);
+
+	fd = rf_handle_get(readArg->fd);
+	if (fd >= 0) {
+		rf_wb_flush(readArg->fd, fd);
+		if (count >= 0 && (res->data.RF_Data_T_val = rf_arena_alloc(count)) != NULL) {
+			bytesRead = rf_cache_read(readArg->fd, fd, res->data.RF_Data_T_val, count);
+			if (bytesRead >= 0) {
+				res->data.RF_Data_T_len = bytesRead;
+				res->readStatus = OKAY;
+			}
+		}
+		rf_handle_put(readArg->fd);
+	}
+
+	if (res->readStatus == OKAY)
+		rf_log_dump("rf_readfile_2", res->data.RF_Data_T_val, res->data.RF_Data_T_len);
+	else
+		RF_LOG(RF_LOG_WARN, "rf_readfile_2 failed, fd %ld", readArg->fd);
+	rf_request_done(RF_STAT_READ2, readArg->fd, res->data.RF_Data_T_len, res->readStatus, start);
+
+	return(TRUE);
+}
+
+// *****************************************************
+//
+// rf_writefile_2_svc
+//     Used to write one block to a file based on the parameters set by a given RF_WriteFile2Request_T.
+// input parameters: writeArg - The RF_WriteFile2Request_T who's members have been populated by a RF_CLIENT.
+//	                 res      - The reply to fill in.
+//	                 rqstp    - The RF_CLIENT that made the request.
+// return value: TRUE; writeStatus in res is 0 only if the whole block was written.
+//
+// *****************************************************
+bool_t rf_writefile_2_svc(RF_WriteFile2Request_T *writeArg, RF_WriteFile2Reply_T *res, struct svc_req *rqstp)
+{
+	long long start = rf_stats_clock();
+	ssize_t bytesWritten;
+	int fd;
+
+	res->writeStatus = FAILED;
+	res->bytesWritten = 0;
+
+	fd = rf_handle_get(writeArg->fd);
+	if (fd >= 0) {
+		bytesWritten = rf_wb_write(writeArg->fd, fd, writeArg->data.RF_Data_T_val, writeArg->data.RF_Data_T_len);
+		if (bytesWritten >= 0)
+			res->bytesWritten = bytesWritten;
+		if (bytesWritten == writeArg->data.RF_Data_T_len)
+			res->writeStatus = OKAY;
+		rf_handle_put(writeArg->fd);
+	}
+
+	if (res->writeStatus == OKAY)
+		rf_log_dump("rf_writefile_2", writeArg->data.RF_Data_T_val, res->bytesWritten);
+	else
+		RF_LOG(RF_LOG_WARN, "rf_writefile_2 failed, fd %ld", writeArg->fd);
+	rf_request_done(RF_STAT_WRITE2, writeArg->fd, res->bytesWritten, res->writeStatus, start);
+
+	return(TRUE);
+}
+
+// *****************************************************
+//
+// rf_closefile_2_svc
+//     Used to close a file opened by rf_openfile_2. Same as rf_closefile_1.
+// input parameters: closeArg - The RF_CloseFileRequest_T who's members have been populated by a RF_CLIENT.
+//	                 res      - The reply to fill in.
 //	                 rqstp    - The RF_CLIENT that made the request.
-// return value: A RF_CloseFileReply_T who's members reflect the outcome of the rf_closefile_1 procedure.
+// return value: TRUE; res reflects the outcome of the close.
+//
+// *****************************************************
+bool_t rf_closefile_2_svc(RF_CloseFileRequest_T *closeArg, RF_CloseFileReply_T *res, struct svc_req *rqstp)
+{
+	long long start = rf_stats_clock();
+	int fd;
+
+	fd = rf_handle_release(closeArg->fd);
+	if (fd >= 0)
+		res->closeStatus = (rf_wb_close(closeArg->fd, fd, 0, NULL) | close(fd)) ? FAILED : OKAY;
+	else
+		res->closeStatus = FAILED;
+	rf_request_done(RF_STAT_CLOSE2, closeArg->fd, 0, res->closeStatus, start);
+
+	return(TRUE);
+}
+
+// *****************************************************
+//
+// rf_closesync_2_svc
+//     Used to close a file opened by rf_openfile_2, like rf_closefile_2, and
+//     tell whether what was written through it is on stable storage.
+// input parameters: closeArg - The RF_CloseSyncRequest_T who's members have been populated by a RF_CLIENT.
+//	                 res      - The reply to fill in.
+//	                 rqstp    - The RF_CLIENT that made the request.
+// return value: TRUE; res reflects the outcome of the close and the durability of the data.
+//
+// *****************************************************
+bool_t rf_closesync_2_svc(RF_CloseSyncRequest_T *closeArg, RF_CloseSyncReply_T *res, struct svc_req *rqstp)
+{
+	long long start = rf_stats_clock();
+	int durable = 0;
+	int fd;
+
+	res->closeStatus = FAILED;
+	res->durability = rf_wb_durability();
+	fd = rf_handle_release(closeArg->fd);
+	if (fd >= 0)
+		res->closeStatus = (rf_wb_close(closeArg->fd, fd, closeArg->sync != 0, &durable) | close(fd)) ? FAILED : OKAY;
+	res->durable = (res->closeStatus == OKAY && durable);
+	if (res->closeStatus != OKAY)
+		RF_LOG(RF_LOG_WARN, "rf_closesync_2 failed, fd %ld", closeArg->fd);
+	rf_request_done(RF_STAT_CLOSESYNC2, closeArg->fd, 0, res->closeStatus, start);
+
+	return(TRUE);
+}
+
+// *****************************************************
+//
+// rf_pread_block
+//     Reads one block at an offset into a RF_PReadReply_T, for rf_preadfile_2
+//     and rf_readpath_2. Large reads of regular files over TCP are sent right
+//     away by rf_svc_reply_file, unless the caller needs the bytes itself.
+// input parameters: handle   - Handle of the file, for the block cache's read-ahead.
+//                   fd       - The file, from rf_handle_get(handle).
+//                   offset   - File offset.
+//                   count    - Bytes asked for.
+//                   res      - The reply to fill in; readStatus must be FAILED and data empty.
+//                   rqstp    - The request.
+//                   zeroCopy - Non zero to allow sending the reply with sendfile.
+// return value: FALSE if the reply was already sent with sendfile (data_len then
+//               tells how many bytes), TRUE otherwise.
+//
+// *****************************************************
+static bool_t rf_pread_block(long handle, int fd, off_t offset, long count, RF_PReadReply_T *res, struct svc_req *rqstp, int zeroCopy)
+{
+	ssize_t bytesRead;
+	struct stat st;
+
+	if (count > rf_max_block(rqstp))
+		count = rf_max_block(rqstp);
+	if (count < 0 || offset < 0)
+		return(TRUE);
+
+	/* Zero copy path: the length must be known before the data is sent. */
+	if (zeroCopy && count >= RF_SENDFILE_MIN && rf_max_block(rqstp) == RF_MAXBLOCK_TCP &&
+	    fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+		if (offset >= st.st_size)
+			count = 0;
+		else if (count > st.st_size - offset)
+			count = st.st_size - offset;
+		res->readStatus = OKAY;
+		res->data.RF_Data_T_len = count;
+		if (rf_svc_reply_file(rqstp, (xdrproc_t)xdr_rf_pread_head, res, fd, offset, count) == OKAY)
+			return(FALSE);
+		res->readStatus = FAILED;
+		res->data.RF_Data_T_len = 0;
+	}
+
+	if ((res->data.RF_Data_T_val = rf_arena_alloc(count)) != NULL) {
+		bytesRead = rf_cache_pread(handle, fd, res->data.RF_Data_T_val, count, offset);
+		if (bytesRead >= 0) {
+			res->data.RF_Data_T_len = bytesRead;
+			res->readStatus = OKAY;
+		}
+	}
+
+	return(TRUE);
+}
+
+// *****************************************************
+//
+// rf_pwrite_block
+//     Writes one block at an offset, for rf_pwritefile_2 and rf_writepath_2.
+// input parameters: fd     - The file.
+//                   offset - File offset.
+//                   data   - The block.
+//                   res    - The reply to fill in; writeStatus must be FAILED.
+//
+// *****************************************************
+static void rf_pwrite_block(int fd, off_t offset, RF_Data_T *data, RF_PWriteReply_T *res)
+{
+	ssize_t bytesWritten;
+
+	if (offset < 0)
+		return;
+
+	bytesWritten = pwrite(fd, data->RF_Data_T_val, data->RF_Data_T_len, offset);
+	if (bytesWritten > 0)
+		rf_cache_invalidate(fd, offset, bytesWritten);
+	if (bytesWritten >= 0)
+		res->bytesWritten = bytesWritten;
+	if (bytesWritten == data->RF_Data_T_len)
+		res->writeStatus = OKAY;
+}
+
+// *****************************************************
+//
+// rf_preadfile_2_svc
+//     Used to read one block at a given offset, based on a RF_PReadRequest_T.
+//     The file position used by rf_readfile_2 is neither used nor moved.
+//     Large reads of regular files over TCP are sent by rf_svc_reply_file.
+// input parameters: readArg - The RF_PReadRequest_T who's members have been populated by a RF_CLIENT.
+//	                 res     - The reply to fill in.
+//	                 rqstp   - The RF_CLIENT that made the request.
+// return value: FALSE if the reply was already sent with sendfile, TRUE otherwise;
+//               res then holds the bytes read, fewer than asked only at end of file.
+//               The block is taken from the worker's arena.
 //
 // *****************************************************
-RF_CloseFileReply_T *rf_closefile_1(RF_CloseFileRequest_T *closeArg, struct svc_req *rqstp)
+bool_t rf_preadfile_2_svc(RF_PReadRequest_T *readArg, RF_PReadReply_T *res, struct svc_req *rqstp)
 {
-   static RF_CloseFileReply_T res;
+	long long start = rf_stats_clock();
+	bool_t reply = TRUE;
+	int fd;
+
+	res->readStatus = FAILED;
+	res->offset = readArg->offset;
+	res->data.RF_Data_T_val = NULL;
+	res->data.RF_Data_T_len = 0;
 
-   printf("RF Server: Recieved close file request.\n");
+	fd = rf_handle_get(readArg->fd);
+	if (fd >= 0) {
+		rf_wb_flush(readArg->fd, fd);
+		reply = rf_pread_block(readArg->fd, fd, readArg->offset, readArg->bytesToRead, res, rqstp, 1);
+		rf_handle_put(readArg->fd);
+	}
 
-   res.closeStatus = fclose(filedesc[closeArg->fd]); /* Close the file specified by fd */
+	if (res->readStatus == OKAY)
+		rf_log_dump("rf_preadfile_2", res->data.RF_Data_T_val, res->data.RF_Data_T_len);
+	else
+		RF_LOG(RF_LOG_WARN, "rf_preadfile_2 failed at offset %lld, fd %ld", (long long)readArg->offset, readArg->fd);
+	rf_request_done(RF_STAT_PREAD2, readArg->fd, res->data.RF_Data_T_len, res->readStatus, start);
+	if (!reply)
+		res->data.RF_Data_T_len = 0;
+
+	return(reply);
+}
+
+// *****************************************************
+//
+// rf_pwritefile_2_svc
+//     Used to write one block at a given offset, based on a RF_PWriteRequest_T.
+//     The file position used by rf_writefile_2 is neither used nor moved.
+// input parameters: writeArg - The RF_PWriteRequest_T who's members have been populated by a RF_CLIENT.
+//	                 res      - The reply to fill in.
+//	                 rqstp    - The RF_CLIENT that made the request.
+// return value: TRUE; writeStatus in res is 0 only if the whole block was written.
+//
+// *****************************************************
+bool_t rf_pwritefile_2_svc(RF_PWriteRequest_T *writeArg, RF_PWriteReply_T *res, struct svc_req *rqstp)
+{
+	long long start = rf_stats_clock();
+	int fd;
+
+	res->writeStatus = FAILED;
+	res->offset = writeArg->offset;
+	res->bytesWritten = 0;
+
+	fd = rf_handle_get(writeArg->fd);
+	if (fd >= 0) {
+		rf_wb_flush(writeArg->fd, fd);
+		rf_pwrite_block(fd, writeArg->offset, &writeArg->data, res);
+		rf_wb_wrote(writeArg->fd, fd);
+		rf_handle_put(writeArg->fd);
+	}
+
+	if (res->writeStatus == OKAY)
+		rf_log_dump("rf_pwritefile_2", writeArg->data.RF_Data_T_val, res->bytesWritten);
+	else
+		RF_LOG(RF_LOG_WARN, "rf_pwritefile_2 failed at offset %lld, fd %ld", (long long)writeArg->offset, writeArg->fd);
+	rf_request_done(RF_STAT_PWRITE2, writeArg->fd, res->bytesWritten, res->writeStatus, start);
+
+	return(TRUE);
+}
+
+// *****************************************************
+//
+// rf_stats_2_svc
+//     Reports the server metrics: totals and latency percentiles for every
+//     procedure that has been called.
+// input parameters: arg   - No arguments.
+//	                 res   - The reply to fill in.
+//	                 rqstp - The RF_CLIENT that made the request.
+// return value: TRUE. The procedure list and names are taken from the
+//               worker's arena; without memory for them the list is empty
+//               and the call counts as an error.
+//
+// *****************************************************
+bool_t rf_stats_2_svc(void *arg, RF_StatsReply_T *res, struct svc_req *rqstp)
+{
+	long long start = rf_stats_clock();
+	RF_StatsSnap_T snap;
+	RF_ProcStats_T *p;
+
+	res->uptimeUsec = rf_stats_uptime();
+	res->openHandles = rf_handle_count();
+	res->procs.procs_len = 0;
+	res->procs.procs_val = rf_arena_calloc(RF_STAT_PROCS, sizeof(RF_ProcStats_T));
+
+	for (int proc = 0; res->procs.procs_val != NULL && proc < RF_STAT_PROCS; proc++) {
+		rf_stats_snapshot(proc, &snap);
+		if (snap.calls == 0)
+			continue;
+		p = &res->procs.procs_val[res->procs.procs_len++];
+		p->name = rf_arena_strdup(rf_stats_name(proc));
+		p->calls = snap.calls;
+		p->errors = snap.errors;
+		p->bytes = snap.bytes;
+		p->sumUsec = snap.sumUsec;
+		p->maxUsec = snap.maxUsec;
+		p->p50Usec = snap.p50Usec;
+		p->p99Usec = snap.p99Usec;
+		p->p999Usec = snap.p999Usec;
+	}
+	rf_request_done(RF_STAT_STATS2, 0, 0, (res->procs.procs_val != NULL) ? OKAY : FAILED, start);
+
+	return(TRUE);
+}
+
+// *****************************************************
+//
+// rf_fetch_one
+//     Reads the start of a file for rf_fetchfile_2 and rf_fetchmany_2,
+//     opening and closing it here.
+// input parameters: req    - The file and how many bytes the client wants.
+//                   res    - The reply to fill in; the data is taken from the arena.
+//                   budget - Most bytes this file may add to the reply.
+// return value: Bytes read; 0 if the file could not be read (fetchStatus tells).
+//
+// *****************************************************
+static long rf_fetch_one(RF_FetchRequest_T *req, RF_FetchReply_T *res, long budget)
+{
+	struct stat st;
+	long count = req->maxBytes;
+	ssize_t bytesRead;
+	int fd;
+
+	RF_LOG(RF_LOG_DEBUG, "fetch %s, %ld bytes", req->filename, req->maxBytes);
+
+	res->fetchStatus = FAILED;
+	res->fileSize = 0;
+	res->data.RF_Data_T_val = NULL;
+	res->data.RF_Data_T_len = 0;
+
+	if (count > budget)
+		count = budget;
+	if (count < 0 || (fd = open(req->filename, O_RDONLY)) < 0)
+		return(0);
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		return(0);
+	}
+
+	if (S_ISREG(st.st_mode) && st.st_size < count)
+		count = st.st_size;
+	if ((res->data.RF_Data_T_val = rf_arena_alloc(count)) != NULL) {
+		/* No handle: the cache serves the blocks but does not read ahead. */
+		bytesRead = rf_cache_pread(FAILED, fd, res->data.RF_Data_T_val, count, 0);
+		if (bytesRead >= 0) {
+			res->data.RF_Data_T_len = bytesRead;
+			res->fileSize = S_ISREG(st.st_mode) ? st.st_size : bytesRead;
+			res->fetchStatus = OKAY;
+		}
+	}
+	close(fd);
+
+	return(res->data.RF_Data_T_len);
+}
+
+// *****************************************************
+//
+// rf_fetchfile_2_svc
+//     Used to read a whole small file in one call: open, read from the start
+//     and close, based on a RF_FetchRequest_T.
+// input parameters: fetchArg - The RF_FetchRequest_T who's members have been populated by a RF_CLIENT.
+//	                 res      - The reply to fill in.
+//	                 rqstp    - The RF_CLIENT that made the request.
+// return value: TRUE; res holds at most maxBlock bytes and the size of the whole file.
+//               The data is taken from the worker's arena.
+//
+// *****************************************************
+bool_t rf_fetchfile_2_svc(RF_FetchRequest_T *fetchArg, RF_FetchReply_T *res, struct svc_req *rqstp)
+{
+	long long start = rf_stats_clock();
+
+	rf_fetch_one(fetchArg, res, rf_max_block(rqstp));
+
+	if (res->fetchStatus == OKAY)
+		rf_log_dump("rf_fetchfile_2", res->data.RF_Data_T_val, res->data.RF_Data_T_len);
+	else
+		RF_LOG(RF_LOG_WARN, "rf_fetchfile_2 failed, file %s", fetchArg->filename);
+	rf_request_done(RF_STAT_FETCH2, FAILED, res->data.RF_Data_T_len, res->fetchStatus, start);
+
+	return(TRUE);
+}
+
+// *****************************************************
+//
+// rf_storefile_2_svc
+//     Used to write a whole small file in one call: open, write and close,
+//     based on a RF_StoreRequest_T.
+// input parameters: storeArg - The RF_StoreRequest_T who's members have been populated by a RF_CLIENT.
+//	                 res      - The reply to fill in.
+//	                 rqstp    - The RF_CLIENT that made the request.
+// return value: TRUE; storeStatus in res is 0 only if all bytes were written
+//               and the file was closed without error.
+//
+// *****************************************************
+bool_t rf_storefile_2_svc(RF_StoreRequest_T *storeArg, RF_StoreReply_T *res, struct svc_req *rqstp)
+{
+	long long start = rf_stats_clock();
+	u_int len = storeArg->data.RF_Data_T_len;
+	ssize_t bytesWritten;
+	int fd;
+
+	RF_LOG(RF_LOG_DEBUG, "store %s mode %s, %u bytes", storeArg->filename, storeArg->mode, len);
+
+	res->storeStatus = FAILED;
+	res->bytesWritten = 0;
+
+	/* Only modes that write; a read only mode would silently store nothing. */
+	if ((storeArg->mode[0] == 'w' || storeArg->mode[0] == 'a') &&
+	    (fd = rf_open_mode(storeArg->filename, storeArg->mode)) >= 0) {
+		while (res->bytesWritten < len) {
+			bytesWritten = write(fd, storeArg->data.RF_Data_T_val + res->bytesWritten, len - res->bytesWritten);
+			if (bytesWritten <= 0)
+				break;
+			rf_cache_wrote(fd, bytesWritten);
+			res->bytesWritten += bytesWritten;
+		}
+		if (close(fd) == 0 && res->bytesWritten == len)
+			res->storeStatus = OKAY;
+	}
+
+	if (res->storeStatus == OKAY)
+		rf_log_dump("rf_storefile_2", storeArg->data.RF_Data_T_val, res->bytesWritten);
+	else
+		RF_LOG(RF_LOG_WARN, "rf_storefile_2 failed, file %s", storeArg->filename);
+	rf_request_done(RF_STAT_STORE2, FAILED, res->bytesWritten, res->storeStatus, start);
+
+	return(TRUE);
+}
+
+// *****************************************************
+//
+// rf_fetchmany_2_svc
+//     Used to read several small files in one call, as rf_fetchfile_2 does for
+//     one. The files share one maxBlock of data: each gets what is left after
+//     the files before it, so a file may come back cut short or empty.
+// input parameters: fetchArg - The RF_FetchManyRequest_T who's members have been populated by a RF_CLIENT.
+//	                 res      - The reply to fill in.
+//	                 rqstp    - The RF_CLIENT that made the request.
+// return value: TRUE; res holds one RF_FetchReply_T per file, in order.
+//               The replies are taken from the worker's arena; without
+//               memory for them the list is empty and the call counts as
+//               an error.
+//
+// *****************************************************
+bool_t rf_fetchmany_2_svc(RF_FetchManyRequest_T *fetchArg, RF_FetchManyReply_T *res, struct svc_req *rqstp)
+{
+	long long start = rf_stats_clock();
+	u_int num = fetchArg->files.files_len;
+	long budget = rf_max_block(rqstp);
+	long long bytes = 0;
+	long status = OKAY;
+
+	res->files.files_len = 0;
+	res->files.files_val = rf_arena_calloc(num, sizeof(RF_FetchReply_T));
+	if (res->files.files_val == NULL) {
+		num = 0;
+		status = FAILED;
+	}
+
+	for (u_int i = 0; i < num; i++) {
+		RF_FetchReply_T *one = &res->files.files_val[i];
+
+		budget -= rf_fetch_one(&fetchArg->files.files_val[i], one, budget);
+		bytes += one->data.RF_Data_T_len;
+		if (one->fetchStatus != OKAY)
+			status = FAILED;
+	}
+	res->files.files_len = num;
+
+	rf_request_done(RF_STAT_FETCHMANY2, FAILED, bytes, status, start);
+
+	return(TRUE);
+}
+
+// *****************************************************
+//
+// rf_readpath_2_svc
+//     Used to read one block of a file named by its path, at a given offset,
+//     based on a RF_PathReadRequest_T. The file comes from the open file cache
+//     (see rffdcache.h); no handle is given to the client.
+// input parameters: readArg - The RF_PathReadRequest_T who's members have been populated by a RF_CLIENT.
+//	                 res     - The reply to fill in.
+//	                 rqstp   - The RF_CLIENT that made the request.
+// return value: As for rf_preadfile_2_svc.
+//
+// *****************************************************
+bool_t rf_readpath_2_svc(RF_PathReadRequest_T *readArg, RF_PReadReply_T *res, struct svc_req *rqstp)
+{
+	long long start = rf_stats_clock();
+	bool_t reply = TRUE;
+	long handle = FAILED;
+	int fd;
+
+	res->readStatus = FAILED;
+	res->offset = readArg->offset;
+	res->data.RF_Data_T_val = NULL;
+	res->data.RF_Data_T_len = 0;
+
+	fd = rf_fdcache_get(readArg->filename, 0, &handle);
+	if (fd >= 0) {
+		reply = rf_pread_block(handle, fd, readArg->offset, readArg->bytesToRead, res, rqstp, 1);
+		rf_handle_put(handle);
+	}
+
+	if (res->readStatus == OKAY)
+		rf_log_dump("rf_readpath_2", res->data.RF_Data_T_val, res->data.RF_Data_T_len);
+	else
+		RF_LOG(RF_LOG_WARN, "rf_readpath_2 failed at offset %lld, file %s", (long long)readArg->offset, readArg->filename);
+	rf_request_done(RF_STAT_READPATH2, handle, res->data.RF_Data_T_len, res->readStatus, start);
+	if (!reply)
+		res->data.RF_Data_T_len = 0;
+
+	return(reply);
+}
+
+// *****************************************************
+//
+// rf_writepath_2_svc
+//     Used to write one block to a file named by its path, at a given offset,
+//     based on a RF_PathWriteRequest_T. A missing file is created.
+// input parameters: writeArg - The RF_PathWriteRequest_T who's members have been populated by a RF_CLIENT.
+//	                 res      - The reply to fill in.
+//	                 rqstp    - The RF_CLIENT that made the request.
+// return value: TRUE; writeStatus in res is 0 only if the whole block was written.
+//
+// *****************************************************
+bool_t rf_writepath_2_svc(RF_PathWriteRequest_T *writeArg, RF_PWriteReply_T *res, struct svc_req *rqstp)
+{
+	long long start = rf_stats_clock();
+	long handle = FAILED;
+	int fd;
+
+	res->writeStatus = FAILED;
+	res->offset = writeArg->offset;
+	res->bytesWritten = 0;
+
+	fd = rf_fdcache_get(writeArg->filename, 1, &handle);
+	if (fd >= 0) {
+		rf_pwrite_block(fd, writeArg->offset, &writeArg->data, res);
+		rf_handle_put(handle);
+	}
+
+	if (res->writeStatus == OKAY)
+		rf_log_dump("rf_writepath_2", writeArg->data.RF_Data_T_val, res->bytesWritten);
+	else
+		RF_LOG(RF_LOG_WARN, "rf_writepath_2 failed at offset %lld, file %s", (long long)writeArg->offset, writeArg->filename);
+	rf_request_done(RF_STAT_WRITEPATH2, handle, res->bytesWritten, res->writeStatus, start);
+
+	return(TRUE);
+}
+
+// *****************************************************
+//
+// rf_readsum_2_svc
+//     Used to read one block of a file named by its path, like rf_readpath_2,
+//     and checksum it. The block is always copied into the reply, since its
+//     checksum needs the bytes anyway.
+// input parameters: readArg - The RF_PathReadRequest_T who's members have been populated by a RF_CLIENT.
+//	                 res     - The reply to fill in.
+//	                 rqstp   - The RF_CLIENT that made the request.
+// return value: TRUE; res holds the bytes read, fewer than asked only at end of
+//               file, and their CRC32C. The block is taken from the worker's arena.
+//
+// *****************************************************
+bool_t rf_readsum_2_svc(RF_PathReadRequest_T *readArg, RF_SumReadReply_T *res, struct svc_req *rqstp)
+{
+	long long start = rf_stats_clock();
+	long handle = FAILED;
+	int fd;
+
+	res->read.readStatus = FAILED;
+	res->read.offset = readArg->offset;
+	res->read.data.RF_Data_T_val = NULL;
+	res->read.data.RF_Data_T_len = 0;
+	res->crc = 0;
+
+	fd = rf_fdcache_get(readArg->filename, 0, &handle);
+	if (fd >= 0) {
+		rf_pread_block(handle, fd, readArg->offset, readArg->bytesToRead, &res->read, rqstp, 0);
+		rf_handle_put(handle);
+	}
+
+	if (res->read.readStatus == OKAY) {
+		res->crc = rf_crc32c(0, res->read.data.RF_Data_T_val, res->read.data.RF_Data_T_len);
+		rf_log_dump("rf_readsum_2", res->read.data.RF_Data_T_val, res->read.data.RF_Data_T_len);
+	} else {
+		RF_LOG(RF_LOG_WARN, "rf_readsum_2 failed at offset %lld, file %s", (long long)readArg->offset, readArg->filename);
+	}
+	rf_request_done(RF_STAT_READSUM2, handle, res->read.data.RF_Data_T_len, res->read.readStatus, start);
+
+	return(TRUE);
+}
+
+// *****************************************************
+//
+// rf_writesum_2_svc
+//     Used to write one block to a file named by its path, like rf_writepath_2,
+//     after checking it against the checksum sent with it. A damaged block is
+//     not written.
+// input parameters: writeArg - The RF_SumWriteRequest_T who's members have been populated by a RF_CLIENT.
+//	                 res      - The reply to fill in.
+//	                 rqstp    - The RF_CLIENT that made the request.
+// return value: TRUE; writeStatus in res is 0 only if the block checked out and
+//               was written whole.
+//
+// *****************************************************
+bool_t rf_writesum_2_svc(RF_SumWriteRequest_T *writeArg, RF_PWriteReply_T *res, struct svc_req *rqstp)
+{
+	RF_PathWriteRequest_T *w = &writeArg->write;
+	long long start = rf_stats_clock();
+	long handle = FAILED;
+	int fd;
+
+	res->writeStatus = FAILED;
+	res->offset = w->offset;
+	res->bytesWritten = 0;
+
+	if (rf_crc32c(0, w->data.RF_Data_T_val, w->data.RF_Data_T_len) != writeArg->crc) {
+		RF_LOG(RF_LOG_WARN, "rf_writesum_2 checksum mismatch at offset %lld, file %s, block dropped",
+		       (long long)w->offset, w->filename);
+		rf_request_done(RF_STAT_WRITESUM2, handle, 0, res->writeStatus, start);
+		return(TRUE);
+	}
+
+	fd = rf_fdcache_get(w->filename, 1, &handle);
+	if (fd >= 0) {
+		rf_pwrite_block(fd, w->offset, &w->data, res);
+		rf_handle_put(handle);
+	}
+
+	if (res->writeStatus == OKAY)
+		rf_log_dump("rf_writesum_2", w->data.RF_Data_T_val, res->bytesWritten);
+	else
+		RF_LOG(RF_LOG_WARN, "rf_writesum_2 failed at offset %lld, file %s", (long long)w->offset, w->filename);
+	rf_request_done(RF_STAT_WRITESUM2, handle, res->bytesWritten, res->writeStatus, start);
+
+	return(TRUE);
+}
+
+// *****************************************************
+//
+// rf_digest_2_svc
+//     Used to checksum a file named by its path, or a range of it, based on a
+//     RF_DigestRequest_T. The file is read straight from the page cache, not
+//     through the block cache, so a large digest does not push out blocks
+//     other clients are reading.
+// input parameters: digestArg - The RF_DigestRequest_T who's members have been populated by a RF_CLIENT.
+//	                 res       - The reply to fill in.
+//	                 rqstp     - The RF_CLIENT that made the request.
+// return value: TRUE; res holds the file size and the CRC32C of the range.
+//
+// *****************************************************
+bool_t rf_digest_2_svc(RF_DigestRequest_T *digestArg, RF_DigestReply_T *res, struct svc_req *rqstp)
+{
+	long long start = rf_stats_clock();
+	long long offset = digestArg->offset;
+	long long left = digestArg->length;
+	long handle = FAILED;
+	struct stat st;
+	ssize_t n = 0;
+	char *buf;
+	int fd;
+
+	res->digestStatus = FAILED;
+	res->fileSize = 0;
+	res->bytes = 0;
+	res->crc = 0;
+
+	if (offset >= 0 && (buf = rf_arena_alloc(RF_DIGEST_CHUNK)) != NULL) {
+		if ((fd = rf_fdcache_get(digestArg->filename, 0, &handle)) >= 0) {
+			if (fstat(fd, &st) == 0) {
+				res->fileSize = st.st_size;
+				while ((left < 0 || left > 0) &&
+				       (n = pread(fd, buf, (left >= 0 && left < RF_DIGEST_CHUNK) ? left : RF_DIGEST_CHUNK, offset)) > 0) {
+					res->crc = rf_crc32c(res->crc, buf, n);
+					res->bytes += n;
+					offset += n;
+					if (left > 0)
+						left -= n;
+				}
+				if (n >= 0)
+					res->digestStatus = OKAY;
+			}
+			rf_handle_put(handle);
+		}
+	}
+
+	if (res->digestStatus != OKAY)
+		RF_LOG(RF_LOG_WARN, "rf_digest_2 failed, file %s", digestArg->filename);
+	rf_request_done(RF_STAT_DIGEST2, handle, res->bytes, res->digestStatus, start);
+
+	return(TRUE);
+}
+
+// *****************************************************
+//
+// rf_delta_2_svc
+//     Used to work out what a client needs to bring its copy of a file up to
+//     date, based on a RF_DeltaRequest_T carrying signatures of the client's
+//     blocks (see rfdelta.h).
+// input parameters: deltaArg - The RF_DeltaRequest_T who's members have been populated by a RF_CLIENT.
+//	                 res      - The reply to fill in.
+//	                 rqstp    - The RF_CLIENT that made the request.
+// return value: TRUE; res holds the runs to copy from the client's copy and
+//               the literal data in between, in the scan's workspace, which
+//               is taken from the worker's arena.
+//
+// *****************************************************
+bool_t rf_delta_2_svc(RF_DeltaRequest_T *deltaArg, RF_DeltaReply_T *res, struct svc_req *rqstp)
+{
+	long long start = rf_stats_clock();
+	long budget = rf_max_block(rqstp);
+	long handle = FAILED;
+	int fd;
+
+	if (deltaArg->maxBytes > 0 && deltaArg->maxBytes < budget)
+		budget = deltaArg->maxBytes;
+	memset(res, 0, sizeof(RF_DeltaReply_T));
+	res->deltaStatus = FAILED;
+
+	if ((fd = rf_fdcache_get(deltaArg->filename, 0, &handle)) >= 0) {
+		rf_delta_scan(fd, deltaArg, budget, rf_arena_alloc(rf_delta_scan_space(deltaArg, budget)), res);
+		rf_handle_put(handle);
+	}
+
+	if (res->deltaStatus != OKAY)
+		RF_LOG(RF_LOG_WARN, "rf_delta_2 failed at offset %lld, file %s", (long long)deltaArg->offset, deltaArg->filename);
+	rf_request_done(RF_STAT_DELTA2, handle, res->data.RF_Data_T_len, res->deltaStatus, start);
+
+	return(TRUE);
+}
+
+// *****************************************************
+//
+// rf_readz_2_svc
+//     Used to read one block of a file named by its path, like rf_readsum_2,
+//     and compress it with a codec the client takes if that makes it smaller
+//     (see rfcomp.h). Blocks that do not compress go out as they are.
+// input parameters: readArg - The RF_ZReadRequest_T who's members have been populated by a RF_CLIENT.
+//	                 res     - The reply to fill in.
+//	                 rqstp   - The RF_CLIENT that made the request.
+// return value: TRUE; res holds the bytes read, maybe compressed, with their
+//               length and CRC32C before compression. The block is taken
+//               from the worker's arena.
+//
+// *****************************************************
+bool_t rf_readz_2_svc(RF_ZReadRequest_T *readArg, RF_ZReadReply_T *res, struct svc_req *rqstp)
+{
+	RF_PReadReply_T *r = &res->sum.read;
+	long long start = rf_stats_clock();
+	long handle = FAILED;
+	long packed;
+	char *zbuf;
+	int fd;
+
+	r->readStatus = FAILED;
+	r->offset = readArg->read.offset;
+	r->data.RF_Data_T_val = NULL;
+	r->data.RF_Data_T_len = 0;
+	res->sum.crc = 0;
+	res->codec = RF_CODEC_NONE;
+	res->length = 0;
+
+	fd = rf_fdcache_get(readArg->read.filename, 0, &handle);
+	if (fd >= 0) {
+		rf_pread_block(handle, fd, readArg->read.offset, readArg->read.bytesToRead, r, rqstp, 0);
+		rf_handle_put(handle);
+	}
+
+	if (r->readStatus == OKAY) {
+		res->length = r->data.RF_Data_T_len;
+		res->sum.crc = rf_crc32c(0, r->data.RF_Data_T_val, res->length);
+		rf_log_dump("rf_readz_2", r->data.RF_Data_T_val, res->length);
+		if ((readArg->codecs & (1 << RF_CODEC_LZ4)) != 0 && rf_svc_comp_level() > 0 &&
+		    res->length > 0 && (zbuf = rf_arena_alloc(res->length)) != NULL) {
+			packed = rf_comp_pack(r->data.RF_Data_T_val, res->length, zbuf, rf_svc_comp_level());
+			if (packed > 0) {
+				r->data.RF_Data_T_val = zbuf;
+				r->data.RF_Data_T_len = packed;
+				res->codec = RF_CODEC_LZ4;
+			}
+		}
+	} else {
+		RF_LOG(RF_LOG_WARN, "rf_readz_2 failed at offset %lld, file %s", (long long)readArg->read.offset, readArg->read.filename);
+	}
+	rf_request_done(RF_STAT_READZ2, handle, res->length, r->readStatus, start);
+
+	return(TRUE);
+}
+
+// *****************************************************
+//
+// rf_writez_2_svc
+//     Used to write one block to a file named by its path, like rf_writesum_2,
+//     after decompressing it. A block that does not decompress to its length
+//     and checksum is not written.
+// input parameters: writeArg - The RF_ZWriteRequest_T who's members have been populated by a RF_CLIENT.
+//	                 res      - The reply to fill in.
+//	                 rqstp    - The RF_CLIENT that made the request.
+// return value: TRUE; writeStatus in res is 0 only if the block checked out and
+//               was written whole. bytesWritten counts bytes before compression.
+//
+// *****************************************************
+bool_t rf_writez_2_svc(RF_ZWriteRequest_T *writeArg, RF_PWriteReply_T *res, struct svc_req *rqstp)
+{
+	RF_PathWriteRequest_T *w = &writeArg->sum.write;
+	long long start = rf_stats_clock();
+	long handle = FAILED;
+	char *plain = NULL;
+	RF_Data_T data;
+	int fd;
+
+	res->writeStatus = FAILED;
+	res->offset = w->offset;
+	res->bytesWritten = 0;
+
+	data = w->data;
+	if (writeArg->codec == RF_CODEC_LZ4 && writeArg->length <= (u_int)rf_max_block(rqstp) &&
+	    (plain = rf_arena_alloc(writeArg->length)) != NULL &&
+	    rf_comp_unpack(w->data.RF_Data_T_val, w->data.RF_Data_T_len, plain, writeArg->length) == writeArg->length) {
+		data.RF_Data_T_val = plain;
+		data.RF_Data_T_len = writeArg->length;
+	} else if (writeArg->codec != RF_CODEC_NONE) {
+		data.RF_Data_T_val = NULL;
+	}
+
+	if (data.RF_Data_T_val == NULL || data.RF_Data_T_len != writeArg->length ||
+	    rf_crc32c(0, data.RF_Data_T_val, data.RF_Data_T_len) != writeArg->sum.crc) {
+		RF_LOG(RF_LOG_WARN, "rf_writez_2 bad block at offset %lld, file %s, codec %u, block dropped",
+		       (long long)w->offset, w->filename, writeArg->codec);
+		rf_request_done(RF_STAT_WRITEZ2, handle, 0, res->writeStatus, start);
+		return(TRUE);
+	}
+
+	fd = rf_fdcache_get(w->filename, 1, &handle);
+	if (fd >= 0) {
+		rf_pwrite_block(fd, w->offset, &data, res);
+		rf_handle_put(handle);
+	}
+
+	if (res->writeStatus == OKAY)
+		rf_log_dump("rf_writez_2", data.RF_Data_T_val, res->bytesWritten);
+	else
+		RF_LOG(RF_LOG_WARN, "rf_writez_2 failed at offset %lld, file %s", (long long)w->offset, w->filename);
+	rf_request_done(RF_STAT_WRITEZ2, handle, res->bytesWritten, res->writeStatus, start);
+
+	return(TRUE);
+}
+
+// *****************************************************
+//
+// rf_attr_fill
+//     Copies the attributes of a file into a RF_Attr_T.
+// input parameters: st   - stat of the file.
+//                   attr - The attributes to fill in.
+//
+// *****************************************************
+static void rf_attr_fill(struct stat *st, RF_Attr_T *attr)
+{
+	if (S_ISREG(st->st_mode))
+		attr->type = RF_TYPE_FILE;
+	else if (S_ISDIR(st->st_mode))
+		attr->type = RF_TYPE_DIR;
+	else if (S_ISLNK(st->st_mode))
+		attr->type = RF_TYPE_LINK;
+	else
+		attr->type = RF_TYPE_OTHER;
+	attr->size = st->st_size;
+	attr->mtime = (long long)st->st_mtim.tv_sec * 1000000000LL + st->st_mtim.tv_nsec;
+	attr->inode = st->st_ino;
+}
+
+// *****************************************************
+//
+// rf_readdirplus_2_svc
+//     Used to list one page of a directory with the attributes of its entries.
+//     The names come from a scan of the directory cached between pages (see
+//     rfdircache.h); each entry is stat'ed now. Entries removed since the
+//     scan are left out. A page stops at count entries or at maxBlock bytes.
+// input parameters: readdirArg - The RF_ReadDirRequest_T who's members have been populated by a RF_CLIENT.
+//	                 res        - The reply to fill in.
+//	                 rqstp      - The RF_CLIENT that made the request.
+// return value: TRUE; res holds the entries after the cookie, in name order.
+//               The entries are taken from the worker's arena.
+//
+// *****************************************************
+bool_t rf_readdirplus_2_svc(RF_ReadDirRequest_T *readdirArg, RF_ReadDirReply_T *res, struct svc_req *rqstp)
+{
+	long long start = rf_stats_clock();
+	long budget = rf_max_block(rqstp);
+	u_int count = readdirArg->count;
+	RF_DirScan_T *scan;
+	RF_DirEntry_T *e;
+	struct stat st;
+	long long i;
+	int dirFd;
+
+	res->readdirStatus = FAILED;
+	res->cookie = readdirArg->cookie;
+	res->verifier = 0;
+	res->eof = FALSE;
+	res->entries.entries_len = 0;
+	res->entries.entries_val = NULL;
+
+	if (count == 0 || count > RF_MAXDIRPAGE)
+		count = RF_MAXDIRPAGE;
+
+	if ((scan = rf_dircache_get(readdirArg->dirname, &dirFd)) != NULL) {
+		res->verifier = scan->verifier;
+		if (readdirArg->cookie != 0 && readdirArg->verifier != scan->verifier) {
+			res->readdirStatus = RF_READDIR_STALE;
+		} else if (readdirArg->cookie <= scan->numNames &&
+		           (res->entries.entries_val = rf_arena_calloc(count, sizeof(RF_DirEntry_T))) != NULL) {
+			for (i = readdirArg->cookie; i < scan->numNames && res->entries.entries_len < count; i++) {
+				/* XDR size of the entry: name with length and padding, then type, size, mtime and inode. */
+				long size = 4 + ((strlen(scan->names[i]) + 3) & ~3) + 4 + 3 * 8;
+
+				if (size > budget)
+					break;
+				if (fstatat(dirFd, scan->names[i], &st, AT_SYMLINK_NOFOLLOW) != 0)
+					continue;   /* removed since the scan */
+				e = &res->entries.entries_val[res->entries.entries_len];
+				if ((e->name = rf_arena_strdup(scan->names[i])) == NULL)
+					break;
+				rf_attr_fill(&st, &e->attr);
+				res->entries.entries_len++;
+				budget -= size;
+			}
+			res->cookie = i;
+			res->eof = (i >= scan->numNames);
+			res->readdirStatus = OKAY;
+		}
+		rf_dircache_put(scan);
+		close(dirFd);
+	}
+
+	if (res->readdirStatus == FAILED)
+		RF_LOG(RF_LOG_WARN, "rf_readdirplus_2 failed, directory %s", readdirArg->dirname);
+	rf_request_done(RF_STAT_READDIRPLUS2, FAILED, 0, res->readdirStatus, start);
+
+	return(TRUE);
+}
+
+// *****************************************************
+//
+// rf_statmany_2_svc
+//     Used to get the attributes of several files in one call.
+// input parameters: statArg - The RF_StatManyRequest_T who's members have been populated by a RF_CLIENT.
+//	                 res     - The reply to fill in.
+//	                 rqstp   - The RF_CLIENT that made the request.
+// return value: TRUE; res holds one RF_StatResult_T per path, in order.
+//               The results are taken from the worker's arena; without
+//               memory for them the list is empty and the call counts as
+//               an error.
+//
+// *****************************************************
+bool_t rf_statmany_2_svc(RF_StatManyRequest_T *statArg, RF_StatManyReply_T *res, struct svc_req *rqstp)
+{
+	long long start = rf_stats_clock();
+	u_int num = statArg->paths.paths_len;
+	long status = OKAY;
+	struct stat st;
+
+	res->results.results_len = 0;
+	res->results.results_val = rf_arena_calloc(num, sizeof(RF_StatResult_T));
+	if (res->results.results_val == NULL) {
+		num = 0;
+		status = FAILED;
+	}
+
+	for (u_int i = 0; i < num; i++) {
+		RF_StatResult_T *one = &res->results.results_val[i];
+
+		one->statStatus = FAILED;
+		if (stat(statArg->paths.paths_val[i], &st) == 0) {
+			rf_attr_fill(&st, &one->attr);
+			one->statStatus = OKAY;
+		} else {
+			status = FAILED;
+		}
+	}
+	res->results.results_len = num;
+
+	rf_request_done(RF_STAT_STATMANY2, FAILED, 0, status, start);
+
+	return(TRUE);
+}
+
+// *****************************************************
+//
+// rf_getattr_2_svc
+//     Used to find out whether copies of files a client keeps are current.
+// input parameters: getattrArg - The RF_GetAttrRequest_T who's members have been populated by a RF_CLIENT.
+//	                 res        - The reply to fill in.
+//	                 rqstp      - The RF_CLIENT that made the request.
+// return value: TRUE; res holds one RF_GetAttrResult_T per path, in order.
+//               The results are taken from the worker's arena; without
+//               memory for them the list is empty and the call counts as
+//               an error.
+//
+// *****************************************************
+bool_t rf_getattr_2_svc(RF_GetAttrRequest_T *getattrArg, RF_GetAttrReply_T *res, struct svc_req *rqstp)
+{
+	long long start = rf_stats_clock();
+	u_int num = getattrArg->paths.paths_len;
+	long status = OKAY;
+	struct timespec now;
+	struct stat st;
+
+	res->results.results_len = 0;
+	res->results.results_val = rf_arena_calloc(num, sizeof(RF_GetAttrResult_T));
+	if (res->results.results_val == NULL) {
+		num = 0;
+		status = FAILED;
+	}
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	for (u_int i = 0; i < num; i++) {
+		RF_GetAttrResult_T *one = &res->results.results_val[i];
+
+		one->getattrStatus = FAILED;
+		if (stat(getattrArg->paths.paths_val[i], &st) == 0 && S_ISREG(st.st_mode)) {
+			one->size = st.st_size;
+			one->mtime = (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+			one->change = (long long)st.st_ctim.tv_sec * 1000000000LL + st.st_ctim.tv_nsec;
+			one->inode = st.st_ino;
+			one->stable = (now.tv_sec - st.st_mtim.tv_sec >= RF_ATTR_SETTLE &&
+			               now.tv_sec - st.st_ctim.tv_sec >= RF_ATTR_SETTLE);
+			one->getattrStatus = OKAY;
+		} else {
+			status = FAILED;
+		}
+	}
+	res->results.results_len = num;
+
+	rf_request_done(RF_STAT_GETATTR2, FAILED, 0, status, start);
+
+	return(TRUE);
+}
+
+// *****************************************************
+//
+// rfile_1_freeresult
+//     Called by the rpcgen -M dispatcher after a version 1 reply has been sent.
+// input parameters: transp     - The transport the reply went out on.
+//                   xdr_result - XDR routine of the reply.
+//                   result     - The reply filled in by the procedure.
+// return value: TRUE.
+//
+// *****************************************************
+int rfile_1_freeresult(SVCXPRT *transp, xdrproc_t xdr_result, caddr_t result)
+{
+	xdr_free(xdr_result, result);
+
+	return(TRUE);
+}
+
+// *****************************************************
+//
+// rfile_2_freeresult
+//     Called by the rpcgen -M dispatcher after a version 2 reply has been sent.
+//     Everything the procedures allocated for it came from the worker's arena
+//     and is given back at once, without walking the reply.
+// input parameters: transp     - The transport the reply went out on.
+//                   xdr_result - XDR routine of the reply.
+//                   result     - The reply filled in by the procedure.
+// return value: TRUE.
+//
+// *****************************************************
+int rfile_2_freeresult(SVCXPRT *transp, xdrproc_t xdr_result, caddr_t result)
+{
+	rf_arena_reset();
 
-   return(&res);
+	return(TRUE);
 }
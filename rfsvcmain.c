@@ -0,0 +1,1151 @@
+/* rfsvcmain.c */
+
+/* Server main program for rfserver.
+// rpcgen generates only the RFILE dispatch routines (rpcgen -M -m); this file
+// creates the transports and runs them.
+//
+// The server listens on both UDP and TCP, and is event driven. Every socket it
+// serves -- a UDP socket and a TCP listening socket per worker thread, all bound
+// to the shared port with SO_REUSEPORT, and every TCP connection accepted --
+// sits in one epoll set, registered with EPOLLONESHOT. The workers all wait on
+// that set and take one ready socket at a time: a worker serves the calls
+// waiting on it, then arms it again. So a socket is only ever served by one
+// worker at a time, which the RPC library's transports need, while calls on
+// different sockets run at once, on whichever workers are free, and reply in
+// whatever order they finish. A call that blocks on the disk holds up only its
+// own connection, or for UDP the clients the kernel sends to the same socket;
+// the other workers go on serving the rest, and there are
+// several workers per CPU so that enough are left to keep the CPUs busy. Idle
+// connections cost no worker and no scan, so one process holds thousands.
+// The procedures in rfsvcfn.c are thread safe.
+//
+// Large TCP read replies can bypass the RPC library: rf_svc_reply_file writes
+// the reply header itself and lets sendfile move the file data from the page
+// cache straight to the connection. Other reads go through the server's own
+// block cache, shared by all workers.
+//
+// UDP calls that change state go through the duplicate request cache (see
+// rfdrc.h): the UDP transports' xp_recv and xp_reply are hooked so that a
+// retransmitted call gets the reply of its first copy instead of being run
+// again. TCP needs no such cache, since its clients do not resend a call on
+// the same connection.
+//
+// Each worker decodes calls and builds replies in a memory arena of its own
+// (see rfarena.h): the transports' xp_getargs and xp_freeargs are hooked so
+// that a version 2 request is decoded into the arena, and the arena is taken
+// back whole before the next call, so a call costs no malloc in steady state.
+//
+// The dispatch routines are wrapped in admission control (see rfadmit.h): a
+// TCP call waits for its turn and its client's rate before it runs, and a
+// version 2 call may instead be turned away with RF_BUSY and a retry-after.
+// A UDP call never waits, since its worker would hold up the socket other
+// clients share: it is turned away, or for version 1 dropped.
+//
+// Run this program as
+//       rfserver [-p port] [-t threads] [-n maxHandles] [-v level] [-s sample] [-l logfile] [-C cacheMB]
+//               [-F files] [-I idle] [-D entries] [-z level] [-W bufKB] [-d durability] [-P interval]
+//               [-R dirs] [-A active] [-Q ops] [-B KBps] [-L ms] [-w weights]
+//
+//   -p port        Bind UDP and TCP to this port instead of one picked by the
+//                  system. With a fixed port the server keeps running even if no
+//                  portmapper is available; clients then connect to host:port.
+//   -t threads     Number of worker threads (default: RF_THREADS_PER_CPU per CPU).
+//   -n maxHandles  Upper bound on files open at the same time.
+//   -v level       Log level: error, warn, info (default), debug or trace.
+//                  trace also logs the payload of every read and write.
+//   -s sample      Log one in this many requests at level info (default 100,
+//                  0 for none). At debug and trace every request is logged.
+//   -l logfile     Append the log to this file instead of stdout.
+//   -C cacheMB     Memory for the block cache (see rfcache.h), default 64 MB;
+//                  0 turns the cache and read-ahead off.
+//   -F files       Most files the stateless rf_readpath/rf_writepath keep open
+//                  between calls (default 256, see rffdcache.h). They count
+//                  towards maxHandles.
+//   -I idle        Seconds such a file stays open unused (default 30).
+//   -D entries     Most UDP calls the duplicate request cache remembers
+//                  (default 4096, 0 turns it off).
+//   -z level       Compression level of rf_readz replies (see rfcomp.h), 1 to 9
+//                  (default 1); 0 sends every block as it is. Compressed writes
+//                  are taken at any level.
+//   -W bufKB       Write-behind buffer per handle for rf_writefile (see
+//                  rfwb.h), default 64 KB; 0 writes every call through.
+//   -d durability  When written data is synced to stable storage: none
+//                  (default), close, or periodic.
+//   -P interval    Milliseconds a write-behind buffer waits before it is
+//                  written out, and between periodic syncs (default 1000).
+//   -R dirs        Most directory scans rf_readdirplus keeps between pages
+//                  (default 64, see rfdircache.h); 0 reads the directory for
+//                  every page.
+//   -A active      Most calls running at once (default 0, no limit). The rest
+//                  of the TCP calls wait their turn, fairly between clients,
+//                  and the rest of the UDP calls are turned away (see
+//                  rfadmit.h); about twice the number of CPUs keeps them busy.
+//   -Q ops         Calls per second a client may make (default 0, no limit).
+//   -B KBps        KB per second a client may move (default 0, no limit).
+//   -L ms          Latency target with -A: once calls have waited this long,
+//                  calls of clients that already have calls in are turned
+//                  away, except version 1 calls over TCP (default 0, never).
+//   -w weights     Shares of clients in the fair queue, as address=weight,...
+//                  (default 1 each).
+//
+// Sending the server SIGUSR1 writes its metrics (see rfstats.h) to stderr;
+// clients can fetch the same numbers with the rf_stats procedure.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <rpc/rpc.h>
+#include <rpc/pmap_clnt.h>
+
+#include "rf.h"
+#include "rfadmit.h"
+#include "rfarena.h"
+#include "rfbusy.h"
+#include "rfcache.h"
+#include "rfcomp.h"
+#include "rfdircache.h"
+#include "rfdrc.h"
+#include "rffdcache.h"
+#include "rfhandle.h"
+#include "rflog.h"
+#include "rfstats.h"
+#include "rfsvc.h"
+#include "rfwb.h"
+
+#define OKAY 0
+#define FAILED -1
+
+/* Datagram buffer size: the largest UDP block plus room for the RPC header. */
+#define RF_UDP_BUFSIZE (RF_MAXBLOCK_UDP + 4096)
+
+/* Kernel receive buffer of the UDP sockets. Clients keep a window of large
+// write calls in flight, which the default buffer (about 200 KB) drops.
+// The kernel caps this at net.core.rmem_max.
+*/
+#define RF_UDP_SOCKBUF (4 * 1024 * 1024)
+
+/* Room for a record mark, the RPC reply header and a procedure's fixed reply fields. */
+#define RF_REPLY_HEADMAX 512
+
+/* Default worker threads per CPU. Workers blocked on the disk leave the rest to
+// keep the CPUs busy.
+*/
+#define RF_THREADS_PER_CPU 4
+
+/* Most connections a worker accepts before going back to serving calls. */
+#define RF_ACCEPT_BATCH 64
+
+/* Dispatch routines generated by rpcgen in rf_svc.c */
+extern void rfile_1(struct svc_req *, SVCXPRT *);
+extern void rfile_2(struct svc_req *, SVCXPRT *);
+
+/* What a socket in the epoll set is. */
+enum { RF_SOURCE_UDP, RF_SOURCE_LISTEN, RF_SOURCE_CONN };
+
+/* A socket in the epoll set, its epoll_data. */
+typedef struct RF_Source_T
+{
+	int				kind;	/* RF_SOURCE_UDP, RF_SOURCE_LISTEN or RF_SOURCE_CONN */
+	int				sock;
+	SVCXPRT			*xprt;	/* its transport, NULL for a listening socket */
+	struct xp_ops	ops;	/* copy of xprt's ops with some of them hooked */
+} RF_Source_T;
+
+typedef struct RF_Worker_T
+{
+	pthread_t	thread;
+	int			id;
+	RF_Source_T	udp;		/* this worker's UDP socket */
+	RF_Source_T	listen;		/* this worker's TCP listening socket */
+} RF_Worker_T;
+
+/* The epoll set every socket is in. */
+static int epollFd = FAILED;
+
+/* xp_recv and xp_destroy of the TCP connection transports, called through
+// rf_conn_recv and rf_conn_destroy.
+*/
+static bool_t (*vcRecv)(SVCXPRT *, struct rpc_msg *) = NULL;
+static void (*vcDestroy)(SVCXPRT *) = NULL;
+
+/* Connection and XID of the call this thread is serving, set by rf_conn_recv. */
+static __thread SVCXPRT *recvXprt;
+static __thread u_int32_t recvXid;
+
+/* Set by rf_conn_destroy when the connection being served by this thread died. */
+static __thread int connDestroyed;
+
+/* xp_recv and xp_reply of the UDP transports, called through rf_dg_recv and rf_dg_reply. */
+static bool_t (*dgRecv)(SVCXPRT *, struct rpc_msg *) = NULL;
+static bool_t (*dgReply)(SVCXPRT *, struct rpc_msg *) = NULL;
+
+/* xp_getargs and xp_freeargs of the UDP and TCP connection transports, called
+// through rf_dg_getargs, rf_conn_getargs and rf_args_free.
+*/
+static bool_t (*dgGetArgs)(SVCXPRT *, xdrproc_t, void *) = NULL;
+static bool_t (*dgFreeArgs)(SVCXPRT *, xdrproc_t, void *) = NULL;
+static bool_t (*vcGetArgs)(SVCXPRT *, xdrproc_t, void *) = NULL;
+static bool_t (*vcFreeArgs)(SVCXPRT *, xdrproc_t, void *) = NULL;
+
+/* Set when the arguments of the call this thread is serving were decoded into its arena. */
+static __thread int argsInArena;
+
+/* UDP call this thread is serving that the duplicate request cache waits a reply for. */
+static __thread RF_DrcKey_T drcKey;
+static __thread int drcPending;
+static __thread char *drcBuf;
+
+/* Level rf_readz compresses at, set by -z. */
+static int compLevel = RF_COMP_DEFAULT_LEVEL;
+
+
+// *****************************************************
+//
+// rf_conn_recv
+//     Replacement xp_recv for TCP connection transports. Remembers the XID of
+//     each call received, which rf_svc_reply_file needs to build a reply.
+// input parameters: xprt - The connection transport.
+//                   msg  - Filled in with the call header.
+// return value: What the real xp_recv returned.
+//
+// *****************************************************
+static bool_t rf_conn_recv(SVCXPRT *xprt, struct rpc_msg *msg)
+{
+	if (!vcRecv(xprt, msg))
+		return(FALSE);
+
+	recvXprt = xprt;
+	recvXid = msg->rm_xid;
+
+	return(TRUE);
+}
+
+// *****************************************************
+//
+// rf_conn_destroy
+//     Replacement xp_destroy for TCP connection transports. Lets the worker know
+//     the RPC library tore the connection down (and closed its socket) while
+//     serving it, then does the real destroy.
+// input parameters: xprt - The connection transport being destroyed.
+//
+// *****************************************************
+static void rf_conn_destroy(SVCXPRT *xprt)
+{
+	connDestroyed = 1;
+	vcDestroy(xprt);
+}
+
+// *****************************************************
+//
+// rf_args_get
+//     Decodes the arguments of a call into the worker's arena where it can.
+//     Whatever the last call left in the arena is given up first.
+// input parameters: getArgs - The transport's real xp_getargs.
+//                   xprt    - The transport.
+//                   xdrArgs - XDR routine of the arguments.
+//                   args    - The arguments, cleared.
+//                   maxData - Most file data bytes the transport can carry.
+// return value: What the real xp_getargs returned.
+//
+// *****************************************************
+static bool_t rf_args_get(bool_t (*getArgs)(SVCXPRT *, xdrproc_t, void *), SVCXPRT *xprt,
+                          xdrproc_t xdrArgs, void *args, u_int maxData)
+{
+	rf_arena_reset();
+	argsInArena = (rf_arena_args(xdrArgs, args, maxData) == OKAY);
+
+	return(getArgs(xprt, xdrArgs, args));
+}
+
+// *****************************************************
+//
+// rf_dg_getargs
+//     Replacement xp_getargs for UDP transports (see rf_args_get).
+// input parameters: xprt    - The UDP transport.
+//                   xdrArgs - XDR routine of the arguments.
+//                   args    - The arguments, cleared.
+// return value: TRUE if the arguments were decoded.
+//
+// *****************************************************
+static bool_t rf_dg_getargs(SVCXPRT *xprt, xdrproc_t xdrArgs, void *args)
+{
+	return(rf_args_get(dgGetArgs, xprt, xdrArgs, args, RF_UDP_BUFSIZE));
+}
+
+// *****************************************************
+//
+// rf_conn_getargs
+//     Replacement xp_getargs for TCP connection transports (see rf_args_get).
+// input parameters: xprt    - The connection transport.
+//                   xdrArgs - XDR routine of the arguments.
+//                   args    - The arguments, cleared.
+// return value: TRUE if the arguments were decoded.
+//
+// *****************************************************
+static bool_t rf_conn_getargs(SVCXPRT *xprt, xdrproc_t xdrArgs, void *args)
+{
+	return(rf_args_get(vcGetArgs, xprt, xdrArgs, args, RF_MAXBLOCK_TCP));
+}
+
+// *****************************************************
+//
+// rf_args_free
+//     Replacement xp_freeargs for UDP and TCP connection transports. Arguments
+//     decoded into the arena are left to it; others are freed as usual.
+// input parameters: xprt    - The transport.
+//                   xdrArgs - XDR routine of the arguments.
+//                   args    - The arguments.
+// return value: TRUE if the arguments were freed.
+//
+// *****************************************************
+static bool_t rf_args_free(SVCXPRT *xprt, xdrproc_t xdrArgs, void *args)
+{
+	if (argsInArena) {
+		argsInArena = 0;
+		return(TRUE);
+	}
+
+	return((xprt->xp_ops->xp_getargs == rf_dg_getargs ? dgFreeArgs : vcFreeArgs)(xprt, xdrArgs, args));
+}
+
+// *****************************************************
+//
+// rf_dg_recv
+//     Replacement xp_recv for UDP transports. Checks calls to procedures that
+//     change state against the duplicate request cache, which answers or drops
+//     repeated ones.
+// input parameters: xprt - The UDP transport.
+//                   msg  - Filled in with the call header.
+// return value: TRUE if the call is to be served.
+//
+// *****************************************************
+static bool_t rf_dg_recv(SVCXPRT *xprt, struct rpc_msg *msg)
+{
+	struct netbuf *caller;
+
+	if (!dgRecv(xprt, msg))
+		return(FALSE);
+
+	if (msg->rm_direction != CALL || !rf_drc_wanted(msg->rm_call.cb_vers, msg->rm_call.cb_proc))
+		return(TRUE);
+
+	caller = svc_getrpccaller(xprt);
+	if (caller->len > sizeof(drcKey.addr))
+		return(TRUE);
+	memset(&drcKey, 0, sizeof(drcKey));
+	memcpy(&drcKey.addr, caller->buf, caller->len);
+	drcKey.addrLen = caller->len;
+	drcKey.xid = msg->rm_xid;
+	drcKey.prog = msg->rm_call.cb_prog;
+	drcKey.vers = msg->rm_call.cb_vers;
+	drcKey.proc = msg->rm_call.cb_proc;
+	if (rf_drc_begin(&drcKey, xprt->xp_fd) == RF_DRC_DUPLICATE)
+		return(FALSE);
+	drcPending = 1;
+
+	return(TRUE);
+}
+
+// *****************************************************
+//
+// rf_dg_reply
+//     Replacement xp_reply for UDP transports. A reply to a call the duplicate
+//     request cache waits for is encoded and sent here, the way the library
+//     would, and then handed to the cache; other replies go to the real xp_reply.
+// input parameters: xprt - The UDP transport.
+//                   msg  - The reply.
+// return value: TRUE if the reply was sent.
+//
+// *****************************************************
+static bool_t rf_dg_reply(SVCXPRT *xprt, struct rpc_msg *msg)
+{
+	struct netbuf *caller = svc_getrpccaller(xprt);
+	xdrproc_t results = NULL;
+	caddr_t where = NULL;
+	bool_t sent = FALSE;
+	XDR xdrs;
+
+	if (!drcPending)
+		return(dgReply(xprt, msg));
+	drcPending = 0;
+
+	if (drcBuf == NULL && (drcBuf = malloc(RF_UDP_BUFSIZE)) == NULL) {
+		rf_drc_end(&drcKey, NULL, 0);
+		return(dgReply(xprt, msg));
+	}
+
+	/* The library's xp_reply fills in the XID; so must this one. */
+	msg->rm_xid = drcKey.xid;
+	if (msg->rm_reply.rp_stat == MSG_ACCEPTED && msg->acpted_rply.ar_stat == SUCCESS) {
+		results = msg->acpted_rply.ar_results.proc;
+		where = msg->acpted_rply.ar_results.where;
+		msg->acpted_rply.ar_results.proc = (xdrproc_t)xdr_void;
+		msg->acpted_rply.ar_results.where = NULL;
+	}
+
+	xdrmem_create(&xdrs, drcBuf, RF_UDP_BUFSIZE, XDR_ENCODE);
+	if (xdr_replymsg(&xdrs, msg) && (results == NULL || results(&xdrs, where))) {
+		u_int len = XDR_GETPOS(&xdrs);
+
+		sent = (sendto(xprt->xp_fd, drcBuf, len, 0, (struct sockaddr *)caller->buf, caller->len) == (ssize_t)len);
+		rf_drc_end(&drcKey, sent ? drcBuf : NULL, len);
+	} else {
+		rf_drc_end(&drcKey, NULL, 0);
+	}
+	xdr_destroy(&xdrs);
+
+	return(sent);
+}
+
+// *****************************************************
+//
+// rf_bind_socket
+//     Creates a socket bound to the given port on every interface, with
+//     SO_REUSEPORT set so every worker can bind the same port.
+// input parameters: type - SOCK_DGRAM or SOCK_STREAM.
+//                   port - Port in host byte order, 0 lets the system pick one.
+// return value: The socket, or FAILED.
+//
+// *****************************************************
+static int rf_bind_socket(int type, int port)
+{
+	struct sockaddr_in addr;
+	int sock, on = 1;
+
+	if ((sock = socket(AF_INET, type, 0)) < 0)
+		return(FAILED);
+
+	setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+	if (type == SOCK_DGRAM) {
+		int size = RF_UDP_SOCKBUF;
+		setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(port);
+	if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		close(sock);
+		return(FAILED);
+	}
+
+	if (type == SOCK_STREAM && listen(sock, SOMAXCONN) < 0) {
+		close(sock);
+		return(FAILED);
+	}
+
+	return(sock);
+}
+
+// *****************************************************
+//
+// rf_socket_port
+//     Reports the port a socket is bound to.
+// input parameters: sock - A bound socket.
+// return value: The port in host byte order, or 0 if unknown.
+//
+// *****************************************************
+static int rf_socket_port(int sock)
+{
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+
+	if (getsockname(sock, (struct sockaddr *)&addr, &len) < 0)
+		return(0);
+
+	return(ntohs(addr.sin_port));
+}
+
+// *****************************************************
+//
+// rf_source_arm
+//     Puts a socket into the epoll set, or arms it again after it was served.
+//     It is armed for one event only, so that no other worker takes it while
+//     the one that got the event serves it.
+// input parameters: src - The socket.
+//                   op  - EPOLL_CTL_ADD for a new socket, EPOLL_CTL_MOD after serving.
+// return value: OKAY, or FAILED.
+//
+// *****************************************************
+static int rf_source_arm(RF_Source_T *src, int op)
+{
+	struct epoll_event ev;
+
+	ev.events = EPOLLIN | EPOLLONESHOT;
+	ev.data.ptr = src;
+
+	return(epoll_ctl(epollFd, op, src->sock, &ev) == 0 ? OKAY : FAILED);
+}
+
+// *****************************************************
+//
+// rf_worker_accept
+//     Accepts the pending TCP connections on a listening socket, wraps each in
+//     an RPC transport and adds it to the epoll set.
+// input parameters: w      - The worker accepting.
+//                   listen - The listening socket that is readable.
+//
+// *****************************************************
+static void rf_worker_accept(RF_Worker_T *w, RF_Source_T *listen)
+{
+	RF_Source_T *conn;
+	int sock, on = 1;
+
+	for (int i = 0; i < RF_ACCEPT_BATCH && (sock = accept(listen->sock, NULL, NULL)) >= 0; i++) {
+		/* Replies are whole records; do not hold their last segment back for an ACK. */
+		setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+		conn = malloc(sizeof(RF_Source_T));
+		if (conn == NULL || (conn->xprt = svcfd_create(sock, 0, 0)) == NULL) {
+			RF_LOG(RF_LOG_ERROR, "worker %d cannot create transport for new connection", w->id);
+			free(conn);
+			close(sock);
+			continue;
+		}
+		conn->kind = RF_SOURCE_CONN;
+		conn->sock = sock;
+
+		/* Hook xp_destroy so the worker finds out when the library drops the
+		// connection, xp_recv so rf_svc_reply_file knows the call's XID, and
+		// xp_getargs and xp_freeargs to decode calls into the worker's arena.
+		*/
+		if (vcDestroy == NULL) {
+			vcRecv = conn->xprt->xp_ops->xp_recv;
+			vcDestroy = conn->xprt->xp_ops->xp_destroy;
+			vcGetArgs = conn->xprt->xp_ops->xp_getargs;
+			vcFreeArgs = conn->xprt->xp_ops->xp_freeargs;
+		}
+		conn->ops = *conn->xprt->xp_ops;
+		conn->ops.xp_recv = rf_conn_recv;
+		conn->ops.xp_destroy = rf_conn_destroy;
+		conn->ops.xp_getargs = rf_conn_getargs;
+		conn->ops.xp_freeargs = rf_args_free;
+		conn->xprt->xp_ops = &conn->ops;
+
+		if (rf_source_arm(conn, EPOLL_CTL_ADD) != OKAY) {
+			RF_LOG(RF_LOG_ERROR, "worker %d cannot watch new connection: %s", w->id, strerror(errno));
+			SVC_DESTROY(conn->xprt);
+			free(conn);
+		}
+	}
+}
+
+// *****************************************************
+//
+// rf_worker_run
+//     Worker thread body. Takes one ready socket at a time from the epoll set,
+//     serves it and arms it again.
+// input parameters: arg - The RF_Worker_T of this thread.
+// return value: Never returns.
+//
+// *****************************************************
+static void *rf_worker_run(void *arg)
+{
+	RF_Worker_T *w = arg;
+	struct epoll_event ev;
+	RF_Source_T *src;
+
+	for (;;) {
+		/* One event at a time: a worker that blocks in a call must not sit on
+		// other sockets that are ready.
+		*/
+		if (epoll_wait(epollFd, &ev, 1, -1) != 1) {
+			if (errno != EINTR)
+				RF_LOG(RF_LOG_ERROR, "worker %d epoll_wait failed: %s", w->id, strerror(errno));
+			continue;
+		}
+		src = ev.data.ptr;
+
+		recvXprt = NULL;
+		connDestroyed = 0;
+		switch (src->kind) {
+		case RF_SOURCE_LISTEN:
+			rf_worker_accept(w, src);
+			break;
+		case RF_SOURCE_UDP:
+			svc_getreq_common(src->sock);
+			/* The call got no reply, so there is nothing to replay for it. */
+			if (drcPending) {
+				rf_drc_end(&drcKey, NULL, 0);
+				drcPending = 0;
+			}
+			break;
+		case RF_SOURCE_CONN:
+			/* The library closes the socket of a connection it drops, which takes it out of the set. */
+			svc_getreq_common(src->sock);
+			if (connDestroyed) {
+				free(src);
+				continue;
+			}
+			break;
+		}
+
+		if (rf_source_arm(src, EPOLL_CTL_MOD) != OKAY)
+			RF_LOG(RF_LOG_ERROR, "worker %d cannot watch socket %d again: %s", w->id, src->sock, strerror(errno));
+	}
+
+	return(NULL);
+}
+
+// *****************************************************
+//
+// rf_write_all
+//     Writes a whole buffer to a blocking socket.
+// input parameters: sock - The socket.
+//                   buf  - Bytes to write.
+//                   len  - Number of bytes.
+// return value: OKAY, or FAILED if the connection broke.
+//
+// *****************************************************
+static int rf_write_all(int sock, const char *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		if ((n = write(sock, buf, len)) < 0) {
+			if (errno == EINTR)
+				continue;
+			return(FAILED);
+		}
+		buf += n;
+		len -= n;
+	}
+
+	return(OKAY);
+}
+
+// *****************************************************
+//
+// rf_svc_reply_file
+//     Sends the reply to the TCP call being served, taking its trailing opaque
+//     data straight from a file with sendfile instead of copying it through
+//     the RPC library's buffers. The record is: RPC reply header, the fixed
+//     fields encoded by xdrHead (which must end with the opaque length,
+//     count), count bytes of the file, XDR padding.
+//     A procedure that used this must return FALSE so that the dispatcher does
+//     not send a second reply.
+// input parameters: rqstp   - The call being served.
+//                   xdrHead - Encodes the reply fields in front of the data.
+//                   head    - The reply passed to xdrHead.
+//                   fd      - File to send from. Must hold count bytes at offset.
+//                   offset  - File offset of the data.
+//                   count   - Number of data bytes.
+// return value: OKAY if the reply was sent, or the connection was shut down
+//               because it broke mid reply. FAILED if nothing was sent: the call
+//               is not one this thread is serving on a TCP connection, or the
+//               header did not fit. The caller then replies as usual.
+//
+// *****************************************************
+int rf_svc_reply_file(struct svc_req *rqstp, xdrproc_t xdrHead, void *head, int fd, off_t offset, u_int count)
+{
+	static const char zeros[4096];
+	char buf[RF_REPLY_HEADMAX];
+	struct rpc_msg reply;
+	XDR xdrs;
+	u_int headLen, pad;
+	u_int32_t mark;
+	ssize_t n;
+	int sock, on = 1, off = 0;
+	int status = OKAY;
+
+	if (rqstp->rq_xprt != recvXprt)
+		return(FAILED);
+	sock = rqstp->rq_xprt->xp_sock;
+
+	reply.rm_xid = recvXid;
+	reply.rm_direction = REPLY;
+	reply.rm_reply.rp_stat = MSG_ACCEPTED;
+	reply.acpted_rply.ar_verf = rqstp->rq_xprt->xp_verf;
+	reply.acpted_rply.ar_stat = SUCCESS;
+	reply.acpted_rply.ar_results.where = NULL;
+	reply.acpted_rply.ar_results.proc = (xdrproc_t)xdr_void;
+
+	xdrmem_create(&xdrs, buf + sizeof(mark), sizeof(buf) - sizeof(mark), XDR_ENCODE);
+	if (!xdr_replymsg(&xdrs, &reply) || !xdrHead(&xdrs, head)) {
+		xdr_destroy(&xdrs);
+		return(FAILED);
+	}
+	headLen = xdr_getpos(&xdrs);
+	xdr_destroy(&xdrs);
+
+	/* One record, sent as a single last fragment. */
+	pad = (4 - count % 4) % 4;
+	mark = htonl(0x80000000 | (headLen + count + pad));
+	memcpy(buf, &mark, sizeof(mark));
+
+	/* Cork so the header, data and padding leave in full sized segments. */
+	setsockopt(sock, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+	if (rf_write_all(sock, buf, sizeof(mark) + headLen) != OKAY)
+		status = FAILED;
+	while (status == OKAY && count > 0) {
+		n = sendfile(sock, fd, &offset, count);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0) {
+			status = FAILED;
+			break;
+		}
+		/* The file shrank after the length went out; keep the record intact. */
+		if (n == 0) {
+			n = count < sizeof(zeros) ? count : sizeof(zeros);
+			if (rf_write_all(sock, zeros, n) != OKAY)
+				status = FAILED;
+		}
+		count -= n;
+	}
+	if (status == OKAY && pad > 0)
+		status = rf_write_all(sock, zeros, pad);
+	setsockopt(sock, IPPROTO_TCP, TCP_CORK, &off, sizeof(off));
+
+	/* A partial record would corrupt the stream; drop the connection instead. */
+	if (status != OKAY)
+		shutdown(sock, SHUT_RDWR);
+
+	return(OKAY);
+}
+
+// *****************************************************
+//
+// rf_register
+//     Registers a program version with the RPC library and the portmapper.
+// input parameters: xprt     - A transport of the server, used for the dispatch table.
+//                   vers     - RFILE version number.
+//                   dispatch - rpcgen dispatch routine for vers.
+//                   udpPort  - UDP port to advertise.
+//                   tcpPort  - TCP port to advertise.
+//                   fixed    - Non zero if the port was given on the command line.
+// return value: OKAY, or FAILED if the server can not be reached by clients.
+//
+// *****************************************************
+static int rf_register(SVCXPRT *xprt, u_long vers, void (*dispatch)(struct svc_req *, SVCXPRT *),
+                       int udpPort, int tcpPort, int fixed)
+{
+	if (!svc_register(xprt, RFILE, vers, dispatch, 0)) {
+		RF_LOG(RF_LOG_ERROR, "unable to register (RFILE, %lu)", vers);
+		return(FAILED);
+	}
+
+	pmap_unset(RFILE, vers);
+	if (!pmap_set(RFILE, vers, IPPROTO_UDP, udpPort) || !pmap_set(RFILE, vers, IPPROTO_TCP, tcpPort)) {
+		if (!fixed) {
+			RF_LOG(RF_LOG_ERROR, "unable to register (RFILE, %lu) with the portmapper", vers);
+			return(FAILED);
+		}
+		RF_LOG(RF_LOG_WARN, "no portmapper, version %lu reachable on port %d only", vers, udpPort);
+	}
+
+	return(OKAY);
+}
+
+// *****************************************************
+//
+// rf_svc_busy
+//     Turns a version 2 call away without running it: replies with a status
+//     that tells the client to call again after wait ms (see RF_BUSY in rf.x).
+//     The reply is not kept by the duplicate request cache, so the call can
+//     be run when it comes again.
+// input parameters: rqstp - The call.
+//                   xprt  - Its transport.
+//                   wait  - Milliseconds the client should wait.
+//
+// *****************************************************
+static void rf_svc_busy(struct svc_req *rqstp, SVCXPRT *xprt, long wait)
+{
+	union {
+		RF_FetchManyRequest_T	fetchmany;
+		RF_StatManyRequest_T	statmany;
+		RF_GetAttrRequest_T		getattr;
+	} args;
+	const RF_BusyReply_T *reply;
+	xdrproc_t xdrArgs = NULL;
+	void *res;
+
+	if (drcPending) {
+		rf_drc_end(&drcKey, NULL, 0);
+		drcPending = 0;
+	}
+
+	if ((reply = rf_busy_reply(rqstp->rq_proc)) == NULL) {
+		svcerr_noproc(xprt);
+		return;
+	}
+
+	/* The list replies carry the status in each result, one per item asked about.
+	// Decoding the arguments resets the arena, so the reply is taken after it.
+	*/
+	memset(&args, 0, sizeof(args));
+	if (reply->list) {
+		switch (rqstp->rq_proc) {
+		case rf_fetchmany:
+			xdrArgs = (xdrproc_t)xdr_RF_FetchManyRequest_T;
+			break;
+		case rf_statmany:
+			xdrArgs = (xdrproc_t)xdr_RF_StatManyRequest_T;
+			break;
+		default:
+			xdrArgs = (xdrproc_t)xdr_RF_GetAttrRequest_T;
+			break;
+		}
+		if (!svc_getargs(xprt, xdrArgs, (char *)&args)) {
+			svcerr_decode(xprt);
+			rf_arena_reset();
+			return;
+		}
+	}
+
+	if ((res = rf_arena_calloc(1, reply->size)) != NULL && reply->list) {
+		if (rqstp->rq_proc == rf_fetchmany) {
+			RF_FetchManyReply_T *r = res;
+			if ((r->files.files_val = rf_arena_calloc(args.fetchmany.files.files_len, sizeof(RF_FetchReply_T))) != NULL)
+				r->files.files_len = args.fetchmany.files.files_len;
+			else
+				res = NULL;
+		} else if (rqstp->rq_proc == rf_statmany) {
+			RF_StatManyReply_T *r = res;
+			if ((r->results.results_val = rf_arena_calloc(args.statmany.paths.paths_len, sizeof(RF_StatResult_T))) != NULL)
+				r->results.results_len = args.statmany.paths.paths_len;
+			else
+				res = NULL;
+		} else {
+			RF_GetAttrReply_T *r = res;
+			if ((r->results.results_val = rf_arena_calloc(args.getattr.paths.paths_len, sizeof(RF_GetAttrResult_T))) != NULL)
+				r->results.results_len = args.getattr.paths.paths_len;
+			else
+				res = NULL;
+		}
+	}
+
+	if (res == NULL)
+		svcerr_systemerr(xprt);
+	else {
+		reply->set(res, RF_BUSY - wait);
+		if (!svc_sendreply(xprt, reply->xdrRes, res))
+			svcerr_systemerr(xprt);
+	}
+	if (xdrArgs != NULL)
+		svc_freeargs(xprt, xdrArgs, (char *)&args);
+	rf_arena_reset();
+}
+
+// *****************************************************
+//
+// rf_svc_udp
+//     Tells whether a transport is one of the UDP sockets.
+// input parameters: xprt - The transport.
+// return value: Non zero for UDP, 0 for a TCP connection.
+//
+// *****************************************************
+static int rf_svc_udp(SVCXPRT *xprt)
+{
+	return(xprt->xp_ops->xp_recv == rf_dg_recv);
+}
+
+// *****************************************************
+//
+// rf_dispatch_1
+//     Dispatch routine registered for RFILE version 1: rfile_1 behind
+//     admission control. Version 1 clients do not know RF_BUSY, so a TCP
+//     call is made to wait instead, and a UDP call that may not run yet is
+//     dropped without a reply; the client sends it again on its own timer.
+// input parameters: rqstp - The call.
+//                   xprt  - Its transport.
+//
+// *****************************************************
+static void rf_dispatch_1(struct svc_req *rqstp, SVCXPRT *xprt)
+{
+	if (rqstp->rq_proc == NULLPROC) {
+		rfile_1(rqstp, xprt);
+		return;
+	}
+
+	if (rf_admit_enter(svc_getrpccaller(xprt), rf_svc_udp(xprt) ? RF_ADMIT_NOWAIT : 0) > 0)
+		return;
+	rfile_1(rqstp, xprt);
+	rf_admit_leave();
+}
+
+// *****************************************************
+//
+// rf_dispatch_2
+//     Dispatch routine registered for RFILE version 2: rfile_2 behind
+//     admission control. The null procedure and rf_stats always run at once,
+//     so a loaded server can still be pinged and watched.
+// input parameters: rqstp - The call.
+//                   xprt  - Its transport.
+//
+// *****************************************************
+static void rf_dispatch_2(struct svc_req *rqstp, SVCXPRT *xprt)
+{
+	long wait;
+
+	if (rqstp->rq_proc == NULLPROC || rqstp->rq_proc == rf_stats) {
+		rfile_2(rqstp, xprt);
+		return;
+	}
+
+	if ((wait = rf_admit_enter(svc_getrpccaller(xprt), RF_ADMIT_BUSY | (rf_svc_udp(xprt) ? RF_ADMIT_NOWAIT : 0))) > 0) {
+		rf_svc_busy(rqstp, xprt, wait);
+		return;
+	}
+	rfile_2(rqstp, xprt);
+	rf_admit_leave();
+}
+
+// *****************************************************
+//
+// rf_svc_comp_level
+//     Tells the procedures how hard to compress the blocks they send.
+// return value: The level given with -z, 0 for none.
+//
+// *****************************************************
+int rf_svc_comp_level(void)
+{
+	return(compLevel);
+}
+
+// *****************************************************
+//
+// main
+//     Entry point for the server program. Parses the options, binds the UDP and
+//     TCP sockets of every worker, registers RFILE versions 1 and 2 and starts
+//     the worker threads.
+// input parameters: See the usage at the top of this file.
+// return value: Exit status. Only returns on a startup failure.
+//
+// *****************************************************
+int main(int argc, char *argv[])
+{
+	RF_Worker_T *workers;
+	int numWorkers = RF_THREADS_PER_CPU * sysconf(_SC_NPROCESSORS_ONLN);
+	long maxHandles = 0;
+	long logSample = RF_LOG_DEFAULT_SAMPLE;
+	long long cacheMB = RF_CACHE_DEFAULT_MB;
+	int cacheFiles = RF_FDCACHE_DEFAULT_FILES;
+	int cacheIdle = RF_FDCACHE_DEFAULT_IDLE;
+	int drcEntries = RF_DRC_DEFAULT_ENTRIES;
+	long wbKB = RF_WB_DEFAULT_KB;
+	int durability = RF_SYNC_NONE;
+	int wbInterval = RF_WB_DEFAULT_INTERVAL;
+	int dirScans = RF_DIRCACHE_DEFAULT_DIRS;
+	int admitActive = 0;
+	long admitOps = 0;
+	long long admitKB = 0;
+	int admitTarget = 0;
+	char *admitWeights = NULL;
+	int logLevel = RF_LOG_INFO;
+	FILE *logFile = stdout;
+	int udpPort = 0, tcpPort = 0, fixed = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "p:t:n:v:s:l:C:F:I:D:z:W:d:P:R:A:Q:B:L:w:")) != -1) {
+		switch (opt) {
+		case 'p':
+			udpPort = tcpPort = atoi(optarg);
+			fixed = 1;
+			break;
+		case 't':
+			numWorkers = atoi(optarg);
+			break;
+		case 'n':
+			maxHandles = atol(optarg);
+			break;
+		case 'v':
+			if ((logLevel = rf_log_parse_level(optarg)) == FAILED) {
+				printf("Unknown log level %s.\n", optarg);
+				exit(-1);
+			}
+			break;
+		case 's':
+			logSample = atol(optarg);
+			break;
+		case 'l':
+			if ((logFile = fopen(optarg, "a")) == NULL) {
+				printf("Cannot open log file %s.\n", optarg);
+				exit(-1);
+			}
+			break;
+		case 'C':
+			cacheMB = atoll(optarg);
+			break;
+		case 'F':
+			cacheFiles = atoi(optarg);
+			break;
+		case 'I':
+			cacheIdle = atoi(optarg);
+			break;
+		case 'D':
+			drcEntries = atoi(optarg);
+			break;
+		case 'z':
+			compLevel = atoi(optarg);
+			if (compLevel < 0 || compLevel > RF_COMP_MAXLEVEL) {
+				printf("Compression level must be 0 to %d.\n", RF_COMP_MAXLEVEL);
+				exit(-1);
+			}
+			break;
+		case 'W':
+			wbKB = atol(optarg);
+			break;
+		case 'd':
+			if ((durability = rf_wb_parse_durability(optarg)) == FAILED) {
+				printf("Durability must be none, close or periodic.\n");
+				exit(-1);
+			}
+			break;
+		case 'P':
+			wbInterval = atoi(optarg);
+			break;
+		case 'R':
+			dirScans = atoi(optarg);
+			break;
+		case 'A':
+			admitActive = atoi(optarg);
+			break;
+		case 'Q':
+			admitOps = atol(optarg);
+			break;
+		case 'B':
+			admitKB = atoll(optarg);
+			break;
+		case 'L':
+			admitTarget = atoi(optarg);
+			break;
+		case 'w':
+			admitWeights = optarg;
+			break;
+		default:
+			printf("Usage: %s [-p port] [-t threads] [-n maxHandles] [-v level] [-s sample] [-l logfile] [-C cacheMB] [-F files] [-I idle] [-D entries] [-z level] [-W bufKB] [-d durability] [-P interval] [-R dirs] [-A active] [-Q ops] [-B KBps] [-L ms] [-w weights]\n", argv[0]);
+			exit(-1);
+		}
+	}
+	if (numWorkers < 1)
+		numWorkers = 1;
+
+	/* A client that disconnects mid reply must not kill the server. */
+	signal(SIGPIPE, SIG_IGN);
+
+	/* First, so that every thread started later inherits the blocked SIGUSR1. */
+	if (rf_stats_init() != OKAY) {
+		printf("RF Server: cannot start the stats thread.\n");
+		exit(1);
+	}
+
+	if (rf_log_init(logFile, logLevel, logSample) != OKAY)
+		RF_LOG(RF_LOG_WARN, "cannot start log writer, logging synchronously");
+
+	if (rf_handle_init(maxHandles) != OKAY) {
+		RF_LOG(RF_LOG_ERROR, "cannot allocate handle table");
+		exit(1);
+	}
+
+	if (rf_cache_init(cacheMB * 1024 * 1024) != OKAY)
+		RF_LOG(RF_LOG_WARN, "cannot allocate block cache, running without it");
+
+	if (rf_fdcache_init(cacheFiles, cacheIdle) != OKAY) {
+		RF_LOG(RF_LOG_ERROR, "cannot set up the open file cache");
+		exit(1);
+	}
+
+	if (rf_dircache_init(dirScans) != OKAY) {
+		RF_LOG(RF_LOG_ERROR, "cannot set up the directory cache");
+		exit(1);
+	}
+
+	if (rf_drc_init(drcEntries, RF_DRC_DEFAULT_BYTES) != OKAY)
+		RF_LOG(RF_LOG_WARN, "cannot allocate duplicate request cache, running without it");
+
+	if (rf_wb_init(wbKB * 1024, durability, wbInterval) != OKAY) {
+		RF_LOG(RF_LOG_ERROR, "cannot start the write-behind flusher");
+		exit(1);
+	}
+
+	if (rf_admit_init(admitActive, admitOps, admitKB * 1024, admitTarget, admitWeights) != OKAY) {
+		RF_LOG(RF_LOG_ERROR, "weights must be given as address=weight,...");
+		exit(1);
+	}
+
+	workers = calloc(numWorkers, sizeof(RF_Worker_T));
+	if (workers == NULL) {
+		RF_LOG(RF_LOG_ERROR, "out of memory");
+		exit(1);
+	}
+
+	if ((epollFd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+		RF_LOG(RF_LOG_ERROR, "cannot create epoll set: %s", strerror(errno));
+		exit(1);
+	}
+
+	/* Worker 0 binds first so that, without -p, the others can join the ports it got. */
+	for (int i = 0; i < numWorkers; i++) {
+		RF_Worker_T *w = &workers[i];
+		int udpSock;
+
+		w->id = i;
+		if ((udpSock = rf_bind_socket(SOCK_DGRAM, udpPort)) < 0 ||
+		    (w->listen.sock = rf_bind_socket(SOCK_STREAM, tcpPort)) < 0) {
+			RF_LOG(RF_LOG_ERROR, "cannot bind port: %s", strerror(errno));
+			exit(1);
+		}
+		fcntl(w->listen.sock, F_SETFL, fcntl(w->listen.sock, F_GETFL) | O_NONBLOCK);
+		w->listen.kind = RF_SOURCE_LISTEN;
+		udpPort = rf_socket_port(udpSock);
+		tcpPort = rf_socket_port(w->listen.sock);
+
+		if ((w->udp.xprt = svcudp_bufcreate(udpSock, RF_UDP_BUFSIZE, RF_UDP_BUFSIZE)) == NULL) {
+			RF_LOG(RF_LOG_ERROR, "cannot create udp service");
+			exit(1);
+		}
+		w->udp.kind = RF_SOURCE_UDP;
+		w->udp.sock = udpSock;
+		if (dgReply == NULL) {
+			dgRecv = w->udp.xprt->xp_ops->xp_recv;
+			dgReply = w->udp.xprt->xp_ops->xp_reply;
+			dgGetArgs = w->udp.xprt->xp_ops->xp_getargs;
+			dgFreeArgs = w->udp.xprt->xp_ops->xp_freeargs;
+		}
+		w->udp.ops = *w->udp.xprt->xp_ops;
+		w->udp.ops.xp_recv = rf_dg_recv;
+		w->udp.ops.xp_reply = rf_dg_reply;
+		w->udp.ops.xp_getargs = rf_dg_getargs;
+		w->udp.ops.xp_freeargs = rf_args_free;
+		w->udp.xprt->xp_ops = &w->udp.ops;
+	}
+
+	if (rf_register(workers[0].udp.xprt, RFILE_VERS, rf_dispatch_1, udpPort, tcpPort, fixed) != OKAY ||
+	    rf_register(workers[0].udp.xprt, RFILE_VERS2, rf_dispatch_2, udpPort, tcpPort, fixed) != OKAY)
+		exit(1);
+
+	for (int i = 0; i < numWorkers; i++) {
+		if (rf_source_arm(&workers[i].udp, EPOLL_CTL_ADD) != OKAY ||
+		    rf_source_arm(&workers[i].listen, EPOLL_CTL_ADD) != OKAY) {
+			RF_LOG(RF_LOG_ERROR, "cannot watch sockets: %s", strerror(errno));
+			exit(1);
+		}
+	}
+
+	RF_LOG(RF_LOG_INFO, "%d workers on udp port %d, tcp port %d", numWorkers, udpPort, tcpPort);
+
+	for (int i = 1; i < numWorkers; i++) {
+		if (pthread_create(&workers[i].thread, NULL, rf_worker_run, &workers[i]) != 0) {
+			RF_LOG(RF_LOG_ERROR, "cannot start worker %d", i);
+			exit(1);
+		}
+	}
+	rf_worker_run(&workers[0]);
+
+	RF_LOG(RF_LOG_ERROR, "worker loop exited");
+	exit(1);
+}
@@ -2,24 +2,447 @@
 // Client main program to test RF server.
 //
 // Run this program with UNIX server IP address as the argument like
-//       rfclient  RedactedIPAddress
+//       rfclient  RedactedIPAddress [udp|tcp] [window]
 //
-// See main for program description.
+// The address may be given as address:port to reach a server started with
+// rfserver -p port. The transport defaults to udp. window is the number of
+// read or write calls kept in flight during a transfer (default RF_DEFAULT_WINDOW).
+//
+// It can also run without prompts, for scripts:
+//       rfclient [-t udp|tcp] [-w window] [-s streams] [-j jobs] [-z level] [-c dir [-m MB]] [-r tries] server get REMOTE LOCAL
+//       rfclient [-t udp|tcp] [-w window] [-s streams] [-j jobs] [-z level] [-r tries] server put LOCAL REMOTE
+//       rfclient [-t udp|tcp] server sync REMOTE LOCAL
+//       rfclient [-t udp|tcp] [-w window] [-s streams] [-j jobs] [-z level] [-c dir [-m MB]] [-r tries] server batch MANIFEST
+//       rfclient [-t udp|tcp] server stats
+//       rfclient [-t udp|tcp] [-w window] server digest REMOTE...
+//       rfclient [-t udp|tcp] server ls REMOTE_DIR
+//       rfclient [-t udp|tcp] server stat REMOTE...
+//
+// batch runs every transfer listed in MANIFEST (see rfbatch.h), up to jobs
+// (default RF_DEFAULT_JOBS) at once, each over its own CLIENT handle. The exit
+// status is 0 only if every transfer succeeded. With -s, a large file is split
+// into ranges moved over streams connections at once (see rfstripe.h), and
+// checked against its size and checksum. With -z, blocks travel compressed
+// where that makes them smaller: puts at the given level (1 to 9), gets at the
+// level the server was started with. With -c, gets go through a client cache
+// kept in dir (see rfccache.h): a file that has not changed since it was last
+// fetched is copied out of the cache instead, and the cache is kept under MB
+// megabytes (default RF_CCACHE_DEFAULT_MB). With -r, gets and puts can be
+// resumed (see rfresume.h): each keeps a checkpoint next to its local file,
+// reconnects and carries on from it up to tries times after a timeout or a
+// server restart, and running it again later carries on from where it
+// stopped instead of from byte zero. sync is a get that only fetches the
+// parts of the remote file LOCAL does not already have. stats prints the server's
+// per procedure call counts and latencies, and digest the CRC32C and size of
+// each remote file named, asking for all of them at once and printing each as
+// its reply arrives. ls lists a remote directory and stat prints the type,
+// size and modification time of remote files (see rfdir.h).
+//
+// See main and rf_command for program description.
 //
 */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <signal.h>
 #include <rpc/rpc.h>
 
 #include "rf.h"
+#include "rfconnect.h"
+#include "rfccache.h"
+#include "rfxfer.h"
+#include "rfbatch.h"
+#include "rfresume.h"
+#include "rfstripe.h"
+#include "rfasync.h"
+#include "rfdir.h"
 
 #define RF_PROGRAM 877
-#define RF_VERSION 1
+#define RF_VERSION 2
 
 #define OKAY 0
 #define FAILED -1
 
 
+// *****************************************************
+//
+// rf_is_command
+//     Tells whether the arguments ask for the non-interactive mode.
+// input parameters: argc, argv - As passed to main.
+// return value: Non zero for an option or a get, put or batch command.
+//
+// *****************************************************
+static int rf_is_command(int argc, char *argv[])
+{
+	if (argc >= 2 && argv[1][0] == '-')
+		return(1);
+
+	return(argc >= 3 && (strcmp(argv[2], "get") == 0 || strcmp(argv[2], "put") == 0 || strcmp(argv[2], "sync") == 0 ||
+	                     strcmp(argv[2], "batch") == 0 || strcmp(argv[2], "stats") == 0 ||
+	                     strcmp(argv[2], "digest") == 0 || strcmp(argv[2], "ls") == 0 ||
+	                     strcmp(argv[2], "stat") == 0));
+}
+
+// *****************************************************
+//
+// rf_print_stats
+//     Fetches the server's metrics with rf_stats and prints them as a table.
+// input parameters: server - Server as accepted by rf_connect.
+//                   proto  - "udp" or "tcp".
+// return value: Exit status. 0 on success, 1 if the call failed.
+//
+// *****************************************************
+static int rf_print_stats(char *server, char *proto)
+{
+	RF_StatsReply_T res;
+	RF_ProcStats_T *p;
+	CLIENT *clnt;
+	long maxBlock;
+
+	if ((clnt = rf_connect(server, RF_VERSION, proto, &maxBlock)) == NULL) {
+		clnt_pcreateerror(server);
+		return(1);
+	}
+	memset(&res, 0, sizeof(res));
+	if (rf_stats_2(NULL, &res, clnt) != RPC_SUCCESS) {
+		clnt_perror(clnt, server);
+		clnt_destroy(clnt);
+		return(1);
+	}
+
+	printf("up %.1f s, %ld files open\n", res.uptimeUsec / 1e6, res.openHandles);
+	printf("%-16s %12s %8s %14s %10s %10s %10s %10s %10s\n",
+	       "procedure", "calls", "errors", "bytes", "mean_us", "p50_us", "p99_us", "p999_us", "max_us");
+	for (u_int i = 0; i < res.procs.procs_len; i++) {
+		p = &res.procs.procs_val[i];
+		printf("%-16s %12lld %8lld %14lld %10.1f %10lld %10lld %10lld %10lld\n",
+		       p->name, (long long)p->calls, (long long)p->errors, (long long)p->bytes,
+		       p->calls > 0 ? (double)p->sumUsec / p->calls : 0.0, (long long)p->p50Usec,
+		       (long long)p->p99Usec, (long long)p->p999Usec, (long long)p->maxUsec);
+	}
+
+	xdr_free((xdrproc_t)xdr_RF_StatsReply_T, (char *)&res);
+	clnt_destroy(clnt);
+
+	return(0);
+}
+
+// One file of a digest command.
+typedef struct
+{
+	char				*remote;
+	char				*server;
+	RF_DigestRequest_T	req;
+	RF_DigestReply_T	res;
+	int					failed;
+} RF_DigestJob_T;
+
+// *****************************************************
+//
+// rf_digest_done
+//     Prints the checksum of one file of a digest command once its call ends.
+// input parameters: stat - How the call ended.
+//                   res  - The reply.
+//                   arg  - The RF_DigestJob_T.
+//
+// *****************************************************
+static void rf_digest_done(enum clnt_stat stat, void *res, void *arg)
+{
+	RF_DigestJob_T *job = arg;
+	RF_DigestReply_T *reply = res;
+
+	job->failed = 1;
+	if (stat == RPC_PROCUNAVAIL)
+		printf("%s: server has no rf_digest\n", job->server);
+	else if (stat != RPC_SUCCESS)
+		printf("%s: digest call failed (%s)\n", job->remote, clnt_sperrno(stat));
+	else if (reply->digestStatus != OKAY || reply->bytes != reply->fileSize)
+		printf("%s: cannot checksum remote file\n", job->remote);
+	else {
+		printf("%08x %lld %s\n", reply->crc, (long long)reply->fileSize, job->remote);
+		job->failed = 0;
+	}
+	fflush(stdout);
+}
+
+// *****************************************************
+//
+// rf_print_digest
+//     Asks the server for the checksums of files with rf_digest and prints
+//     them. The calls are all made at once through an asynchronous channel
+//     (see rfasync.h), up to window in flight, and each checksum is printed
+//     as its reply arrives.
+// input parameters: server   - Server as accepted by rf_connect.
+//                   proto    - "udp" or "tcp".
+//                   window   - Calls in flight.
+//                   remotes  - Names of the files on the server.
+//                   nRemotes - Number of names.
+// return value: Exit status. 0 on success, 1 if any call failed.
+//
+// *****************************************************
+static int rf_print_digest(char *server, char *proto, int window, char **remotes, int nRemotes)
+{
+	RF_DigestJob_T *jobs;
+	RF_Async_T *as;
+	CLIENT *clnt;
+	long maxBlock;
+	int status = 0;
+
+	if ((clnt = rf_connect(server, RFILE_VERS2, proto, &maxBlock)) == NULL) {
+		clnt_pcreateerror(server);
+		return(1);
+	}
+	if ((jobs = calloc(nRemotes, sizeof(RF_DigestJob_T))) == NULL ||
+	    (as = rf_async_create(clnt, window > 0 ? window : RF_DEFAULT_WINDOW, RF_MAXPATHLEN + 512, 512)) == NULL) {
+		perror("rf_print_digest");
+		free(jobs);
+		clnt_destroy(clnt);
+		return(1);
+	}
+
+	for (int i = 0; i < nRemotes; i++) {
+		jobs[i].remote = remotes[i];
+		jobs[i].server = server;
+		jobs[i].req.filename = remotes[i];
+		jobs[i].req.offset = 0;
+		jobs[i].req.length = -1;
+		if (rf_async_call_cb(as, rf_digest, (xdrproc_t)xdr_RF_DigestRequest_T, &jobs[i].req,
+		                     (xdrproc_t)xdr_RF_DigestReply_T, &jobs[i].res, rf_digest_done, &jobs[i]) != OKAY) {
+			printf("%s: digest call failed\n", remotes[i]);
+			jobs[i].failed = 1;
+		}
+	}
+
+	/* Returns once every call has ended. */
+	rf_async_destroy(as);
+	for (int i = 0; i < nRemotes; i++)
+		status |= jobs[i].failed;
+	free(jobs);
+	clnt_destroy(clnt);
+
+	return(status);
+}
+
+// *****************************************************
+//
+// rf_print_attr
+//     Prints one line for a remote file: type, size, modification time, name.
+// input parameters: attr - The file's attributes.
+//                   name - Name to print.
+//
+// *****************************************************
+static void rf_print_attr(RF_Attr_T *attr, char *name)
+{
+	static const char types[] = "?-dl?";
+	time_t mtime = attr->mtime / 1000000000LL;
+	char when[32];
+
+	strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime(&mtime));
+	printf("%c %12lld %s %s\n", types[attr->type <= RF_TYPE_OTHER ? attr->type : 0], (long long)attr->size, when, name);
+}
+
+// *****************************************************
+//
+// rf_print_dir
+//     Lists a remote directory with rf_readdirplus and prints its entries.
+// input parameters: server - Server as accepted by rf_connect.
+//                   proto  - "udp" or "tcp".
+//                   dir    - Name of the directory on the server.
+// return value: Exit status. 0 on success, 1 if the listing failed.
+//
+// *****************************************************
+static int rf_print_dir(char *server, char *proto, char *dir)
+{
+	RF_DirEntry_T *entries;
+	enum clnt_stat rpcError;
+	u_int numEntries;
+	CLIENT *clnt;
+	long maxBlock;
+
+	if ((clnt = rf_connect(server, RFILE_VERS2, proto, &maxBlock)) == NULL) {
+		clnt_pcreateerror(server);
+		return(1);
+	}
+	if (rf_dir_list(clnt, dir, &entries, &numEntries, &rpcError) != OKAY) {
+		if (rpcError == RPC_PROCUNAVAIL)
+			printf("%s: server has no rf_readdirplus\n", server);
+		else if (rpcError != RPC_SUCCESS)
+			printf("%s: listing failed (%s)\n", dir, clnt_sperrno(rpcError));
+		else
+			printf("%s: cannot list remote directory\n", dir);
+		clnt_destroy(clnt);
+		return(1);
+	}
+
+	for (u_int i = 0; i < numEntries; i++)
+		rf_print_attr(&entries[i].attr, entries[i].name);
+	rf_dir_free(entries, numEntries);
+	clnt_destroy(clnt);
+
+	return(0);
+}
+
+// *****************************************************
+//
+// rf_print_stat
+//     Gets the attributes of remote files with rf_statmany and prints them.
+// input parameters: server   - Server as accepted by rf_connect.
+//                   proto    - "udp" or "tcp".
+//                   remotes  - Names of the files on the server.
+//                   nRemotes - Number of names.
+// return value: Exit status. 0 on success, 1 if the call failed or a file was not found.
+//
+// *****************************************************
+static int rf_print_stat(char *server, char *proto, char **remotes, int nRemotes)
+{
+	RF_StatResult_T *results;
+	enum clnt_stat rpcError;
+	CLIENT *clnt;
+	long maxBlock;
+	int status = 0;
+
+	if ((clnt = rf_connect(server, RFILE_VERS2, proto, &maxBlock)) == NULL) {
+		clnt_pcreateerror(server);
+		return(1);
+	}
+	if ((results = calloc(nRemotes, sizeof(RF_StatResult_T))) == NULL ||
+	    rf_dir_stat(clnt, maxBlock, nRemotes, remotes, results, &rpcError) != OKAY) {
+		if (results == NULL)
+			perror("rf_print_stat");
+		else if (rpcError == RPC_PROCUNAVAIL)
+			printf("%s: server has no rf_statmany\n", server);
+		else
+			printf("%s: stat failed (%s)\n", server, clnt_sperrno(rpcError));
+		free(results);
+		clnt_destroy(clnt);
+		return(1);
+	}
+
+	for (int i = 0; i < nRemotes; i++) {
+		if (results[i].statStatus == OKAY) {
+			rf_print_attr(&results[i].attr, remotes[i]);
+		} else {
+			printf("%s: not found\n", remotes[i]);
+			status = 1;
+		}
+	}
+	free(results);
+	clnt_destroy(clnt);
+
+	return(status);
+}
+
+// *****************************************************
+//
+// rf_command
+//     Runs the non-interactive mode: one get, put or sync, a batch manifest,
+//     stats, a digest, a listing or a stat.
+// input parameters: argc, argv - As passed to main; see the usage at the top of this file.
+// return value: Exit status. 0 if every transfer succeeded, 1 if any failed,
+//               -1 for bad arguments.
+//
+// *****************************************************
+static int rf_command(int argc, char *argv[])
+{
+	RF_BatchEntry_T one, *entries;
+	char *proto = "udp";
+	int window = RF_DEFAULT_WINDOW;
+	int streams = RF_DEFAULT_STREAMS;
+	int jobs = RF_DEFAULT_JOBS;
+	int numEntries = 0;
+	long long cacheMB = RF_CCACHE_DEFAULT_MB;
+	char *cacheDir = NULL;
+	char *server, *cmd;
+	int resume = 0;
+	int opt, status;
+
+	while ((opt = getopt(argc, argv, "+t:w:s:j:z:c:m:r:")) != -1) {
+		switch (opt) {
+		case 't':
+			proto = optarg;
+			break;
+		case 'w':
+			if (atoi(optarg) > 0)
+				window = atoi(optarg);
+			break;
+		case 's':
+			if (atoi(optarg) > 0)
+				streams = atoi(optarg);
+			break;
+		case 'j':
+			if (atoi(optarg) > 0)
+				jobs = atoi(optarg);
+			break;
+		case 'z':
+			rf_xfer_compress(atoi(optarg));
+			break;
+		case 'c':
+			cacheDir = optarg;
+			break;
+		case 'm':
+			if (atoll(optarg) > 0)
+				cacheMB = atoll(optarg);
+			break;
+		case 'r':
+			resume = 1;
+			rf_resume_tries(atoi(optarg));
+			break;
+		default:
+			numEntries = FAILED;
+		}
+	}
+
+	server = (optind < argc) ? argv[optind] : NULL;
+	cmd = (optind + 1 < argc) ? argv[optind + 1] : "";
+	if (numEntries != FAILED && (strcmp(cmd, "get") == 0 || strcmp(cmd, "put") == 0 || strcmp(cmd, "sync") == 0) &&
+	    argc - optind == 4) {
+		one.put = (cmd[0] == 'p');
+		one.sync = (cmd[0] == 's');
+		one.local = argv[optind + (one.put ? 2 : 3)];
+		one.remote = argv[optind + (one.put ? 3 : 2)];
+		entries = &one;
+		numEntries = 1;
+	} else if (numEntries != FAILED && strcmp(cmd, "stats") == 0 && argc - optind == 2) {
+		return(rf_print_stats(server, proto));
+	} else if (numEntries != FAILED && strcmp(cmd, "digest") == 0 && argc - optind >= 3) {
+		return(rf_print_digest(server, proto, window, argv + optind + 2, argc - optind - 2));
+	} else if (numEntries != FAILED && strcmp(cmd, "ls") == 0 && argc - optind == 3) {
+		return(rf_print_dir(server, proto, argv[optind + 2]));
+	} else if (numEntries != FAILED && strcmp(cmd, "stat") == 0 && argc - optind >= 3) {
+		return(rf_print_stat(server, proto, argv + optind + 2, argc - optind - 2));
+	} else if (numEntries != FAILED && strcmp(cmd, "batch") == 0 && argc - optind == 3) {
+		if ((numEntries = rf_batch_load(argv[optind + 2], &entries)) == FAILED)
+			return(1);
+	} else {
+		printf("Usage: %s [-t udp|tcp] [-w window] [-s streams] [-j jobs] [-z level] [-c dir [-m MB]] [-r tries] server-IP Address[:port] get REMOTE LOCAL\n", argv[0]);
+		printf("       %s [-t udp|tcp] [-w window] [-s streams] [-j jobs] [-z level] [-r tries] server-IP Address[:port] put LOCAL REMOTE\n", argv[0]);
+		printf("       %s [-t udp|tcp] [-w window] [-s streams] [-j jobs] [-z level] [-c dir [-m MB]] [-r tries] server-IP Address[:port] batch MANIFEST\n", argv[0]);
+		printf("       %s [-t udp|tcp] server-IP Address[:port] sync REMOTE LOCAL\n", argv[0]);
+		printf("       %s [-t udp|tcp] server-IP Address[:port] stats\n", argv[0]);
+		printf("       %s [-t udp|tcp] server-IP Address[:port] digest REMOTE...\n", argv[0]);
+		printf("       %s [-t udp|tcp] server-IP Address[:port] ls REMOTE_DIR\n", argv[0]);
+		printf("       %s [-t udp|tcp] server-IP Address[:port] stat REMOTE...\n", argv[0]);
+		return(-1);
+	}
+
+	if (cacheDir != NULL && rf_ccache_init(cacheDir, cacheMB * 1024 * 1024) != OKAY) {
+		printf("Cannot use %s as a cache directory.\n", cacheDir);
+		return(1);
+	}
+	/* A server gone away must fail the call, not kill the client. */
+	signal(SIGPIPE, SIG_IGN);
+	for (int i = 0; i < numEntries; i++)
+		entries[i].resume = resume;
+	status = rf_batch_run(server, proto, window, streams, jobs, entries, numEntries);
+	rf_ccache_trim();
+
+	return(status == 0 ? 0 : 1);
+}
+
+
 // *****************************************************
 //
 // main
@@ -31,26 +454,29 @@
 //         3.)  Get name of local file to store remote file as, from user.
 //         4.)  Open local file.
 //         5.)  Open remote file. If failed, offer user to choose a different file name.
-//         6.)  Read remote file. Print read buffer if successful. Goto 8 if failed.
-//         7.)  Write to local file. (repeat 6 & 7 as necessary)
+//         6.)  Read remote file, a window of blocks at a time. Goto 8 if failed.
+//         7.)  Write each block to the local file at its offset. (repeat 6 & 7 as necessary)
 //         8.)  Close local and remote files.
 //         9.)  Get local file name from user to send to server.
 //         10.) Get remote file name from user to store local file as.
 //         11.) Open local file. If failed, offer user to choose a different file name.
 //         12.) Open remote file.
-//         13.) Read local file. Print read buffer.
-//         14.) Write to remote file. (repeat 13 & 14 as necessary)
+//         13.) Read local file one block at a time.
+//         14.) Write each block to the remote file at its offset, a window at a time. (repeat 13 & 14 as necessary)
 //         15.) Close local and remote files.
 //         16.) Offer user the opportunity to repeat the rfclient procedure. Goto 2 if 'y'; else goto 17.
 //         17.) Close the RPC Connection and exit(0).
 //
-// input parameters: A valid IP address String must be supplied as an argument.
+// input parameters: A valid IP address String must be supplied as an argument,
+//                   optionally followed by the transport, udp or tcp, and the window.
 // return value: Exit status. This integer is 0 if successful, or negative otherwise.
 //
 // *****************************************************
 main (int argc, char *argv[]) {
    CLIENT *rf_clnt;
    char *server;    /* Server IP address */
+   char *proto;     /* Transport, "udp" or "tcp" */
+   long maxBlock;   /* Largest block the client handle can carry */
    long status;     /* Used to store a process' return value. Valid values are OKAY or FAILED. */
    long fd;         /* File descriptor (index) of server's file pointer array */
    char line_stdin[1024];      /* Used to store user input String */
@@ -61,32 +487,42 @@ main (int argc, char *argv[]) {
 
    
    FILE *filePtr;      //Used to store the local file pointer.
-   long bytesWritten;  //The number of bytes written to a file.
-   long bytesRead;     //The number of bytes read from a file.
+   long blockSize;     //The number of bytes moved per read or write call.
+   int window = RF_DEFAULT_WINDOW; //Number of read or write calls kept in flight.
+   RF_XferStats_T xferStats;       //What the last get or put did.
 
    /* rf.x structures */
-   RF_OpenFileRequest_T openReq;
-   RF_OpenFileReply_T *openReply;
-   RF_ReadFileRequest_T readReq;
-   RF_ReadFileReply_T *readReply;
+   /* The stubs are generated with rpcgen -M, so replies are stored in these
+   // caller owned structs; the *Reply pointers are set to them on success and
+   // to NULL when the call failed.
+   */
+   RF_OpenFile2Request_T openReq;
+   RF_OpenFile2Reply_T openRes, *openReply;
    RF_CloseFileRequest_T closeReq;
-   RF_CloseFileReply_T *closeReply;
-   RF_WriteFileRequest_T writeReq;
-   RF_WriteFileReply_T *writeReply;
+   RF_CloseFileReply_T closeRes, *closeReply;
+   RF_CloseSyncRequest_T closeSyncReq;
+   RF_CloseSyncReply_T closeSyncRes;
+   enum clnt_stat rpcError;
 
-   if (argc != 2) {
-      printf("Usage: %s server-IP Address\n", argv[0]);
+   if (rf_is_command(argc, argv))
+      exit(rf_command(argc, argv));
+
+   if (argc < 2 || argc > 4) {
+      printf("Usage: %s server-IP Address[:port] [udp|tcp] [window]\n", argv[0]);
       exit(-1);
    }
 
    server = argv[1]; /* get server name. */
+   proto = (argc >= 3) ? argv[2] : "udp";
+   if (argc == 4 && atoi(argv[3]) > 0)
+      window = atoi(argv[3]);
 
    // Create client handle.
    //
 
-   printf("Calling RF clnt_create()\n");
+   printf("Calling RF rf_connect() over %s\n", proto);
    /* Get a RPC CLIENT. Terminate if unsuccessful */
-   if ((rf_clnt = clnt_create(server, RF_PROGRAM, RF_VERSION, "udp")) == NULL) {
+   if ((rf_clnt = rf_connect(server, RF_VERSION, proto, &maxBlock)) == NULL) {
       clnt_pcreateerror(server);
       exit(-2);
    }
@@ -96,7 +532,8 @@ main (int argc, char *argv[]) {
 // For the project modify code below to do two things:
 // (1) to copy a file from the server and store it locally on the client (your system)
 // (2) to copy a local file from your system and store it on the server
-// Read ONLY 64 bytes at a time
+// Blocks are as large as both the server's maxBlock and the client transport allow,
+// and a window of them is kept in flight (see rfxfer.c).
 // Test your program with two files of size 200 to 300 bytes/character.
 //
 // To produce output, you must print the content of file sent from client after read
@@ -147,13 +584,13 @@ do{
 		}
 
 		//Get a RF_OpenFileReply_T by sending server a RF_OpenFileRequest_T.
-		printf("Trying rf_openfile_1() on remote file: %s\n", remote_filename);
-		strcpy(openReq.filename, remote_filename);
-		strcpy(openReq.mode, "r");
-		openReply = rf_openfile_1(&openReq, rf_clnt);
+		printf("Trying rf_openfile_2() on remote file: %s\n", remote_filename);
+		openReq.filename = remote_filename;
+		openReq.mode = "r";
+		openReply = (rf_openfile_2(&openReq, &openRes, rf_clnt) == RPC_SUCCESS) ? &openRes : NULL;
 		/* Ensure something was returned */
 		if (openReply == NULL) {
-			printf("rf_openfile_1 failed (returned NULL).\n");
+			printf("rf_openfile_2 failed (returned NULL).\n");
 			clnt_perror(rf_clnt, server);
 			exit(-1);
 		} else {
@@ -161,7 +598,8 @@ do{
 			status = openReply->openStatus;
 			if (status == OKAY) {
 				fd = openReply->fd;
-				printf("RF open is sucessful. FD: %d\n", fd);
+				blockSize = openReply->maxBlock < maxBlock ? openReply->maxBlock : maxBlock;
+				printf("RF open is sucessful. FD: %d, block size: %ld\n", fd, blockSize);
 			} else {
 				printf("ERROR RF open status = %d\n", status);
 				do{
@@ -189,75 +627,21 @@ do{
 	// read and close attempts.
 	*/
 	if(status == OKAY){
-		// Read from remote server file 64 bytes at a time until end of file or error.
-		printf("Trying RF read file.\n");
-
-		/* Initialize readReq */
-		readReq.fd = fd;
-		readReq.bytesToRead = 64;
-
-		// There are four ways to exit this loop. 
-		// (1) readReply is NULL, which means the rpc procedure call failed due to network error or rpc server not running
-		// (2) rpc call is successful, however, read operation failed with bytesread is negative
-		// (3) end of file has reached, bytesread is zero
-		// (4) fwrite to local file failed
-	   
-		while ((readReply = rf_readfile_1(&readReq, rf_clnt)) != NULL) 
-		{
-			printf("rpc call is successful. Checking rpc return status from the server\n");
-			status = readReply->readStatus;
-			if (status == OKAY) 
-			{
-				printf("Successful read from the server. Checking for end of file or not\n");
-				if (readReply->bytesRead > 0) {
-					printf("RF read file successful with bytesRead = %d.\n\n", readReply->bytesRead);
-
-					// Print each character that is read. Finish with a new line.
-					for(int i=0;i<readReply->bytesRead;i++)
-					{
-						printf("%c",readReply->buf[i]);
-					}
-					printf("\n");
-					
-					bytesWritten = 0; /* Reset */
-					bytesWritten = fwrite(readReply->buf, 1, readReply->bytesRead, filePtr); /* Write to get_local_file */
-					/* If fwrite failed, exit the loop.*/
-					if(bytesWritten <= 0){
-						printf("ERROR: Write to local file failed. bytesWritten = %d.\n", bytesWritten);
-						break;
-					}
-					printf("Successful write to local file. bytesWritten = %d.\n", bytesWritten);
-					if(feof(filePtr)){
-						printf("Reached EOF\n");
-						break;
-					}
-
-				}
-				/* Reached EOF. Leave the loop. */
-				else if(readReply->bytesRead == 0){
-					printf("No bytes to read from remote server.\n");
-					break;
-				}
-				else
-				{
-					printf("ERROR Bytes read is negative, bytesRead = %d\n", readReply->bytesRead);
-					break;
-				}
-			} 
-			else 
-			{
-				printf("ERROR rpc server procedure returned error. RF status = %d\n", status);
-				break;
-			}
-		}
-
-		// This is the error handling for the readReply is NULL. 
-		if (readReply == NULL) {
-			printf("ERROR RPC: RF procedure call failed due to network error or rpc server not running\n");
-			clnt_perror(rf_clnt,server);
+		// Read the remote server file with up to window read calls in flight,
+		// until end of file or error. Blocks land in the local file at their own offsets.
+		printf("Trying RF read file with %d calls in flight.\n", window);
+
+		fflush(filePtr);
+		if (rf_xfer_get(rf_clnt, fd, fileno(filePtr), blockSize, window, &xferStats) == OKAY) {
+			printf("RF read file successful. %lld bytes in %ld blocks, %.3f s, %ld retransmits.\n",
+			       xferStats.bytes, xferStats.blocks, xferStats.seconds, xferStats.retransmits);
+		} else {
+			printf("ERROR RF read file failed after %lld bytes.\n", xferStats.bytes);
+			// An rpc error means network error or rpc server not running.
+			if (xferStats.rpcError != RPC_SUCCESS)
+				printf("ERROR RPC: %s\n", clnt_sperrno(xferStats.rpcError));
 		}
 
-
 		// Close local client file. Reset filePtr for next operation.
 		printf("Closing local file.\n");
 		fclose(filePtr);
@@ -267,7 +651,7 @@ do{
 		printf("Calling RF close file.\n");
 
 		closeReq.fd = fd;
-		closeReply  = rf_closefile_1(&closeReq, rf_clnt); /* Get RF_CloseFileReply_T to determine closeStatus. */
+		closeReply  = (rf_closefile_2(&closeReq, &closeRes, rf_clnt) == RPC_SUCCESS) ? &closeRes : NULL; /* Get RF_CloseFileReply_T to determine closeStatus. */
 
 		if (closeReply == NULL) 
 		{
@@ -355,14 +739,14 @@ do{
 	*/
 	if(filePtr != NULL){
 		// call open the remote server file using rpc open file procedure (function/method)
-		printf("Trying rf_openfile_1()\n");
-		strcpy(openReq.filename, remote_filename);
-		strcpy(openReq.mode, "w");  // set mode for writing to file.
-		openReply = rf_openfile_1(&openReq, rf_clnt); /* Get the RF_OpenFileReply_T struct */
+		printf("Trying rf_openfile_2()\n");
+		openReq.filename = remote_filename;
+		openReq.mode = "w";  // set mode for writing to file.
+		openReply = (rf_openfile_2(&openReq, &openRes, rf_clnt) == RPC_SUCCESS) ? &openRes : NULL; /* Get the RF_OpenFile2Reply_T struct */
 		
 		/* Ensure remote file was opened. */
 		if(openReply == NULL) {
-			printf("rf_openfile_1 failed.\n");
+			printf("rf_openfile_2 failed.\n");
 			clnt_perror(rf_clnt, server);
 			exit(-1);
 		}
@@ -371,59 +755,41 @@ do{
 		status = openReply->openStatus;
 		if (status == OKAY) {
 			fd = openReply->fd;
-			printf("RF open is successful. FD: %d\n", fd);
+			blockSize = openReply->maxBlock < maxBlock ? openReply->maxBlock : maxBlock;
+			printf("RF open is successful. FD: %d, block size: %ld\n", fd, blockSize);
 		}else{
 			printf("ERROR RF open status = %d\n", status);
 			exit(-1);
 		}
 
-		/* Read from local file and write to remote file until local file reaches EOF. */
-		do{
-		
-			printf("Reading local file.\n");
-			bytesRead = fread(writeReq.buf, 1, 64, filePtr); // Write 64 bytes from local file to RF_WriteFileRequest_T struct.
-			/* Ensure there were no read errors; if so, quit. */
-			if(bytesRead < 0){
-				printf("ERROR reading local file. bytesRead: %d\n", bytesRead);
-				clnt_perror(rf_clnt, server);
-				exit(-1);
-			}
-			writeReq.fd = fd; //Supply the file descriptor for RF_WriteFileRequest_T.
-			writeReq.bytesToWrite = bytesRead; //Specify the number of bytes to be written in RF_WriteFileRequest_T.
-			
-			printf("The following bytes were read from the local file\n\n");
-			
-			/* Print the bytes entered int writeReq.buf */
-			for(int i=0; i < bytesRead; i++){
-				printf("%c",writeReq.buf[i]);
-			}
-			printf("\n");
-			printf("*** End of bytes read. ***\n");
-			printf("\n");
-			
-			/* Write to remote file. */
-			printf("Trying rf_writefile_1.\n");
-			writeReply = rf_writefile_1(&writeReq, rf_clnt); //Get the RF_WriteFileReply_T struct from rf_writefile_1.
-			
-			/* Ensure the remote file was written to successfully; if not, quit. */
-			status = writeReply->writeStatus;
-			if(status != OKAY){
-				printf("ERROR RF write status = %d\n", status);
-				clnt_perror(rf_clnt, server);
-				exit(-1);
-			}
-			
-			bytesWritten = writeReply->bytesWritten;
-			printf("RF write is successful. bytesWritten: %d\n", bytesWritten);
-		
-		}while(!feof(filePtr)); /* End send loop */
+		/* Send the local file to the remote file with up to window write calls in flight. */
+		printf("Trying RF write file with %d calls in flight.\n", window);
+		if (rf_xfer_put(rf_clnt, fd, fileno(filePtr), blockSize, window, &xferStats) != OKAY) {
+			printf("ERROR RF write file failed after %lld bytes.\n", xferStats.bytes);
+			if (xferStats.rpcError != RPC_SUCCESS)
+				printf("ERROR RPC: %s\n", clnt_sperrno(xferStats.rpcError));
+			exit(-1);
+		}
+		printf("RF write file successful. %lld bytes in %ld blocks, %.3f s, %ld retransmits.\n",
+		       xferStats.bytes, xferStats.blocks, xferStats.seconds, xferStats.retransmits);
 		
 		printf("Local file reached EOF.\n");
 		
-		// close the server file
+		// close the server file, asking whether the data is on its disk; an older server only closes it
 		printf("Calling RF close file.\n");
-		closeReq.fd = fd;
-		closeReply = rf_closefile_1(&closeReq, rf_clnt); /* Get RF_CloseFileReply_T to determine closeStatus. */
+		closeSyncReq.fd = fd;
+		closeSyncReq.sync = 0;
+		closeRes.closeStatus = FAILED;
+		closeReply = NULL;
+		if ((rpcError = rf_closesync_2(&closeSyncReq, &closeSyncRes, rf_clnt)) == RPC_SUCCESS) {
+			closeRes.closeStatus = closeSyncRes.closeStatus;
+			closeReply = &closeRes;
+			if (closeSyncRes.closeStatus == OKAY)
+				printf("Written data is %s.\n", closeSyncRes.durable ? "on the server's stable storage" : "not yet synced by the server");
+		} else if (rpcError == RPC_PROCUNAVAIL) {
+			closeReq.fd = fd;
+			closeReply = (rf_closefile_2(&closeReq, &closeRes, rf_clnt) == RPC_SUCCESS) ? &closeRes : NULL; /* Get RF_CloseFileReply_T to determine closeStatus. */
+		}
 
 		if(closeReply == NULL) 
 		{
@@ -0,0 +1,471 @@
+/* rfwb.c */
+
+/* This file implements the server's write-behind buffers (see rfwb.h).
+// A handle gets an entry the first time it is written; entries are found by
+// handle through a hash table under one mutex, and each has a mutex of its
+// own that is held while its buffer is filled or written out. An entry lives
+// until its handle is closed, and is then kept, buffer and all, on a short
+// spare list for the next handle written. The flusher thread takes a reference on a
+// handle (rf_handle_get) before it touches the entry, so a close, which
+// releases the handle first, never frees an entry the flusher is using.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "rf.h"
+#include "rfcache.h"
+#include "rfhandle.h"
+#include "rfwb.h"
+
+#define OKAY 0
+#define FAILED -1
+
+#define RF_WB_BUCKETS 1024   /* hash chains of the entry table */
+#define RF_WB_SPARES  64     /* most closed entries kept for reuse */
+
+typedef struct RF_WbEntry_T
+{
+	long			handle;
+	pthread_mutex_t	lock;
+	char			*buf;		/* bytes waiting to be written, allocated on first use */
+	size_t			len;		/* bytes in buf */
+	size_t			room;		/* bytes buf takes before it is written out, up to the next aligned offset */
+	int				error;		/* errno of a write that failed after its call was answered, 0 if none */
+	int				dirty;		/* written since it was last synced */
+	time_t			since;		/* rf_wb_now() when buf stopped being empty */
+	struct RF_WbEntry_T *hashNext;	/* also links the spare entries */
+} RF_WbEntry_T;
+
+static RF_WbEntry_T *table[RF_WB_BUCKETS];
+static RF_WbEntry_T *spare = NULL;    /* closed entries kept for reuse, under tableLock */
+static int numSpares = 0;
+static pthread_mutex_t tableLock = PTHREAD_MUTEX_INITIALIZER;
+static size_t blockSize = 0;          /* 0 while writes are not buffered */
+static int policy = RF_SYNC_NONE;
+static int interval = RF_WB_DEFAULT_INTERVAL;
+
+
+// *****************************************************
+//
+// rf_wb_now
+//     Reads the monotonic clock.
+// return value: Current time in milliseconds.
+//
+// *****************************************************
+static time_t rf_wb_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+// *****************************************************
+//
+// rf_wb_bucket
+//     Finds the hash chain of a handle.
+// input parameters: handle - The handle.
+// return value: Pointer to the head of the chain.
+//
+// *****************************************************
+static RF_WbEntry_T **rf_wb_bucket(long handle)
+{
+	return(&table[(handle & RF_HANDLE_INDEX_MASK) % RF_WB_BUCKETS]);
+}
+
+// *****************************************************
+//
+// rf_wb_find
+//     Finds the entry of a handle, creating it if asked, and locks it.
+// input parameters: handle - The handle.
+//                   create - Non zero to create a missing entry.
+// return value: The locked entry, or NULL if there is none or no memory.
+//
+// *****************************************************
+static RF_WbEntry_T *rf_wb_find(long handle, int create)
+{
+	RF_WbEntry_T *e;
+
+	pthread_mutex_lock(&tableLock);
+	for (e = *rf_wb_bucket(handle); e != NULL; e = e->hashNext)
+		if (e->handle == handle)
+			break;
+	if (e == NULL && create) {
+		if ((e = spare) != NULL) {
+			spare = e->hashNext;
+			numSpares--;
+		} else if ((e = calloc(1, sizeof(RF_WbEntry_T))) != NULL) {
+			pthread_mutex_init(&e->lock, NULL);
+		}
+		if (e != NULL) {
+			e->handle = handle;
+			e->hashNext = *rf_wb_bucket(handle);
+			*rf_wb_bucket(handle) = e;
+		}
+	}
+	if (e != NULL)
+		pthread_mutex_lock(&e->lock);
+	pthread_mutex_unlock(&tableLock);
+
+	return(e);
+}
+
+// *****************************************************
+//
+// rf_wb_put
+//     Writes bytes at the file position, all of them unless the write fails,
+//     and drops the cached blocks they replace.
+// input parameters: fd  - The file.
+//                   buf - The bytes.
+//                   len - Number of bytes.
+// return value: Bytes written, short of len only if the write failed, or
+//               FAILED if none were.
+//
+// *****************************************************
+static ssize_t rf_wb_put(int fd, const char *buf, size_t len)
+{
+	size_t done = 0;
+	ssize_t n;
+
+	while (done < len) {
+		if ((n = write(fd, buf + done, len - done)) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		if (n == 0)
+			break;
+		done += n;
+		rf_cache_wrote(fd, n);
+	}
+
+	return((done > 0 || len == 0) ? (ssize_t)done : FAILED);
+}
+
+// *****************************************************
+//
+// rf_wb_drain
+//     Writes out the buffer of an entry. Called with the entry locked.
+//     A failure is kept in the entry for the next write or the close.
+// input parameters: e  - The entry.
+//                   fd - The file of its handle.
+//
+// *****************************************************
+static void rf_wb_drain(RF_WbEntry_T *e, int fd)
+{
+	if (e->len == 0)
+		return;
+
+	errno = 0;
+	if (rf_wb_put(fd, e->buf, e->len) != (ssize_t)e->len && e->error == 0)
+		e->error = (errno != 0) ? errno : EIO;
+	e->len = 0;
+	e->dirty = 1;
+}
+
+// *****************************************************
+//
+// rf_wb_flusher
+//     Writes out the buffers that have waited an interval and, under
+//     RF_SYNC_PERIODIC, syncs the files written to since the last round.
+// input parameters: arg - Unused.
+// return value: Never returns.
+//
+// *****************************************************
+static void *rf_wb_flusher(void *arg)
+{
+	RF_WbEntry_T *e;
+	long *handles = NULL;
+	int numHandles, maxHandles = 0;
+	time_t now;
+	int fd;
+
+	for (;;) {
+		usleep(interval * 1000);
+		now = rf_wb_now();
+
+		/* Collect the handles, then let go of the table. */
+		pthread_mutex_lock(&tableLock);
+		numHandles = 0;
+		for (int b = 0; b < RF_WB_BUCKETS; b++) {
+			for (e = table[b]; e != NULL; e = e->hashNext) {
+				if (numHandles == maxHandles) {
+					long *more = realloc(handles, (maxHandles * 2 + 64) * sizeof(long));
+
+					if (more == NULL)
+						break;
+					handles = more;
+					maxHandles = maxHandles * 2 + 64;
+				}
+				handles[numHandles++] = e->handle;
+			}
+		}
+		pthread_mutex_unlock(&tableLock);
+
+		for (int i = 0; i < numHandles; i++) {
+			if ((fd = rf_handle_get(handles[i])) < 0)
+				continue;   /* closed meanwhile */
+			if ((e = rf_wb_find(handles[i], 0)) != NULL) {
+				if (e->len > 0 && now - e->since >= interval)
+					rf_wb_drain(e, fd);
+				if (policy == RF_SYNC_PERIODIC && e->dirty) {
+					if (fdatasync(fd) == 0)
+						e->dirty = 0;
+					else if (e->error == 0)
+						e->error = errno;
+				}
+				pthread_mutex_unlock(&e->lock);
+			}
+			rf_handle_put(handles[i]);
+		}
+	}
+
+	return(NULL);
+}
+
+// *****************************************************
+//
+// rf_wb_init
+//     Sets the buffer size and durability policy and starts the flusher thread.
+// input parameters: bufBytes   - Buffer per handle; 0 or less writes every
+//                                call through at once.
+//                   durability - RF_SYNC_NONE, RF_SYNC_CLOSE or RF_SYNC_PERIODIC.
+//                   intervalMs - Milliseconds a buffer waits before the flusher
+//                                writes it out, and between periodic syncs.
+// return value: OKAY, or FAILED if the flusher could not be started.
+//
+// *****************************************************
+int rf_wb_init(long bufBytes, int durability, int intervalMs)
+{
+	pthread_t thread;
+
+	blockSize = (bufBytes > 0) ? bufBytes : 0;
+	policy = durability;
+	interval = (intervalMs > 0) ? intervalMs : RF_WB_DEFAULT_INTERVAL;
+
+	if (blockSize == 0 && policy != RF_SYNC_PERIODIC)
+		return(OKAY);
+	if (pthread_create(&thread, NULL, rf_wb_flusher, NULL) != 0)
+		return(FAILED);
+	pthread_detach(thread);
+
+	return(OKAY);
+}
+
+// *****************************************************
+//
+// rf_wb_durability
+//     Reports the durability policy.
+// return value: RF_SYNC_NONE, RF_SYNC_CLOSE or RF_SYNC_PERIODIC.
+//
+// *****************************************************
+int rf_wb_durability(void)
+{
+	return(policy);
+}
+
+// *****************************************************
+//
+// rf_wb_write
+//     Writes bytes at the file position of a handle, through its buffer.
+//     Writes of a whole buffer or more go to the file at once, after what the
+//     buffer holds.
+// input parameters: handle - The handle.
+//                   fd     - Its file, from rf_handle_get(handle).
+//                   buf    - The bytes.
+//                   len    - Number of bytes.
+// return value: len once the bytes are buffered or written, fewer if the file
+//               took fewer, or FAILED with errno set if the write, or an
+//               earlier one through the buffer, failed.
+//
+// *****************************************************
+ssize_t rf_wb_write(long handle, int fd, const char *buf, size_t len)
+{
+	RF_WbEntry_T *e;
+	ssize_t written;
+	off_t pos;
+	int error;
+
+	if ((e = rf_wb_find(handle, 1)) == NULL)
+		return(rf_wb_put(fd, buf, len));
+
+	if (e->len > 0 && e->len + len > e->room)
+		rf_wb_drain(e, fd);
+	if (e->error != 0) {
+		error = e->error;
+		e->error = 0;
+		pthread_mutex_unlock(&e->lock);
+		errno = error;
+		return(FAILED);
+	}
+
+	if (len >= blockSize) {
+		written = rf_wb_put(fd, buf, len);
+		e->dirty = 1;
+		pthread_mutex_unlock(&e->lock);
+		return(written);
+	}
+
+	if (e->buf == NULL && (e->buf = malloc(blockSize)) == NULL) {
+		pthread_mutex_unlock(&e->lock);
+		return(rf_wb_put(fd, buf, len));
+	}
+	if (e->len == 0) {
+		/* Fill up to the next multiple of the buffer size in the file. */
+		pos = lseek(fd, 0, SEEK_CUR);
+		e->room = (pos >= 0) ? blockSize - pos % blockSize : blockSize;
+		if (e->room < len)
+			e->room = blockSize;
+		e->since = rf_wb_now();
+	}
+	memcpy(e->buf + e->len, buf, len);
+	e->len += len;
+	if (e->len == e->room)
+		rf_wb_drain(e, fd);
+	pthread_mutex_unlock(&e->lock);
+
+	return(len);
+}
+
+// *****************************************************
+//
+// rf_wb_flush
+//     Writes out the buffer of a handle, before something else uses its file.
+// input parameters: handle - The handle.
+//                   fd     - Its file, from rf_handle_get(handle).
+//
+// *****************************************************
+void rf_wb_flush(long handle, int fd)
+{
+	RF_WbEntry_T *e;
+
+	if ((e = rf_wb_find(handle, 0)) == NULL)
+		return;
+
+	rf_wb_drain(e, fd);
+	pthread_mutex_unlock(&e->lock);
+}
+
+// *****************************************************
+//
+// rf_wb_wrote
+//     Records that a handle's file was written without its buffer, by an
+//     offset write, so that the durability policy syncs it.
+// input parameters: handle - The handle.
+//                   fd     - Its file, from rf_handle_get(handle).
+//
+// *****************************************************
+void rf_wb_wrote(long handle, int fd)
+{
+	RF_WbEntry_T *e;
+
+	if ((e = rf_wb_find(handle, 1)) == NULL)
+		return;
+
+	e->dirty = 1;
+	pthread_mutex_unlock(&e->lock);
+}
+
+// *****************************************************
+//
+// rf_wb_close
+//     Writes out the buffer of a handle that is being closed, syncs its file
+//     as the durability policy says, and forgets the handle.
+// input parameters: handle  - The handle, already released (rf_handle_release).
+//                   fd      - Its file, still open.
+//                   sync    - Non zero to sync the file whatever the policy.
+//                   durable - If not NULL, set to non zero if everything
+//                             written through the handle is on stable storage.
+// return value: OKAY, or FAILED with errno set if a write through the buffer
+//               or the sync failed.
+//
+// *****************************************************
+int rf_wb_close(long handle, int fd, int sync, int *durable)
+{
+	RF_WbEntry_T *e, **p;
+	int error, dirty;
+
+	/* The handle is released, so the flusher can not get hold of the entry any more. */
+	pthread_mutex_lock(&tableLock);
+	for (p = rf_wb_bucket(handle); (e = *p) != NULL; p = &e->hashNext) {
+		if (e->handle == handle) {
+			*p = e->hashNext;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&tableLock);
+
+	/* Without an entry nothing was written through the handle. */
+	error = 0;
+	dirty = 0;
+	if (e != NULL) {
+		pthread_mutex_lock(&e->lock);
+		rf_wb_drain(e, fd);
+		error = e->error;
+		dirty = e->dirty;
+		if (dirty && (sync || policy == RF_SYNC_CLOSE)) {
+			if (fdatasync(fd) == 0)
+				dirty = 0;
+			else if (error == 0)
+				error = errno;
+		}
+		pthread_mutex_unlock(&e->lock);
+
+		/* Cleared as calloc would, but for the lock and the buffer. */
+		e->handle = 0;
+		e->len = 0;
+		e->room = 0;
+		e->error = 0;
+		e->dirty = 0;
+		e->since = 0;
+		pthread_mutex_lock(&tableLock);
+		if (numSpares < RF_WB_SPARES) {
+			e->hashNext = spare;
+			spare = e;
+			numSpares++;
+			e = NULL;
+		}
+		pthread_mutex_unlock(&tableLock);
+		if (e != NULL) {
+			pthread_mutex_destroy(&e->lock);
+			free(e->buf);
+			free(e);
+		}
+	}
+
+	if (durable != NULL)
+		*durable = (error == 0 && !dirty);
+	if (error != 0) {
+		errno = error;
+		return(FAILED);
+	}
+
+	return(OKAY);
+}
+
+// *****************************************************
+//
+// rf_wb_parse_durability
+//     Parses a durability policy name.
+// input parameters: name - "none", "close" or "periodic".
+// return value: The RF_SYNC_ policy, or FAILED if the name is unknown.
+//
+// *****************************************************
+int rf_wb_parse_durability(char *name)
+{
+	if (strcmp(name, "none") == 0)
+		return(RF_SYNC_NONE);
+	if (strcmp(name, "close") == 0)
+		return(RF_SYNC_CLOSE);
+	if (strcmp(name, "periodic") == 0)
+		return(RF_SYNC_PERIODIC);
+
+	return(FAILED);
+}
@@ -0,0 +1,43 @@
+/* rfwb.h */
+
+/* Server write-behind buffers.
+// rf_writefile writes at the file position, often only a few bytes at a time
+// (at most 64 with version 1). Instead of a write system call each, the bytes
+// written through a handle are gathered in a buffer of that handle and written
+// out together once it is full, so a file written in small pieces goes to the
+// disk in blocks of the buffer size, aligned to multiples of it in the file.
+// Anything else done with the handle -- a read, an offset write, a close --
+// writes the buffer out first, so it always sees the bytes in order. Buffers
+// left alone are written out by a flusher thread after the sync interval.
+// A write that fails once its call has been answered is reported by the next
+// write or the close of the handle.
+//
+// When data reaches stable storage depends on the durability policy:
+//   RF_SYNC_NONE     the kernel writes the data back in its own time;
+//   RF_SYNC_CLOSE    a file written through a handle is synced (fdatasync)
+//                    when the handle is closed;
+//   RF_SYNC_PERIODIC files written to are synced every sync interval.
+// rf_wb_close tells whether everything written through a handle was on stable
+// storage once it returned, for the reply to rf_closesync.
+//
+// Files the stateless path procedures keep open (rffdcache.h) are not
+// buffered and not synced.
+*/
+
+#ifndef RFWB_H
+#define RFWB_H
+
+#include <sys/types.h>
+
+#define RF_WB_DEFAULT_KB 64           /* buffer per handle when the caller has no preference */
+#define RF_WB_DEFAULT_INTERVAL 1000   /* milliseconds between flushes when the caller has no preference */
+
+int     rf_wb_init(long bufBytes, int durability, int intervalMs);
+int     rf_wb_durability(void);
+ssize_t rf_wb_write(long handle, int fd, const char *buf, size_t len);
+void    rf_wb_flush(long handle, int fd);
+void    rf_wb_wrote(long handle, int fd);
+int     rf_wb_close(long handle, int fd, int sync, int *durable);
+int     rf_wb_parse_durability(char *name);
+
+#endif /* RFWB_H */
@@ -0,0 +1,1117 @@
+/* rfxfer.c */
+
+/* This file implements the client transfer engine (see rfxfer.h).
+// Both directions keep up to window calls in flight. A get issues reads at
+// increasing offsets until a short read shows where the file ends; a put reads
+// the local file block by block and issues one write per block. Replies are
+// handled in arrival order, so a slow or retransmitted block never stalls the
+// blocks behind it.
+// A failed transfer sets stats->failure to a short description.
+// rf_xfer_get_file and rf_xfer_put_file use the compound procedures, so small
+// files cost a single round trip, and move the rest of larger files with the
+// stateless rf_readpath/rf_writepath. A server without them gets the
+// open/transfer/close sequence.
+// Stateless blocks go through rf_readsum and rf_writesum where the server has
+// them, so every block is checked against its CRC32C (see rfcrc.h). A range
+// transfer also works out the checksum of its whole range: each block's
+// checksum is moved past the rest of the range and the results XORed, which
+// gives the same value in whatever order the blocks complete.
+// With rf_xfer_compress, stateless blocks go through rf_readz and rf_writez
+// instead, and travel compressed where that makes them smaller (see rfcomp.h).
+// A server without the newer procedures rejects the first call before
+// anything was moved, and the transfer starts again one step down:
+// compressed, checksummed, plain.
+// rf_xfer_sync updates an existing local copy with rf_delta (see rfdelta.h),
+// getting only what changed.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <rpc/rpc.h>
+
+#include "rf.h"
+#include "rfcomp.h"
+#include "rfcrc.h"
+#include "rfdelta.h"
+#include "rfpipe.h"
+#include "rfxfer.h"
+
+#define OKAY 0
+#define FAILED -1
+
+/* Room for the RPC header and the fixed fields of a call or reply. */
+#define RF_XFER_OVERHEAD 512
+
+/* Files up to this size move in one compound call (rf_fetchfile, rf_storefile)
+// instead of an open, one or more transfers and a close.
+*/
+#define RF_XFER_SMALL (64 * 1024)
+
+/* Bytes rf_xfer_sync copies from the old local copy at a time. */
+#define RF_XFER_COPYBUF (1024 * 1024)
+
+/* How stateless blocks travel, from the oldest procedures to the newest. */
+#define RF_XFER_PLAIN 0   /* rf_readpath, rf_writepath */
+#define RF_XFER_SUM   1   /* rf_readsum, rf_writesum */
+#define RF_XFER_ZIP   2   /* rf_readz, rf_writez */
+
+/* Level blocks are compressed at, 0 for none. Set by rf_xfer_compress. */
+static int xferLevel = 0;
+
+
+// *****************************************************
+//
+// rf_xfer_seconds
+//     Reads the monotonic clock.
+// return value: Current time in seconds.
+//
+// *****************************************************
+static double rf_xfer_seconds(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return(ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+// *****************************************************
+//
+// rf_xfer_get_from
+//     Copies a remote file into a local file from an offset to its end.
+// input parameters: clnt      - CLIENT handle talking RFILE_VERS2.
+//                   fd        - Remote handle from rf_openfile_2, opened for reading.
+//                   remote    - Name of the remote file, or NULL. If set, fd is
+//                               not used and the stateless rf_readpath is called.
+//                   mode      - RF_XFER_SUM to call rf_readsum instead of
+//                               rf_readpath and check every block against its
+//                               checksum, RF_XFER_ZIP for rf_readz, which also
+//                               lets the server compress blocks.
+//                   localFd   - Local file descriptor open for writing.
+//                   offset    - Where to start, in both files.
+//                   end       - Where to stop, or -1 to copy up to the end of the
+//                               file. With an end, stats->crc is set to the
+//                               checksum of the range.
+//                   blockSize - Bytes per read call (see rf_xfer_get).
+//                   window    - Largest number of read calls in flight.
+//                   stats     - Filled in with what the transfer did.
+// return value: OKAY if the rest of the file, or of the range, was copied,
+//               FAILED otherwise.
+//
+// *****************************************************
+static int rf_xfer_get_from(CLIENT *clnt, long fd, char *remote, int mode, int localFd, long long offset, long long end, long blockSize, int window, RF_XferStats_T *stats)
+{
+	static const u_long readProc[] = { rf_readpath, rf_readsum, rf_readz };
+	static const xdrproc_t readArgs[] = {
+		(xdrproc_t)xdr_RF_PathReadRequest_T, (xdrproc_t)xdr_RF_PathReadRequest_T, (xdrproc_t)xdr_RF_ZReadRequest_T
+	};
+	RF_Pipe_T *rp;
+	RF_PReadRequest_T req;
+	RF_ZReadRequest_T zReq;
+	RF_PathReadRequest_T *pathReq = &zReq.read;
+	RF_ZReadReply_T zRes;
+	RF_SumReadReply_T *sumRes = &zRes.sum;
+	RF_PReadReply_T *res = &sumRes->read;
+	u_int32_t crc;
+	char *data;
+	char *plain = NULL;      /* decompressed block */
+	u_int callMax = RF_XFER_OVERHEAD + (remote != NULL ? strlen(remote) : 0);
+	long long *slotOffset;   /* offset asked for by the call in each slot */
+	long long nextOffset = offset;
+	long long eof = -1;      /* end of file, -1 until a short read was seen */
+	long want;               /* bytes asked for by a call */
+	int inFlight = 0;
+	int status = OKAY;
+	int slot;
+	u_int len;
+	XDR xdrs;
+
+	memset(stats, 0, sizeof(RF_XferStats_T));
+	stats->seconds = rf_xfer_seconds();
+
+	rp = rf_pipe_create(clnt, RFILE, RFILE_VERS2, window, callMax, blockSize + RF_XFER_OVERHEAD);
+	slotOffset = calloc(window, sizeof(long long));
+	if (mode == RF_XFER_ZIP)
+		plain = malloc(blockSize);
+	if (rp == NULL || slotOffset == NULL || (mode == RF_XFER_ZIP && plain == NULL)) {
+		rf_pipe_destroy(rp);
+		free(slotOffset);
+		free(plain);
+		stats->failure = "out of memory";
+		return(FAILED);
+	}
+
+	memset(&zRes, 0, sizeof(zRes));
+	req.fd = fd;
+	pathReq->filename = remote;
+	zReq.codecs = 1 << RF_CODEC_LZ4;
+
+	for (;;) {
+		/* Keep the window full until the end of the file or range is known.
+		// A server may not have rf_readsum or rf_readz, so only one is sent
+		// until one has come back; an old server is not flooded with calls it
+		// rejects.
+		*/
+		while (status == OKAY && inFlight < (mode != RF_XFER_PLAIN && stats->blocks == 0 ? 1 : window) && eof < 0 && (end < 0 || nextOffset < end)) {
+			slot = rf_pipe_free_slot(rp);
+			want = (end >= 0 && end - nextOffset < blockSize) ? end - nextOffset : blockSize;
+			req.offset = pathReq->offset = nextOffset;
+			req.bytesToRead = pathReq->bytesToRead = want;
+			if ((remote != NULL ?
+			     rf_pipe_call(rp, slot, readProc[mode], readArgs[mode], mode == RF_XFER_ZIP ? (void *)&zReq : (void *)pathReq) :
+			     rf_pipe_call(rp, slot, rf_preadfile, (xdrproc_t)xdr_RF_PReadRequest_T, &req)) != OKAY) {
+				stats->failure = "cannot send read call";
+				status = FAILED;
+				break;
+			}
+			slotOffset[slot] = nextOffset;
+			nextOffset += want;
+			inFlight++;
+		}
+		if (inFlight == 0)
+			break;
+
+		/* A failed pipe can not be drained; give up on everything in flight. */
+		if ((slot = rf_pipe_wait(rp, &xdrs)) < 0) {
+			stats->rpcError = rf_pipe_error(rp);
+			stats->failure = "read call failed";
+			status = FAILED;
+			break;
+		}
+		inFlight--;
+
+		if (!(mode == RF_XFER_ZIP ? xdr_RF_ZReadReply_T(&xdrs, &zRes) :
+		      mode == RF_XFER_SUM ? xdr_RF_SumReadReply_T(&xdrs, sumRes) : xdr_RF_PReadReply_T(&xdrs, res)) ||
+		    res->readStatus != OKAY || res->offset != slotOffset[slot]) {
+			xdr_free((xdrproc_t)xdr_RF_ZReadReply_T, (char *)&zRes);
+			stats->failure = "server read failed";
+			status = FAILED;
+			continue;
+		}
+
+		data = res->data.RF_Data_T_val;
+		len = res->data.RF_Data_T_len;
+		stats->wire += len;
+		if (mode == RF_XFER_ZIP && zRes.codec != RF_CODEC_NONE) {
+			if (zRes.codec != RF_CODEC_LZ4 || zRes.length > blockSize ||
+			    rf_comp_unpack(data, len, plain, zRes.length) != zRes.length) {
+				xdr_free((xdrproc_t)xdr_RF_ZReadReply_T, (char *)&zRes);
+				stats->failure = "bad compressed block";
+				status = FAILED;
+				continue;
+			}
+			data = plain;
+			len = zRes.length;
+		}
+		crc = rf_crc32c(0, data, len);
+		if (mode != RF_XFER_PLAIN && crc != sumRes->crc) {
+			xdr_free((xdrproc_t)xdr_RF_ZReadReply_T, (char *)&zRes);
+			stats->failure = "block checksum mismatch";
+			status = FAILED;
+			continue;
+		}
+		if (len > 0 && pwrite(localFd, data, len, res->offset) != len) {
+			stats->failure = "local write failed";
+			status = FAILED;
+		}
+		want = (end >= 0 && end - res->offset < blockSize) ? end - res->offset : blockSize;
+		if (len < want && (eof < 0 || res->offset + len < eof))
+			eof = res->offset + len;
+		if (end >= 0)
+			stats->crc ^= rf_crc32c_shift(crc, end - (res->offset + len));
+		stats->bytes += len;
+		stats->blocks++;
+		xdr_free((xdrproc_t)xdr_RF_ZReadReply_T, (char *)&zRes);
+	}
+
+	stats->retransmits = rf_pipe_retransmits(rp);
+	stats->seconds = rf_xfer_seconds() - stats->seconds;
+	rf_pipe_destroy(rp);
+	free(slotOffset);
+	free(plain);
+
+	return(status);
+}
+
+// *****************************************************
+//
+// rf_xfer_get
+//     Copies a remote file into a local file.
+// input parameters: clnt      - CLIENT handle talking RFILE_VERS2.
+//                   fd        - Remote handle from rf_openfile_2, opened for reading.
+//                   localFd   - Local file descriptor open for writing.
+//                   blockSize - Bytes per read call. Must not exceed the maxBlock
+//                               returned by rf_openfile_2, or the server's clamped
+//                               replies look like end of file.
+//                   window    - Largest number of read calls in flight.
+//                   stats     - Filled in with what the transfer did.
+// return value: OKAY if the whole file was copied, FAILED otherwise.
+//
+// *****************************************************
+int rf_xfer_get(CLIENT *clnt, long fd, int localFd, long blockSize, int window, RF_XferStats_T *stats)
+{
+	return(rf_xfer_get_from(clnt, fd, NULL, RF_XFER_PLAIN, localFd, 0, -1, blockSize, window, stats));
+}
+
+// *****************************************************
+//
+// rf_xfer_put_from
+//     Copies a local file into a remote file from an offset to its end.
+// input parameters: clnt      - CLIENT handle talking RFILE_VERS2.
+//                   fd        - Remote handle from rf_openfile_2, opened for writing.
+//                   remote    - Name of the remote file, or NULL. If set, fd is
+//                               not used and the stateless rf_writepath is called.
+//                   mode      - RF_XFER_SUM to call rf_writesum instead of
+//                               rf_writepath, so the server checks every block,
+//                               RF_XFER_ZIP for rf_writez, which also sends
+//                               blocks compressed where that makes them smaller.
+//                   localFd   - Local file descriptor open for reading.
+//                   offset    - Where to start, in both files.
+//                   end       - Where to stop, or -1 to copy up to the end of the
+//                               file. With an end, stats->crc is set to the
+//                               checksum of the range.
+//                   blockSize - Bytes per write call (see rf_xfer_put).
+//                   window    - Largest number of write calls in flight.
+//                   stats     - Filled in with what the transfer did.
+// return value: OKAY if the rest of the file, or of the range, was copied,
+//               FAILED otherwise.
+//
+// *****************************************************
+static int rf_xfer_put_from(CLIENT *clnt, long fd, char *remote, int mode, int localFd, long long offset, long long end, long blockSize, int window, RF_XferStats_T *stats)
+{
+	static const u_long writeProc[] = { rf_writepath, rf_writesum, rf_writez };
+	static const xdrproc_t writeArgs[] = {
+		(xdrproc_t)xdr_RF_PathWriteRequest_T, (xdrproc_t)xdr_RF_SumWriteRequest_T, (xdrproc_t)xdr_RF_ZWriteRequest_T
+	};
+	RF_Pipe_T *rp;
+	RF_PWriteRequest_T req;
+	RF_ZWriteRequest_T zReq;
+	RF_SumWriteRequest_T *sumReq = &zReq.sum;
+	RF_PathWriteRequest_T *pathReq = &sumReq->write;
+	RF_PWriteReply_T res;
+	u_int callMax = blockSize + RF_XFER_OVERHEAD + (remote != NULL ? strlen(remote) : 0);
+	long long *slotOffset;   /* offset written by the call in each slot */
+	u_int *slotLen;          /* bytes written by the call in each slot */
+	u_int *slotWire;         /* bytes the call in each slot carried */
+	char *buf;
+	char *zbuf = NULL;       /* compressed block */
+	long packed;
+	int localEof = 0;
+	int inFlight = 0;
+	int status = OKAY;
+	int slot;
+	ssize_t n;
+	XDR xdrs;
+
+	memset(stats, 0, sizeof(RF_XferStats_T));
+	stats->seconds = rf_xfer_seconds();
+
+	rp = rf_pipe_create(clnt, RFILE, RFILE_VERS2, window, callMax, RF_XFER_OVERHEAD);
+	slotOffset = calloc(window, sizeof(long long));
+	slotLen = calloc(window, sizeof(u_int));
+	slotWire = calloc(window, sizeof(u_int));
+	buf = malloc(blockSize);
+	if (mode == RF_XFER_ZIP)
+		zbuf = malloc(blockSize);
+	if (rp == NULL || slotOffset == NULL || slotLen == NULL || slotWire == NULL || buf == NULL ||
+	    (mode == RF_XFER_ZIP && zbuf == NULL)) {
+		rf_pipe_destroy(rp);
+		free(slotOffset);
+		free(slotLen);
+		free(slotWire);
+		free(buf);
+		free(zbuf);
+		stats->failure = "out of memory";
+		return(FAILED);
+	}
+
+	req.fd = fd;
+	req.data.RF_Data_T_val = buf;
+	pathReq->filename = remote;
+
+	for (;;) {
+		/* Keep the window full until the local file is used up. The block is
+		// encoded into the slot by rf_pipe_call, so buf can be refilled at once.
+		// As with rf_readsum, one rf_writesum or rf_writez goes out alone first.
+		*/
+		while (status == OKAY && inFlight < (mode != RF_XFER_PLAIN && stats->blocks == 0 ? 1 : window) && !localEof) {
+			n = (end >= 0 && end - offset < blockSize) ? end - offset : blockSize;
+			if (n <= 0 || (n = pread(localFd, buf, n, offset)) <= 0) {
+				if (n < 0) {
+					stats->failure = "local read failed";
+					status = FAILED;
+				}
+				localEof = 1;
+				break;
+			}
+			slot = rf_pipe_free_slot(rp);
+			req.offset = pathReq->offset = offset;
+			req.data.RF_Data_T_len = pathReq->data.RF_Data_T_len = n;
+			pathReq->data.RF_Data_T_val = buf;
+			sumReq->crc = rf_crc32c(0, buf, n);
+			zReq.codec = RF_CODEC_NONE;
+			zReq.length = n;
+			if (mode == RF_XFER_ZIP && (packed = rf_comp_pack(buf, n, zbuf, xferLevel)) > 0) {
+				pathReq->data.RF_Data_T_val = zbuf;
+				pathReq->data.RF_Data_T_len = packed;
+				zReq.codec = RF_CODEC_LZ4;
+			}
+			if ((remote != NULL ?
+			     rf_pipe_call(rp, slot, writeProc[mode], writeArgs[mode],
+			                  mode == RF_XFER_ZIP ? (void *)&zReq : mode == RF_XFER_SUM ? (void *)sumReq : (void *)pathReq) :
+			     rf_pipe_call(rp, slot, rf_pwritefile, (xdrproc_t)xdr_RF_PWriteRequest_T, &req)) != OKAY) {
+				stats->failure = "cannot send write call";
+				status = FAILED;
+				break;
+			}
+			slotOffset[slot] = offset;
+			slotLen[slot] = n;
+			slotWire[slot] = pathReq->data.RF_Data_T_len;
+			if (end >= 0)
+				stats->crc ^= rf_crc32c_shift(sumReq->crc, end - (offset + n));
+			offset += n;
+			inFlight++;
+		}
+		if (inFlight == 0)
+			break;
+
+		if ((slot = rf_pipe_wait(rp, &xdrs)) < 0) {
+			stats->rpcError = rf_pipe_error(rp);
+			stats->failure = "write call failed";
+			status = FAILED;
+			break;
+		}
+		inFlight--;
+
+		if (!xdr_RF_PWriteReply_T(&xdrs, &res) || res.writeStatus != OKAY ||
+		    res.offset != slotOffset[slot] || res.bytesWritten != slotLen[slot]) {
+			stats->failure = "server write failed";
+			status = FAILED;
+			continue;
+		}
+		stats->bytes += slotLen[slot];
+		stats->wire += slotWire[slot];
+		stats->blocks++;
+	}
+
+	stats->retransmits = rf_pipe_retransmits(rp);
+	stats->seconds = rf_xfer_seconds() - stats->seconds;
+	rf_pipe_destroy(rp);
+	free(slotOffset);
+	free(slotLen);
+	free(slotWire);
+	free(buf);
+	free(zbuf);
+
+	return(status);
+}
+
+// *****************************************************
+//
+// rf_xfer_put
+//     Copies a local file into a remote file.
+// input parameters: clnt      - CLIENT handle talking RFILE_VERS2.
+//                   fd        - Remote handle from rf_openfile_2, opened for writing.
+//                   localFd   - Local file descriptor open for reading.
+//                   blockSize - Bytes per write call, at most the maxBlock returned
+//                               by rf_openfile_2.
+//                   window    - Largest number of write calls in flight.
+//                   stats     - Filled in with what the transfer did.
+// return value: OKAY if the whole file was copied, FAILED otherwise.
+//
+// *****************************************************
+int rf_xfer_put(CLIENT *clnt, long fd, int localFd, long blockSize, int window, RF_XferStats_T *stats)
+{
+	return(rf_xfer_put_from(clnt, fd, NULL, RF_XFER_PLAIN, localFd, 0, -1, blockSize, window, stats));
+}
+
+// *****************************************************
+//
+// rf_xfer_get_path
+//     Copies part of a remote file without a remote handle, with rf_readz if
+//     compression is on, else with rf_readsum, falling back to the older
+//     procedures the server has.
+// input parameters: As for rf_xfer_get_from.
+// return value: As for rf_xfer_get_from.
+//
+// *****************************************************
+static int rf_xfer_get_path(CLIENT *clnt, char *remote, int localFd, long long offset, long long end, long blockSize, int window, RF_XferStats_T *stats)
+{
+	int mode = xferLevel > 0 ? RF_XFER_ZIP : RF_XFER_SUM;
+	int status;
+
+	/* An older server rejects the first read before anything was written. */
+	status = rf_xfer_get_from(clnt, FAILED, remote, mode, localFd, offset, end, blockSize, window, stats);
+	while (status == FAILED && stats->rpcError == RPC_PROCUNAVAIL && stats->bytes == 0 && mode > RF_XFER_PLAIN)
+		status = rf_xfer_get_from(clnt, FAILED, remote, --mode, localFd, offset, end, blockSize, window, stats);
+
+	return(status);
+}
+
+// *****************************************************
+//
+// rf_xfer_put_path
+//     Copies part of a local file without a remote handle, with rf_writez if
+//     compression is on, else with rf_writesum, falling back to the older
+//     procedures the server has.
+// input parameters: As for rf_xfer_put_from.
+// return value: As for rf_xfer_put_from.
+//
+// *****************************************************
+static int rf_xfer_put_path(CLIENT *clnt, int localFd, char *remote, long long offset, long long end, long blockSize, int window, RF_XferStats_T *stats)
+{
+	int mode = xferLevel > 0 ? RF_XFER_ZIP : RF_XFER_SUM;
+	int status;
+
+	status = rf_xfer_put_from(clnt, FAILED, remote, mode, localFd, offset, end, blockSize, window, stats);
+	while (status == FAILED && stats->rpcError == RPC_PROCUNAVAIL && stats->bytes == 0 && mode > RF_XFER_PLAIN)
+		status = rf_xfer_put_from(clnt, FAILED, remote, --mode, localFd, offset, end, blockSize, window, stats);
+
+	return(status);
+}
+
+// *****************************************************
+//
+// rf_xfer_get_range
+//     Copies a byte range of a remote file to the same place in a local file,
+//     with the stateless rf_readsum or rf_readpath. The range ends early at the
+//     end of the file.
+// input parameters: clnt      - CLIENT handle talking RFILE_VERS2.
+//                   remote    - Name of the file on the server.
+//                   localFd   - Local file descriptor open for writing.
+//                   offset    - Start of the range.
+//                   length    - Bytes in the range.
+//                   blockSize - Bytes per read call, at most the maxBlock of clnt.
+//                   window    - Largest number of read calls in flight.
+//                   stats     - Filled in with what the transfer did; crc is
+//                               the CRC32C of the range.
+// return value: OKAY if the range was copied, FAILED otherwise.
+//
+// *****************************************************
+int rf_xfer_get_range(CLIENT *clnt, char *remote, int localFd, long long offset, long long length, long blockSize, int window, RF_XferStats_T *stats)
+{
+	return(rf_xfer_get_path(clnt, remote, localFd, offset, offset + length, blockSize, window, stats));
+}
+
+// *****************************************************
+//
+// rf_xfer_put_range
+//     Copies a byte range of a local file to the same place in a remote file,
+//     with the stateless rf_writesum or rf_writepath. The remote file is
+//     neither created nor truncated first.
+// input parameters: clnt      - CLIENT handle talking RFILE_VERS2.
+//                   localFd   - Local file descriptor open for reading.
+//                   remote    - Name of the file on the server.
+//                   offset    - Start of the range.
+//                   length    - Bytes in the range.
+//                   blockSize - Bytes per write call, at most the maxBlock of clnt.
+//                   window    - Largest number of write calls in flight.
+//                   stats     - Filled in with what the transfer did; crc is
+//                               the CRC32C of the range.
+// return value: OKAY if the range was copied, FAILED otherwise.
+//
+// *****************************************************
+int rf_xfer_put_range(CLIENT *clnt, int localFd, char *remote, long long offset, long long length, long blockSize, int window, RF_XferStats_T *stats)
+{
+	return(rf_xfer_put_path(clnt, localFd, remote, offset, offset + length, blockSize, window, stats));
+}
+
+// *****************************************************
+//
+// rf_xfer_compress
+//     Turns compression of stateless blocks on or off for every transfer that
+//     starts afterwards. Call it before starting any.
+// input parameters: level - Level the client compresses written blocks at,
+//                           1 to RF_COMP_MAXLEVEL (see rfcomp.h); 0 turns
+//                           compression off both ways.
+//
+// *****************************************************
+void rf_xfer_compress(int level)
+{
+	xferLevel = (level > RF_COMP_MAXLEVEL) ? RF_COMP_MAXLEVEL : level;
+}
+
+// *****************************************************
+//
+// rf_xfer_digest
+//     Asks the server for the CRC32C of a whole file with rf_digest.
+// input parameters: clnt   - CLIENT handle talking RFILE_VERS2.
+//                   remote - Name of the file on the server.
+//                   crc    - Set to the checksum of the file.
+//                   size   - Set to the size of the file.
+//                   stats  - failure and rpcError are set if the call failed.
+// return value: OKAY, FAILED, or RF_XFER_UNSUPPORTED if the server has not
+//               got rf_digest.
+//
+// *****************************************************
+int rf_xfer_digest(CLIENT *clnt, char *remote, u_int32_t *crc, long long *size, RF_XferStats_T *stats)
+{
+	RF_DigestRequest_T req;
+	RF_DigestReply_T res;
+	enum clnt_stat rpcError;
+
+	req.filename = remote;
+	req.offset = 0;
+	req.length = -1;
+	if ((rpcError = rf_digest_2(&req, &res, clnt)) == RPC_PROCUNAVAIL)
+		return(RF_XFER_UNSUPPORTED);
+	if (rpcError != RPC_SUCCESS) {
+		stats->rpcError = rpcError;
+		stats->failure = "digest call failed";
+		return(FAILED);
+	}
+	if (res.digestStatus != OKAY || res.bytes != res.fileSize) {
+		stats->failure = "cannot checksum remote file";
+		return(FAILED);
+	}
+
+	*crc = res.crc;
+	*size = res.fileSize;
+
+	return(OKAY);
+}
+
+// *****************************************************
+//
+// rf_xfer_open
+//     Opens a remote file with rf_openfile_2 and works out the block size.
+// input parameters: clnt      - CLIENT handle talking RFILE_VERS2.
+//                   remote    - Name of the file on the server.
+//                   mode      - fopen style mode.
+//                   maxBlock  - Largest block the client handle can carry.
+//                   blockSize - Set to the block size to use with the handle.
+//                   stats     - failure and rpcError are set if the open failed.
+// return value: The remote handle, or FAILED.
+//
+// *****************************************************
+static long rf_xfer_open(CLIENT *clnt, char *remote, char *mode, long maxBlock, long *blockSize, RF_XferStats_T *stats)
+{
+	RF_OpenFile2Request_T req;
+	RF_OpenFile2Reply_T res;
+
+	req.filename = remote;
+	req.mode = mode;
+	if ((stats->rpcError = rf_openfile_2(&req, &res, clnt)) != RPC_SUCCESS) {
+		stats->failure = "open call failed";
+		return(FAILED);
+	}
+	if (res.openStatus != OKAY) {
+		stats->failure = "cannot open remote file";
+		return(FAILED);
+	}
+
+	*blockSize = (res.maxBlock < maxBlock) ? res.maxBlock : maxBlock;
+
+	return(res.fd);
+}
+
+// *****************************************************
+//
+// rf_xfer_close
+//     Closes a remote file opened by rf_xfer_open.
+// input parameters: clnt  - CLIENT handle the file was opened on.
+//                   fd    - The remote handle.
+//                   stats - failure and rpcError are set if the close failed
+//                           and nothing failed before.
+// return value: OKAY or FAILED.
+//
+// *****************************************************
+static int rf_xfer_close(CLIENT *clnt, long fd, RF_XferStats_T *stats)
+{
+	RF_CloseFileRequest_T req;
+	RF_CloseFileReply_T res;
+	enum clnt_stat rpcError;
+
+	req.fd = fd;
+	if ((rpcError = rf_closefile_2(&req, &res, clnt)) != RPC_SUCCESS || res.closeStatus != OKAY) {
+		if (stats->failure == NULL) {
+			stats->rpcError = rpcError;
+			stats->failure = "cannot close remote file";
+		}
+		return(FAILED);
+	}
+
+	return(OKAY);
+}
+
+// *****************************************************
+//
+// rf_xfer_get_file
+//     Copies a remote file into a local file, opening and closing both.
+//     The local file is created or truncated. The first RF_XFER_SMALL bytes
+//     come in one rf_fetchfile call, and the rest of a larger file through
+//     stateless rf_readpath calls, so the server holds no handle for it. An
+//     older server without these procedures gets rf_openfile and a handle.
+// input parameters: clnt     - CLIENT handle talking RFILE_VERS2.
+//                   remote   - Name of the file on the server.
+//                   local    - Name of the local file.
+//                   maxBlock - Largest block the client handle can carry (see rf_connect).
+//                   window   - Largest number of read calls in flight.
+//                   stats    - Filled in with what the transfer did.
+// return value: OKAY if the whole file was copied, FAILED otherwise.
+//
+// *****************************************************
+int rf_xfer_get_file(CLIENT *clnt, char *remote, char *local, long maxBlock, int window, RF_XferStats_T *stats)
+{
+	RF_FetchRequest_T req;
+	RF_FetchReply_T res;
+	enum clnt_stat rpcError;
+	double seconds = rf_xfer_seconds();
+	long long got = 0, size = 0;
+	long fd = FAILED, blockSize;
+	int localFd;
+	int status = OKAY;
+
+	memset(stats, 0, sizeof(RF_XferStats_T));
+	memset(&res, 0, sizeof(res));
+
+	req.filename = remote;
+	req.maxBytes = (maxBlock < RF_XFER_SMALL) ? maxBlock : RF_XFER_SMALL;
+	if ((rpcError = rf_fetchfile_2(&req, &res, clnt)) == RPC_SUCCESS) {
+		if (res.fetchStatus != OKAY) {
+			stats->failure = "cannot open remote file";
+			xdr_free((xdrproc_t)xdr_RF_FetchReply_T, (char *)&res);
+			return(FAILED);
+		}
+		got = res.data.RF_Data_T_len;
+		size = res.fileSize;
+	} else if (rpcError != RPC_PROCUNAVAIL) {
+		stats->rpcError = rpcError;
+		stats->failure = "fetch call failed";
+		return(FAILED);
+	}
+
+	/* A server without rf_fetchfile gets the whole file through a handle. The
+	// remote file is opened first, so a missing one leaves no empty local file.
+	*/
+	if (rpcError != RPC_SUCCESS && (fd = rf_xfer_open(clnt, remote, "r", maxBlock, &blockSize, stats)) == FAILED)
+		return(FAILED);
+	if ((localFd = open(local, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0) {
+		stats->failure = "cannot open local file";
+		if (fd != FAILED)
+			rf_xfer_close(clnt, fd, stats);
+		xdr_free((xdrproc_t)xdr_RF_FetchReply_T, (char *)&res);
+		return(FAILED);
+	}
+
+	if (got > 0 && write(localFd, res.data.RF_Data_T_val, got) != got) {
+		stats->failure = "local write failed";
+		status = FAILED;
+	}
+	xdr_free((xdrproc_t)xdr_RF_FetchReply_T, (char *)&res);
+
+	/* The rest of a large file. A server that has rf_fetchfile but not
+	// rf_readpath rejects the first read before anything was written.
+	*/
+	if (status == OKAY && fd == FAILED && size > got) {
+		status = rf_xfer_get_path(clnt, remote, localFd, got, -1, maxBlock, window, stats);
+		if (status == FAILED && stats->rpcError == RPC_PROCUNAVAIL && stats->bytes == 0) {
+			if ((fd = rf_xfer_open(clnt, remote, "r", maxBlock, &blockSize, stats)) != FAILED)
+				status = OKAY;
+		}
+	}
+	if (fd != FAILED) {
+		if (status == OKAY)
+			status = rf_xfer_get_from(clnt, fd, NULL, RF_XFER_PLAIN, localFd, got, -1, blockSize, window, stats);
+		if (rf_xfer_close(clnt, fd, stats) != OKAY)
+			status = FAILED;
+	}
+	if (close(localFd) != 0 && status == OKAY) {
+		stats->failure = "cannot close local file";
+		status = FAILED;
+	}
+
+	if (rpcError == RPC_SUCCESS) {
+		stats->bytes += got;
+		stats->wire += got;
+		stats->blocks++;
+	}
+	stats->seconds = rf_xfer_seconds() - seconds;
+
+	return(status);
+}
+
+// *****************************************************
+//
+// rf_xfer_put_stateless
+//     Copies a local regular file into a remote file without a remote handle:
+//     its first block goes in a rf_storefile call, which also creates or
+//     truncates the remote file, and the rest in rf_writepath calls.
+// input parameters: clnt     - CLIENT handle talking RFILE_VERS2.
+//                   localFd  - Local file descriptor open for reading.
+//                   size     - Size of the local file.
+//                   remote   - Name of the file on the server.
+//                   maxBlock - Largest block the client handle can carry.
+//                   window   - Largest number of write calls in flight.
+//                   stats    - Filled in with what the transfer did.
+// return value: OKAY if the whole file was copied, FAILED otherwise, or
+//               RF_XFER_UNSUPPORTED if the server has not got the procedures
+//               and nothing was written.
+//
+// *****************************************************
+static int rf_xfer_put_stateless(CLIENT *clnt, int localFd, long long size, char *remote, long maxBlock, int window, RF_XferStats_T *stats)
+{
+	RF_StoreRequest_T req;
+	RF_StoreReply_T res;
+	RF_XferStats_T rest;
+	enum clnt_stat rpcError;
+	long first = (maxBlock < RF_XFER_SMALL) ? maxBlock : RF_XFER_SMALL;
+	int status;
+
+	if (first > size)
+		first = size;
+	if ((req.data.RF_Data_T_val = malloc(first > 0 ? first : 1)) == NULL) {
+		stats->failure = "out of memory";
+		return(FAILED);
+	}
+	if (pread(localFd, req.data.RF_Data_T_val, first, 0) != first) {
+		free(req.data.RF_Data_T_val);
+		stats->failure = "local read failed";
+		return(FAILED);
+	}
+
+	req.filename = remote;
+	req.mode = "w";
+	req.data.RF_Data_T_len = first;
+	rpcError = rf_storefile_2(&req, &res, clnt);
+	free(req.data.RF_Data_T_val);
+	if (rpcError == RPC_PROCUNAVAIL)
+		return(RF_XFER_UNSUPPORTED);
+	if (rpcError != RPC_SUCCESS) {
+		stats->rpcError = rpcError;
+		stats->failure = "store call failed";
+		return(FAILED);
+	}
+	if (res.storeStatus != OKAY) {
+		stats->failure = "server write failed";
+		return(FAILED);
+	}
+	stats->bytes = first;
+	stats->wire = first;
+	stats->blocks = 1;
+	if (size == first)
+		return(OKAY);
+
+	status = rf_xfer_put_path(clnt, localFd, remote, first, -1, maxBlock, window, &rest);
+	if (status == FAILED && rest.rpcError == RPC_PROCUNAVAIL && rest.bytes == 0)
+		return(RF_XFER_UNSUPPORTED);
+	stats->bytes += rest.bytes;
+	stats->wire += rest.wire;
+	stats->blocks += rest.blocks;
+	stats->retransmits = rest.retransmits;
+	stats->rpcError = rest.rpcError;
+	stats->failure = rest.failure;
+
+	return(status);
+}
+
+// *****************************************************
+//
+// rf_xfer_put_file
+//     Copies a local file into a remote file, opening and closing both.
+//     The remote file is created or truncated. A regular file is sent without
+//     a remote handle (see rf_xfer_put_stateless), a file of at most
+//     RF_XFER_SMALL bytes in a single call. Other local files, or an older
+//     server, get rf_openfile and a handle.
+// input parameters: clnt     - CLIENT handle talking RFILE_VERS2.
+//                   local    - Name of the local file.
+//                   remote   - Name of the file on the server.
+//                   maxBlock - Largest block the client handle can carry (see rf_connect).
+//                   window   - Largest number of write calls in flight.
+//                   stats    - Filled in with what the transfer did.
+// return value: OKAY if the whole file was copied, FAILED otherwise.
+//
+// *****************************************************
+int rf_xfer_put_file(CLIENT *clnt, char *local, char *remote, long maxBlock, int window, RF_XferStats_T *stats)
+{
+	struct stat st;
+	double seconds = rf_xfer_seconds();
+	long fd, blockSize;
+	int localFd;
+	int status;
+
+	memset(stats, 0, sizeof(RF_XferStats_T));
+
+	if ((localFd = open(local, O_RDONLY)) < 0) {
+		stats->failure = "cannot open local file";
+		return(FAILED);
+	}
+
+	if (fstat(localFd, &st) == 0 && S_ISREG(st.st_mode) &&
+	    (status = rf_xfer_put_stateless(clnt, localFd, st.st_size, remote, maxBlock, window, stats)) != RF_XFER_UNSUPPORTED) {
+		close(localFd);
+		stats->seconds = rf_xfer_seconds() - seconds;
+		return(status);
+	}
+
+	memset(stats, 0, sizeof(RF_XferStats_T));
+	if ((fd = rf_xfer_open(clnt, remote, "w", maxBlock, &blockSize, stats)) == FAILED) {
+		close(localFd);
+		return(FAILED);
+	}
+
+	status = rf_xfer_put(clnt, fd, localFd, blockSize, window, stats);
+	if (rf_xfer_close(clnt, fd, stats) != OKAY)
+		status = FAILED;
+	close(localFd);
+
+	return(status);
+}
+
+// *****************************************************
+//
+// rf_xfer_sync_whole
+//     Gets a whole file for rf_xfer_sync, when no delta can be used.
+// input parameters: As for rf_xfer_sync.
+// return value: As for rf_xfer_get_file.
+//
+// *****************************************************
+static int rf_xfer_sync_whole(CLIENT *clnt, char *remote, char *local, long maxBlock, int window, RF_XferStats_T *stats)
+{
+	int status = rf_xfer_get_file(clnt, remote, local, maxBlock, window, stats);
+
+	stats->literal = stats->bytes;
+
+	return(status);
+}
+
+// *****************************************************
+//
+// rf_xfer_sync
+//     Brings a local copy of a remote file up to date with rf_delta, so that
+//     only the parts the local copy does not already have are sent. The new
+//     copy is built next to the old one and renamed over it once its checksum
+//     matches that of the remote file. Without a local copy, against a server
+//     without rf_delta, or if the checksums differ, the whole file is copied
+//     with rf_xfer_get_file instead.
+// input parameters: clnt     - CLIENT handle talking RFILE_VERS2.
+//                   remote   - Name of the file on the server.
+//                   local    - Name of the local copy.
+//                   maxBlock - Largest block the client handle can carry.
+//                   window   - Largest number of read calls in flight, for a whole copy.
+//                   stats    - Filled in with what the transfer did; bytes is the
+//                              size of the file and literal the part of it sent.
+// return value: OKAY if the local copy is up to date, FAILED otherwise.
+//
+// *****************************************************
+int rf_xfer_sync(CLIENT *clnt, char *remote, char *local, long maxBlock, int window, RF_XferStats_T *stats)
+{
+	RF_DeltaRequest_T req;
+	RF_DeltaReply_T res;
+	RF_DeltaOp_T *op;
+	RF_BlockSig_T *sigs;
+	enum clnt_stat rpcError;
+	struct stat st;
+	double seconds = rf_xfer_seconds();
+	char temp[RF_MAXPATHLEN + 16];
+	char *copyBuf;
+	long long numBlocks, first, from, offset = 0, fileSize = 1;
+	long long drift = 0;   /* how far the remote file has moved the last block found */
+	u_int32_t localCrc = 0, remoteCrc = 0;
+	long blockSize, len;
+	u_int used;
+	int oldFd, newFd = -1;
+	int status = OKAY;
+
+	memset(stats, 0, sizeof(RF_XferStats_T));
+
+	if ((oldFd = open(local, O_RDONLY)) < 0)
+		return(rf_xfer_sync_whole(clnt, remote, local, maxBlock, window, stats));
+	if (fstat(oldFd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0 ||
+	    snprintf(temp, sizeof(temp), "%s.rfdelta", local) >= sizeof(temp)) {
+		close(oldFd);
+		return(rf_xfer_sync_whole(clnt, remote, local, maxBlock, window, stats));
+	}
+
+	blockSize = rf_delta_block_size(st.st_size);
+	numBlocks = (st.st_size + blockSize - 1) / blockSize;
+	sigs = malloc(numBlocks * sizeof(RF_BlockSig_T));
+	copyBuf = malloc(RF_XFER_COPYBUF);
+	if (sigs == NULL || copyBuf == NULL) {
+		stats->failure = "out of memory";
+		status = FAILED;
+	} else if (rf_delta_sign(oldFd, st.st_size, blockSize, sigs) != OKAY) {
+		stats->failure = "local read failed";
+		status = FAILED;
+	} else if ((newFd = open(temp, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0) {
+		stats->failure = "cannot open local file";
+		status = FAILED;
+	}
+
+	req.filename = remote;
+	req.length = (long long)RF_MAXDELTASIGS / 2 * blockSize;
+	req.maxBytes = maxBlock;
+	req.blockSize = blockSize;
+	req.localSize = st.st_size;
+
+	while (status == OKAY && offset < fileSize) {
+		/* Send the signatures of the blocks around where the local copy should
+		// have the data, allowing for what was inserted or removed before it.
+		*/
+		first = (offset - drift) / blockSize - RF_MAXDELTASIGS / 4;
+		if (first > numBlocks - RF_MAXDELTASIGS)
+			first = numBlocks - RF_MAXDELTASIGS;
+		if (first < 0)
+			first = 0;
+		req.offset = offset;
+		req.firstBlock = first;
+		req.sigs.sigs_len = (numBlocks - first < RF_MAXDELTASIGS) ? numBlocks - first : RF_MAXDELTASIGS;
+		req.sigs.sigs_val = sigs + first;
+
+		memset(&res, 0, sizeof(res));
+		if ((rpcError = rf_delta_2(&req, &res, clnt)) != RPC_SUCCESS) {
+			stats->rpcError = rpcError;
+			stats->failure = "delta call failed";
+			status = FAILED;
+			break;
+		}
+		if (res.deltaStatus != OKAY) {
+			stats->failure = "cannot read remote file";
+			status = FAILED;
+		}
+
+		/* Runs of old blocks are copied from the old copy, literal runs from the reply. */
+		used = 0;
+		from = offset;
+		for (u_int i = 0; status == OKAY && i < res.ops.ops_len; i++) {
+			op = &res.ops.ops_val[i];
+			if (op->block < 0) {
+				if (op->length > res.data.RF_Data_T_len - used) {
+					stats->failure = "bad delta reply";
+					status = FAILED;
+				} else if (pwrite(newFd, res.data.RF_Data_T_val + used, op->length, from) != op->length) {
+					stats->failure = "local write failed";
+					status = FAILED;
+				} else {
+					localCrc = rf_crc32c(localCrc, res.data.RF_Data_T_val + used, op->length);
+					used += op->length;
+					stats->literal += op->length;
+				}
+			} else {
+				for (long long done = 0; status == OKAY && done < op->length; done += len) {
+					len = (op->length - done < RF_XFER_COPYBUF) ? op->length - done : RF_XFER_COPYBUF;
+					if (pread(oldFd, copyBuf, len, op->block * blockSize + done) != len ||
+					    pwrite(newFd, copyBuf, len, from + done) != len) {
+						stats->failure = "local copy failed";
+						status = FAILED;
+					} else {
+						localCrc = rf_crc32c(localCrc, copyBuf, len);
+					}
+				}
+				drift = from - op->block * blockSize;
+			}
+			from += op->length;
+		}
+		if (status == OKAY && (from != res.nextOffset || used != res.data.RF_Data_T_len ||
+		                       (res.nextOffset <= offset && offset < res.fileSize))) {
+			stats->failure = "bad delta reply";
+			status = FAILED;
+		}
+		remoteCrc = rf_crc32c_combine(remoteCrc, res.crc, res.nextOffset - offset);
+		offset = res.nextOffset;
+		fileSize = res.fileSize;
+		stats->blocks++;
+		xdr_free((xdrproc_t)xdr_RF_DeltaReply_T, (char *)&res);
+	}
+
+	close(oldFd);
+	if (newFd >= 0 && close(newFd) != 0 && status == OKAY) {
+		stats->failure = "cannot close local file";
+		status = FAILED;
+	}
+	free(sigs);
+	free(copyBuf);
+
+	/* An old server, or two blocks that only look the same: copy it all. */
+	if ((status == FAILED && stats->rpcError == RPC_PROCUNAVAIL && stats->blocks == 0) ||
+	    (status == OKAY && localCrc != remoteCrc)) {
+		unlink(temp);
+		return(rf_xfer_sync_whole(clnt, remote, local, maxBlock, window, stats));
+	}
+	if (status == OKAY && rename(temp, local) != 0) {
+		stats->failure = "cannot rename local file";
+		status = FAILED;
+	}
+	if (status != OKAY && newFd >= 0)
+		unlink(temp);
+
+	stats->bytes = offset;
+	stats->seconds = rf_xfer_seconds() - seconds;
+
+	return(status);
+}
+
+// *****************************************************
+//
+// rf_xfer_get_many
+//     Copies several small remote files into local files with one rf_fetchmany
+//     call. A file the call did not bring whole (larger than RF_XFER_SMALL,
+//     past the call's shared maxBlock, or not readable) is left to the caller,
+//     who can copy it with rf_xfer_get_file.
+// input parameters: clnt     - CLIENT handle talking RFILE_VERS2.
+//                   num      - Number of files, at most RF_MAXFETCH.
+//                   remote   - Names of the files on the server.
+//                   local    - Names of the local files, created or truncated.
+//                   maxBlock - Largest block the client handle can carry (see rf_connect).
+//                   done     - done[i] is set to 1 if file i was dealt with, 0 if it is left.
+//                   stats    - stats[i] is filled in for every file dealt with;
+//                              its failure is NULL if the file was copied.
+// return value: Number of files dealt with, or FAILED if the call failed
+//               (all files are then left).
+//
+// *****************************************************
+int rf_xfer_get_many(CLIENT *clnt, int num, char **remote, char **local, long maxBlock, int *done, RF_XferStats_T *stats)
+{
+	RF_FetchRequest_T files[RF_MAXFETCH];
+	RF_FetchManyRequest_T req;
+	RF_FetchManyReply_T res;
+	double seconds = rf_xfer_seconds();
+	int numDone = 0;
+	int localFd;
+
+	memset(done, 0, num * sizeof(int));
+	if (num > RF_MAXFETCH)
+		return(FAILED);
+
+	for (int i = 0; i < num; i++) {
+		files[i].filename = remote[i];
+		files[i].maxBytes = (maxBlock < RF_XFER_SMALL) ? maxBlock : RF_XFER_SMALL;
+	}
+	req.files.files_len = num;
+	req.files.files_val = files;
+	memset(&res, 0, sizeof(res));
+	if (rf_fetchmany_2(&req, &res, clnt) != RPC_SUCCESS)
+		return(FAILED);
+	seconds = rf_xfer_seconds() - seconds;
+
+	for (int i = 0; i < num && i < res.files.files_len; i++) {
+		RF_FetchReply_T *one = &res.files.files_val[i];
+		u_int len = one->data.RF_Data_T_len;
+
+		if (one->fetchStatus != OKAY || one->fileSize != len)
+			continue;
+
+		memset(&stats[i], 0, sizeof(RF_XferStats_T));
+		if ((localFd = open(local[i], O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0) {
+			stats[i].failure = "cannot open local file";
+		} else {
+			if (len > 0 && write(localFd, one->data.RF_Data_T_val, len) != len)
+				stats[i].failure = "local write failed";
+			if (close(localFd) != 0 && stats[i].failure == NULL)
+				stats[i].failure = "cannot close local file";
+		}
+		stats[i].bytes = (stats[i].failure == NULL) ? len : 0;
+		stats[i].blocks = 1;
+		stats[i].seconds = seconds;
+		done[i] = 1;
+		numDone++;
+	}
+	xdr_free((xdrproc_t)xdr_RF_FetchManyReply_T, (char *)&res);
+
+	return(numDone);
+}
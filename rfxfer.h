@@ -0,0 +1,58 @@
+/* rfxfer.h */
+
+/* Client transfer engine.
+// Moves a whole file between a local descriptor and a remote handle opened
+// with rf_openfile_2, using the offset addressed rf_preadfile/rf_pwritefile
+// procedures with a window of calls in flight (see rfpipe.h). Blocks may
+// complete in any order; each one is written at its own offset.
+// rf_xfer_get_file and rf_xfer_put_file take file names instead. They move
+// small files in a single compound call and larger ones with the stateless
+// path procedures, so the server holds no handle for them; an older server
+// gets an open and a close. rf_xfer_get_many fetches a group of small files
+// in one call. rf_xfer_get_range and rf_xfer_put_range move one byte range
+// of a file, so that several handles can share a large file (see rfstripe.h).
+// Stateless blocks carry a CRC32C where the server supports it, and
+// rf_xfer_digest gets the checksum of a whole remote file. After
+// rf_xfer_compress they travel compressed as well (see rfcomp.h). rf_xfer_sync
+// brings an existing local copy up to date, getting only the parts that
+// changed (see rfdelta.h).
+*/
+
+#ifndef RFXFER_H
+#define RFXFER_H
+
+#include <rpc/rpc.h>
+
+#define RF_DEFAULT_WINDOW 8   /* calls in flight when the caller has no preference */
+
+/* Returned when the server has not got the newer procedures a transfer tried. */
+#define RF_XFER_UNSUPPORTED 1
+
+typedef struct RF_XferStats_T
+{
+	long long	bytes;			/* file bytes moved */
+	long		blocks;			/* read or write calls that completed */
+	long		retransmits;	/* UDP calls sent more than once */
+	double		seconds;		/* wall clock time of the transfer */
+	u_int32_t	crc;			/* CRC32C of the range moved, set by the range transfers */
+	long long	literal;		/* bytes rf_xfer_sync was sent, the rest came from the old copy */
+	long long	wire;			/* file data bytes that crossed the network, fewer than bytes if compressed */
+	int			cached;			/* the file came out of the client cache (see rfccache.h) */
+	long long	resumed;		/* offset a resumable transfer carried on from (see rfresume.h) */
+	long long	resent;			/* bytes a resumable transfer moved again after failures */
+	enum clnt_stat	rpcError;	/* why the transfer failed, RPC_SUCCESS if it did not fail in RPC */
+	const char	*failure;		/* what failed, NULL on success */
+} RF_XferStats_T;
+
+int rf_xfer_get(CLIENT *clnt, long fd, int localFd, long blockSize, int window, RF_XferStats_T *stats);
+int rf_xfer_put(CLIENT *clnt, long fd, int localFd, long blockSize, int window, RF_XferStats_T *stats);
+int rf_xfer_get_file(CLIENT *clnt, char *remote, char *local, long maxBlock, int window, RF_XferStats_T *stats);
+int rf_xfer_put_file(CLIENT *clnt, char *local, char *remote, long maxBlock, int window, RF_XferStats_T *stats);
+int rf_xfer_get_range(CLIENT *clnt, char *remote, int localFd, long long offset, long long length, long blockSize, int window, RF_XferStats_T *stats);
+int rf_xfer_put_range(CLIENT *clnt, int localFd, char *remote, long long offset, long long length, long blockSize, int window, RF_XferStats_T *stats);
+int rf_xfer_sync(CLIENT *clnt, char *remote, char *local, long maxBlock, int window, RF_XferStats_T *stats);
+int rf_xfer_digest(CLIENT *clnt, char *remote, u_int32_t *crc, long long *size, RF_XferStats_T *stats);
+void rf_xfer_compress(int level);
+int rf_xfer_get_many(CLIENT *clnt, int num, char **remote, char **local, long maxBlock, int *done, RF_XferStats_T *stats);
+
+#endif /* RFXFER_H */